@@ -24,6 +24,7 @@ add_executable(
     test_query
     ${PROJECT_SOURCE_DIR}/test/test_query.cpp
     ${PROJECT_SOURCE_DIR}/src/query.cpp
+    ${PROJECT_SOURCE_DIR}/src/search_context.cpp
     ${PROJECT_SOURCE_DIR}/src/sc_utilities.cpp)
 if(MSVC)
     set_target_properties(test_query PROPERTIES COMPILE_FLAGS "/MT ${OpenMP_CXX_FLAGS}")
@@ -36,6 +37,7 @@ add_executable(
     ${PROJECT_SOURCE_DIR}/test/test_multi_query.cpp
     ${PROJECT_SOURCE_DIR}/src/query.cpp
     ${PROJECT_SOURCE_DIR}/src/multi_query.cpp
+    ${PROJECT_SOURCE_DIR}/src/search_context.cpp
     ${PROJECT_SOURCE_DIR}/src/sc_utilities.cpp)
 if(MSVC)
     set_target_properties(test_multi_query PROPERTIES COMPILE_FLAGS "/MT ${OpenMP_CXX_FLAGS}")
@@ -73,6 +75,7 @@ add_executable(
     ${PROJECT_SOURCE_DIR}/test/test_sc_query.cpp
     ${PROJECT_SOURCE_DIR}/src/query.cpp
     ${PROJECT_SOURCE_DIR}/src/sc_query.cpp
+    ${PROJECT_SOURCE_DIR}/src/search_context.cpp
     ${PROJECT_SOURCE_DIR}/src/sc_utilities.cpp)
 if(MSVC)
     set_target_properties(test_sc_query PROPERTIES COMPILE_FLAGS "/MT ${OpenMP_CXX_FLAGS}")
@@ -10,17 +10,20 @@
 
 #include<iostream>
 #include <vector>
+#include "sc_utilities.h"
 
 using namespace std;
 namespace SC {
 
 /**
- * a struct to represent a bucket or a cell in the inverted file
+ * a struct to represent a bucket or a cell in the inverted file.
+ * It is a view into the contiguous arrays of the inverted file.
  */
 typedef struct {
-	int L = 0; // the number of data in this cell
-	vector<int> pid; // the identifiers of data in this cell
-	vector<unsigned char> codes; // the codes of data in this cell
+	idx_t L = 0; // the number of data in this cell
+	idx_t * pid = nullptr; // the identifiers of data in this cell
+	unsigned char * codes = nullptr; // the codes of data in this cell
+	unsigned char * refine = nullptr; // the refinement records of data in this cell, if any
 } Bucket;
 
 } /* namespace PQLearn */
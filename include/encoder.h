@@ -12,8 +12,12 @@
 #include <cmath>
 #include <cstring>
 #include <cassert>
+#include <thread>
 #include "sc_utilities.h"
+#include "sc_algorithm.h"
 #include "bucket.h"
+#include "sc_index.h"
+#include "sc_hcq.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -21,33 +25,86 @@
 
 using namespace std;
 
+// The maximum number of vectors of a tile of the blocked assignment
+#ifndef SC_ASSIGN_TILE
+#define SC_ASSIGN_TILE 4096
+#endif
+// The target size (in floats) of the distance matrix of a tile
+#ifndef SC_ASSIGN_BUDGET
+#define SC_ASSIGN_BUDGET (1 << 24)
+#endif
+
 namespace SC {
 /**
  * Encoder class
- * Constrains: kc^mc < 2^31 and N < 2^31, mp<=16, kp <= 256
+ * Constrains: N < 2^31 (unless SC_LARGE_INDEX is defined), mp<=16, kp <= 256
  * DO NOT BREAK THESE CONSTRAINS!
  */
 class Encoder {
 protected:
 	PQConfig config;
 	float * cq, * pq; // code-books
-	int size = 0;
+	// The optional refinement quantizer: a PQ of the residuals of the
+	// residuals, kr centers in each of its mr sub-spaces
+	int kr = 0, mr = 0;
+	float * rq;
+	// The optional two-level search of the coarse centers (see load_coarse_tree)
+	HierarchicalCQ hcq;
+	unsigned char * refine; // the refinement record of each vector (see index_refine_size)
+	size_t size = 0; // the number of buckets: kc^mc
 	int non_empty_bucket = 0;
-	int * L, * pid;
-	ushort * cid;
+	idx_t * L, * pid;
+	cid_t * cid;
 	unsigned char * codes;
-	vector<Bucket> ivf;
+	// The inverted file: the buckets are contiguous ranges of ivf_pid and ivf_codes
+	size_t ivf_size; // the number of buckets
+	idx_t * ivf_off; // the start of each bucket, ivf_off[ivf_size] is the end
+	idx_t * ivf_pid;
+	unsigned char * ivf_codes;
+	unsigned char * ivf_refine;
+	template<typename BucketFunc>
+	inline void build_ivf(size_t, BucketFunc);
+	void release_ivf();
+	Bucket bucket(size_t);
 	int old_mp;
+	// The blocked assignment: a tile of vectors, their residuals and distances
+	size_t tile;
+	float * tile_x, * tile_res, * tile_dist;
+	float * norm_c, * norm_r, * norm_q; // the squared norms of the centers
+	size_t assign_prepare();
+	void assign_release();
+	template<typename DataType>
+	inline void assign_load(const DataType *, size_t, const idx_t * ids = nullptr);
+	void assign_coarse(const float *, size_t, int, cid_t *);
+	void assign_residual(size_t, const cid_t *);
+	void assign_sub(const float *, const float *, int, int, size_t, unsigned char *);
+	void assign_codes(size_t, unsigned char *);
+	void assign_refine(const float *, size_t, const unsigned char *, unsigned char *);
+	void write_index(const char *, size_t, int, bool);
+	void load_index(const unsigned char *, size_t, const char *, bool);
+	size_t index_layout(IndexHeader&, size_t, int);
+	unsigned char * index_create(const char *, size_t, bool);
+	void index_finish(unsigned char *, IndexHeader&, size_t, const char *, bool);
+	virtual void index_path(char *, const char *, const char *);
+	virtual size_t num_buckets();
+	virtual int index_nc();
+	virtual void encode_chunk(float *, size_t, size_t *, unsigned char *, unsigned char *);
+	void spill_run(int, idx_t, size_t, size_t *, unsigned char *, unsigned char *, idx_t *);
+	void merge_runs(int, const char *, idx_t *, size_t, bool);
 public:
 	Encoder();
 	virtual ~Encoder();
 	void load_codebooks(const char *, const char *, bool);
+	void load_refinement(const char *, bool);
+	void load_coarse_tree(const char *, bool);
 	void load_encoded_data(const char *, bool);
 
 	template<typename DataType>
 	inline void encode(const char *, int, bool);
 	template<typename DataType>
 	inline void rencode(const char *, int, bool);
+	template<typename DataType>
+	inline void encode_stream(const char *, int, const char *, const char *, size_t, bool);
 
 	void distribution(bool);
 
@@ -82,113 +139,24 @@ inline void Encoder::encode(
 			* static_cast<size_t>(config.mc));
 	SimpleCluster::init_array(codes, static_cast<size_t>(config.N)
 			* static_cast<size_t>(config.mp));
+	size_t rs = index_refine_size(mr);
+	if(mr > 0)
+		SimpleCluster::init_array(refine, static_cast<size_t>(config.N) * rs);
 
-	int max_threads = 1;
-#ifdef _OPENMP
-	max_threads = omp_get_max_threads();
-#endif
-	// Encode data
-
-	double d = 0.0, d_tmp = 0.0;
-	int bsc = config.dim/config.mc,
-			bsp = config.dim/config.mp;
-	int base = 0;
-	size_t p = static_cast<size_t>(config.N) / max_threads;
-
-#ifdef _OPENMP
-	omp_set_num_threads(max_threads);
-#pragma omp parallel
-	{
-#pragma omp for private(base,d,d_tmp)
-#endif
-		for(int i0 = 0; i0 < max_threads; i0++) {
-			DataType * v_tmp;
-			float * v_tmp0, * v_tmp1, * v_tmp2, * v_tmp3, * v_tmp4, * v_tmp5;
-			if(!SimpleCluster::init_array<float>(v_tmp0,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
-			}
-			if(!SimpleCluster::init_array<float>(v_tmp1,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
-			}
-			if(!SimpleCluster::init_array<float>(v_tmp2,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
-			}
-
-			// Range definition
-			size_t start = p * static_cast<size_t>(i0);
-			size_t  end = start + p;
-			size_t base_u = start * config.mc;
-			size_t base_c = start * config.mp;
-			size_t base_p = start;
-			size_t i, j, k;
-			ushort min_p;
-
-			if(end > config.N || i0 ==  max_threads - 1)
-				end = config.N;
-
-			v_tmp = data + start * static_cast<size_t>(config.dim);
-			for(i = start; i < end; i++) {
-				for(j = 0; j < config.dim; j++) {
-					v_tmp0[j] = static_cast<float>(v_tmp[j]);
-				}
-				v_tmp5 = v_tmp0;
-
-				// Find the coarse quantizer code
-				base = 0;
-				v_tmp3 = cq; // fixed this pointer to point into the begin of cq
-				for(j = 0; j < config.mc; j++) {
-					d = DBL_MAX;
-					// Linear search
-					v_tmp4 = v_tmp3;
-					for(k = 0; k < config.kc; k++) {
-						d_tmp = SimpleCluster::distance_l2_square<float>(
-								v_tmp5, v_tmp4,bsc);
-						if(d > d_tmp) {
-							d = d_tmp;
-							min_p = k;
-						}
-						v_tmp4 += bsc;
-					}
-					v_tmp1 = v_tmp3 + min_p * bsc;
-					cid[base_u] = min_p;
-					// Residual vector
-					for(k = 0; k < bsc; k++) {
-						v_tmp2[base++] = v_tmp5[k] - v_tmp1[k];
-					}
-					v_tmp5 += bsc;
-					v_tmp3 = v_tmp4;
-					base_u++;
-				}
-
-				// Encoding
-				// Point this to the begin of pq
-				v_tmp3 = pq;
-				v_tmp4 = v_tmp2;
-				for(j = 0; j < config.mp; j++) {
-					d = DBL_MAX;
-					// Linear search
-					for(k = 0; k < config.kp; k++) {
-						d_tmp = SimpleCluster::distance_l2_square<float>(
-								v_tmp4, v_tmp3,bsp);
-						if(d > d_tmp) {
-							d = d_tmp;
-							min_p = k;
-						}
-						v_tmp3 += bsp;
-					}
-					codes[base_c++] = min_p;
-					v_tmp4 += bsp;
-				}
-
-				v_tmp += config.dim;
-			}
-		}
-#ifdef _OPENMP
+	// Encode data tile by tile
+	size_t N = static_cast<size_t>(config.N), t0, m;
+	assign_prepare();
+	for(t0 = 0; t0 < N; t0 += tile) {
+		m = min(tile,N - t0);
+		assign_load<DataType>(data + t0 * config.dim,m);
+		assign_coarse(tile_x,m,1,cid + t0 * config.mc);
+		assign_codes(m,codes + t0 * config.mp);
+		if(mr > 0)
+			assign_refine(tile_x,m,codes + t0 * config.mp,refine + t0 * rs);
+		if(verbose)
+			cout << "Encoded " << t0 + m << "/" << N << " vector(s)" << endl;
 	}
-#endif
+	assign_release();
 }
 
 /**
@@ -213,98 +181,259 @@ inline void Encoder::rencode(
 
 	SimpleCluster::init_array(codes, static_cast<size_t>(config.N)
 			* static_cast<size_t>(config.mp));
+	size_t rs = index_refine_size(mr);
+	if(mr > 0)
+		SimpleCluster::init_array(refine, static_cast<size_t>(config.N) * rs);
 
+	// Encode data tile by tile, in the order of the inverted file
+	size_t N = static_cast<size_t>(config.N), t0, m;
+	assign_prepare();
+	for(t0 = 0; t0 < N; t0 += tile) {
+		m = min(tile,N - t0);
+		assign_load<DataType>(data,m,pid + t0);
+		assign_residual(m,cid + t0 * config.mc);
+		assign_codes(m,codes + t0 * config.mp);
+		if(mr > 0)
+			assign_refine(tile_x,m,codes + t0 * config.mp,refine + t0 * rs);
+	}
+	assign_release();
+}
+
+/**
+ * Build the inverted file in two parallel passes. Each thread counts the
+ * vectors of its range per bucket, then the prefix sums of the counts give
+ * each thread its own positions, so the ids and the codes are scattered in
+ * parallel without locks. The vectors of a bucket keep their order.
+ * @param n_buckets the number of buckets
+ * @param bucket_of the bucket of the i-th vector, or -1 to skip it
+ */
+template<typename BucketFunc>
+inline void Encoder::build_ivf(
+		size_t n_buckets,
+		BucketFunc bucket_of) {
 	int max_threads = 1;
 #ifdef _OPENMP
 	max_threads = omp_get_max_threads();
 #endif
-	// Encode data
+	// Bound the memory of the per-thread counts
+	max_threads = static_cast<int>(min<size_t>(max_threads,
+			max<size_t>(1,SC_ASSIGN_BUDGET / (n_buckets + 1))));
+	size_t N = static_cast<size_t>(config.N), mp = config.mp, rs = index_refine_size(mr);
+	size_t p = N / max_threads;
 
-	double d = 0.0, d_tmp = 0.0;
-	int bsc = config.dim/config.mc,
-			bsp = config.dim/config.mp;
-	int base = 0;
-	size_t p = static_cast<size_t>(config.N) / max_threads;
+	release_ivf();
+	ivf_size = n_buckets;
+	SimpleCluster::init_array(ivf_off,n_buckets + 1);
+	SimpleCluster::init_array(ivf_pid,N + 1);
+	SimpleCluster::init_array(ivf_codes,N * mp + 1);
+	if(refine != nullptr)
+		SimpleCluster::init_array(ivf_refine,N * rs + 1);
+	vector<idx_t> pos(static_cast<size_t>(max_threads) * n_buckets,0);
 
+	// Pass 1: the histogram of each thread
 #ifdef _OPENMP
-	omp_set_num_threads(max_threads);
-#pragma omp parallel
+#pragma omp parallel num_threads(max_threads)
 	{
-#pragma omp for private(base,d,d_tmp)
+#pragma omp for
 #endif
 		for(int i0 = 0; i0 < max_threads; i0++) {
-			DataType * v_tmp;
-			float * v_tmp0, * v_tmp1, * v_tmp2, * v_tmp3, * v_tmp4, * v_tmp5;
-			if(!SimpleCluster::init_array<float>(v_tmp0,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
-			}
-			if(!SimpleCluster::init_array<float>(v_tmp1,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
-			}
-			if(!SimpleCluster::init_array<float>(v_tmp2,config.dim)) {
-				cerr << "Cannot allocate memory" << endl;
-				exit(1);
+			size_t start = p * static_cast<size_t>(i0);
+			size_t end = start + p;
+			if(end > N || i0 == max_threads - 1)
+				end = N;
+			idx_t * count = &pos[static_cast<size_t>(i0) * n_buckets];
+			long b;
+			for(size_t i = start; i < end; i++) {
+				b = bucket_of(i);
+				if(b >= 0) count[b]++;
 			}
+		}
+#ifdef _OPENMP
+	}
+#endif
+
+	// The prefix sums: the first position of each thread in each bucket
+	size_t i, count = 0;
+	idx_t l;
+	non_empty_bucket = 0;
+	for(i = 0; i < n_buckets; i++) {
+		ivf_off[i] = static_cast<idx_t>(count);
+		for(int t = 0; t < max_threads; t++) {
+			l = pos[static_cast<size_t>(t) * n_buckets + i];
+			pos[static_cast<size_t>(t) * n_buckets + i] = static_cast<idx_t>(count);
+			count += l;
+		}
+		if(static_cast<size_t>(ivf_off[i]) < count) non_empty_bucket++;
+	}
+	ivf_off[n_buckets] = static_cast<idx_t>(count);
 
-			// Range definition
+	// Pass 2: scatter the ids, the codes and the refinement records
+#ifdef _OPENMP
+#pragma omp parallel num_threads(max_threads)
+	{
+#pragma omp for
+#endif
+		for(int i0 = 0; i0 < max_threads; i0++) {
 			size_t start = p * static_cast<size_t>(i0);
-			size_t  end = start + p;
-			size_t base_u = start * config.mc;
-			size_t base_c = start * config.mp;
-			size_t base_p = start;
-			size_t i, j, k;
-			ushort min_p;
+			size_t end = start + p;
+			if(end > N || i0 == max_threads - 1)
+				end = N;
+			idx_t * next = &pos[static_cast<size_t>(i0) * n_buckets];
+			long b;
+			size_t q;
+			for(size_t i = start; i < end; i++) {
+				b = bucket_of(i);
+				if(b < 0) continue;
+				q = static_cast<size_t>(next[b]++);
+				ivf_pid[q] = static_cast<idx_t>(i);
+				memcpy(ivf_codes + q * mp,codes + i * mp,mp);
+				if(ivf_refine != nullptr)
+					memcpy(ivf_refine + q * rs,refine + i * rs,rs);
+			}
+		}
+#ifdef _OPENMP
+	}
+#endif
+}
+
+/**
+ * Convert a tile of vectors into tile_x
+ * @param data the vectors, or the whole data set if ids is given
+ * @param m the number of vectors
+ * @param ids the rows of data to be loaded, nullptr for the first m rows
+ */
+template<typename DataType>
+inline void Encoder::assign_load(
+		const DataType * data,
+		size_t m,
+		const idx_t * ids) {
+	int dim = config.dim;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(size_t i = 0; i < m; i++) {
+		const DataType * v = data + dim * (ids == nullptr ?
+				i : static_cast<size_t>(ids[i]));
+		float * f = tile_x + i * dim;
+		for(int j = 0; j < dim; j++)
+			f[j] = static_cast<float>(v[j]);
+	}
+}
+
+/**
+ * Encode a data file that does not fit in memory and write the index container.
+ * The file is read by chunks of vectors: a reader thread loads the next chunk
+ * while all the threads encode the current one. The postings of each chunk are
+ * sorted by bucket and appended to a spill file, which is merged into the
+ * container at the end. The memory used is set by the chunk size.
+ * @param filename the location of the raw data file
+ * @param offset if each vector has an offset
+ * @param db_path the output folder
+ * @param db_prefix the prefix of the output file
+ * @param chunk the number of vectors of a chunk
+ * @param verbose to enable verbose mode
+ */
+template<typename DataType>
+inline void Encoder::encode_stream(
+		const char * filename,
+		int offset,
+		const char * db_path,
+		const char * db_prefix,
+		size_t chunk,
+		bool verbose) {
+#ifdef _WIN32
+#else
+	if(config.mc <= 0 || config.mp <= 0) {
+		cerr << "Nothing to do" << endl;
+		return;
+	}
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		cerr << "Cannot open the file " << filename << endl;
+		exit(1);
+	}
+	size_t row = offset + static_cast<size_t>(config.dim) * sizeof(DataType);
+	size_t n = get_file_size(filename) / row;
+	if(chunk == 0 || chunk > n) chunk = n;
+	if(n == 0) {
+		cerr << "Nothing to do" << endl;
+		close(fd);
+		return;
+	}
 
-			if(end > config.N || i0 ==  max_threads - 1)
-				end = config.N;
+	char fname[256], spill[256];
+	index_path(fname,db_path,db_prefix);
+	if(snprintf(spill,sizeof(spill),"%s.spill_",fname) >= static_cast<int>(sizeof(spill))) {
+		cerr << "The path of the spill file is too long: " << fname << endl;
+		exit(1);
+	}
+	int sfd = open(spill, O_RDWR | O_CREAT | O_TRUNC,(mode_t)0600);
+	if(sfd < 0) {
+		cerr << "Cannot open the file " << spill << endl;
+		exit(1);
+	}
 
-			for(i = start; i < end; i++) {
-				v_tmp = data + static_cast<size_t>(config.dim) * pid[base_p++];
-				for(j = 0; j < config.dim; j++) {
-					v_tmp0[j] = static_cast<float>(v_tmp[j]);
-				}
-				v_tmp5 = v_tmp0;
+	size_t n_buckets = num_buckets();
+	idx_t * counts;
+	unsigned char * raw[2], * chunk_codes, * chunk_refine = nullptr;
+	float * data;
+	size_t * bucket;
+	SimpleCluster::init_array(counts,n_buckets);
+	memset(counts,0,n_buckets * sizeof(idx_t));
+	SimpleCluster::init_array(raw[0],chunk * row);
+	SimpleCluster::init_array(raw[1],chunk * row);
+	SimpleCluster::init_array(data,chunk * config.dim);
+	SimpleCluster::init_array(bucket,chunk);
+	SimpleCluster::init_array(chunk_codes,chunk * config.mp);
+	if(mr > 0)
+		SimpleCluster::init_array(chunk_refine,chunk * index_refine_size(mr));
 
-				// Find the coarse quantizer code
-				base = 0;
-				v_tmp3 = cq; // fixed this pointer to point into the begin of cq
-				for(j = 0; j < config.mc; j++) {
-					min_p = cid[base_u];
-					v_tmp1 = v_tmp3 + min_p * bsc;
-					// Residual vector
-					for(k = 0; k < bsc; k++) {
-						v_tmp2[base++] = v_tmp5[k] - v_tmp1[k];
-					}
-					v_tmp5 += bsc;
-					v_tmp3 += config.kc * bsc;
-					base_u++;
-				}
+	size_t start = 0, m, next, c = 0;
+	assign_prepare();
+	read_all(fd,raw[0],chunk * row,0);
+	while(start < n) {
+		m = min(chunk,n - start);
+		next = start + m;
+		// Read the next chunk while this one is being encoded
+		thread reader;
+		if(next < n)
+			reader = thread(read_all,fd,raw[(c + 1) & 1],
+					min(chunk,n - next) * row,next * row);
 
-				// Encoding
-				// Point this to the begin of pq
-				v_tmp3 = pq;
-				v_tmp4 = v_tmp2;
-				for(j = 0; j < config.mp; j++) {
-					d = DBL_MAX;
-					// Linear search
-					for(k = 0; k < config.kp; k++) {
-						d_tmp = SimpleCluster::distance_l2_square<float>(
-								v_tmp4, v_tmp3,bsp);
-						if(d > d_tmp) {
-							d = d_tmp;
-							min_p = k;
-						}
-						v_tmp3 += bsp;
-					}
-					codes[base_c++] = min_p;
-					v_tmp4 += bsp;
-				}
-			}
-		}
+		unsigned char * r = raw[c & 1];
 #ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for(size_t i = 0; i < m; i++) {
+			const DataType * v = reinterpret_cast<const DataType *>(r + i * row + offset);
+			float * f = data + i * config.dim;
+			for(int j = 0; j < config.dim; j++)
+				f[j] = static_cast<float>(v[j]);
+		}
+		encode_chunk(data,m,bucket,chunk_codes,chunk_refine);
+		spill_run(sfd,static_cast<idx_t>(start),m,bucket,chunk_codes,chunk_refine,counts);
+
+		if(reader.joinable())
+			reader.join();
+		start = next;
+		c++;
+		if(verbose)
+			cout << "Encoded " << start << "/" << n << " vector(s)" << endl;
 	}
+	close(fd);
+	assign_release();
+	::delete raw[0];
+	::delete raw[1];
+	::delete data;
+	::delete bucket;
+	::delete chunk_codes;
+	::delete chunk_refine;
+
+	config.N = static_cast<idx_t>(n);
+	merge_runs(sfd,fname,counts,n_buckets,verbose);
+	close(sfd);
+	unlink(spill);
+	::delete counts;
 #endif
 }
 } /* namespace PQLearn */
@@ -19,9 +19,9 @@ using namespace std;
 namespace SC {
 class Evaluation {
 public:
-	inline void load_groundtruth(const char *,int *&, int,int&,bool);
-	inline void calc_recall(int *, int *, int, int, int&, bool);
-	inline void calc_comb_recall(int **, int *, int, int, int, int&, bool);
+	inline void load_groundtruth(const char *,idx_t *&, int,int&,bool);
+	inline void calc_recall(idx_t *, idx_t *, int, int, int&, bool);
+	inline void calc_comb_recall(idx_t **, idx_t *, int, int, int, int&, bool);
 };
 
 /**
@@ -33,13 +33,13 @@ public:
  */
 inline void Evaluation::load_groundtruth(
 		const char * filename,
-		int *& gt,
+		idx_t *& gt,
 		int d,
 		int& N,
 		bool verbose) {
 	int * tmp;
 	N = load_data(filename,tmp,4,d,verbose);
-	SimpleCluster::init_array<int>(gt,N);
+	SimpleCluster::init_array<idx_t>(gt,N);
 	for(int i = 0; i < N; i++) {
 		gt[i] = *tmp;
 		tmp += d;
@@ -56,15 +56,15 @@ inline void Evaluation::load_groundtruth(
  * @param verbose enable verbose mode
  */
 inline void Evaluation::calc_recall(
-		int * result,
-		int * groundtruth,
+		idx_t * result,
+		idx_t * groundtruth,
 		int R,
 		int N,
 		int& recall,
 		bool verbose) {
 	recall = 0;
-	int gt;
-	int * tmp = result;
+	idx_t gt;
+	idx_t * tmp = result;
 	for(int i = 0; i < N; i++) {
 		//		tmp = result;
 		gt = groundtruth[i];
@@ -101,16 +101,16 @@ inline void Evaluation::calc_recall(
  * @param verbose enable verbose mode
  */
 inline void Evaluation::calc_comb_recall(
-		int ** results,
-		int * groundtruth,
+		idx_t ** results,
+		idx_t * groundtruth,
 		int R,
 		int N,
 		int S,
 		int& recall,
 		bool verbose) {
 	recall = 0;
-	int gt;
-	int ** tmp = (int **)::operator new(S * sizeof(int *));
+	idx_t gt;
+	idx_t ** tmp = (idx_t **)::operator new(S * sizeof(idx_t *));
 	for(int i = 0; i < S; i++) {
 		tmp[i] = results[i];
 	}
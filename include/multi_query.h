@@ -22,6 +22,7 @@
 #include <cblas.h>
 #include "sc_utilities.h"
 #include "sc_algorithm.h"
+#include "sc_multiseq.h"
 #include "query.h"
 
 using namespace std;
@@ -35,241 +36,325 @@ namespace SC {
  */
 class MultiQuery : public PQQuery {
 protected:
+	inline void scan_multi(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool, bool) const;
+	template<int D>
+	inline void search_multi_d(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool, bool) const;
 public:
 	// The methods of class
 	MultiQuery();
 	virtual ~MultiQuery();
 
-	inline void search_multi2(
-			float *,
-			float *&, float *&,float *&,
-			int *, int *&,
-			int *&, int *&,int *&, int *&,
-			int *&, int *&,
-			int *&, int *&, bool *,
-			int&, int, int,int, int, int&,
-			double&, double&,
-			bool, bool);
+	void init_workspace(SearchWorkspace&, int, int) const;
+	inline void search_multi(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool) const;
+	inline void search_multi_rerank(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
+	inline void search_multi_parallel(
+			float *, int,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
 };
 
 /**
- * Search method: A demo on single thread mode
+ * Search method with a given workspace (Multi-D-ADC, mc = 2, 3 or 4).
+ * All the scratch arrays are owned by the workspace, so that several
+ * threads can search the same index at the same time and nothing is
+ * allocated here. The statistics of the search are left in the workspace.
  * @param query the query vector
- * @param result the result by identifiers
+ * @param ws the workspace of the calling thread (see init_workspace)
+ * @param result the top R identifiers, sorted by distance (R entries)
+ * @param dist the top R distances (R entries)
  * @param R the number of top retrieved results
+ * @param w the maximum number of cells to be traversed
+ * @param T the maximum number of candidates
+ * @param real_dist to score the candidates with the exact distances
  * @param verbose to enable verbose mode
  */
-inline void MultiQuery::search_multi2(float * query,
-		float *& v_tmp, float *& dist, float *& q,
-		int * tmp, int *& result,
-		int *& hid1, int *& hid2,int *& hid3, int *& hid4,
-		int *& s1, int *& s2,
-		int *& prebuck, int *& cache, bool * traversed,
-		int& sum, int R, int w, int T, int M, int& e,
-		double& t1, double& t2,
-		bool real_dist, bool verbose) {
-	if(config.mc != 2) {
-		cerr << "This search method is for Multi-D-ADC-2 only" << endl;
+inline void MultiQuery::search_multi(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool verbose) const {
+	scan_multi(query,ws,result,dist,R,w,T,real_dist,false,verbose);
+}
+
+/**
+ * Select the search of the inverted multi-index for mc sub-spaces
+ * @param positions to leave the positions of the results in the inverted
+ * file instead of their identifiers (see rerank)
+ */
+inline void MultiQuery::scan_multi(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool positions, bool verbose) const {
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
+	}
+	switch(config.mc) {
+	case 2:
+		search_multi_d<2>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	case 3:
+		search_multi_d<3>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	case 4:
+		search_multi_d<4>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	default:
+		cerr << "This search method is for Multi-D-ADC with mc = 2, 3 or 4 only" << endl;
+	}
+}
+
+/**
+ * Two-stage search method (Multi-D-ADC, mc = 2, 3 or 4): the K best candidates of the
+ * ADC search are re-ranked with the exact distances to their raw vectors
+ * (see load_data and map_data) or with the refinement codes of the index.
+ * @param query the query vector
+ * @param ws the workspace of the calling thread, for K results (see init_workspace)
+ * @param result the top R identifiers, sorted by distance (R entries)
+ * @param dist the top R re-ranked distances (R entries)
+ * @param R the number of top retrieved results
+ * @param K the number of re-ranked candidates (K >= R)
+ * @param w the maximum number of cells to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void MultiQuery::search_multi_rerank(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int K, int w, int T, bool verbose) const {
+	if(!can_rerank() || R <= 0) return;
+	if(K < R) K = R;
+	ws.reserve(K);
+	ws.result[0] = -1; // nothing to re-rank if the search fails
+	scan_multi(query,ws,ws.result,ws.dist,K,w,T,false,true,verbose);
+	int k = 0;
+	while(k < K && ws.result[k] >= 0) k++;
+	rerank(query,ws,k,result,dist,R);
+}
+
+/**
+ * The search of the inverted multi-index with D = mc sub-spaces.
+ * The cells are traversed with the multi-sequence algorithm.
+ * The candidates are kept as positions until the top R is known.
+ */
+template<int D>
+inline void MultiQuery::search_multi_d(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool positions, bool verbose) const {
+	size_t kc = static_cast<size_t>(config.kc), n_cells = 1;
+	int d;
+	for(d = 0; d < D; d++)
+		n_cells *= kc;
+	if(!ws.fits(n_cells,D,w,R)) {
+		cerr << "The workspace is too small for this search" << endl;
 		return;
 	}
 
-	// Temporary pointers: 8 * 8 = 64 bytes
+	SearchContext& context = ws;
+	float * v_tmp = ws.coarse, * q = ws.q;
+	int * tmp = ws.coarse_id, * visited = ws.visited;
+	const float * lists[D];
+	const int * ids[D];
+	const int * u;
 	float * v_tmp1;
-	float * v_tmp2;
-	float * v_tmp3;
-	int * i_tmp;
-	int * i_tmp1;
-	int * i_tmp2;
+	idx_t * i_tmp;
 	unsigned char * c_tmp;
 	clock_t st, ed;
 
-	// Step 1: assign the query to coarse quantizer
-	int i, j, k, l, count = 0, base = 0, base1, base2, base_c,
-			c = config.mp >> 1,
-			h1, h2, h3, h4,
-			bid, sum2 = 0, lb = config.kc * config.mc; // 10 * 4 = 40 bytes
-	float d_tmp, d_tmp1, d_tmp2; // 4 bytes
+	int i, j, k, l, M, count, sum, e, n;
+	size_t bid, base, base_c, base_d[D];
+	idx_t start;
+	float d_tmp, d_tmp1;
 	int bsc = config.dim / config.mc;
-	int bsp = config.dim / config.mp;
-	int bst = bsc * config.kc;
-	int bsz = bsp * config.kp; // 4 bytes
-	int bs = config.kp * config.mp / config.mc;
+	int mpd = config.mp / config.mc; // the sub-quantizers of a sub-space
+	int bs = config.kp * mpd;
 
+	// Step 1: rank the coarse centers of each sub-space
 	st = clock();
-	pre_compute2(query);
+	pre_compute2(query,context);
 	ed = clock();
-	t1 += ed - st;
+	ws.t1 += ed - st;
 	float q_sum = 0.0;
 	v_tmp1 = query;
-	for(i = 0; i < config.mc; i++) {
+	for(d = 0; d < D; d++) {
 		d_tmp1 = 0.0;
 		for(j = 0; j < bsc; j++) {
 			d_tmp = *(v_tmp1++);
 			d_tmp1 += d_tmp * d_tmp;
 		}
 		q_sum += d_tmp1;
-		q[i] = d_tmp1;
+		q[d] = d_tmp1;
 	}
 
-	v_tmp1 = diff_qc;
-	for(i = 0; i < config.mc; i++) {
-		d_tmp1 = q[i];
+	base = 0;
+	for(d = 0; d < D; d++) {
 		for(j = 0; j < config.kc; j++) {
-			d_tmp = d_tmp1 + (*(v_tmp1++));
-			v_tmp[base] = d_tmp;
+			v_tmp[base] = q[d] + context.diff_qc[base];
 			tmp[base++] = j;
 		}
 	}
 
+	// Only the ranks that the traversal can reach are sorted
+	M = static_cast<int>(min(kc,ws.n_cache + 1));
 	st = clock();
-	nth_element_id(v_tmp,v_tmp + config.kc,tmp,M);
-	nth_element_id(v_tmp + config.kc,v_tmp + (config.kc << 1),tmp + config.kc,M);
-	sort_id(v_tmp,v_tmp + M,tmp);
-	sort_id(v_tmp + config.kc, v_tmp + config.kc + M,tmp + config.kc);
+	for(d = 0; d < D; d++) {
+		v_tmp1 = v_tmp + d * kc;
+		if(M < config.kc)
+			nth_element_id(v_tmp1,v_tmp1 + kc,tmp + d * kc,M - 1);
+		sort_id(v_tmp1,v_tmp1 + M,tmp + d * kc);
+		lists[d] = v_tmp1;
+		ids[d] = tmp + d * kc;
+	}
 	ed = clock();
-	t2 += ed - st;
-
+	ws.t2 += ed - st;
 
 	// Step 2: Multi-sequences algorithm
-	sum = sum2 = count = e = 0;
-	int count2 = 0;
-	i_tmp1 = tmp;
-	i_tmp2 = tmp + config.kc;
-	h3 = i_tmp1[0];
-	h4 = i_tmp2[0];
-	v_tmp1 = v_tmp + lb;
-	v_tmp2 = v_tmp;
-	v_tmp3 = v_tmp + config.kc;
-	d_tmp = v_tmp2[0] + v_tmp3[0];
-	pq_insert4(
-			v_tmp1,
-			hid1,hid2,hid3,hid4,
-			d_tmp,0,0,h3,h4,
-			sum2,w,verbose);
-
-
-	while(count2 < w && sum < T) {
-		if(sum2 > 0) {
-			pq_pop4(
-					v_tmp1,
-					hid1,hid2,hid3,hid4,
-					h1,h2,h3,h4,
-					sum2,verbose);
-			bid = h3 * config.kc + h4;
-			i = h1 * config.kc + h2;
-			if(bid > 0) {
-				l = L[bid] - L[bid-1];
-			} else {
-				l = L[bid];
-			}
-			if(l > 0) {
-				prebuck[count] = bid;
-				s1[count] = h3;
-				s2[count++] = h4;
-				sum += l;
-			} else e++;
-			traversed[i] = true;
-			cache[count2++] = i;
-		}
-
-		if(sum < T) {
-			if(h1 < config.kc - 1 &&
-					(h2 == 0 || (i + config.kc <= size && traversed[i + config.kc - 1]))) {
-				h3 = i_tmp1[h1+1];
-				h4 = i_tmp2[h2];
-				d_tmp = v_tmp2[h1+1] + v_tmp3[h2];
-
-				if(i + config.kc < size) {
-					pq_insert4(
-							v_tmp1,
-							hid1,hid2,hid3,hid4,
-							d_tmp,h1+1,h2,h3,h4,
-							sum2,w,verbose);
-				}
-			}
-			if(h2 < config.kc - 1 &&
-					(h1 == 0 || (i + 1 >= config.kc && traversed[i - config.kc + 1]))) {
-				h3 = i_tmp1[h1];
-				h4 = i_tmp2[h2+1];
-				d_tmp = v_tmp2[h1] + v_tmp3[h2+1];
-
-				if(i + 1 < size) {
-					pq_insert4(
-							v_tmp1,
-							hid1,hid2,hid3,hid4,
-							d_tmp,h1,h2+1,h3,h4,
-							sum2,w,verbose);
-				}
-			}
-		}
+	MultiSequence<D> ms(lists,config.kc,
+			ws.heap,ws.heap_cap,ws.cells,ws.n_cache);
+	MSCell<D> c;
+	sum = e = count = 0;
+	while(count < w && sum < T && ms.next(c)) {
+		bid = 0;
+		for(d = 0; d < D; d++)
+			bid = bid * kc + ids[d][c.h[d]];
+		l = dir.length(bid);
+		if(l > 0) {
+			for(d = 0; d < D; d++)
+				visited[count * D + d] = ids[d][c.h[d]];
+			count++;
+			sum += l;
+		} else e++;
 	}
-
-	int count_w = count, count2_w = count2;
+	ms.clear();
 
 	// Step 3: Local search
-	// Allocate the memory to store search results
-	// Remember to free them after used
-	SimpleCluster::init_array(result,sum);
-	SimpleCluster::init_array(dist,sum);
-	count = 0;
+	TopR& top = context.top;
+	top.reset(R);
+	n = 0;
 
-	v_tmp1 = diff_qc + config.kc;
-	for(i = 0; i < count_w; i++) {
-		bid = prebuck[i];
-		h3 = s1[i];
-		h4 = s2[i];
-		if(bid > 0) {
-			l = L[bid] - L[bid-1];
-			i_tmp = pid + L[bid-1];
-			c_tmp = codes + static_cast<size_t>(L[bid-1]) * config.mp;
-		} else {
-			l = L[bid];
-			i_tmp = pid;
-			c_tmp = codes;
+	for(i = 0; i < count; i++) {
+		u = visited + i * D;
+		bid = 0;
+		d_tmp = q_sum;
+		for(d = 0; d < D; d++) {
+			bid = bid * kc + u[d];
+			d_tmp += context.diff_qc[d * kc + u[d]];
+			base_d[d] = (d * kc + u[d]) * bs;
 		}
-
-		d_tmp = q_sum + diff_qc[h3] + v_tmp1[h4];
-		base1 = h3 * bs;
-		base2 = (h4 + config.kc - 1) * bs;
+		l = dir.bucket(bid,start);
+		i_tmp = pid + start;
+		c_tmp = codes + start * config.mp;
 
 		// Calculate all l distances
-		memcpy(&result[count],i_tmp,l * sizeof(int));
-		if(!real_dist) {
+		if(!real_dist && l >= (config.kp >> 3)) {
+			// Large buckets: merged table and vectorized scan
+			for(d = 0; d < D; d++)
+				adc_merge_table(context.diff_qr + d * bs,dot_cr + base_d[d],
+						context.adc_table + d * bs,bs);
+			context.scan(c_tmp,start,l,config.mp,config.kp,d_tmp);
+		} else if(!real_dist) {
 			for(j = 0; j < l; j++) {
 				base = 0;
 				d_tmp1 = d_tmp;
-				for(k = 0; k < c; k++) {
-					base_c = base + *(c_tmp++);
-					d_tmp1 += diff_qr[base_c];
-					d_tmp1 += dot_cr[base1 + base_c];
-					base += config.kp;
-				}
-				for(k = c; k < config.mp; k++) {
-					base_c = base + *(c_tmp++);
-					d_tmp1 += diff_qr[base_c];
-					d_tmp1 += dot_cr[base2 + base_c];
-					base += config.kp;
+				for(d = 0; d < D; d++) {
+					for(k = 0; k < mpd; k++) {
+						base_c = *(c_tmp++);
+						d_tmp1 += context.diff_qr[base + base_c];
+						d_tmp1 += dot_cr[base_d[d] + k * config.kp + base_c];
+						base += config.kp;
+					}
 				}
-				dist[count++] = d_tmp1;
+				top.push(d_tmp1,start + j);
 			}
 		} else {
 			for(j = 0; j < l; j++) {
-				dist[count++] = SimpleCluster::distance_l2_square(
-						query,raw_data + i_tmp[j] * config.dim,config.dim);
+				top.push(raw.distance(query,i_tmp[j]),
+						start + j);
 			}
 		}
-		if(count >= T) break;
+		n += l;
+		if(n >= T) break;
 	}
 
-	for(i = 0; i < count2_w; i++) {
-		traversed[cache[i]] = 0;
+	// Step 4: Extract the top R
+	k = top.finish(result,dist);
+	if(!positions)
+		for(i = 0; i < k; i++)
+			result[i] = pid[result[i]];
+	ws.sum = sum;
+	ws.empty = e;
+	if(verbose)
+		cout << "Visited " << count << " cells, " << e << " empty" << endl;
+}
+
+/**
+ * Search a set of queries on all threads (Multi-D-ADC, mc = 2, 3 or 4).
+ * The index is shared, each thread owns a workspace and a range of queries.
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param result the top R identifiers of each query (nq x R)
+ * @param dist the top R distances of each query (nq x R)
+ * @param R the number of top retrieved results
+ * @param w the maximum number of cells to be traversed
+ * @param T the maximum number of candidates
+ * @param n_threads the number of threads (0 to use all cores)
+ * @param verbose to enable verbose mode
+ */
+inline void MultiQuery::search_multi_parallel(
+		float * queries, int nq,
+		idx_t * result, float * dist,
+		int R, int w, int T, int n_threads, bool verbose) const {
+	if(config.mc < 2 || config.mc > 4) {
+		cerr << "This search method is for Multi-D-ADC with mc = 2, 3 or 4 only" << endl;
+		return;
 	}
+	if(nq <= 0 || R <= 0) return;
+
+	int max_threads = 1;
+#ifdef _OPENMP
+	max_threads = n_threads > 0 ? n_threads : omp_get_max_threads();
+#endif
+	if(max_threads > nq) max_threads = nq;
+	size_t p = static_cast<size_t>(nq) / max_threads;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(max_threads)
+	{
+#pragma omp for
+#endif
+		for(int i0 = 0; i0 < max_threads; i0++) {
+			SearchWorkspace ws;
+			init_workspace(ws,w,R);
 
-	// Step 3: Extract the top R
-	if(sum >= R) {
-		nth_element_id(dist,dist+sum,result,R-1);
-		sort_id(dist,dist+R,result);
+			// Range definition
+			size_t start = p * static_cast<size_t>(i0);
+			size_t end = start + p;
+			if(end > nq || i0 == max_threads - 1)
+				end = nq;
+
+			for(size_t i = start; i < end; i++) {
+				search_multi(queries + i * config.dim,ws,
+						result + i * R,dist + i * R,
+						R,w,T,false,verbose);
+			}
+		}
+#ifdef _OPENMP
 	}
+#endif
 }
 } /* namespace PQLearn */
 
@@ -53,6 +53,10 @@ protected:
 	float ** cq;
 	int k;
 	int * kc, * mc;
+	KmeansTrainType train; // the training of the sub-quantizers
+	int train_size; // the size of the sample or of a batch
+	int train_groups; // the number of sub-quantizers trained at once
+	KmeansCriteria criteria;
 public:
 	float * data; // raw vector data; size: N * dim
 
@@ -74,6 +78,8 @@ public:
 	 * Using k-means++
 	 */
 	inline void create_sub_quantizers(bool);
+	inline void set_training(KmeansTrainType, int, int, float);
+	inline void set_training_groups(int);
 
 	/**
 	 * Distortion
@@ -130,6 +136,10 @@ PQQuantizer<DataType>::PQQuantizer (
 	cq = nullptr;
 	kc = nullptr;
 	mc = nullptr;
+	train = KmeansTrainType::FULL;
+	train_size = 0;
+	train_groups = 1;
+	criteria = {2.0,1.0,1000,0.0f};
 	if(!SimpleCluster::init_array<float>(centers,nsc*dim)) {
 		if(verbose)
 			cerr << "There are some errors occurred while initializing data" << endl;
@@ -228,74 +238,129 @@ inline int PQQuantizer<DataType>::size() {
 
 /**
  * Sub-quantizers
- * This function will create codes, centers and labels
+ * This function will create codes, centers and labels.
+ * The sub-quantizers are trained train_groups at a time, each with its
+ * share of the threads: a k-means of dimension 8 or 16 does not scale
+ * over many threads, several of them do.
+ * A sub-space is read in place, as a view of the data whose rows are
+ * dim floats apart, instead of a copy of its columns.
  * @param verbose enable verbose mode
  */
 template<typename DataType>
 inline void PQQuantizer<DataType>::create_sub_quantizers(bool verbose) {
 	int bs = dim / part; //block size
-	float * _centers, * _seeds = nullptr;
-	int * _labels;
-	float * tmp_data;
-	int i, j, col_st;
-	KmeansCriteria criteria = {2.0,1.0,1000};
+	int i;
 	int max_threads = 1;
 #ifdef _OPENMP
 	max_threads = omp_get_max_threads();
 #endif
-	_centers = centers;
-	_labels = labels;
-	int start = 0, end = dim / part;
+	int groups = std::max(1,std::min(std::min(train_groups,part),max_threads));
+	int n_thread = std::max(1,max_threads / groups);
+#ifdef _OPENMP
+	int levels = omp_get_max_active_levels();
+	if(groups > 1)
+		omp_set_max_active_levels(std::max(levels,2));
+#pragma omp parallel for num_threads(groups) schedule(dynamic,1) if(groups > 1)
+#endif
 	for(i = 0; i < part; i++) {
-		strip_matrix<float>(data,tmp_data,N,dim,start,end,verbose);
+		float * view = data + static_cast<size_t>(i) * bs;
+		float * _centers = centers + static_cast<size_t>(i) * nsc * bs, * _seeds = nullptr;
+		int * _labels = labels + static_cast<size_t>(i) * N;
 		if(verbose)
 			cout << "Creating codebook " << i  << "/" << part << endl;
-		greg_kmeans<float>(
-				tmp_data,_centers,_labels,_seeds,
-				KmeansType::KMEANS_PLUS_SEEDS,
-				criteria,
-				DistanceType::NORM_L2,
-				EmptyActs::SINGLETON,
-				N,nsc,bs,max_threads,
-				verbose);
-		start = end;
-		end += dim / part;
-		if(end > dim) end = dim;
-		_centers += nsc * dim / part;
-		_labels += N;
+		if(train == KmeansTrainType::SAMPLED)
+			sampled_kmeans<float>(
+					view,_centers,_labels,_seeds,
+					KmeansType::KMEANS_PLUS_SEEDS,
+					criteria,
+					DistanceType::NORM_L2,
+					EmptyActs::SINGLETON,
+					N,nsc,bs,train_size,n_thread,
+					verbose,dim);
+		else if(train == KmeansTrainType::MINI_BATCH)
+			minibatch_kmeans<float>(
+					view,_centers,_labels,_seeds,
+					KmeansType::KMEANS_PLUS_SEEDS,
+					criteria,
+					DistanceType::NORM_L2,
+					EmptyActs::SINGLETON,
+					N,nsc,bs,train_size,n_thread,
+					verbose,dim);
+		else
+			greg_kmeans<float>(
+					view,_centers,_labels,_seeds,
+					KmeansType::KMEANS_PLUS_SEEDS,
+					criteria,
+					DistanceType::NORM_L2,
+					EmptyActs::SINGLETON,
+					N,nsc,bs,n_thread,
+					verbose,dim);
+		::delete _seeds;
 		if(verbose)
 			cout << "Finished subcodebook " << i << endl;
-		::delete tmp_data;
-		tmp_data = nullptr;
 	}
+#ifdef _OPENMP
+	omp_set_max_active_levels(levels);
+#endif
 	return;
 }
 
+/**
+ * Choose how the sub-quantizers are trained
+ * FULL: k-means over all the vectors (the default)
+ * SAMPLED: k-means over a random sample of size vectors
+ * MINI_BATCH: mini-batch k-means with batches of size vectors
+ * In both last cases all the vectors are assigned to the final centers.
+ * @param type the training
+ * @param size the size of the sample or of a batch
+ * @param iterations the maximum number of iterations (or of batches)
+ * @param tolerance stop when the relative decrease of the distortion is
+ * below it (0 to disable)
+ */
+template<typename DataType>
+inline void PQQuantizer<DataType>::set_training(
+		KmeansTrainType type,
+		int size,
+		int iterations,
+		float tolerance) {
+	if(type != KmeansTrainType::FULL && size <= 0) {
+		cerr << "The size of the sample or of a batch must be positive" << endl;
+		exit(EXIT_FAILURE);
+	}
+	train = type;
+	train_size = size;
+	criteria.iterations = iterations;
+	criteria.tolerance = tolerance;
+}
+
+/**
+ * Choose how many sub-quantizers are trained at once
+ * @param groups the number of sub-quantizers trained at once, each with
+ * 1/groups of the threads (1: one after the other, with all the threads)
+ */
+template<typename DataType>
+inline void PQQuantizer<DataType>::set_training_groups(int groups) {
+	train_groups = groups > 0 ? groups : 1;
+}
+
 /**
  * Calculate the distortion of the quantization
  * @param verbose enable verbose mode
  */
 template<typename DataType>
 inline double PQQuantizer<DataType>::distortion(bool verbose) {
-	double e = 0.0, e_tmp;
-	float * tmp_data;
-	int i;
-	float * _centers = centers;
-	int * _labels = labels;
-	int start = 0, end = dim / part;
-	for(i = 0; i < part; i++) {
-		strip_matrix(data,tmp_data,N,dim,start,end,verbose);
-		e_tmp = SimpleCluster::distortion<float>(tmp_data,_centers,_labels,
-				DistanceType::NORM_L2,dim/part,N,nsc,verbose);
-		e += e_tmp * e_tmp;
-		start = end;
-		end += dim / part;
-		if(end > dim) end = dim;
-		_centers += nsc * dim / part;
-		_labels += N;
-		::delete tmp_data;
-		tmp_data = nullptr;
-	}
+	double e = 0.0;
+	int i, bs = dim / part;
+	int max_threads = 1;
+#ifdef _OPENMP
+	max_threads = omp_get_max_threads();
+#endif
+	for(i = 0; i < part; i++)
+		e += SimpleCluster::label_distortion<float>(
+				data + static_cast<size_t>(i) * bs,
+				centers + static_cast<size_t>(i) * nsc * bs,
+				labels + static_cast<size_t>(i) * N,
+				DistanceType::NORM_L2,bs,N,max_threads,dim);
 	return sqrt(e);
 }
 
@@ -32,6 +32,17 @@
 #include <cblas.h>
 #include "sc_utilities.h"
 #include "sc_algorithm.h"
+#include "search_context.h"
+#include "sc_heap.h"
+#include "sc_adc.h"
+#include "sc_fastscan.h"
+#include "sc_index.h"
+#include "sc_rerank.h"
+#include "sc_hcq.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -41,48 +52,119 @@ namespace SC {
  * Query class
  * Main jobs are search, update, delete, insert.
  * Search method will be implemented first.
+ * The index is read-only once loaded. Everything that depends on the query
+ * lives in a SearchContext, so the const methods can be called from many
+ * threads at the same time, each one with its own context.
  */
 class PQQuery {
 protected:
 	// Variables
-	int size = 0;
+	size_t size = 0; // the number of buckets: kc^mc
 	int not_empty = 0;
 	float * cq, * pq;
-	int * L;
-	int * pid;
+	BucketDirectory dir; // the offsets of the non-empty buckets
+	idx_t * pid;
 	unsigned char * codes;
 	PQConfig config;
 	float * norm_c;
 	float * norm_r;
 	float * dot_cr;
-	float * diff_qr;
-	float * diff_qc;
-	float * raw_data;
-	float * real_dist;
+	BaseVectors raw; // the raw vectors, for the exact distances
+	// The refinement quantizer of the index, if any (see Encoder::assign_refine)
+	int kr = 0, mr = 0;
+	float * rq; // the refinement codebooks
+	unsigned char * refine; // the refinement record of each position
+	// The optional two-level ranking of the coarse centers (see load_coarse_tree)
+	HierarchicalCQ hcq;
+	unsigned char * fs_codes; // 4-bit codes in blocks (fast-scan)
+	size_t * fs_off; // the first block of each bucket; size: size + 1
+	unsigned char * mapped; // the mapped index file, if any
+	size_t mapped_size; // the size of the mapping
+	SearchContext ctx; // the context of the single thread methods
+	inline void scan_ivfadc(
+			float *, float *, float *,
+			SearchContext&,
+			idx_t *, float *,
+			int, int, int, bool, bool) const;
+	inline bool can_rerank() const;
+	inline int rerank(
+			float *, SearchContext&, int,
+			idx_t *, float *, int) const;
+	inline void pre_compute_refine(float *, SearchContext&) const;
+	inline void pre_compute_product(float *, SearchContext&) const;
+	inline void pre_compute_ivfadc(float *, SearchContext&) const;
+	inline int rank_coarse(float *, float *, SearchContext&, int) const;
+	inline const float * coarse_dots(int, SearchContext&) const;
+	inline float coarse_dot(int, int, int) const;
+	inline float refine_delta(const float *, idx_t) const;
+	void load_refinement(const unsigned char *, const IndexHeader&, bool);
+	virtual size_t num_buckets();
+	void load_index(const unsigned char *, size_t, const char *, bool);
 public:
 	PQQuery();
 	virtual ~PQQuery();
 	void load_codebooks(const char *, const char *, bool);
-	int load_encoded_data(const char *, bool);
+	void load_coarse_tree(const char *, bool);
+	idx_t load_encoded_data(const char *, bool);
+	idx_t map_encoded_data(const char *, bool);
+	bool enable_fast_scan(bool);
 	template<typename DataType>
-	inline void load_data(const char *, int, bool);
+	inline void load_data(const char *, int, bool, int = SC_RAW_FLOAT);
+	idx_t map_data(const char *, bool);
 	inline void pre_compute1();
 	inline void pre_compute2(float *);
+	inline void pre_compute2(float *, SearchContext&) const;
 	inline void pre_compute3(float *);
+	inline void pre_compute3(float *, SearchContext&) const;
+	inline void pre_compute2_batch(float *, int, float *, float *) const;
 	inline void search_ivfadc(
 			float *,
-			float *&, float *&,
-			int *&, int *&, int *&,
+			unsigned char *, float *&,
+			idx_t *&, int *&,
 			int&, int, int,int, bool, bool);
+	inline void search_ivfadc(
+			float *, SearchContext&,
+			idx_t *, float *,
+			int, int, int, bool) const;
+	inline void search_ivfadc_batch(
+			float *, int,
+			idx_t *, float *,
+			int, int, int, bool);
+	inline void search_ivfadc_batch(
+			float *, int, SearchContext&,
+			idx_t *, float *,
+			int, int, int, bool) const;
+	inline void search_ivfadc_parallel(
+			float *, int,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
+	inline void search_ivfadc_rerank(
+			float *, SearchContext&,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
+	inline void search_ivfadc_fs(
+			float *, SearchContext&,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
 	int get_size();
 	int get_full_size();
+	PQConfig get_config();
+	const BaseVectors& get_raw_data() const;
 	double entropy(size_t);
 };
 
+/**
+ * Load the raw vectors for the exact distances
+ * @param filename the file of the database
+ * @param offset the size of the header of each vector in bytes
+ * @param verbose enable verbose mode
+ * @param type the storage type of the vectors (see SC_RAW_FLOAT)
+ */
 template<typename DataType>
-inline void PQQuery::load_data(const char * filename, int offset, bool verbose) {
-	config.N = SC::load_and_convert_data<DataType,float>(filename,raw_data,offset,config.dim,verbose);
-	SimpleCluster::init_array(real_dist,config.N);
+inline void PQQuery::load_data(const char * filename, int offset, bool verbose, int type) {
+	config.N = raw.load<DataType>(filename,offset,config.dim,verbose,type);
+	::delete ctx.real_dist;
+	SimpleCluster::init_array(ctx.real_dist,config.N);
 }
 
 /**
@@ -91,9 +173,11 @@ inline void PQQuery::load_data(const char * filename, int offset, bool verbose)
 inline void PQQuery::pre_compute1() {
 	SimpleCluster::init_array(norm_c, config.mc * config.kc);
 	SimpleCluster::init_array(norm_r, config.mp * config.kp);
-	SimpleCluster::init_array(dot_cr, config.kc * config.kp * config.mp);
-	SimpleCluster::init_array(diff_qc, config.mc * config.kc);
-	SimpleCluster::init_array(diff_qr, config.mp * config.kp);
+	// With a coarse tree, the tables of a bucket are computed when scanned
+	size_t n_dots = static_cast<size_t>(config.kc) * config.kp * config.mp;
+	if(!hcq.loaded())
+		SimpleCluster::init_array(dot_cr, n_dots);
+	ctx.init(config);
 
 	float * v_tmp1, * v_tmp2, * v_tmp3;
 	float d_tmp, d;
@@ -125,6 +209,7 @@ inline void PQQuery::pre_compute1() {
 	}
 
 	// Calculate all dot-products
+	if(hcq.loaded()) return;
 	base = 0;
 	v_tmp1 = cq;
 	v_tmp2 = pq;
@@ -145,18 +230,26 @@ inline void PQQuery::pre_compute1() {
 		}
 		v_tmp2 += config.kp * bsc;
 	}
-	assert(base == config.kc * config.kp * config.mp);
+	assert(base == n_dots);
 }
 
 /**
  * Precompute all things that are query dependent
  */
 inline void PQQuery::pre_compute2(float * query) {
-	size_t i, j, k;
+	pre_compute2(query,ctx);
+}
+
+/**
+ * Precompute all things that are query dependent
+ * @param query the query vector
+ * @param context the context that receives the tables
+ */
+inline void PQQuery::pre_compute2(float * query, SearchContext& context) const {
+	size_t i, j;
 	float *  v_tmp1, * v_tmp2;
-	float d, d_tmp = 0.0;
+	float d;
 	int bsc = config.dim / config.mc;
-	int bsp = config.dim / config.mp;
 
 	v_tmp1 = query;
 	v_tmp2 = cq;
@@ -164,62 +257,166 @@ inline void PQQuery::pre_compute2(float * query) {
 	for(i = 0; i < config.mc; i++) {
 		for(j = 0; j < config.kc; j++) {
 			d = cblas_sdot(bsc,v_tmp1,1,v_tmp2,1);
-			diff_qc[base] = norm_c[base++] - d - d;
+			context.diff_qc[base] = norm_c[base] - d - d;
+			base++;
 			v_tmp2 += bsc;
 		}
 		v_tmp1 += bsc;
 	}
+	pre_compute_product(query,context);
+}
 
-	v_tmp1 = query;
-	v_tmp2 = pq;
-	base = 0;
+/**
+ * Precompute the query-to-product table
+ * @param query the query vector
+ * @param context the context that receives the table
+ */
+inline void PQQuery::pre_compute_product(float * query, SearchContext& context) const {
+	size_t i, j, base = 0;
+	float * v_tmp1 = query, * v_tmp2 = pq;
+	float d;
+	int bsp = config.dim / config.mp;
 	for(i = 0; i < config.mp; i++) {
 		for(j = 0; j < config.kp; j++) {
 			d = cblas_sdot(bsp,v_tmp1,1,v_tmp2,1);
-			diff_qr[base] = norm_r[base++] - d - d;
+			context.diff_qr[base] = norm_r[base] - d - d;
+			base++;
 			v_tmp2 += bsp;
 		}
 		v_tmp1 += bsp;
 	}
 }
 
+/**
+ * Precompute the query dependent tables of an IVFADC search. With a coarse
+ * tree, the query-to-coarse table is left to rank_coarse, which fills it
+ * for the centers of the visited cells only.
+ * @param query the query vector
+ * @param context the context that receives the tables
+ */
+inline void PQQuery::pre_compute_ivfadc(float * query, SearchContext& context) const {
+	if(hcq.loaded())
+		pre_compute_product(query,context);
+	else
+		pre_compute2(query,context);
+}
+
+/**
+ * Rank the coarse centers that are the nearest to a query (IVFADC only):
+ * all the kc centers, or the centers of the nearest cells of the coarse tree
+ * @param query the query vector
+ * @param q_qc the query-to-coarse table, filled here with a coarse tree
+ * @param context the context that receives the ranking: the ids in
+ * context.buckets, the values of q_qc in context.v_tmp, the nearest first
+ * @param w the number of centers to be ranked
+ * @return the number of ranked centers
+ */
+inline int PQQuery::rank_coarse(
+		float * query, float * q_qc,
+		SearchContext& context, int w) const {
+	if(hcq.loaded())
+		return hcq.rank(query,w,q_qc,context.buckets,context.v_tmp);
+	float * v_tmp = context.v_tmp;
+	int * buckets = context.buckets;
+	if(w > config.kc) w = config.kc;
+	for(int i = 0; i < config.kc; i++) {
+		v_tmp[i] = q_qc[i];
+		buckets[i] = i;
+	}
+	if(w < config.kc)
+		nth_element_id(v_tmp,v_tmp + config.kc,buckets,w - 1);
+	sort_id(v_tmp,v_tmp + w,buckets);
+	return w;
+}
+
+/**
+ * The dot-products 2 <c, p> of a coarse center with all the product
+ * centers (IVFADC only), laid out like a bucket of dot_cr
+ * @param c the coarse center
+ * @param context the context that holds the table when dot_cr is not computed
+ * @return the mp x kp table
+ */
+inline const float * PQQuery::coarse_dots(int c, SearchContext& context) const {
+	size_t bs1 = static_cast<size_t>(config.kp) * config.mp;
+	if(dot_cr != nullptr)
+		return dot_cr + static_cast<size_t>(c) * bs1;
+	int bsp = config.dim / config.mp;
+	const float * center = cq + static_cast<size_t>(c) * config.dim;
+	for(int m = 0; m < config.mp; m++)
+		cblas_sgemv(CblasRowMajor,CblasNoTrans,config.kp,bsp,2.0f,
+				pq + static_cast<size_t>(m) * config.kp * bsp,bsp,
+				center + m * bsp,1,0.0f,context.dot_table + m * config.kp,1);
+	return context.dot_table;
+}
+
+/**
+ * A single entry of coarse_dots
+ * @param c the coarse center
+ * @param m the sub-quantizer
+ * @param k the product center
+ */
+inline float PQQuery::coarse_dot(int c, int m, int k) const {
+	if(dot_cr != nullptr)
+		return dot_cr[static_cast<size_t>(c) * config.kp * config.mp
+				+ static_cast<size_t>(m) * config.kp + k];
+	int bsp = config.dim / config.mp;
+	return 2.0f * cblas_sdot(bsp,cq + static_cast<size_t>(c) * config.dim + m * bsp,1,
+			pq + (static_cast<size_t>(m) * config.kp + k) * bsp,1);
+}
+
 inline void PQQuery::pre_compute3(float * query) {
-	size_t i, j;
-	float * v_tmp1 = raw_data;
-	float * v_tmp2 = real_dist;
-	for(i = 0; i < config.N; i++) {
-		*(v_tmp2++) = SimpleCluster::distance_l2_square(query,v_tmp1,config.dim);
-		v_tmp1 += config.dim;
+	pre_compute3(query,ctx);
+}
+
+/**
+ * Compute the exact distances from the query to all the raw data
+ * @param query the query vector
+ * @param context the context that receives the distances
+ */
+inline void PQQuery::pre_compute3(float * query, SearchContext& context) const {
+	if(context.real_dist == nullptr || !raw.loaded()) {
+		cerr << "The raw vectors are not loaded (see load_data)" << endl;
+		return;
 	}
+	float * v_tmp2 = context.real_dist;
+	for(idx_t i = 0; i < config.N; i++)
+		*(v_tmp2++) = raw.distance(query,i);
 }
 /**
  * Search method: A demo on single thread mode
  * @param query the query vector
- * @param result the result by identifiers
+ * @param heap the storage of the ranking of the coarse centers,
+ * MinHeap4<HeapEntry>::bytes(kc) bytes
+ * @param result the top R identifiers, allocated here (R entries)
  * @param R the number of top retrieved results
  * @param verbose to enable verbose mode
  */
 inline void PQQuery::search_ivfadc(float * query,
-		float *& v_tmp, float *& dist,
-		int *& result, int *& buckets, int *& prebuck,
+		unsigned char * heap, float *& dist,
+		idx_t *& result, int *& prebuck,
 		int& sum, int R, int w, int T, bool real_dist, bool verbose) {
 	if(config.mc != 1) {
 		cerr << "This search method is for IVFADC only" << endl;
 		return;
 	}
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
+	}
 
 	// Temporary pointers: 8 * 8 = 64 bytes
 	float * v_tmp1;
 	float * v_tmp2;
-	int * i_tmp;
+	idx_t * i_tmp, start;
 	unsigned char * c_tmp = codes;
+	const float * dot = nullptr;
 
 	// Step 1: assign the query to coarse quantizer
 	int i, j, k, l, count = 0, count2,
-			base = 0, base1, base_c, c, bid, sum2 = 0; // 8 * 4 = 32 bytes
+			base = 0, base_c, c, bid; // 7 * 4 = 28 bytes
 	float d_tmp, d_tmp1; // 4 bytes
 
-	pre_compute2(query);
+	pre_compute_ivfadc(query,ctx);
 	float q_sum = 0.0;
 	v_tmp1 = query;
 	for(i = 0; i < config.dim; i++) {
@@ -227,102 +424,619 @@ inline void PQQuery::search_ivfadc(float * query,
 		q_sum += d_tmp * d_tmp;
 	}
 
-	v_tmp1 = diff_qc;
-	for(i = 0; i < config.kc; i++) {
-		d_tmp = q_sum + *(v_tmp1++);
-		pq_insert(v_tmp,buckets,d_tmp,i,sum2,config.kc,verbose);
-	}
-
-	if(verbose) {
-		cout << "Finished STEP 1" << endl;
+	MinHeap4<HeapEntry> coarse(heap,config.kc);
+	HeapEntry e;
+	if(hcq.loaded()) {
+		// Only the centers of the nearest cells are ranked
+		count2 = rank_coarse(query,ctx.diff_qc,ctx,w);
+		for(i = 0; i < count2; i++) {
+			e.key = q_sum + ctx.v_tmp[i];
+			e.id = ctx.buckets[i];
+			coarse.push(e);
+		}
+	} else {
+		v_tmp1 = ctx.diff_qc;
 		for(i = 0; i < config.kc; i++) {
-			cout << buckets[i] << " ";
+			e.key = q_sum + *(v_tmp1++);
+			e.id = i;
+			coarse.push(e);
 		}
-		cout << endl;
 	}
 
+	if(verbose)
+		cout << "Finished STEP 1" << endl;
+
 
 	// Step 2: Local search
-	sum2 = config.kc;
 	sum = 0;
 
-	for(i = 0; i < w; i++) {
-		bid = pq_pop(v_tmp,buckets,sum2,verbose);
-		if(bid > 0) {
-			l = L[bid] - L[bid-1];
-		} else {
-			l = L[bid];
-		}
+	for(i = 0; i < w && coarse.pop(e); i++) {
+		bid = e.id;
+		l = dir.length(bid);
 		prebuck[count++] = bid;
 		sum += l;
 		if(sum >= T) break;
 	}
 
-	// Allocate the memory to store search results
+	// Allocate the memory to store the top R results
 	// Remember to free them after used
-	SimpleCluster::init_array(result,sum);
-	SimpleCluster::init_array(dist,sum);
+	SimpleCluster::init_array(result,R);
+	SimpleCluster::init_array(dist,R);
+	ctx.top.reset(R);
 	count = 0;
 	int bs = config.dim / config.mp, bsz = bs * config.kp
 			,bs1 = config.kp * config.mp / config.mc; // 8 bytes
 
 	for(i = 0; i < w; i++) {
 		bid = prebuck[i];
-		if(bid > 0) {
-			l = L[bid] - L[bid-1];
-			i_tmp = pid + L[bid-1];
-			c_tmp = codes + static_cast<size_t>(config.mp) *
-					static_cast<size_t>(L[bid-1]);
-		} else {
-			l = L[0];
-			i_tmp = pid;
-			c_tmp = codes;
-		}
+		l = dir.bucket(bid,start);
+		i_tmp = pid + start;
+		c_tmp = codes + static_cast<size_t>(config.mp) *
+				static_cast<size_t>(start);
 
 		if(verbose) {
 			cout << "Searching in bucket " << bid
 					<< " that has " << l << " elements" << endl;
 		}
 
-		d_tmp1 = q_sum + diff_qc[bid];
-		base1 = bid * bs1;
+		d_tmp1 = q_sum + ctx.diff_qc[bid];
+		if(!real_dist)
+			dot = coarse_dots(bid,ctx);
 
 		// Calculate all l distances
-		memcpy(&result[count],i_tmp,l * sizeof(int));
-//		memcpy(&result[count+sum],i_tmp,l * sizeof(int));
-		count2 = count;
-		if(!real_dist) {
+		if(!real_dist && l >= (config.kp >> 3)) {
+			// Large buckets: merged table and vectorized scan
+			adc_merge_table(ctx.diff_qr,dot,ctx.adc_table,bs1);
+			ctx.scan(c_tmp,i_tmp,l,config.mp,config.kp,d_tmp1);
+		} else if(!real_dist) {
 			for(j = 0; j < l; j++) {
 				base = 0;
 				d_tmp = d_tmp1;
 				for(k = 0; k < config.mp; k++) {
 					c = static_cast<int>(*(c_tmp++));
 					base_c = base + c;
-					d_tmp += (diff_qr[base_c] + dot_cr[base1 + base_c]);
+					d_tmp += (ctx.diff_qr[base_c] + dot[base_c]);
 					base += config.kp;
 				}
-				dist[count] = d_tmp;
-				count++;
+				ctx.top.push(d_tmp,i_tmp[j]);
 			}
 		} else {
 			for(j = 0; j < l; j++) {
-				dist[count] = SimpleCluster::distance_l2_square(
-						query,raw_data + i_tmp[j] * config.dim,config.dim);
-				count++;
+				ctx.top.push(raw.distance(query,i_tmp[j]),
+						i_tmp[j]);
 			}
 		}
-//		memcpy(&dist[count2+sum],&dist[count2],l*sizeof(float));
+		count += l;
 		if(verbose)
 			cout << "Searched all " << l << " elements" << endl;
 		if(count >= T) break;
 	}
 
 	// Step 3: Extract the top R
-	if(sum >= R) {
-		nth_element_id(dist,dist+sum,result,R-1);
-		sort_id(dist,dist+R,result);
+	ctx.top.finish(result,dist);
+}
+
+/**
+ * Precompute the query dependent tables for a batch of queries.
+ * One sgemm per sub-space replaces the per-centroid sdot calls of pre_compute2().
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param qc the query-to-coarse tables (nq x (mc * kc)), not used with a
+ * coarse tree (rank_coarse fills the table of each query instead)
+ * @param qr the query-to-product tables (nq x (mp * kp))
+ */
+inline void PQQuery::pre_compute2_batch(
+		float * queries,
+		int nq,
+		float * qc,
+		float * qr) const {
+	size_t i, j, k;
+	int bsc = config.dim / config.mc;
+	int bsp = config.dim / config.mp;
+	int lc = config.mc * config.kc;
+	int lr = config.mp * config.kp;
+
+	// qc = -2 * Q * C^T for each coarse sub-space
+	for(i = 0; i < config.mc && !hcq.loaded(); i++) {
+		cblas_sgemm(CblasRowMajor,CblasNoTrans,CblasTrans,
+				nq,config.kc,bsc,
+				-2.0f,queries + i * bsc,config.dim,
+				cq + i * config.kc * bsc,bsc,
+				0.0f,qc + i * config.kc,lc);
+	}
+
+	// qr = -2 * Q * P^T for each product sub-space
+	for(i = 0; i < config.mp; i++) {
+		cblas_sgemm(CblasRowMajor,CblasNoTrans,CblasTrans,
+				nq,config.kp,bsp,
+				-2.0f,queries + i * bsp,config.dim,
+				pq + i * config.kp * bsp,bsp,
+				0.0f,qr + i * config.kp,lr);
+	}
+
+	// Add the center norms
+	float * v_tmp1;
+	for(k = 0; k < nq; k++) {
+		if(!hcq.loaded()) {
+			v_tmp1 = qc + k * lc;
+			for(j = 0; j < lc; j++)
+				v_tmp1[j] += norm_c[j];
+		}
+		v_tmp1 = qr + k * lr;
+		for(j = 0; j < lr; j++)
+			v_tmp1[j] += norm_r[j];
 	}
 }
+
+/**
+ * Search method with a given context (IVFADC only)
+ * @param query the query vector
+ * @param context the context of the calling thread
+ * @param result the top R identifiers
+ * @param dist the top R distances
+ * @param R the number of top retrieved results
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc(
+		float * query, SearchContext& context,
+		idx_t * result, float * dist,
+		int R, int w, int T, bool verbose) const {
+	if(config.mc != 1) {
+		cerr << "This search method is for IVFADC only" << endl;
+		return;
+	}
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
+	}
+	pre_compute_ivfadc(query,context);
+	scan_ivfadc(query,context.diff_qc,context.diff_qr,context,
+			result,dist,R,w,T,false,verbose);
+}
+
+/**
+ * Two-stage search method (IVFADC only): the K best candidates of the
+ * ADC scan are re-ranked with the exact distances to their raw vectors
+ * (see load_data and map_data) or, without them, with the refinement
+ * codes of the index (see rerank).
+ * @param query the query vector
+ * @param context the context of the calling thread
+ * @param result the top R identifiers
+ * @param dist the top R re-ranked distances
+ * @param R the number of top retrieved results
+ * @param K the number of re-ranked candidates (K >= R)
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc_rerank(
+		float * query, SearchContext& context,
+		idx_t * result, float * dist,
+		int R, int K, int w, int T, bool verbose) const {
+	if(config.mc != 1) {
+		cerr << "This search method is for IVFADC only" << endl;
+		return;
+	}
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
+	}
+	if(!can_rerank() || R <= 0) return;
+	if(K < R) K = R;
+	context.reserve(K);
+	pre_compute_ivfadc(query,context);
+	scan_ivfadc(query,context.diff_qc,context.diff_qr,context,
+			context.result,context.dist,K,w,T,true,verbose);
+	int k = 0;
+	while(k < K && context.result[k] >= 0) k++;
+	rerank(query,context,k,result,dist,R);
+}
+
+/**
+ * Check that a short list can be re-ranked
+ * @return false if neither the raw vectors nor the refinement codes are loaded
+ */
+inline bool PQQuery::can_rerank() const {
+	if(raw.loaded() || refine != nullptr) return true;
+	cerr << "Neither the raw vectors nor the refinement codes are loaded" << endl;
+	return false;
+}
+
+/**
+ * Re-rank a short list.
+ * The ADC search has left the positions of the candidates in context.result
+ * and their ADC distances in context.dist, the top R is collected again
+ * by context.top. The exact distances to the raw vectors are used if they
+ * are loaded. Otherwise the ADC distances are refined with the refinement
+ * codes: a second table lookup per candidate, from the same positions.
+ * @param query the query vector
+ * @param context the context of the calling thread
+ * @param k the number of candidates in context.result
+ * @param result the top R identifiers
+ * @param dist the top R re-ranked distances
+ * @param R the number of top retrieved results
+ * @return the number of results
+ */
+inline int PQQuery::rerank(
+		float * query, SearchContext& context, int k,
+		idx_t * result, float * dist, int R) const {
+	TopR& top = context.top;
+	idx_t * c_id = context.result;
+	int i;
+	top.reset(R);
+	if(raw.loaded()) {
+		for(i = 0; i < k; i++)
+			c_id[i] = pid[c_id[i]];
+		exact_rerank(query,raw,c_id,k,top);
+	} else if(refine != nullptr) {
+		pre_compute_refine(query,context);
+		for(i = 0; i < k; i++)
+			top.push(context.dist[i] + refine_delta(context.refine_table,c_id[i]),
+					pid[c_id[i]]);
+	}
+	return top.finish(result,dist);
+}
+
+/**
+ * Compute the query-to-refinement table: -2 <q_j, c_jk> for the center k
+ * of each sub-space j of the refinement quantizer
+ * @param query the query vector
+ * @param context the context that receives the table
+ */
+inline void PQQuery::pre_compute_refine(float * query, SearchContext& context) const {
+	int j, k, bsr = config.dim / mr;
+	context.reserve_refine(static_cast<size_t>(mr) * kr);
+	const float * v_tmp = rq;
+	float * t = context.refine_table;
+	for(j = 0; j < mr; j++) {
+		for(k = 0; k < kr; k++) {
+			*(t++) = -2.0f * cblas_sdot(bsr,query + j * bsr,1,v_tmp,1);
+			v_tmp += bsr;
+		}
+	}
+}
+
+/**
+ * The correction of the ADC distance of a position by its refinement
+ * record: the norm correction plus one lookup per refinement code
+ * @param table the query-to-refinement table (see pre_compute_refine)
+ * @param p the position
+ */
+inline float PQQuery::refine_delta(const float * table, idx_t p) const {
+	const unsigned char * r = refine + static_cast<size_t>(p) * index_refine_size(mr);
+	float e;
+	memcpy(&e,r,sizeof(float));
+	r += sizeof(float);
+	for(int j = 0; j < mr; j++, table += kr)
+		e += table[r[j]];
+	return e;
+}
+
+/**
+ * Rank the coarse centers, scan the closest buckets and extract the top R.
+ * The query dependent tables are given by the caller.
+ * @param query the query vector
+ * @param q_qc the query-to-coarse table
+ * @param q_qr the query-to-product table
+ * @param context the context of the calling thread
+ * @param result the top R identifiers
+ * @param dist the top R distances
+ * @param R the number of top retrieved results
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param positions to leave the positions of the results in the inverted
+ * file instead of their identifiers (see rerank)
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::scan_ivfadc(
+		float * query, float * q_qc, float * q_qr,
+		SearchContext& context,
+		idx_t * result, float * dist,
+		int R, int w, int T, bool positions, bool verbose) const {
+	int i, j, k, l, bid, sum, count, nw;
+	int bs1 = config.kp * config.mp;
+	size_t base, base_c;
+	float q_sum, d_tmp, d_tmp1;
+	const float * dot;
+	int * buckets = context.buckets;
+	idx_t start;
+	unsigned char * c_tmp;
+
+	q_sum = cblas_sdot(config.dim,query,1,query,1);
+
+	// Step 1: rank the coarse centers
+	w = rank_coarse(query,q_qc,context,w);
+
+	// Step 2: local search
+	sum = nw = 0;
+	while(nw < w && sum < T) {
+		bid = buckets[nw++];
+		sum += dir.length(bid);
+	}
+	TopR& top = context.top;
+	top.reset(R);
+
+	count = 0;
+	for(i = 0; i < nw; i++) {
+		bid = buckets[i];
+		l = dir.bucket(bid,start);
+		c_tmp = codes + static_cast<size_t>(config.mp) *
+				static_cast<size_t>(start);
+		if(l <= 0) continue;
+
+		// The candidates are kept as positions until the top R is known
+		d_tmp1 = q_sum + q_qc[bid];
+		dot = coarse_dots(bid,context);
+		count += l;
+		if(l >= (config.kp >> 3)) {
+			// Large buckets: merged table and vectorized scan
+			adc_merge_table(q_qr,dot,context.adc_table,bs1);
+			context.scan(c_tmp,start,l,config.mp,config.kp,d_tmp1);
+			continue;
+		}
+		for(j = 0; j < l; j++) {
+			base = 0;
+			d_tmp = d_tmp1;
+			for(k = 0; k < config.mp; k++) {
+				base_c = base + *(c_tmp++);
+				d_tmp += (q_qr[base_c] + dot[base_c]);
+				base += config.kp;
+			}
+			top.push(d_tmp,start + j);
+		}
+	}
+
+	// Step 3: extract the top R
+	k = top.finish(result,dist);
+	if(!positions)
+		for(i = 0; i < k; i++)
+			result[i] = pid[result[i]];
+	if(verbose)
+		cout << "Searched " << count << " candidates" << endl;
+}
+
+/**
+ * Search method for a batch of queries (IVFADC only)
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param result the top R identifiers of each query (nq x R)
+ * @param dist the top R distances of each query (nq x R)
+ * @param R the number of top retrieved results
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc_batch(
+		float * queries, int nq,
+		idx_t * result, float * dist,
+		int R, int w, int T, bool verbose) {
+	search_ivfadc_batch(queries,nq,ctx,result,dist,R,w,T,verbose);
+}
+
+/**
+ * Search method for a batch of queries with a given context (IVFADC only)
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param context the context of the calling thread
+ * @param result the top R identifiers of each query (nq x R)
+ * @param dist the top R distances of each query (nq x R)
+ * @param R the number of top retrieved results
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc_batch(
+		float * queries, int nq, SearchContext& context,
+		idx_t * result, float * dist,
+		int R, int w, int T, bool verbose) const {
+	if(config.mc != 1) {
+		cerr << "This search method is for IVFADC only" << endl;
+		return;
+	}
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
+	}
+	if(nq <= 0 || R <= 0) return;
+
+	// The tables are computed block by block to bound the memory.
+	// With a coarse tree there is no query-to-coarse table of all the kc
+	// centers: each query is ranked against context.diff_qc, which
+	// rank_coarse fills for the centers of the visited cells only.
+	const int qb = 256;
+	int lc = hcq.loaded() ? 0 : config.kc, lr = config.mp * config.kp;
+	int q0, q1, q;
+	float * qc = nullptr, * qr;
+	if(lc > 0)
+		SimpleCluster::init_array(qc,static_cast<size_t>(qb) * lc);
+	SimpleCluster::init_array(qr,static_cast<size_t>(qb) * lr);
+
+	for(q0 = 0; q0 < nq; q0 += qb) {
+		q1 = min(nq,q0 + qb);
+		pre_compute2_batch(queries + static_cast<size_t>(q0) * config.dim,
+				q1 - q0,qc,qr);
+		for(q = q0; q < q1; q++) {
+			scan_ivfadc(
+					queries + static_cast<size_t>(q) * config.dim,
+					lc > 0 ? qc + static_cast<size_t>(q - q0) * lc : context.diff_qc,
+					qr + static_cast<size_t>(q - q0) * lr,
+					context,
+					result + static_cast<size_t>(q) * R,
+					dist + static_cast<size_t>(q) * R,
+					R,w,T,false,verbose);
+		}
+	}
+
+	::delete qc;
+	::delete qr;
+}
+
+/**
+ * Search a set of queries on all threads (IVFADC only).
+ * The index is shared, each thread owns a context and a range of queries.
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param result the top R identifiers of each query (nq x R)
+ * @param dist the top R distances of each query (nq x R)
+ * @param R the number of top retrieved results
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param n_threads the number of threads (0 to use all cores)
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc_parallel(
+		float * queries, int nq,
+		idx_t * result, float * dist,
+		int R, int w, int T, int n_threads, bool verbose) const {
+	if(config.mc != 1) {
+		cerr << "This search method is for IVFADC only" << endl;
+		return;
+	}
+	if(nq <= 0 || R <= 0) return;
+
+	int max_threads = 1;
+#ifdef _OPENMP
+	max_threads = n_threads > 0 ? n_threads : omp_get_max_threads();
+#endif
+	if(max_threads > nq) max_threads = nq;
+	size_t p = static_cast<size_t>(nq) / max_threads;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(max_threads)
+	{
+#pragma omp for
+#endif
+		for(int i0 = 0; i0 < max_threads; i0++) {
+			// Range definition
+			size_t start = p * static_cast<size_t>(i0);
+			size_t end = start + p;
+			if(end > nq || i0 == max_threads - 1)
+				end = nq;
+
+			SearchContext context(config);
+			search_ivfadc_batch(
+					queries + start * config.dim,
+					static_cast<int>(end - start),
+					context,
+					result + start * R,
+					dist + start * R,
+					R,w,T,verbose);
+		}
+#ifdef _OPENMP
+	}
+#endif
+}
+
+/**
+ * Search method on the 4-bit fast-scan codes (IVFADC only).
+ * The buckets are scanned with quantized tables, then the K best candidates
+ * are re-ranked with the exact distances if the raw data are loaded,
+ * or with the float ADC distances otherwise, refined by the refinement
+ * codes if the index has them.
+ * @param query the query vector
+ * @param context the context of the calling thread
+ * @param result the top R identifiers
+ * @param dist the top R distances
+ * @param R the number of top retrieved results
+ * @param K the number of re-ranked candidates (K >= R)
+ * @param w the number of buckets to be visited
+ * @param T the maximum number of candidates
+ * @param verbose to enable verbose mode
+ */
+inline void PQQuery::search_ivfadc_fs(
+		float * query, SearchContext& context,
+		idx_t * result, float * dist,
+		int R, int K, int w, int T, bool verbose) const {
+	if(config.mc != 1 || fs_codes == nullptr) {
+		cerr << "This search method is for IVFADC with fast-scan codes only" << endl;
+		return;
+	}
+	if(R <= 0) return;
+	if(K < R) K = R;
+
+	int i, j, k, l, m, bid, sum, count, nw;
+	int bs1 = config.kp * config.mp;
+	idx_t start;
+	size_t bsz = fs_block_size(config.mp), nb, p;
+	float q_sum, d_tmp, delta, offset;
+	float * c_dist;
+	int * buckets = context.buckets;
+	idx_t * c_id;
+	const unsigned char * packed;
+
+	pre_compute_ivfadc(query,context);
+	q_sum = cblas_sdot(config.dim,query,1,query,1);
+
+	// Step 1: rank the coarse centers
+	w = rank_coarse(query,context.diff_qc,context,w);
+
+	// Step 2: scan the buckets with the quantized tables
+	sum = nw = 0;
+	while(nw < w && sum < T) {
+		bid = buckets[nw++];
+		sum += dir.length(bid);
+	}
+	TopR& top = context.top;
+	top.reset(K);
+
+	count = 0;
+	for(i = 0; i < nw; i++) {
+		bid = buckets[i];
+		l = dir.bucket(bid,start);
+		if(l <= 0) continue;
+
+		adc_merge_table(context.diff_qr,coarse_dots(bid,context),
+				context.adc_table,bs1);
+		offset = fs_quantize_lut(context.adc_table,config.mp,context.lut,delta);
+		nb = fs_blocks(l);
+		context.reserve_fs(nb * FS_BLOCK);
+		fs_scan(fs_codes + fs_off[bid] * bsz,nb,config.mp,
+				context.lut,context.fs_dist);
+
+		// The identifiers are kept as positions until the re-ranking
+		d_tmp = q_sum + context.diff_qc[bid] + offset;
+		for(j = 0; j < l; j++)
+			top.push(d_tmp + delta * context.fs_dist[j],start + j);
+		count += l;
+	}
+
+	// Step 3: re-rank the K best candidates
+	context.reserve(K);
+	c_dist = context.dist;
+	c_id = context.result;
+	k = top.finish(c_id,c_dist);
+	if(raw.loaded()) {
+		rerank(query,context,k,result,dist,R);
+		if(verbose)
+			cout << "Searched " << count << " candidates, re-ranked " << k << endl;
+		return;
+	}
+	if(refine != nullptr)
+		pre_compute_refine(query,context);
+	top.reset(R);
+	for(i = 0; i < k; i++) {
+		p = static_cast<size_t>(c_id[i]);
+		bid = dir.find(static_cast<idx_t>(p));
+		dir.bucket(bid,start);
+		packed = fs_codes + fs_off[bid] * bsz;
+		d_tmp = q_sum + context.diff_qc[bid];
+		for(m = 0; m < config.mp; m++) {
+			j = fs_code(packed,p - start,m,config.mp);
+			d_tmp += (context.diff_qr[m * config.kp + j] + coarse_dot(bid,m,j));
+		}
+		if(refine != nullptr)
+			d_tmp += refine_delta(context.refine_table,c_id[i]);
+		top.push(d_tmp,pid[p]);
+	}
+
+	// Step 4: extract the top R
+	top.finish(result,dist);
+	if(verbose)
+		cout << "Searched " << count << " candidates, re-ranked " << k << endl;
+}
+
 } /* namespace PQLearn */
 
 #endif /* QUERY_H_ */
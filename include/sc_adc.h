@@ -0,0 +1,206 @@
+/*
+ * sc_adc.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_ADC_H_
+#define SC_ADC_H_
+
+#include <iostream>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SC_ADC_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * The signature of an ADC scan kernel
+ * @param codes the codes of the candidates (n x mp, row major)
+ * @param n the number of candidates
+ * @param mp the number of sub-quantizers
+ * @param kp the number of centers of each sub-quantizer
+ * @param table the merged lookup table (mp x kp)
+ * @param bias the value added to every distance
+ * @param dist the output distances (n)
+ */
+typedef void (*adc_scan_t)(
+		const unsigned char *, size_t,
+		int, int,
+		const float *, float,
+		float *);
+
+/**
+ * Merge the query-to-product table and a row of the center dot-products
+ * into one lookup table, so that the scan needs one lookup per sub-quantizer
+ * @param qr the query-to-product table
+ * @param dot the row of dot-products of a bucket
+ * @param table the merged table
+ * @param n the number of elements
+ */
+inline void adc_merge_table(
+		const float * qr, const float * dot,
+		float * table, int n) {
+	for(int i = 0; i < n; i++)
+		table[i] = qr[i] + dot[i];
+}
+
+/**
+ * Scalar ADC scan
+ */
+inline void adc_scan_scalar(
+		const unsigned char * codes, size_t n,
+		int mp, int kp,
+		const float * table, float bias,
+		float * dist) {
+	size_t j;
+	int k;
+	const float * t;
+	float d;
+	for(j = 0; j < n; j++) {
+		d = bias;
+		t = table;
+		for(k = 0; k < mp; k++) {
+			d += t[*(codes++)];
+			t += kp;
+		}
+		dist[j] = d;
+	}
+}
+
+#ifdef SC_ADC_X86
+/**
+ * SSE ADC scan: scores 4 candidates per iteration
+ */
+__attribute__((target("sse2")))
+inline void adc_scan_sse(
+		const unsigned char * codes, size_t n,
+		int mp, int kp,
+		const float * table, float bias,
+		float * dist) {
+	size_t j = 0;
+	int k;
+	const float * t;
+	const unsigned char * c0, * c1, * c2, * c3;
+	__m128 acc;
+	for(; j + 4 <= n; j += 4) {
+		c0 = codes + j * mp;
+		c1 = c0 + mp;
+		c2 = c1 + mp;
+		c3 = c2 + mp;
+		acc = _mm_set1_ps(bias);
+		t = table;
+		for(k = 0; k < mp; k++) {
+			acc = _mm_add_ps(acc,
+					_mm_setr_ps(t[c0[k]],t[c1[k]],t[c2[k]],t[c3[k]]));
+			t += kp;
+		}
+		_mm_storeu_ps(dist + j,acc);
+	}
+	adc_scan_scalar(codes + j * mp,n - j,mp,kp,table,bias,dist + j);
+}
+
+/**
+ * AVX2 ADC scan: scores 16 then 8 candidates per iteration with gathers.
+ * A gather of the codes reads 4 bytes, so a block is only vectorized
+ * when at least 3 more bytes of the same bucket follow it.
+ */
+__attribute__((target("avx2")))
+inline void adc_scan_avx2(
+		const unsigned char * codes, size_t n,
+		int mp, int kp,
+		const float * table, float bias,
+		float * dist) {
+	size_t j = 0, size = n * mp;
+	int k;
+	const float * t;
+	const unsigned char * c;
+	const __m256i stride = _mm256_setr_epi32(
+			0,mp,2 * mp,3 * mp,4 * mp,5 * mp,6 * mp,7 * mp);
+	const __m256i next = _mm256_set1_epi32(8 * mp);
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i id0, id1;
+	__m256 acc0, acc1;
+
+	for(; (j + 16) * mp + 3 <= size; j += 16) {
+		c = codes + j * mp;
+		acc0 = acc1 = _mm256_set1_ps(bias);
+		t = table;
+		for(k = 0; k < mp; k++) {
+			id0 = _mm256_i32gather_epi32(
+					reinterpret_cast<const int *>(c + k),stride,1);
+			id1 = _mm256_i32gather_epi32(
+					reinterpret_cast<const int *>(c + k),
+					_mm256_add_epi32(stride,next),1);
+			id0 = _mm256_and_si256(id0,mask);
+			id1 = _mm256_and_si256(id1,mask);
+			acc0 = _mm256_add_ps(acc0,_mm256_i32gather_ps(t,id0,4));
+			acc1 = _mm256_add_ps(acc1,_mm256_i32gather_ps(t,id1,4));
+			t += kp;
+		}
+		_mm256_storeu_ps(dist + j,acc0);
+		_mm256_storeu_ps(dist + j + 8,acc1);
+	}
+
+	for(; (j + 8) * mp + 3 <= size; j += 8) {
+		c = codes + j * mp;
+		acc0 = _mm256_set1_ps(bias);
+		t = table;
+		for(k = 0; k < mp; k++) {
+			id0 = _mm256_i32gather_epi32(
+					reinterpret_cast<const int *>(c + k),stride,1);
+			id0 = _mm256_and_si256(id0,mask);
+			acc0 = _mm256_add_ps(acc0,_mm256_i32gather_ps(t,id0,4));
+			t += kp;
+		}
+		_mm256_storeu_ps(dist + j,acc0);
+	}
+	adc_scan_sse(codes + j * mp,n - j,mp,kp,table,bias,dist + j);
+}
+#endif
+
+/**
+ * Select the best kernel supported by the CPU.
+ * Define SC_ADC_NO_GATHER on CPUs where the gathers are slow.
+ */
+inline adc_scan_t adc_select() {
+#ifdef SC_ADC_X86
+	__builtin_cpu_init();
+#ifndef SC_ADC_NO_GATHER
+	if(__builtin_cpu_supports("avx2"))
+		return adc_scan_avx2;
+#endif
+	if(__builtin_cpu_supports("sse2"))
+		return adc_scan_sse;
+#endif
+	return adc_scan_scalar;
+}
+
+/**
+ * Compute the ADC distances of n candidates with a merged lookup table.
+ * The kernel is selected once, on the first call.
+ * @param codes the codes of the candidates (n x mp, row major)
+ * @param n the number of candidates
+ * @param mp the number of sub-quantizers
+ * @param kp the number of centers of each sub-quantizer
+ * @param table the merged lookup table (mp x kp)
+ * @param bias the value added to every distance
+ * @param dist the output distances (n)
+ */
+inline void adc_scan(
+		const unsigned char * codes, size_t n,
+		int mp, int kp,
+		const float * table, float bias,
+		float * dist) {
+	static const adc_scan_t kernel = adc_select();
+	kernel(codes,n,mp,kp,table,bias,dist);
+}
+
+} /* namespace SC */
+
+#endif /* SC_ADC_H_ */
@@ -10,68 +10,253 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cfloat>
 #include <cblas.h>
 #include "sc_utilities.h"
 
 using namespace std;
 
 namespace SC {
+// Ranges up to this size are finished by insertion sort
+#ifndef SC_INSERTION_SORT
+#define SC_INSERTION_SORT 16
+#endif
+// sort_id switches to the radix sort from this size on
+#ifndef SC_RADIX_SORT_MIN
+#define SC_RADIX_SORT_MIN (1 << 16)
+#endif
+
 /**
- * Sorting with index tracking using STL's tools
- * @param st,ed pointers to specify the range of array to be sorted
+ * Swap two entries of a pair of parallel arrays
+ */
+template<typename IdType>
+inline void swap_id(float * st, IdType * id, size_t i, size_t j) {
+	float tmp = st[i];
+	st[i] = st[j];
+	st[j] = tmp;
+	IdType it = id[i];
+	id[i] = id[j];
+	id[j] = it;
+}
+
+/**
+ * Insertion Sorting with index tracking, for short ranges
+ * @param st the array to be sorted
  * @param id the id of the array
+ * @param n the size of the array
  */
-inline void sort_id(float * st, float * ed, int * id) {
-	size_t n = ed - st;
-	vector<pair<int,float>> pv;
+template<typename IdType>
+inline void insertion_sort_id(float * st, IdType * id, size_t n) {
+	size_t i, j;
+	for(i = 1; i < n; i++) {
+		float tmp = st[i];
+		IdType it = id[i];
+		for(j = i; j > 0 && tmp < st[j-1]; j--) {
+			st[j] = st[j-1];
+			id[j] = id[j-1];
+		}
+		st[j] = tmp;
+		id[j] = it;
+	}
+}
 
-	float * tmp;
-	int * it;
-	for(tmp = st, it = id; tmp != ed; tmp++, it++) {
-		pv.push_back(pair<int,float>(*it,*tmp));
+/**
+ * Restore the max-heap st[0..n) below the entry p
+ */
+template<typename IdType>
+inline void sift_down_id(float * st, IdType * id, size_t p, size_t n) {
+	size_t c;
+	for(; (c = (p << 1) + 1) < n; p = c) {
+		if(c + 1 < n && st[c] < st[c + 1]) c++;
+		if(!(st[p] < st[c])) break;
+		swap_id(st,id,p,c);
 	}
+}
 
-	sort(pv.begin(), pv.end(),
-			[](const pair<int,float>& a, const pair<int,float>& b) -> bool
-			{ return a.second < b.second ; });
-	tmp = st;
-	it = id;
-	for(size_t i = 0; i < n; i++) {
-		*tmp = pv[i].second;
-		*it = pv[i].first;
-		tmp++;
-		it++;
+/**
+ * Heap Sorting with index tracking, the fallback of the introsort
+ * @param st the array to be sorted
+ * @param id the id of the array
+ * @param n the size of the array
+ */
+template<typename IdType>
+inline void heap_sort_id(float * st, IdType * id, size_t n) {
+	size_t i;
+	for(i = n >> 1; i-- > 0;)
+		sift_down_id(st,id,i,n);
+	// Move the largest one to the end, then restore the heap
+	for(i = n; i > 1; i--) {
+		swap_id(st,id,0,i - 1);
+		sift_down_id(st,id,0,i - 1);
 	}
-	pv.clear();
 }
 
 /**
- * nth_element with id tracking
- * @param st,ed pointers to specify the range of array to be sorted
+ * Partitioning around the median of the first, middle and last entries
+ * @param st the array to be partitioned (at least 3 entries)
  * @param id the id of the array
+ * @param n the size of the array
+ * @return k such that st[0..k) <= pivot <= st[k..n), 0 < k < n
  */
-inline void nth_element_id(float * st, float * ed, int * id, int r) {
-	size_t n = ed - st;
-	vector<pair<int,float>> pv;
+template<typename IdType>
+inline size_t median_partition_id(float * st, IdType * id, size_t n) {
+	size_t m = n >> 1;
+	if(st[m] < st[0]) swap_id(st,id,0,m);
+	if(st[n-1] < st[0]) swap_id(st,id,0,n-1);
+	if(st[n-1] < st[m]) swap_id(st,id,m,n-1);
+	// st[0] and st[n-1] are sentinels of the two scans
+	float pivot = st[m];
+	size_t i = 0, j = n - 1;
+	while(true) {
+		do i++; while(st[i] < pivot);
+		do j--; while(pivot < st[j]);
+		if(i >= j) break;
+		swap_id(st,id,i,j);
+	}
+	return j + 1;
+}
+
+/**
+ * Introsort with index tracking: quick sort on the median of three,
+ * heap sort once the recursion gets too deep
+ * @param st the array to be sorted
+ * @param id the id of the array
+ * @param n the size of the array
+ * @param depth the remaining recursion depth
+ */
+template<typename IdType>
+inline void intro_sort_id(float * st, IdType * id, size_t n, int depth) {
+	size_t k;
+	while(n > SC_INSERTION_SORT) {
+		if(depth-- == 0) {
+			heap_sort_id(st,id,n);
+			return;
+		}
+		k = median_partition_id(st,id,n);
+		// Recurse on the smaller part, loop on the larger one
+		if(k < n - k) {
+			intro_sort_id(st,id,k,depth);
+			st += k;
+			id += k;
+			n -= k;
+		} else {
+			intro_sort_id(st + k,id + k,n - k,depth);
+			n = k;
+		}
+	}
+	insertion_sort_id(st,id,n);
+}
+
+/**
+ * The maximum recursion depth of the introsort / introselect
+ */
+inline int intro_depth(size_t n) {
+	int depth = 0;
+	for(; n > 1; n >>= 1)
+		depth += 2;
+	return depth;
+}
+
+/**
+ * LSD radix sorting with index tracking.
+ * Each entry is packed into a 64-bit key: the order-preserving bits of
+ * the distance on top, its position below. Only the top 32 bits are sorted,
+ * so the sort is stable. It allocates 3 arrays of n entries.
+ * @param st the array to be sorted
+ * @param id the id of the array
+ * @param n the size of the array (less than 2^32)
+ */
+template<typename IdType>
+inline void radix_sort_id(float * st, IdType * id, size_t n) {
+	uint64_t * key, * tmp, * swp;
+	IdType * it;
+	size_t i, count[4][256];
+	uint32_t u;
+	int b;
+	SimpleCluster::init_array(key,n);
+	SimpleCluster::init_array(tmp,n);
+	memset(count,0,sizeof(count));
+	for(i = 0; i < n; i++) {
+		memcpy(&u,st + i,sizeof(float));
+		// Negative numbers: flip all bits, others: flip the sign bit
+		u = (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+		key[i] = (static_cast<uint64_t>(u) << 32) | i;
+		for(b = 0; b < 4; b++)
+			count[b][(u >> (b << 3)) & 0xff]++;
+	}
+	for(b = 0; b < 4; b++) {
+		// Nothing to do if all the keys share this byte
+		if(count[b][(key[0] >> (32 + (b << 3))) & 0xff] == n) continue;
+		size_t sum = 0, c;
+		for(i = 0; i < 256; i++) {
+			c = count[b][i];
+			count[b][i] = sum;
+			sum += c;
+		}
+		for(i = 0; i < n; i++)
+			tmp[count[b][(key[i] >> (32 + (b << 3))) & 0xff]++] = key[i];
+		swp = key;
+		key = tmp;
+		tmp = swp;
+	}
+	::delete tmp;
 
-	float * tmp;
-	int * it;
-	for(tmp = st, it = id; tmp != ed; tmp++, it++) {
-		pv.push_back(pair<int,float>(*it,*tmp));
+	SimpleCluster::init_array(it,n);
+	memcpy(it,id,n * sizeof(IdType));
+	for(i = 0; i < n; i++) {
+		u = static_cast<uint32_t>(key[i] >> 32);
+		u = (u & 0x80000000u) ? (u ^ 0x80000000u) : ~u;
+		memcpy(st + i,&u,sizeof(float));
+		id[i] = it[key[i] & 0xffffffffu];
 	}
+	::delete key;
+	::delete it;
+}
+
+/**
+ * Sorting with index tracking, in place.
+ * Large arrays are radix sorted.
+ * @param st,ed pointers to specify the range of array to be sorted
+ * @param id the id of the array
+ */
+template<typename IdType>
+inline void sort_id(float * st, float * ed, IdType * id) {
+	if(ed <= st) return;
+	size_t n = ed - st;
+	if(n >= SC_RADIX_SORT_MIN && n <= 0xffffffffu)
+		radix_sort_id(st,id,n);
+	else
+		intro_sort_id(st,id,n,intro_depth(n));
+}
 
-	nth_element(pv.begin(), pv.begin() + r, pv.end(),
-			[](const pair<int,float>& a, const pair<int,float>& b) -> bool
-			{ return a.second < b.second ; });
-	tmp = st;
-	it = id;
-	for(size_t i = 0; i < n; i++) {
-		*tmp = pv[i].second;
-		*it = pv[i].first;
-		tmp++;
-		it++;
+/**
+ * nth_element with id tracking, in place (introselect)
+ * @param st,ed pointers to specify the range of array to be sorted
+ * @param id the id of the array
+ * @param r the position of the element to be put in place
+ */
+template<typename IdType>
+inline void nth_element_id(float * st, float * ed, IdType * id, int r) {
+	if(ed <= st || r < 0) return;
+	size_t n = ed - st, nth = r, k;
+	if(nth >= n) return;
+	int depth = intro_depth(n);
+	while(n > SC_INSERTION_SORT) {
+		if(depth-- == 0) {
+			heap_sort_id(st,id,n);
+			return;
+		}
+		k = median_partition_id(st,id,n);
+		if(nth < k) {
+			n = k;
+		} else {
+			st += k;
+			id += k;
+			n -= k;
+			nth -= k;
+		}
 	}
-	pv.clear();
+	insertion_sort_id(st,id,n);
 }
 
 /**
@@ -212,6 +397,96 @@ inline float distance_l2(float * x, float * y, int n) {
 	cblas_saxpy(n,-1,x,1,y,1);
 	return cblas_snrm2(n,x,1);
 }
+
+/**
+ * The squared L2 norms of a set of vectors
+ * @param x the vectors (n rows of d elements, ldx elements apart)
+ * @param n the number of vectors
+ * @param d the dimensionality
+ * @param ldx the distance between two rows
+ * @param norms the output (n)
+ */
+inline void l2_sqr_norms(const float * x, int n, int d, int ldx, float * norms) {
+	for(int i = 0; i < n; i++)
+		norms[i] = cblas_sdot(d,x + static_cast<size_t>(i) * ldx,1,
+				x + static_cast<size_t>(i) * ldx,1);
+}
+
+/**
+ * The squared L2 distances between a block of vectors and a set of centers
+ * with one sgemm: dist = ||x||^2 + ||c||^2 - 2 * X * C^T
+ * @param x the vectors (n rows of d elements, ldx elements apart)
+ * @param n the number of vectors
+ * @param ldx the distance between two rows of x
+ * @param x_norms the squared norms of the vectors, nullptr if only the ranking is needed
+ * @param c the centers (k x d, row major)
+ * @param c_norms the squared norms of the centers
+ * @param k the number of centers
+ * @param d the dimensionality
+ * @param dist the output (n x k, row major)
+ */
+inline void l2_sqr_gemm(
+		const float * x, int n, int ldx, const float * x_norms,
+		const float * c, const float * c_norms, int k, int d,
+		float * dist) {
+	float * row = dist;
+	for(int i = 0; i < n; i++, row += k) {
+		float b = x_norms == nullptr ? 0.0f : x_norms[i];
+		for(int j = 0; j < k; j++)
+			row[j] = c_norms[j] + b;
+	}
+	cblas_sgemm(CblasRowMajor,CblasNoTrans,CblasTrans,
+			n,k,d,
+			-2.0f,x,ldx,
+			c,d,
+			1.0f,dist,k);
+}
+
+/**
+ * The position of the smallest element (the first one on ties)
+ * @param d the array
+ * @param k the size of the array
+ */
+inline int argmin_row(const float * d, int k) {
+	float m = FLT_MAX;
+	int i;
+	// The minimum is a vectorizable reduction, the position a second pass
+#ifdef _OPENMP
+#pragma omp simd reduction(min:m)
+#endif
+	for(i = 0; i < k; i++)
+		m = d[i] < m ? d[i] : m;
+	for(i = 0; i < k; i++)
+		if(d[i] == m) return i;
+	return 0;
+}
+
+/**
+ * The positions of the r smallest elements, sorted by value
+ * @param d the array
+ * @param k the size of the array
+ * @param r the number of positions (r <= k)
+ * @param id the output positions (r)
+ * @param dt a buffer of r values
+ */
+inline void nearest_row(const float * d, int k, int r, int * id, float * dt) {
+	if(r == 1) {
+		id[0] = argmin_row(d,k);
+		return;
+	}
+	int i, j, n = 0;
+	for(i = 0; i < k; i++) {
+		if(n == r && d[i] >= dt[r-1]) continue;
+		// Insert into the sorted list of the r best
+		j = n < r ? n++ : r - 1;
+		for(; j > 0 && dt[j-1] > d[i]; j--) {
+			dt[j] = dt[j-1];
+			id[j] = id[j-1];
+		}
+		dt[j] = d[i];
+		id[j] = i;
+	}
+}
 }
 
 
@@ -0,0 +1,306 @@
+/*
+ * sc_directory.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_DIRECTORY_H_
+#define SC_DIRECTORY_H_
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "sc_utilities.h"
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * The directory of the buckets of an inverted file.
+ * Most of the kc^mc (or kc^nc) cells of a multi-index are empty, so only
+ * one bit is kept per cell, with the offsets of the non-empty ones:
+ * bits: the non-empty cells (n_buckets bits, in 64-bit words)
+ * ranks: two words per block of 512 bits (rank9): the number of non-empty
+ * cells before the block, and the counts before each of its words 1 to 7
+ * (9 bits each)
+ * offsets: the first position of each non-empty bucket, then N
+ * A lookup is two reads in the rank block, one popcount and two reads
+ * in the offsets. The memory is about 1.25 bits per cell plus one offset
+ * per non-empty bucket, instead of one offset per cell.
+ * The directory owns its arrays or views a mapped index (see view).
+ */
+class BucketDirectory {
+public:
+	BucketDirectory() {
+		bits = ranks = nullptr;
+		offsets = nullptr;
+		own = nullptr;
+		n = ne = n_words = n_blocks = count = 0;
+	}
+	virtual ~BucketDirectory() {
+		release();
+	}
+
+	/**
+	 * The number of bytes of a directory
+	 * @param n_buckets the number of buckets
+	 * @param non_empty the number of non-empty buckets
+	 * @param index_size the size of an offset
+	 */
+	static inline size_t bytes(size_t n_buckets, size_t non_empty,
+			size_t index_size = sizeof(idx_t)) {
+		size_t w = words(n_buckets);
+		return (w + 2 * blocks(w) + 2) * sizeof(uint64_t)
+				+ (non_empty + 1) * index_size;
+	}
+
+	/**
+	 * Allocate an empty directory, to be filled with append then finish
+	 * @param n_buckets the number of buckets
+	 * @param non_empty the number of non-empty buckets
+	 */
+	inline void reset(size_t n_buckets, size_t non_empty) {
+		release();
+		layout(n_buckets,non_empty);
+		size_t b = bytes(n,ne);
+		SimpleCluster::init_array(own,(b + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+		memset(own,0,b);
+		place(reinterpret_cast<unsigned char *>(own));
+		count = 0;
+	}
+
+	/**
+	 * Add a non-empty bucket, in the increasing order of the buckets
+	 * @param b the bucket
+	 * @param start the first position of the bucket
+	 * @return false if there are more non-empty buckets than announced
+	 */
+	inline bool append(size_t b, idx_t start) {
+		if(count >= ne || b >= n) return false;
+		const_cast<uint64_t *>(bits)[b >> 6] |= static_cast<uint64_t>(1) << (b & 63);
+		const_cast<idx_t *>(offsets)[count++] = start;
+		return true;
+	}
+
+	/**
+	 * Compute the ranks once all the buckets have been added
+	 * @param end the end of the last bucket (the number of vectors)
+	 * @return false if the number of non-empty buckets is not the announced one
+	 */
+	inline bool finish(idx_t end) {
+		uint64_t * r = const_cast<uint64_t *>(ranks);
+		uint64_t c = 0, sub;
+		size_t k, j;
+		for(k = 0; k < n_blocks; k++) {
+			r[k << 1] = c;
+			sub = 0;
+			for(j = 0; j < 8 && (k << 3) + j < n_words; j++) {
+				if(j > 0)
+					sub |= (c - r[k << 1]) << (9 * (j - 1));
+				c += __builtin_popcountll(bits[(k << 3) + j]);
+			}
+			for(; j < 8; j++)
+				if(j > 0) sub |= (c - r[k << 1]) << (9 * (j - 1));
+			r[(k << 1) + 1] = sub;
+		}
+		r[n_blocks << 1] = c;
+		const_cast<idx_t *>(offsets)[ne] = end;
+		return c == ne && count == ne;
+	}
+
+	/**
+	 * Build the directory from the prefix sums of the bucket lengths
+	 * @param ends the end of each bucket
+	 * @param n_buckets the number of buckets
+	 */
+	inline void build(const idx_t * ends, size_t n_buckets) {
+		size_t b, m = 0;
+		idx_t start = 0;
+		for(b = 0; b < n_buckets; b++) {
+			if(ends[b] > start) m++;
+			start = ends[b];
+		}
+		reset(n_buckets,m);
+		start = 0;
+		for(b = 0; b < n_buckets; b++) {
+			if(ends[b] > start) append(b,start);
+			start = ends[b];
+		}
+		finish(start);
+	}
+
+	/**
+	 * Use a directory written by write, without copying it
+	 * @param data the directory, 8-byte aligned
+	 * @param n_buckets the number of buckets
+	 * @param non_empty the number of non-empty buckets
+	 */
+	inline void view(const unsigned char * data, size_t n_buckets, size_t non_empty) {
+		release();
+		layout(n_buckets,non_empty);
+		place(const_cast<unsigned char *>(data));
+		count = ne;
+	}
+
+	/**
+	 * Copy a directory written by write
+	 * @param data the directory
+	 * @param n_buckets the number of buckets
+	 * @param non_empty the number of non-empty buckets
+	 */
+	inline void read(const unsigned char * data, size_t n_buckets, size_t non_empty) {
+		reset(n_buckets,non_empty);
+		memcpy(own,data,bytes(n,ne));
+		count = ne;
+	}
+
+	/**
+	 * Write the directory (bytes(size(), non_empty()) bytes)
+	 */
+	inline void write(unsigned char * dst) const {
+		size_t w = (n_words + 2 * n_blocks + 2) * sizeof(uint64_t);
+		memcpy(dst,bits,n_words * sizeof(uint64_t));
+		memcpy(dst + n_words * sizeof(uint64_t),ranks,(2 * n_blocks + 2) * sizeof(uint64_t));
+		memcpy(dst + w,offsets,(ne + 1) * sizeof(idx_t));
+	}
+
+	/**
+	 * The number of non-empty buckets before a bucket
+	 * @param b the bucket
+	 */
+	inline size_t rank(size_t b) const {
+		size_t k = b >> 9, j = (b >> 6) & 7;
+		uint64_t r = ranks[k << 1];
+		if(j > 0)
+			r += (ranks[(k << 1) + 1] >> (9 * (j - 1))) & 0x1FF;
+		uint64_t m = (static_cast<uint64_t>(1) << (b & 63)) - 1;
+		return static_cast<size_t>(r + __builtin_popcountll(bits[b >> 6] & m));
+	}
+
+	/**
+	 * Look a bucket up
+	 * @param b the bucket
+	 * @param start the first position of the bucket
+	 * @return the length of the bucket
+	 */
+	inline idx_t bucket(size_t b, idx_t& start) const {
+		if(((bits[b >> 6] >> (b & 63)) & 1) == 0) {
+			start = 0;
+			return 0;
+		}
+		size_t r = rank(b);
+		start = offsets[r];
+		return offsets[r + 1] - start;
+	}
+
+	/**
+	 * The length of a bucket
+	 * @param b the bucket
+	 */
+	inline idx_t length(size_t b) const {
+		idx_t start;
+		return bucket(b,start);
+	}
+
+	/**
+	 * The bucket that holds a position
+	 * @param p the position, less than the number of vectors
+	 */
+	inline size_t find(idx_t p) const {
+		size_t r = upper_bound(offsets,offsets + ne + 1,p) - offsets - 1;
+		// The block of the r-th non-empty bucket, then its word
+		size_t lo = 0, hi = n_blocks, mid;
+		while(hi - lo > 1) {
+			mid = (lo + hi) >> 1;
+			if(ranks[mid << 1] <= r) lo = mid;
+			else hi = mid;
+		}
+		size_t j = 0, t = r - ranks[lo << 1];
+		while(j < 7 && (lo << 3) + j + 1 < n_words
+				&& ((ranks[(lo << 1) + 1] >> (9 * j)) & 0x1FF) <= t)
+			j++;
+		if(j > 0)
+			t -= (ranks[(lo << 1) + 1] >> (9 * (j - 1))) & 0x1FF;
+		uint64_t w = bits[(lo << 3) + j];
+		for(; t > 0; t--)
+			w &= w - 1;
+		return (((lo << 3) + j) << 6) + __builtin_ctzll(w);
+	}
+
+	/**
+	 * The number of buckets
+	 */
+	inline size_t size() const {
+		return n;
+	}
+
+	/**
+	 * The number of non-empty buckets
+	 */
+	inline size_t non_empty() const {
+		return ne;
+	}
+
+	/**
+	 * The number of vectors
+	 */
+	inline idx_t end() const {
+		return offsets == nullptr ? 0 : offsets[ne];
+	}
+
+	/**
+	 * The memory of the directory in bytes
+	 */
+	inline size_t memory() const {
+		return bytes(n,ne);
+	}
+
+	inline bool loaded() const {
+		return bits != nullptr;
+	}
+
+private:
+	const uint64_t * bits; // the non-empty buckets
+	const uint64_t * ranks; // rank9 counts, 2 * n_blocks + 2 words
+	const idx_t * offsets; // the first position of each non-empty bucket, then N
+	uint64_t * own; // the arrays, if they are not a view
+	size_t n, ne, n_words, n_blocks, count;
+
+	BucketDirectory(const BucketDirectory&);
+	BucketDirectory& operator=(const BucketDirectory&);
+
+	static inline size_t words(size_t n_buckets) {
+		return (n_buckets + 63) >> 6;
+	}
+
+	static inline size_t blocks(size_t n_words) {
+		return (n_words + 7) >> 3;
+	}
+
+	inline void layout(size_t n_buckets, size_t non_empty) {
+		n = n_buckets;
+		ne = non_empty;
+		n_words = words(n);
+		n_blocks = blocks(n_words);
+	}
+
+	inline void place(unsigned char * data) {
+		bits = reinterpret_cast<const uint64_t *>(data);
+		ranks = bits + n_words;
+		offsets = reinterpret_cast<const idx_t *>(ranks + 2 * n_blocks + 2);
+	}
+
+	inline void release() {
+		::delete own;
+		own = nullptr;
+		bits = ranks = nullptr;
+		offsets = nullptr;
+		n = ne = n_words = n_blocks = count = 0;
+	}
+};
+
+} /* namespace SC */
+
+#endif /* SC_DIRECTORY_H_ */
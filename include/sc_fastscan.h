@@ -0,0 +1,282 @@
+/*
+ * sc_fastscan.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_FASTSCAN_H_
+#define SC_FASTSCAN_H_
+
+#include <iostream>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cfloat>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SC_FS_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * 4-bit PQ codes (kp = 16) in a block-interleaved layout.
+ * A block holds 32 vectors. For each pair of sub-quantizers (2q, 2q+1)
+ * a block stores 32 bytes, the byte i being
+ * code[i][2q] | (code[i][2q+1] << 4).
+ * A block is then FS_BLOCK * ceil(mp/2) bytes long.
+ */
+#define FS_BLOCK 32
+
+/**
+ * The size of a block in bytes
+ * @param mp the number of sub-quantizers
+ */
+inline size_t fs_block_size(int mp) {
+	return static_cast<size_t>(FS_BLOCK) * ((mp + 1) >> 1);
+}
+
+/**
+ * The number of blocks needed by n vectors
+ * @param n the number of vectors
+ */
+inline size_t fs_blocks(size_t n) {
+	return (n + FS_BLOCK - 1) / FS_BLOCK;
+}
+
+/**
+ * Pack n codes of 8 bits (each value less than 16) into blocks
+ * @param codes the codes (n x mp, row major)
+ * @param n the number of vectors
+ * @param mp the number of sub-quantizers
+ * @param packed the output, fs_blocks(n) * fs_block_size(mp) bytes
+ */
+inline void fs_pack(
+		const unsigned char * codes, size_t n, int mp,
+		unsigned char * packed) {
+	size_t nb = fs_blocks(n), bs = fs_block_size(mp), i;
+	int q, np = (mp + 1) >> 1;
+	unsigned char lo, hi;
+	memset(packed,0,nb * bs);
+	for(i = 0; i < n; i++) {
+		unsigned char * b = packed + (i / FS_BLOCK) * bs + (i % FS_BLOCK);
+		const unsigned char * c = codes + i * mp;
+		for(q = 0; q < np; q++) {
+			lo = c[q << 1] & 0x0f;
+			hi = ((q << 1) + 1 < mp) ? (c[(q << 1) + 1] & 0x0f) : 0;
+			b[q * FS_BLOCK] = lo | (hi << 4);
+		}
+	}
+}
+
+/**
+ * Read the sub-code m of the vector i from packed blocks
+ * @param packed the packed blocks
+ * @param i the position of the vector
+ * @param m the sub-quantizer
+ * @param mp the number of sub-quantizers
+ */
+inline int fs_code(const unsigned char * packed, size_t i, int m, int mp) {
+	unsigned char b = packed[(i / FS_BLOCK) * fs_block_size(mp)
+	                         + (m >> 1) * FS_BLOCK + (i % FS_BLOCK)];
+	return (m & 1) ? (b >> 4) : (b & 0x0f);
+}
+
+/**
+ * Quantize a float lookup table (mp x 16) to 8 bits.
+ * All sub-tables share one scale, so that the sums stay comparable:
+ * t[m][x] ~ offset_m + delta * lut[m][x].
+ * @param table the float table
+ * @param mp the number of sub-quantizers
+ * @param lut the quantized table, 2 * ceil(mp/2) x 16 bytes
+ * @param delta the scale
+ * @return the sum of the offsets of all sub-tables
+ */
+inline float fs_quantize_lut(
+		const float * table, int mp,
+		unsigned char * lut, float& delta) {
+	int m, x, np = (mp + 1) >> 1;
+	float mn, mx, offset = 0.0f, v;
+	delta = 0.0f;
+	for(m = 0; m < mp; m++) {
+		mn = FLT_MAX;
+		mx = -FLT_MAX;
+		for(x = 0; x < 16; x++) {
+			v = table[m * 16 + x];
+			if(v < mn) mn = v;
+			if(v > mx) mx = v;
+		}
+		if(mx - mn > delta) delta = mx - mn;
+	}
+	delta = delta > 0.0f ? delta / 255.0f : 1.0f;
+	for(m = 0; m < mp; m++) {
+		mn = FLT_MAX;
+		for(x = 0; x < 16; x++)
+			if(table[m * 16 + x] < mn) mn = table[m * 16 + x];
+		offset += mn;
+		for(x = 0; x < 16; x++) {
+			v = (table[m * 16 + x] - mn) / delta + 0.5f;
+			lut[m * 16 + x] = static_cast<unsigned char>(v > 255.0f ? 255.0f : v);
+		}
+	}
+	if(mp < (np << 1))
+		memset(lut + mp * 16,0,16);
+	return offset;
+}
+
+/**
+ * The signature of a fast-scan kernel
+ * @param packed the packed blocks
+ * @param nb the number of blocks
+ * @param mp the number of sub-quantizers
+ * @param lut the quantized table
+ * @param dist the quantized distances, nb * 32 elements
+ */
+typedef void (*fs_scan_t)(
+		const unsigned char *, size_t, int,
+		const unsigned char *, uint16_t *);
+
+/**
+ * Scalar fast-scan
+ */
+inline void fs_scan_scalar(
+		const unsigned char * packed, size_t nb, int mp,
+		const unsigned char * lut, uint16_t * dist) {
+	size_t b;
+	int i, q, np = (mp + 1) >> 1;
+	const unsigned char * p, * t;
+	for(b = 0; b < nb; b++) {
+		for(i = 0; i < FS_BLOCK; i++)
+			dist[i] = 0;
+		p = packed;
+		t = lut;
+		for(q = 0; q < np; q++) {
+			for(i = 0; i < FS_BLOCK; i++) {
+				dist[i] += t[p[i] & 0x0f];
+				dist[i] += t[16 + (p[i] >> 4)];
+			}
+			p += FS_BLOCK;
+			t += 32;
+		}
+		packed = p;
+		dist += FS_BLOCK;
+	}
+}
+
+#ifdef SC_FS_X86
+/**
+ * SSSE3 fast-scan: two halves of 16 vectors with pshufb
+ */
+__attribute__((target("ssse3")))
+inline void fs_scan_ssse3(
+		const unsigned char * packed, size_t nb, int mp,
+		const unsigned char * lut, uint16_t * dist) {
+	size_t b;
+	int h, q, np = (mp + 1) >> 1;
+	const __m128i m4 = _mm_set1_epi8(0x0f);
+	const __m128i m8 = _mm_set1_epi16(0x00ff);
+	__m128i v, r0, r1, acc_e, acc_o;
+	for(b = 0; b < nb; b++) {
+		for(h = 0; h < 2; h++) {
+			acc_e = acc_o = _mm_setzero_si128();
+			for(q = 0; q < np; q++) {
+				v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+						packed + q * FS_BLOCK + (h << 4)));
+				r0 = _mm_shuffle_epi8(_mm_loadu_si128(
+						reinterpret_cast<const __m128i *>(lut + (q << 5))),
+						_mm_and_si128(v,m4));
+				r1 = _mm_shuffle_epi8(_mm_loadu_si128(
+						reinterpret_cast<const __m128i *>(lut + (q << 5) + 16)),
+						_mm_and_si128(_mm_srli_epi16(v,4),m4));
+				acc_e = _mm_add_epi16(acc_e,_mm_and_si128(r0,m8));
+				acc_o = _mm_add_epi16(acc_o,_mm_srli_epi16(r0,8));
+				acc_e = _mm_add_epi16(acc_e,_mm_and_si128(r1,m8));
+				acc_o = _mm_add_epi16(acc_o,_mm_srli_epi16(r1,8));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dist + (h << 4)),
+					_mm_unpacklo_epi16(acc_e,acc_o));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dist + (h << 4) + 8),
+					_mm_unpackhi_epi16(acc_e,acc_o));
+		}
+		packed += np * FS_BLOCK;
+		dist += FS_BLOCK;
+	}
+}
+
+/**
+ * AVX2 fast-scan: one block of 32 vectors per iteration with vpshufb
+ */
+__attribute__((target("avx2")))
+inline void fs_scan_avx2(
+		const unsigned char * packed, size_t nb, int mp,
+		const unsigned char * lut, uint16_t * dist) {
+	size_t b;
+	int q, np = (mp + 1) >> 1;
+	const __m256i m4 = _mm256_set1_epi8(0x0f);
+	const __m256i m8 = _mm256_set1_epi16(0x00ff);
+	__m256i v, r0, r1, acc_e, acc_o, lo, hi;
+	for(b = 0; b < nb; b++) {
+		acc_e = acc_o = _mm256_setzero_si256();
+		for(q = 0; q < np; q++) {
+			v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+					packed + q * FS_BLOCK));
+			r0 = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(
+					reinterpret_cast<const __m128i *>(lut + (q << 5)))),
+					_mm256_and_si256(v,m4));
+			r1 = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(
+					reinterpret_cast<const __m128i *>(lut + (q << 5) + 16))),
+					_mm256_and_si256(_mm256_srli_epi16(v,4),m4));
+			acc_e = _mm256_add_epi16(acc_e,_mm256_and_si256(r0,m8));
+			acc_o = _mm256_add_epi16(acc_o,_mm256_srli_epi16(r0,8));
+			acc_e = _mm256_add_epi16(acc_e,_mm256_and_si256(r1,m8));
+			acc_o = _mm256_add_epi16(acc_o,_mm256_srli_epi16(r1,8));
+		}
+		// Restore the order of the vectors: 0-7 | 16-23 and 8-15 | 24-31
+		lo = _mm256_unpacklo_epi16(acc_e,acc_o);
+		hi = _mm256_unpackhi_epi16(acc_e,acc_o);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dist),
+				_mm256_permute2x128_si256(lo,hi,0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dist + 16),
+				_mm256_permute2x128_si256(lo,hi,0x31));
+		packed += np * FS_BLOCK;
+		dist += FS_BLOCK;
+	}
+}
+#endif
+
+/**
+ * Select the best fast-scan kernel supported by the CPU
+ */
+inline fs_scan_t fs_select() {
+#ifdef SC_FS_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return fs_scan_avx2;
+	if(__builtin_cpu_supports("ssse3"))
+		return fs_scan_ssse3;
+#endif
+	return fs_scan_scalar;
+}
+
+/**
+ * Compute the quantized distances of nb blocks.
+ * The kernel is selected once, on the first call.
+ * @param packed the packed blocks
+ * @param nb the number of blocks
+ * @param mp the number of sub-quantizers
+ * @param lut the quantized table
+ * @param dist the quantized distances, nb * 32 elements
+ */
+inline void fs_scan(
+		const unsigned char * packed, size_t nb, int mp,
+		const unsigned char * lut, uint16_t * dist) {
+	static const fs_scan_t kernel = fs_select();
+	kernel(packed,nb,mp,lut,dist);
+}
+
+} /* namespace SC */
+
+#endif /* SC_FASTSCAN_H_ */
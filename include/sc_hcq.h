@@ -0,0 +1,519 @@
+/*
+ * sc_hcq.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_HCQ_H_
+#define SC_HCQ_H_
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cfloat>
+#include <cmath>
+#include <k-means.h>
+#include "sc_utilities.h"
+#include "sc_algorithm.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace SC {
+
+// The number of top-level cells visited by an assignment (see HierarchicalCQ::set_probe)
+#ifndef SC_HCQ_PROBE
+#define SC_HCQ_PROBE 8
+#endif
+// The number of candidate cells of a point in a balanced assignment
+#ifndef SC_HCQ_BALANCE_NN
+#define SC_HCQ_BALANCE_NN 8
+#endif
+// The number of rounds of the balanced k-means
+#ifndef SC_HCQ_BALANCE_ITERS
+#define SC_HCQ_BALANCE_ITERS 4
+#endif
+
+/**
+ * A two-level coarse quantizer for a large kc (IVFADC, mc = 1).
+ * kc1 top-level centers split the space, then kc2 centers are trained on
+ * the points of each top-level cell (nested k-means). The center a * kc2 + b
+ * is the b-th center of the cell a, so the kc = kc1 x kc2 centers are an
+ * ordinary coarse codebook (cq) and the inverted file does not change.
+ * A vector is assigned by ranking the kc1 top-level centers, then the kc2
+ * centers of the probe nearest cells only: kc1 + probe x kc2 distances
+ * instead of kc, O(sqrt(kc)) for kc1 = kc2.
+ * The centers are written as two codebooks: the kc centers (filename.ctr_,
+ * read as cq by the encoders and the indexes) and the kc1 top-level
+ * ones (filename.top_). The kc centers are owned after train, or a view
+ * of the coarse codebook of an encoder or an index (see load).
+ */
+class HierarchicalCQ {
+public:
+	HierarchicalCQ() {
+		top = top_norms = fine_norms = own = nullptr;
+		fine = nullptr;
+		kc1 = kc2 = dim = 0;
+		probe = SC_HCQ_PROBE;
+	}
+	virtual ~HierarchicalCQ() {
+		release();
+	}
+
+	inline void train(float *, int, int, int, int, float, bool);
+	inline void output(const char *, bool) const;
+	inline bool load(const char *, const float *, int, int, bool);
+	inline void assign(const float *, size_t, int, int, int *, float *) const;
+	inline int rank(const float *, int, float *, int *, float *) const;
+
+	/**
+	 * Set the number of top-level cells visited by an assignment.
+	 * A ranking of w centers visits at least ceil(w / kc2) cells.
+	 */
+	inline void set_probe(int p) {
+		probe = p > 0 ? p : 1;
+	}
+
+	inline bool loaded() const {
+		return top != nullptr;
+	}
+
+	/**
+	 * The number of top-level centers (kc1)
+	 */
+	inline int top_size() const {
+		return kc1;
+	}
+
+	/**
+	 * The number of centers of a top-level cell (kc2)
+	 */
+	inline int cell_size() const {
+		return kc2;
+	}
+
+	/**
+	 * The number of centers (kc = kc1 x kc2)
+	 */
+	inline int size() const {
+		return kc1 * kc2;
+	}
+
+	/**
+	 * The centers, cell by cell (kc x dim)
+	 */
+	inline const float * centers() const {
+		return fine;
+	}
+
+	/**
+	 * The top-level centers (kc1 x dim)
+	 */
+	inline const float * top_centers() const {
+		return top;
+	}
+
+private:
+	float * top; // the top-level centers; size: kc1 * dim
+	float * top_norms; // their squared norms
+	const float * fine; // the centers of the cells; size: kc1 * kc2 * dim
+	float * fine_norms; // their squared norms
+	float * own; // the centers of the cells, if they are not a view
+	int kc1, kc2, dim, probe;
+
+	HierarchicalCQ(const HierarchicalCQ&);
+	HierarchicalCQ& operator=(const HierarchicalCQ&);
+
+	inline void release() {
+		::delete top;
+		::delete top_norms;
+		::delete fine_norms;
+		::delete own;
+		top = top_norms = fine_norms = own = nullptr;
+		fine = nullptr;
+		kc1 = kc2 = dim = 0;
+	}
+
+	inline void compute_norms() {
+		SimpleCluster::init_array(top_norms,kc1);
+		SimpleCluster::init_array(fine_norms,static_cast<size_t>(kc1) * kc2);
+		l2_sqr_norms(top,kc1,dim,dim,top_norms);
+		l2_sqr_norms(fine,kc1 * kc2,dim,dim,fine_norms);
+	}
+
+	static inline float dot(const float * x, const float * y, int d) {
+		float s = 0.0f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:s)
+#endif
+		for(int i = 0; i < d; i++)
+			s += x[i] * y[i];
+		return s;
+	}
+
+	static inline void balanced_kmeans(float *, int, int, float *, int, int *, float, int);
+	static inline void write_codebook(const char *, const float *, int, int);
+};
+
+/**
+ * Make the clusters of a k-means even: each cluster takes at most
+ * ceil(balance * N / k) points. The points pick their nearest cluster that
+ * is not full among their SC_HCQ_BALANCE_NN nearest centers, the points
+ * that lose most by moving first. The centers are then the means of their
+ * points, over SC_HCQ_BALANCE_ITERS rounds.
+ * @param data the points (N x d)
+ * @param N the number of points
+ * @param d the dimensionality
+ * @param centers the centers (k x d), updated
+ * @param k the number of centers
+ * @param label the cluster of each point (N), updated
+ * @param balance the capacity factor, at least 1
+ * @param n_thread the number of threads
+ */
+inline void HierarchicalCQ::balanced_kmeans(
+		float * data, int N, int d,
+		float * centers, int k, int * label,
+		float balance, int n_thread) {
+	if(k <= 1 || N <= k) return;
+	int nn = min(k,SC_HCQ_BALANCE_NN);
+	size_t cap = static_cast<size_t>(ceil(balance * N / k));
+	size_t tile = min<size_t>(4096,max<size_t>(64,(1 << 24) / k));
+	vector<int> cand(static_cast<size_t>(N) * nn), order(N), count(k);
+	vector<float> cd(static_cast<size_t>(N) * nn), gap(N), norms(k),
+			dist(tile * k), sum(static_cast<size_t>(k) * d);
+	int it, i, j, c;
+	long long r;
+	for(it = 0; it < SC_HCQ_BALANCE_ITERS; it++) {
+		// The nn nearest centers of each point
+		l2_sqr_norms(centers,k,d,d,&norms[0]);
+		for(size_t t0 = 0; t0 < static_cast<size_t>(N); t0 += tile) {
+			size_t m = min(tile,static_cast<size_t>(N) - t0);
+			l2_sqr_gemm(data + t0 * d,m,d,nullptr,centers,&norms[0],k,d,&dist[0]);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_thread)
+#endif
+			for(r = 0; r < static_cast<long long>(m); r++) {
+				size_t p = t0 + r;
+				nearest_row(&dist[r * k],k,nn,&cand[p * nn],&cd[p * nn]);
+				if(nn == 1) cd[p] = dist[r * k + cand[p]];
+				// The points that lose most by moving go first
+				gap[p] = nn > 1 ? cd[p * nn] - cd[p * nn + 1] : 0.0f;
+				order[p] = static_cast<int>(p);
+			}
+		}
+		sort_id(&gap[0],&gap[0] + N,&order[0]);
+
+		// Fill the clusters up to their capacity
+		fill(count.begin(),count.end(),0);
+		for(i = 0; i < N; i++) {
+			size_t p = order[i];
+			const float * x = data + p * d;
+			c = -1;
+			for(j = 0; j < nn && c < 0; j++)
+				if(count[cand[p * nn + j]] < static_cast<int>(cap))
+					c = cand[p * nn + j];
+			if(c < 0) {
+				// All the nearest clusters are full: the nearest one that is not
+				float m = FLT_MAX, v;
+				for(j = 0; j < k; j++) {
+					if(count[j] >= static_cast<int>(cap)) continue;
+					v = norms[j] - 2.0f * dot(x,centers + static_cast<size_t>(j) * d,d);
+					if(v < m) {
+						m = v;
+						c = j;
+					}
+				}
+			}
+			label[p] = c;
+			count[c]++;
+		}
+
+		// The centers are the means of their points
+		fill(sum.begin(),sum.end(),0.0f);
+		for(size_t p = 0; p < static_cast<size_t>(N); p++) {
+			float * s = &sum[static_cast<size_t>(label[p]) * d];
+			const float * x = data + p * d;
+			for(j = 0; j < d; j++)
+				s[j] += x[j];
+		}
+		for(c = 0; c < k; c++) {
+			if(count[c] == 0) continue;
+			for(j = 0; j < d; j++)
+				centers[static_cast<size_t>(c) * d + j] =
+						sum[static_cast<size_t>(c) * d + j] / count[c];
+		}
+	}
+}
+
+/**
+ * Train the quantizer with nested k-means: kc1 centers over all the points,
+ * then kc2 centers over the points of each top-level cell. A cell with
+ * fewer than kc2 points keeps its points as centers, the remaining ones
+ * are copies of its top-level center (they stay empty).
+ * @param data the training vectors (N x d)
+ * @param N the number of vectors, at least kc1 * kc2
+ * @param d the dimensionality
+ * @param _kc1 the number of top-level centers
+ * @param _kc2 the number of centers of a top-level cell
+ * @param balance 0 for plain k-means, otherwise each cluster of both levels
+ * is capped at balance times the mean size (balance >= 1)
+ * @param verbose enable verbose mode
+ */
+inline void HierarchicalCQ::train(
+		float * data, int N, int d,
+		int _kc1, int _kc2,
+		float balance, bool verbose) {
+	if(_kc1 <= 0 || _kc2 <= 0 || d <= 0
+			|| static_cast<long long>(_kc1) * _kc2 > INT_MAX) {
+		cerr << "Error at parameters of HierarchicalCQ" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(static_cast<long long>(N) < static_cast<long long>(_kc1) * _kc2) {
+		cerr << "Cannot train " << _kc1 << "x" << _kc2
+				<< " centers on " << N << " vectors" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(balance > 0.0f && balance < 1.0f) balance = 1.0f;
+	release();
+	kc1 = _kc1;
+	kc2 = _kc2;
+	dim = d;
+	int n_thread = 1;
+#ifdef _OPENMP
+	n_thread = omp_get_max_threads();
+#endif
+	SimpleCluster::KmeansCriteria criteria = {2.0,1.0,1000,0.0f};
+	int * label, * cell_label;
+	float * seeds = nullptr, * buffer;
+	SimpleCluster::init_array(top,static_cast<size_t>(kc1) * dim);
+	SimpleCluster::init_array(own,static_cast<size_t>(kc1) * kc2 * dim);
+	SimpleCluster::init_array(label,N);
+
+	// The top level
+	SimpleCluster::greg_kmeans<float>(data,top,label,seeds,
+			SimpleCluster::KmeansType::KMEANS_PLUS_SEEDS,criteria,
+			SimpleCluster::DistanceType::NORM_L2,SimpleCluster::EmptyActs::SINGLETON,
+			N,kc1,dim,n_thread,verbose);
+	::delete seeds;
+	seeds = nullptr;
+	if(balance > 0.0f)
+		balanced_kmeans(data,N,dim,top,kc1,label,balance,n_thread);
+
+	// The points of each cell (counting sort)
+	vector<size_t> start(kc1 + 1,0);
+	vector<int> order(N);
+	int i, a;
+	for(i = 0; i < N; i++)
+		start[label[i] + 1]++;
+	for(a = 0; a < kc1; a++)
+		start[a + 1] += start[a];
+	vector<size_t> next(start.begin(),start.end() - 1);
+	for(i = 0; i < N; i++)
+		order[next[label[i]]++] = i;
+	size_t n_max = 0, n, p;
+	for(a = 0; a < kc1; a++)
+		n_max = max(n_max,start[a + 1] - start[a]);
+	SimpleCluster::init_array(buffer,max<size_t>(n_max,1) * dim);
+	SimpleCluster::init_array(cell_label,max<size_t>(n_max,1));
+
+	// The second level, cell by cell
+	for(a = 0; a < kc1; a++) {
+		n = start[a + 1] - start[a];
+		float * cell = own + static_cast<size_t>(a) * kc2 * dim;
+		for(p = 0; p < n; p++)
+			memcpy(buffer + p * dim,data + static_cast<size_t>(order[start[a] + p]) * dim,
+					dim * sizeof(float));
+		if(n <= static_cast<size_t>(kc2)) {
+			memcpy(cell,buffer,n * dim * sizeof(float));
+			for(p = n; p < static_cast<size_t>(kc2); p++)
+				memcpy(cell + p * dim,top + static_cast<size_t>(a) * dim,dim * sizeof(float));
+		} else {
+			SimpleCluster::greg_kmeans<float>(buffer,cell,cell_label,seeds,
+					SimpleCluster::KmeansType::KMEANS_PLUS_SEEDS,criteria,
+					SimpleCluster::DistanceType::NORM_L2,SimpleCluster::EmptyActs::SINGLETON,
+					static_cast<int>(n),kc2,dim,n_thread,false);
+			if(balance > 0.0f)
+				balanced_kmeans(buffer,static_cast<int>(n),dim,cell,kc2,
+						cell_label,balance,n_thread);
+		}
+		if(verbose)
+			cout << "Trained the cell " << a << "/" << kc1
+			<< " (" << n << " vectors)" << endl;
+	}
+	::delete seeds;
+	::delete buffer;
+	::delete cell_label;
+	::delete label;
+	fine = own;
+	compute_norms();
+}
+
+/**
+ * Write a codebook file: [k][1][dim] then the centers, as floats
+ */
+inline void HierarchicalCQ::write_codebook(
+		const char * filename, const float * c, int k, int d) {
+	ofstream output(filename,ios::out | ios::binary);
+	if(!output) {
+		cerr << "Cannot open the file " << filename << endl;
+		exit(EXIT_FAILURE);
+	}
+	float h[3] = {static_cast<float>(k),1.0f,static_cast<float>(d)};
+	output.write(reinterpret_cast<const char *>(h),sizeof(h));
+	output.write(reinterpret_cast<const char *>(c),
+			static_cast<streamsize>(k) * d * sizeof(float));
+	if(!output) {
+		cerr << "Cannot write to file " << filename << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Write the centers to filename.ctr_ (kc centers) and the top-level
+ * centers to filename.top_
+ * @param filename the prefix of the files
+ * @param verbose enable verbose mode
+ */
+inline void HierarchicalCQ::output(const char * filename, bool verbose) const {
+	char fn[256];
+	sprintf(fn,"%s.ctr_",filename);
+	write_codebook(fn,fine,kc1 * kc2,dim);
+	sprintf(fn,"%s.top_",filename);
+	write_codebook(fn,top,kc1,dim);
+	if(verbose)
+		cout << "Wrote " << kc1 << "x" << kc2 << " centers to " << filename << endl;
+}
+
+/**
+ * Load the top-level centers and use a loaded coarse codebook as the
+ * centers of the cells, without copying it
+ * @param filename the top-level codebook (see output)
+ * @param cq the coarse codebook (kc x d), kept by the caller
+ * @param kc the number of coarse centers, a multiple of kc1
+ * @param d the dimensionality
+ * @param verbose enable verbose mode
+ * @return false if the codebooks do not match
+ */
+inline bool HierarchicalCQ::load(
+		const char * filename, const float * cq,
+		int kc, int d, bool verbose) {
+	release();
+	PQConfig c;
+	load_codebook<float>(filename,c,top,0,verbose);
+	if(c.mc != 1 || c.dim != d || c.kc <= 0 || kc % c.kc != 0) {
+		cerr << "The top-level codebook " << filename
+				<< " does not match the coarse codebook" << endl;
+		release();
+		return false;
+	}
+	kc1 = c.kc;
+	kc2 = kc / kc1;
+	dim = d;
+	fine = cq;
+	compute_norms();
+	return true;
+}
+
+/**
+ * Find the nn nearest centers of a block of vectors: one sgemm against
+ * the top-level centers, then the centers of the probe nearest cells
+ * @param x the vectors (m rows of dim elements, ldx elements apart)
+ * @param m the number of vectors
+ * @param ldx the distance between two rows of x
+ * @param nn the number of nearest centers (nn <= probe x kc2)
+ * @param ids the output center ids (m x nn), the nearest first
+ * @param work a buffer of m x kc1 floats
+ */
+inline void HierarchicalCQ::assign(
+		const float * x, size_t m, int ldx, int nn,
+		int * ids, float * work) const {
+	int np = min(probe,kc1);
+	l2_sqr_gemm(x,m,ldx,nullptr,top,top_norms,kc1,dim,work);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		// The nearest cells and the nn best centers of a vector
+		vector<int> cells(np);
+		vector<float> cd(np), best(nn);
+		long long r;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for(r = 0; r < static_cast<long long>(m); r++) {
+			const float * v = x + r * ldx;
+			int * id = ids + r * nn;
+			float s;
+			int i, b, j, n = 0, f;
+			nearest_row(work + r * kc1,kc1,np,&cells[0],&cd[0]);
+			for(i = 0; i < np; i++) {
+				f = cells[i] * kc2;
+				for(b = 0; b < kc2; b++, f++) {
+					s = fine_norms[f] - 2.0f * dot(v,fine + static_cast<size_t>(f) * dim,dim);
+					if(n == nn && s >= best[nn - 1]) continue;
+					// Insert into the sorted list of the nn best
+					j = n < nn ? n++ : nn - 1;
+					for(; j > 0 && best[j - 1] > s; j--) {
+						best[j] = best[j - 1];
+						id[j] = id[j - 1];
+					}
+					best[j] = s;
+					id[j] = f;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Rank the centers that are the nearest to a query. Only the centers of
+ * the max(probe, ceil(w / kc2)) nearest cells are compared to the query.
+ * @param query the query vector
+ * @param w the number of centers to be ranked
+ * @param q_qc the query-to-coarse table (kc), ||c||^2 - 2 <q, c> is written
+ * for the centers of the visited cells only
+ * @param buckets the output center ids (at least kc1 and probe x kc2), the nearest first
+ * @param v_tmp the output ||c||^2 - 2 <q, c> of the ranked centers (same size)
+ * @return the number of ranked centers, min(w, the number of visited centers)
+ */
+inline int HierarchicalCQ::rank(
+		const float * query, int w,
+		float * q_qc, int * buckets, float * v_tmp) const {
+	int np = min(kc1,max(probe,(w + kc2 - 1) / kc2));
+	int a, b, i, f, n;
+	for(a = 0; a < kc1; a++) {
+		v_tmp[a] = top_norms[a] - 2.0f * dot(query,top + static_cast<size_t>(a) * dim,dim);
+		buckets[a] = a;
+	}
+	if(np < kc1)
+		nth_element_id(v_tmp,v_tmp + kc1,buckets,np - 1);
+
+	// The centers of the i-th nearest cell go to i * kc2: from the last cell
+	// to the first, each cell is read before its slot is overwritten
+	for(i = np - 1; i >= 0; i--) {
+		f = buckets[i] * kc2;
+		n = i * kc2;
+		for(b = 0; b < kc2; b++, f++, n++) {
+			q_qc[f] = fine_norms[f] - 2.0f * dot(query,fine + static_cast<size_t>(f) * dim,dim);
+			v_tmp[n] = q_qc[f];
+			buckets[n] = f;
+		}
+	}
+	n = np * kc2;
+	if(w > n) w = n;
+	if(w < n)
+		nth_element_id(v_tmp,v_tmp + n,buckets,w - 1);
+	sort_id(v_tmp,v_tmp + w,buckets);
+	return w;
+}
+
+} /* namespace SC */
+
+#endif /* SC_HCQ_H_ */
@@ -0,0 +1,179 @@
+/*
+ * sc_heap.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_HEAP_H_
+#define SC_HEAP_H_
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * An entry of a priority queue: a key and the identifier it belongs to
+ */
+struct HeapEntry {
+	float key;
+	int id;
+};
+
+/**
+ * A 4-ary min-heap of packed cells, ordered by their member key.
+ * The four children of a cell are contiguous and the storage is shifted so
+ * that they share one cache line (16-byte cells) or one half line (8-byte
+ * cells): a sift step reads one line instead of one per level of a binary
+ * heap, and the tree is half as deep.
+ * The cells are moved into a hole rather than swapped, so each sift writes
+ * every cell once. Nothing is allocated: the storage belongs to the caller.
+ */
+template<typename Cell>
+class MinHeap4 {
+public:
+	MinHeap4() {
+		heap = nullptr;
+		capacity = n = 0;
+	}
+
+	/**
+	 * @param storage at least bytes(capacity) bytes
+	 * @param capacity the maximum number of cells
+	 */
+	MinHeap4(unsigned char * storage, size_t capacity) {
+		attach(storage,capacity);
+	}
+
+	/**
+	 * The number of bytes of the storage of a heap
+	 * @param capacity the maximum number of cells
+	 */
+	static inline size_t bytes(size_t capacity) {
+		return (capacity + 3) * sizeof(Cell) + 64;
+	}
+
+	/**
+	 * Use a new storage, the heap is emptied
+	 * @param storage at least bytes(capacity) bytes
+	 * @param capacity the maximum number of cells
+	 */
+	inline void attach(unsigned char * storage, size_t capacity) {
+		uintptr_t a = reinterpret_cast<uintptr_t>(storage);
+		storage += (64 - a % 64) % 64;
+		// The children of i are 4i+1..4i+4: with 3 unused cells ahead of
+		// the root they start on a multiple of 4 cells
+		heap = reinterpret_cast<Cell *>(storage) + 3;
+		this->capacity = capacity;
+		n = 0;
+	}
+
+	/**
+	 * Move the cells to a new storage, to grow the heap
+	 * @param storage at least bytes(capacity) bytes
+	 * @param capacity the maximum number of cells, at least size()
+	 */
+	inline void move_to(unsigned char * storage, size_t capacity) {
+		Cell * old = heap;
+		size_t m = n;
+		attach(storage,capacity);
+		for(n = 0; n < m; n++)
+			heap[n] = old[n];
+	}
+
+	inline size_t size() const {
+		return n;
+	}
+
+	inline bool empty() const {
+		return n == 0;
+	}
+
+	inline void clear() {
+		n = 0;
+	}
+
+	/**
+	 * The cell of the smallest key
+	 */
+	inline const Cell& top() const {
+		return heap[0];
+	}
+
+	/**
+	 * Insert a cell
+	 * @return false if the heap is full, the cell is dropped
+	 */
+	inline bool push(const Cell& c) {
+		if(n >= capacity) return false;
+		size_t i = n++, p;
+		while(i > 0) {
+			p = (i - 1) >> 2;
+			if(heap[p].key <= c.key) break;
+			heap[i] = heap[p];
+			i = p;
+		}
+		heap[i] = c;
+		return true;
+	}
+
+	/**
+	 * Remove the cell of the smallest key
+	 * @param c the removed cell
+	 * @return false if the heap is empty
+	 */
+	inline bool pop(Cell& c) {
+		if(n == 0) return false;
+		c = heap[0];
+		if(--n > 0) sift_down(heap[n]);
+		return true;
+	}
+
+private:
+	Cell * heap;
+	size_t capacity, n;
+
+	/**
+	 * Put a cell at the root, in place of the popped one,
+	 * and restore the heap of the n first cells
+	 */
+	inline void sift_down(const Cell c) {
+		size_t i = 0, j, k, m;
+		float a, b, km;
+		while((j = (i << 2) + 1) < n) {
+			// The smallest of the (up to) four children
+			if(j + 3 < n) {
+				// A tournament on the keys of one cache line, without branches
+				a = heap[j].key;
+				b = heap[j + 1].key;
+				m = b < a ? j + 1 : j;
+				km = b < a ? b : a;
+				a = heap[j + 2].key;
+				b = heap[j + 3].key;
+				k = b < a ? j + 3 : j + 2;
+				a = b < a ? b : a;
+				m = a < km ? k : m;
+				km = a < km ? a : km;
+			} else {
+				m = j;
+				km = heap[j].key;
+				for(k = j + 1; k < n; k++)
+					if(heap[k].key < km) {
+						m = k;
+						km = heap[k].key;
+					}
+			}
+			if(c.key <= km) break;
+			heap[i] = heap[m];
+			i = m;
+		}
+		heap[i] = c;
+	}
+};
+
+} /* namespace SC */
+
+#endif /* SC_HEAP_H_ */
@@ -0,0 +1,332 @@
+/*
+ * sc_index.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_INDEX_H_
+#define SC_INDEX_H_
+
+#include <iostream>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include "sc_utilities.h"
+#include "sc_directory.h"
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * The index container written by Encoder::output and SCEncoder::output.
+ * [IndexHeader] then the sections, each one starting on a 64-byte boundary:
+ * offsets: the bucket directory (see BucketDirectory): one bit per bucket
+ * and the offsets of the non-empty buckets only. Version 1 stored the prefix
+ * sums of the bucket lengths (n_buckets entries), it can still be read.
+ * ids: the id of each vector, sorted by bucket (n entries)
+ * codes: the PQ codes, sorted by bucket (n x mp bytes)
+ * codebooks: the coarse, the product then the refinement codebooks (floats)
+ * refine: the refinement record of each vector, sorted by bucket
+ * (n x index_refine_size(mr) bytes, empty without refinement)
+ * The offsets and the ids are index_size = sizeof(idx_t) bytes wide.
+ * All the counts of the header are 64 bits wide.
+ * Versions 1 and 2 have no refinement: their header is IndexHeaderV2,
+ * index_read_header upgrades it.
+ */
+#define SC_INDEX_MAGIC "SCINDEX"
+#define SC_INDEX_VERSION 3
+#define SC_INDEX_ALIGN 64
+
+enum {
+	SC_SECTION_OFFSETS = 0,
+	SC_SECTION_IDS,
+	SC_SECTION_CODES,
+	SC_SECTION_CODEBOOKS,
+	SC_SECTION_REFINE,
+	SC_SECTIONS
+};
+
+// The number of sections of the versions 1 and 2
+#define SC_SECTIONS_V2 4
+
+/**
+ * A section of the container
+ * @param offset the position in the file, a multiple of SC_INDEX_ALIGN
+ * @param size the size in bytes
+ * @param checksum the checksum of the content
+ */
+typedef struct {
+	uint64_t offset, size, checksum;
+} IndexSection;
+
+/**
+ * The header of the container
+ * @param magic SC_INDEX_MAGIC
+ * @param version the version of the layout
+ * @param header_size sizeof(IndexHeader)
+ * @param kc, mc, kp, mp, dim the parameters of the quantizers
+ * @param nc the number of nearest centers of the dense partitioning (0 for IVFADC)
+ * @param index_size the size in bytes of an offset or an id
+ * @param kr, mr the parameters of the refinement quantizer (0 without refinement)
+ * @param n the number of vectors
+ * @param n_buckets the number of buckets
+ * @param non_empty the number of non-empty buckets
+ * @param checksum the checksum of the header, this field excluded
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version, header_size;
+	int32_t kc, mc, kp, mp, dim, nc, index_size, reserved;
+	int32_t kr, mr;
+	uint64_t n, n_buckets, non_empty;
+	IndexSection sections[SC_SECTIONS];
+	uint64_t checksum;
+} IndexHeader;
+
+/**
+ * The header of the versions 1 and 2, without refinement
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version, header_size;
+	int32_t kc, mc, kp, mp, dim, nc, index_size, reserved;
+	uint64_t n, n_buckets, non_empty;
+	IndexSection sections[SC_SECTIONS_V2];
+	uint64_t checksum;
+} IndexHeaderV2;
+
+/**
+ * The size of the refinement record of a vector: the norm correction
+ * (a float) then the mr refinement codes
+ * @param mr the number of refinement sub-quantizers
+ */
+inline size_t index_refine_size(int mr) {
+	return mr > 0 ? sizeof(float) + static_cast<size_t>(mr) : 0;
+}
+
+/**
+ * Round a position up to the alignment of the sections
+ */
+inline size_t index_align(size_t pos) {
+	return (pos + SC_INDEX_ALIGN - 1) & ~static_cast<size_t>(SC_INDEX_ALIGN - 1);
+}
+
+/**
+ * A 64-bit checksum (FNV-1a over 8-byte words)
+ * @param data the data
+ * @param n the size in bytes
+ */
+inline uint64_t index_checksum(const void * data, size_t n) {
+	const unsigned char * p = static_cast<const unsigned char *>(data);
+	uint64_t h = 14695981039346656037ULL, w;
+	size_t i;
+	for(i = 0; i + 8 <= n; i += 8) {
+		memcpy(&w,p + i,8);
+		h = (h ^ w) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	for(; i < n; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+/**
+ * The checksum of a header
+ */
+inline uint64_t index_header_checksum(const IndexHeader& header) {
+	return index_checksum(&header,offsetof(IndexHeader,checksum));
+}
+
+/**
+ * Check whether a file starts with the magic of the container
+ * @param data the content of the file
+ * @param f_size the size of the file
+ */
+inline bool index_is_container(const unsigned char * data, size_t f_size) {
+	return f_size >= sizeof(IndexHeaderV2)
+			&& memcmp(data,SC_INDEX_MAGIC,sizeof(SC_INDEX_MAGIC)) == 0;
+}
+
+/**
+ * Read the header of a container, of any version.
+ * A header of the versions 1 and 2 is upgraded: no refinement section.
+ * @param data the content of the file
+ * @param f_size the size of the file
+ * @param header the header
+ * @return false if the file is not a container
+ */
+inline bool index_read_header(const unsigned char * data, size_t f_size, IndexHeader& header) {
+	if(!index_is_container(data,f_size)) return false;
+	uint32_t version;
+	memcpy(&version,data + offsetof(IndexHeader,version),sizeof(uint32_t));
+	if(version > 2) {
+		if(f_size < sizeof(IndexHeader)) return false;
+		memcpy(&header,data,sizeof(IndexHeader));
+		return true;
+	}
+	IndexHeaderV2 old;
+	memcpy(&old,data,sizeof(IndexHeaderV2));
+	memset(&header,0,sizeof(IndexHeader));
+	memcpy(header.magic,old.magic,sizeof(old.magic));
+	header.version = old.version;
+	header.header_size = old.header_size;
+	header.kc = old.kc;
+	header.mc = old.mc;
+	header.kp = old.kp;
+	header.mp = old.mp;
+	header.dim = old.dim;
+	header.nc = old.nc;
+	header.index_size = old.index_size;
+	header.n = old.n;
+	header.n_buckets = old.n_buckets;
+	header.non_empty = old.non_empty;
+	for(int i = 0; i < SC_SECTIONS_V2; i++)
+		header.sections[i] = old.sections[i];
+	header.checksum = old.checksum;
+	return true;
+}
+
+/**
+ * Validate a container: the header, the bounds and the alignment of the sections
+ * and, if asked, the checksums of the sections (this reads the whole file)
+ * @param data the content of the file
+ * @param f_size the size of the file
+ * @param filename the name of the file, for the messages
+ * @param deep also verify the checksums of the sections
+ * @return true if the container is valid
+ */
+inline bool index_check(
+		const unsigned char * data, size_t f_size,
+		const char * filename, bool deep) {
+	IndexHeader h;
+	const IndexHeader * header = &h;
+	if(!index_read_header(data,f_size,h)) {
+		cerr << filename << " is not an index container" << endl;
+		return false;
+	}
+	bool legacy = header->version <= 2;
+	size_t header_size = legacy ? sizeof(IndexHeaderV2) : sizeof(IndexHeader);
+	if(header->version < 1 || header->version > SC_INDEX_VERSION
+			|| header->header_size != header_size) {
+		cerr << "Unsupported version " << header->version << " of " << filename << endl;
+		return false;
+	}
+	// The checksum covers the header as it is stored
+	if(header->checksum != index_checksum(data,legacy ? offsetof(IndexHeaderV2,checksum)
+			: offsetof(IndexHeader,checksum))) {
+		cerr << "The header of " << filename << " is corrupted" << endl;
+		return false;
+	}
+	if(header->mr < 0 || header->kr < 0 || header->kr > 256
+			|| (header->mr > 0 && (header->kr == 0 || header->dim % header->mr != 0))) {
+		cerr << "The refinement of " << filename << " is invalid" << endl;
+		return false;
+	}
+	uint64_t expected[SC_SECTIONS] = {
+			header->version == 1 ? header->n_buckets * header->index_size
+					: BucketDirectory::bytes(header->n_buckets,header->non_empty,header->index_size),
+			header->n * header->index_size,
+			header->n * header->mp,
+			static_cast<uint64_t>(header->kc + header->kp + header->kr) * header->dim * sizeof(float),
+			header->n * index_refine_size(header->mr)
+	};
+	for(int i = 0; i < (legacy ? SC_SECTIONS_V2 : SC_SECTIONS); i++) {
+		const IndexSection& s = header->sections[i];
+		if(s.offset % SC_INDEX_ALIGN != 0 || s.size != expected[i]
+				|| s.offset < header_size || s.offset + s.size > f_size) {
+			cerr << "The section " << i << " of " << filename << " is out of place" << endl;
+			return false;
+		}
+		if(deep && s.checksum != index_checksum(data + s.offset,s.size)) {
+			cerr << "The section " << i << " of " << filename << " is corrupted" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check that a container was built with the given quantizers
+ * @param header the header of the container
+ * @param config the configuration of the loaded codebooks
+ * @param n_buckets the expected number of buckets
+ * @param filename the name of the file, for the messages
+ */
+inline bool index_match(
+		const IndexHeader& header, const PQConfig& config,
+		size_t n_buckets, const char * filename) {
+	if(header.kc != config.kc || header.mc != config.mc
+			|| header.kp != config.kp || header.mp != config.mp
+			|| header.dim != config.dim || header.n_buckets != n_buckets) {
+		cerr << "The file " << filename << " does not match the codebooks" << endl;
+		return false;
+	}
+	if(header.index_size != sizeof(idx_t)) {
+		cerr << "The file " << filename << " has " << header.index_size * 8
+				<< "-bit ids, but this build uses " << sizeof(idx_t) * 8
+				<< "-bit ids (see SC_LARGE_INDEX)" << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Read the bucket directory of a checked container
+ * @param data the content of the file
+ * @param header the header of the container
+ * @param dir the directory
+ * @param copy copy the directory, otherwise it is a view of the data
+ * from version 2 on
+ */
+inline void index_directory(
+		const unsigned char * data, const IndexHeader& header,
+		BucketDirectory& dir, bool copy) {
+	const unsigned char * d = data + header.sections[SC_SECTION_OFFSETS].offset;
+	if(header.version == 1)
+		dir.build(reinterpret_cast<const idx_t *>(d),header.n_buckets);
+	else if(copy)
+		dir.read(d,header.n_buckets,header.non_empty);
+	else
+		dir.view(d,header.n_buckets,header.non_empty);
+}
+
+/**
+ * Read n ids stored as int (the legacy layout)
+ * @param src the ids in the file
+ * @param ids the output
+ * @param n the number of ids
+ */
+inline void index_read_ids(const unsigned char * src, idx_t * ids, size_t n) {
+	if(sizeof(idx_t) == sizeof(int)) {
+		memcpy(ids,src,n * sizeof(int));
+		return;
+	}
+	int id;
+	for(size_t i = 0; i < n; i++) {
+		memcpy(&id,src + i * sizeof(int),sizeof(int));
+		ids[i] = id;
+	}
+}
+
+/**
+ * Write n ids as int (the legacy layout)
+ * @param ids the ids
+ * @param dst the ids in the file
+ * @param n the number of ids
+ */
+inline void index_write_ids(const idx_t * ids, unsigned char * dst, size_t n) {
+	if(sizeof(idx_t) == sizeof(int)) {
+		memcpy(dst,ids,n * sizeof(int));
+		return;
+	}
+	int id;
+	for(size_t i = 0; i < n; i++) {
+		id = static_cast<int>(ids[i]);
+		memcpy(dst + i * sizeof(int),&id,sizeof(int));
+	}
+}
+
+} /* namespace SC */
+
+#endif /* SC_INDEX_H_ */
@@ -0,0 +1,309 @@
+/*
+ * sc_multiseq.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_MULTISEQ_H_
+#define SC_MULTISEQ_H_
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utilities.h>
+#include "sc_heap.h"
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * A cell of the multi-sequence algorithm: the sum of its D distances
+ * and the rank of each of its coordinates in the sorted lists.
+ * The cells are 16 or 32 bytes so that four siblings fill whole cache lines.
+ */
+template<int D>
+struct alignas(16) MSCell {
+	float key;
+	int h[D];
+};
+
+/**
+ * The set of the traversed cells of a query, as linear indices.
+ * An open-addressing hash table with linear probing: its size follows the
+ * number of traversed cells, not the number of cells of the index, and it
+ * doubles when it is half full. The occupied slots are listed, so that
+ * clearing costs one write per traversed cell.
+ */
+class CellSet {
+public:
+	CellSet() {
+		table = nullptr;
+		slots = nullptr;
+		capacity = n = 0;
+		shift = 64;
+	}
+	virtual ~CellSet() {
+		::delete table;
+		::delete slots;
+		table = nullptr;
+		slots = nullptr;
+	}
+
+	/**
+	 * Make room for m cells, the set is emptied
+	 * @param m the number of cells
+	 */
+	inline void reserve(size_t m) {
+		size_t c = 16;
+		int b = 4;
+		while(c < (m << 1)) {
+			c <<= 1;
+			b++;
+		}
+		if(c > capacity) {
+			::delete table;
+			::delete slots;
+			SimpleCluster::init_array(table,c);
+			SimpleCluster::init_array(slots,c >> 1);
+			memset(table,0,c * sizeof(uint64_t));
+			capacity = c;
+			shift = 64 - b;
+		} else clear();
+		n = 0;
+	}
+
+	/**
+	 * Check whether a cell has been traversed
+	 * @param i the linear index of the cell
+	 */
+	inline bool contains(size_t i) const {
+		const uint64_t k = static_cast<uint64_t>(i) + 1;
+		for(size_t p = slot(i);; p = (p + 1) & (capacity - 1)) {
+			if(table[p] == k) return true;
+			if(table[p] == 0) return false;
+		}
+	}
+
+	/**
+	 * Add a cell that is not in the set
+	 * @param i the linear index of the cell
+	 */
+	inline void insert(size_t i) {
+		if(((n + 1) << 1) > capacity) grow();
+		size_t p = slot(i);
+		while(table[p] != 0)
+			p = (p + 1) & (capacity - 1);
+		table[p] = static_cast<uint64_t>(i) + 1;
+		slots[n++] = p;
+	}
+
+	/**
+	 * Remove all the cells, the capacity is kept
+	 */
+	inline void clear() {
+		for(size_t k = 0; k < n; k++)
+			table[slots[k]] = 0;
+		n = 0;
+	}
+
+	/**
+	 * The number of cells in the set
+	 */
+	inline size_t size() const {
+		return n;
+	}
+
+	/**
+	 * The number of bytes of the set
+	 */
+	inline size_t bytes() const {
+		return capacity * sizeof(uint64_t) + (capacity >> 1) * sizeof(size_t);
+	}
+
+private:
+	uint64_t * table; // the cell index + 1 of each slot, 0 if it is free
+	size_t * slots; // the occupied slots, in the insertion order
+	size_t capacity, n;
+	int shift; // 64 - log2(capacity)
+
+	CellSet(const CellSet&);
+	CellSet& operator=(const CellSet&);
+
+	/**
+	 * Fibonacci hashing: the high bits of the product are well mixed
+	 */
+	inline size_t slot(size_t i) const {
+		return static_cast<size_t>((static_cast<uint64_t>(i)
+				* UINT64_C(0x9E3779B97F4A7C15)) >> shift);
+	}
+
+	/**
+	 * Double the capacity and insert the cells again
+	 */
+	inline void grow() {
+		uint64_t * old = table;
+		size_t * old_slots = slots;
+		size_t m = n, k, p;
+		SimpleCluster::init_array(table,capacity << 1);
+		SimpleCluster::init_array(slots,capacity);
+		capacity <<= 1;
+		shift--;
+		memset(table,0,capacity * sizeof(uint64_t));
+		n = 0;
+		for(k = 0; k < m; k++) {
+			p = slot(static_cast<size_t>(old[old_slots[k]] - 1));
+			while(table[p] != 0)
+				p = (p + 1) & (capacity - 1);
+			table[p] = old[old_slots[k]];
+			slots[n++] = p;
+		}
+		::delete old;
+		::delete old_slots;
+	}
+};
+
+/**
+ * The multi-sequence algorithm over D sorted lists of n distances.
+ * It serves the inverted multi-index (one list per sub-space) and the
+ * dense partitioning (the same list D times) alike.
+ * The cells are visited in ascending order of the sum of their distances.
+ * A cell enters the frontier once all its predecessors have been visited,
+ * so the frontier stays small. The frontier and the set of the traversed
+ * cells belong to the caller (see SearchWorkspace) and grow with the
+ * traversal: the memory of a query is O(max_pops), whatever n^D is.
+ */
+template<int D>
+class MultiSequence {
+public:
+	/**
+	 * Start a traversal from the cell (0,...,0)
+	 * @param lists the D sorted lists
+	 * @param n the length of each list
+	 * @param heap the storage of the frontier (see ms_heap_bytes),
+	 * reallocated when the frontier is full
+	 * @param heap_cap the capacity of the frontier, updated when it grows
+	 * @param cells the traversed cells, empty
+	 * @param max_pops the maximum number of traversed cells
+	 */
+	MultiSequence(const float * const * lists, int n,
+			unsigned char *& heap, size_t& heap_cap,
+			CellSet& cells, size_t max_pops)
+			: heap(heap), heap_cap(heap_cap), cells(cells) {
+		int d;
+		this->n = n;
+		frontier.attach(heap,heap_cap);
+		this->max_pops = max_pops;
+		stride[D - 1] = 1;
+		for(d = D - 2; d >= 0; d--)
+			stride[d] = stride[d + 1] * static_cast<size_t>(n);
+		MSCell<D> c;
+		c.key = 0.0f;
+		for(d = 0; d < D; d++) {
+			this->lists[d] = lists[d];
+			c.h[d] = 0;
+			c.key += lists[d][0];
+		}
+		push(c);
+	}
+
+	/**
+	 * Visit the closest cell that has not been visited yet
+	 * @param c the visited cell
+	 * @return false if all the cells or max_pops cells have been visited
+	 */
+	inline bool next(MSCell<D>& c) {
+		if(cells.size() >= max_pops || !frontier.pop(c)) return false;
+
+		size_t i = index(c);
+		cells.insert(i);
+
+		// A successor is ready when all its other predecessors are visited
+		int d, e;
+		bool ready;
+		MSCell<D> s;
+		for(d = 0; d < D; d++) {
+			if(c.h[d] + 1 >= n) continue;
+			ready = true;
+			for(e = 0; e < D && ready; e++) {
+				if(e == d || c.h[e] == 0) continue;
+				ready = cells.contains(i + stride[d] - stride[e]);
+			}
+			if(!ready) continue;
+			s = c;
+			s.h[d]++;
+			s.key = 0.0f;
+			for(e = 0; e < D; e++)
+				s.key += lists[e][s.h[e]];
+			push(s);
+		}
+		return true;
+	}
+
+	/**
+	 * The number of visited cells
+	 */
+	inline size_t visited() const {
+		return cells.size();
+	}
+
+	/**
+	 * Forget the traversed cells for the next traversal
+	 */
+	inline void clear() {
+		cells.clear();
+		frontier.clear();
+	}
+
+private:
+	const float * lists[D];
+	int n;
+	size_t stride[D]; // the linear index of a cell is sum(h[d] * stride[d])
+	MinHeap4<MSCell<D> > frontier;
+	unsigned char *& heap;
+	size_t& heap_cap;
+	CellSet& cells;
+	size_t max_pops;
+
+	MultiSequence(const MultiSequence&);
+	MultiSequence& operator=(const MultiSequence&);
+
+	inline size_t index(const MSCell<D>& c) const {
+		size_t i = 0;
+		for(int d = 0; d < D; d++)
+			i += c.h[d] * stride[d];
+		return i;
+	}
+
+	/**
+	 * Insert a cell into the frontier, which doubles when it is full
+	 */
+	inline void push(const MSCell<D>& c) {
+		if(frontier.push(c)) return;
+		unsigned char * tmp;
+		heap_cap = heap_cap > 0 ? heap_cap << 1 : 16;
+		SimpleCluster::init_array(tmp,MinHeap4<MSCell<D> >::bytes(heap_cap));
+		frontier.move_to(tmp,heap_cap);
+		::delete heap;
+		heap = tmp;
+		frontier.push(c);
+	}
+};
+
+/**
+ * The number of bytes of the frontier of a MultiSequence<D>
+ * @param D the number of coordinates of a cell (2 to 4)
+ * @param heap_cap the capacity of the frontier
+ */
+inline size_t ms_heap_bytes(int D, size_t heap_cap) {
+	switch(D) {
+	case 2: return MinHeap4<MSCell<2> >::bytes(heap_cap);
+	case 3: return MinHeap4<MSCell<3> >::bytes(heap_cap);
+	default: return MinHeap4<MSCell<4> >::bytes(heap_cap);
+	}
+}
+
+} /* namespace SC */
+
+#endif /* SC_MULTISEQ_H_ */
@@ -11,6 +11,7 @@
 #include <iostream>
 #include <algorithm>
 #include <cblas.h>
+#include "sc_multiseq.h"
 #include "query.h"
 
 using namespace std;
@@ -22,279 +23,157 @@ class SCQuery : public PQQuery
 {
 protected:
 	int nc;
+	size_t num_buckets();
+	inline void scan_mr(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool, bool) const;
+	template<int D>
+	inline void search_mr_d(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool, bool) const;
 public:
 	SCQuery();
 	SCQuery(int);
 	virtual ~SCQuery();
-	int load_encoded_data(const char *, bool);
+	idx_t load_encoded_data(const char *, bool);
 
+	void init_workspace(SearchWorkspace&, int, int) const;
 	inline void search_mr_ivf(
-			float *,
-			float *&, float *&,
-			int *, int *&,
-			int *&, int *&,int *&, int *&,
-			int *&, int *&,
-			int *&, int *&, bool *,
-			int&, int, int, int, int,
-			bool, bool);
-
-	inline void search_mr_ivf3(
-			float *,
-			float *&, float *&,
-			int *, int *&,
-			int *&, int *&,int *&, int *&,
-			int *&, int *&,
-			int *&, //int *&,int *&,
-			int *&, int *&, bool *,
-			int&, int, int, int, int,
-			bool, bool);
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int,
+			bool, bool) const;
+	inline void search_mr_ivf_rerank(
+			float *, SearchWorkspace&,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
+	inline void search_mr_ivf_parallel(
+			float *, int,
+			idx_t *, float *,
+			int, int, int, int, bool) const;
 };
 
 /**
- * Search method: A demo on single thread mode
+ * Search method with a given workspace (MultiRank IVFADC, nc = 2, 3 or 4).
+ * All the scratch arrays are owned by the workspace, so that several
+ * threads can search the same index at the same time and nothing is
+ * allocated here. The statistics of the search are left in the workspace.
  * @param query the query vector
- * @param result the result by identifiers
+ * @param ws the workspace of the calling thread (see init_workspace)
+ * @param result the top R identifiers, sorted by distance (R entries)
+ * @param dist the top R distances (R entries)
  * @param R the number of top retrieved results
+ * @param w the maximum number of cells to be visited
+ * @param T the maximum number of candidates
+ * @param real_dist to score the candidates with the exact distances
  * @param verbose to enable verbose mode
  */
-inline void SCQuery::search_mr_ivf(float * query,
-		float *& v_tmp, float *& dist,
-		int * tmp, int *& result,
-		int *& hid1, int *& hid2, int *& hid3, int *& hid4,
-		int *& s1, int *& s2,
-		int *& prebuck, int *& cache, bool * traversed,
-		int& sum, int R, int w, int T, int M,
-		bool real_dist, bool verbose) {
-	if(config.mc != 1 || nc != 2) {
+inline void SCQuery::search_mr_ivf(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool verbose) const {
+	scan_mr(query,ws,result,dist,R,w,T,real_dist,false,verbose);
+}
+
+/**
+ * Select the search of the dense partitioning for nc nearest centers
+ * @param positions to leave the positions of the results in the inverted
+ * file instead of their identifiers (see rerank)
+ */
+inline void SCQuery::scan_mr(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool positions, bool verbose) const {
+	if(config.mc != 1) {
 		cerr << "This search method is for MultiRank IVFADC only" << endl;
 		return;
 	}
-
-	// Temporary pointers: 8 * 8 = 64 bytes
-	float * v_tmp1;
-	int * i_tmp;
-	unsigned char * c_tmp1, * c_tmp2;
-
-	// Step 1: assign the query to coarse quantizer
-	size_t i, j, k, l, count = 0, count2 = 0, base = 0, base1, base2, base_c, base_c2, base_k;
-	size_t kc = static_cast<size_t>(config.kc);
-	size_t kp = static_cast<size_t>(config.kp);
-	size_t size2 = kc * kc;
-	int h1, h2, h3, h4, m1, m2, c2,
-	bid, sum2 = 0, lb = config.kc * config.mc; // 10 * 4 = 40 bytes
-	float d_tmp, d_tmp1, d_tmp2, d_tmp3; // 4 bytes
-	int bsp = config.dim / config.mp;
-	int bsz = bsp * config.kp; // 4 bytes
-	int bs = config.kp * config.mp / config.mc;
-
-	pre_compute2(query);
-	float q_sum = 0.0;
-	v_tmp1 = query;
-	for(i = 0; i < config.dim; i++) {
-		d_tmp = *(v_tmp1++);
-		q_sum += d_tmp * d_tmp;
-	}
-
-	v_tmp1 = diff_qc;
-	for(j = 0; j < kc; j++) {
-		d_tmp = q_sum + (*(v_tmp1++));
-		v_tmp[j] = d_tmp;
-		tmp[j] = j;
-	}
-
-	nth_element_id(v_tmp,v_tmp + config.kc,tmp,M);
-	sort_id(v_tmp,v_tmp + M,tmp);
-
-	if(verbose) {
-		cout << "Finished STEP 1" << endl;
-	}
-
-	// Step 2: Multi-sequences algorithm
-	sum = sum2 = count = count2 = 0;
-	h3 = tmp[0];
-	h4 = tmp[1];
-	v_tmp1 = v_tmp + kc;
-	d_tmp = v_tmp[0] + v_tmp[1];
-
-	pq_insert4(
-			v_tmp1,
-			hid1,hid2,hid3,hid4,
-			d_tmp,
-			0,1,h3,h4,sum2,w,verbose);
-	pq_insert4(
-			v_tmp1,
-			hid1,hid2,hid3,hid4,
-			d_tmp,
-			1,0,h4,h3,sum2,w,verbose);
-
-	while(count < w && sum < T) {
-		if(sum2 > 0) {
-			pq_pop4(
-					v_tmp1,
-					hid1,hid2,hid3,hid4,
-					h1,h2,h3,h4,
-					sum2,verbose);
-			bid = h3 * kc + h4;
-			if(bid > 0) {
-				l = L[bid] - L[bid-1];
-			} else l = 0;
-			if(l > 0) {
-				prebuck[count] = bid;
-				s1[count] = h3;
-				//				s2[count] = h4;
-				count++;
-				sum += l;
-			}
-			i = kc * h1 + h2;
-			traversed[i] = true;
-			cache[count2++] = i;
-		}
-
-
-		if(sum < T) {
-			j = kc * h2 + h1;
-			m1 = i + kc - 1;
-			m2 = i - kc + 1;
-			if(h1 < kc - 1 &&
-					(h2 == 0 || (m1 < size2 && traversed[m1]))
-					//					&& h1+1 != h2
-			) {
-				d_tmp = v_tmp[h1+1] + v_tmp[h2];
-				h3 = tmp[h1+1];
-				h4 = tmp[h2];
-
-				pq_insert4(
-						v_tmp1,
-						hid1,hid2,hid3,hid4,
-						d_tmp,
-						h1+1,h2,h3,h4,sum2,w,verbose);
-			}
-			if(h2 < kc - 1 &&
-					(h1 == 0 || (m2 >= 0 && traversed[m2]))
-					//					&& h1 != h2+1
-			) {
-				d_tmp = v_tmp[h1] + v_tmp[h2+1];
-				h3 = tmp[h1];
-				h4 = tmp[h2+1];
-				pq_insert4(
-						v_tmp1,
-						hid1,hid2,hid3,hid4,
-						d_tmp,
-						h1,h2+1,h3,h4,sum2,w,verbose);
-			}
-		}
-	}
-
-	if(verbose) {
-		cout << "Finished STEP 2 with " << count << " cells" << endl;
-	}
-
-	int count_w = count, count2_w = count2;
-
-	// Step 3: Local search
-	// Allocate the memory to store search results
-	// Remember to free them after used
-	SimpleCluster::init_array(result,sum);
-	SimpleCluster::init_array(dist,sum);
-	count = 0;
-
-	for(i = 0; i < count_w; i++) {
-		bid = prebuck[i];
-		h3 = s1[i];
-		if(bid > 0) {
-			l = L[bid] - L[bid-1];
-			i_tmp = pid + L[bid-1];
-			c_tmp1 = codes + static_cast<size_t>(L[bid-1]) * config.mp;
-		} else {
-			l = L[bid];
-			i_tmp = pid;
-			c_tmp1 = codes;
-		}
-		if(verbose) {
-			cout << "This cell contains " << l << " cadidates with id=" << bid << endl;
-		}
-		d_tmp = q_sum + diff_qc[h3];
-		base1 = h3 * bs;
-		// Calculate all l distances
-		memcpy(&result[count],i_tmp,l * sizeof(int));
-		if(!real_dist) {
-			for(j = 0; j < l; j++) {
-				base = 0;
-				d_tmp1 = d_tmp;
-				for(k = 0; k < config.mp; k++) {
-					base_c = base + *(c_tmp1++);
-					d_tmp1 += (diff_qr[base_c] + dot_cr[base1 + base_c]);
-					base += config.kp;
-				}
-				dist[count++] = d_tmp1;
-				//				c_tmp1 += config.mp;
-			}
-		} else {
-			for(j = 0; j < l; j++) {
-				dist[count++] = SimpleCluster::distance_l2_square(
-						query,raw_data + i_tmp[j] * config.dim, config.dim);
-			}
-		}
-		if(count >= T) break;
-	}
-
-	for(i = 0; i < count2_w; i++) {
-		traversed[cache[i]] = 0;
-	}
-
-	if(verbose) {
-		cout << "Finished STEP 3" << endl;
-	}
-
-	// Step 4: Extract the top R
-	if(sum >= R) {
-		nth_element_id(dist,dist+sum,result,R-1);
+	if(codes == nullptr) {
+		cerr << "The 8-bit codes are not loaded" << endl;
+		return;
 	}
-	if(verbose) {
-		cout << "Finished STEP 4" << endl;
+	switch(nc) {
+	case 2:
+		search_mr_d<2>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	case 3:
+		search_mr_d<3>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	case 4:
+		search_mr_d<4>(query,ws,result,dist,R,w,T,real_dist,positions,verbose);
+		break;
+	default:
+		cerr << "This search method is for nc = 2, 3 or 4 only" << endl;
 	}
 }
 
 /**
- * Search method: A demo on single thread mode
+ * Two-stage search method (MultiRank IVFADC, nc = 2, 3 or 4): the K best candidates of the
+ * ADC search are re-ranked with the exact distances to their raw vectors
+ * (see load_data and map_data) or with the refinement codes of the index.
  * @param query the query vector
- * @param result the result by identifiers
+ * @param ws the workspace of the calling thread, for K results (see init_workspace)
+ * @param result the top R identifiers, sorted by distance (R entries)
+ * @param dist the top R re-ranked distances (R entries)
  * @param R the number of top retrieved results
+ * @param K the number of re-ranked candidates (K >= R)
+ * @param w the maximum number of cells to be visited
+ * @param T the maximum number of candidates
  * @param verbose to enable verbose mode
  */
-inline void SCQuery::search_mr_ivf3(float * query,
-		float *& v_tmp, float *& dist,
-		int * tmp, int *& result,
-		int *& hid1, int *& hid2, int *& hid3, int *& hid4,
-		int *& hid5, int *& hid6,
-		int *& s1,// int *& s2, int *& s3,
-		int *& prebuck, int *& cache, bool * traversed,
-		int& sum, int R, int w, int T, int M,
-		bool real_dist, bool verbose) {
-	if(config.mc != 1 || nc != 3) {
-		cerr << "This search method is for MultiRank IVFADC-3 only" << endl;
+inline void SCQuery::search_mr_ivf_rerank(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int K, int w, int T, bool verbose) const {
+	if(!can_rerank() || R <= 0) return;
+	if(K < R) K = R;
+	ws.reserve(K);
+	ws.result[0] = -1; // nothing to re-rank if the search fails
+	scan_mr(query,ws,ws.result,ws.dist,K,w,T,false,true,verbose);
+	int k = 0;
+	while(k < K && ws.result[k] >= 0) k++;
+	rerank(query,ws,k,result,dist,R);
+}
+
+/**
+ * The search of the dense partitioning with D = nc nearest centers.
+ * The cells are the D-tuples of the ranked coarse centers, traversed with
+ * the multi-sequence algorithm over D copies of the ranking.
+ * The candidates are kept as positions until the top R is known.
+ */
+template<int D>
+inline void SCQuery::search_mr_d(float * query, SearchWorkspace& ws,
+		idx_t * result, float * dist,
+		int R, int w, int T,
+		bool real_dist, bool positions, bool verbose) const {
+	size_t kc = static_cast<size_t>(config.kc), n_cells = 1;
+	int d;
+	for(d = 0; d < D; d++)
+		n_cells *= kc;
+	if(!ws.fits(n_cells,D,w,R)) {
+		cerr << "The workspace is too small for this search" << endl;
 		return;
 	}
 
-	// Temporary pointers: 8 * 8 = 64 bytes
+	SearchContext& context = ws;
+	float * v_tmp = ws.coarse;
+	int * tmp = ws.coarse_id, * visited = ws.visited;
+	const float * lists[D];
 	float * v_tmp1;
-	int * i_tmp;
-	unsigned char * c_tmp1, * c_tmp2;
+	idx_t * i_tmp;
+	unsigned char * c_tmp1;
 
 	// Step 1: assign the query to coarse quantizer
-	size_t i, j, k, l, count = 0, count2 = 0, base = 0, base1, base2, base_c, base_c2, base_k;
-	size_t kc = static_cast<size_t>(config.kc);
-	size_t kp = static_cast<size_t>(config.kp);
-	size_t kc2 = kc * kc;
-	size_t size2 = kc * kc * kc;
-	int h1, h2, h3, h4, h5, h6, m1, m2, m3,m4,m5,m6,c2,
-	bid, sum2 = 0, lb = config.kc * config.mc; // 10 * 4 = 40 bytes
-	float d_tmp, d_tmp1, d_tmp2, d_tmp3; // 4 bytes
-	int bsp = config.dim / config.mp;
-	int bsz = bsp * config.kp; // 4 bytes
-	int bs = config.kp * config.mp / config.mc;
+	size_t i, j, k, l, count, n, sum, e, bid, base, base_c;
+	const float * dot = nullptr;
+	idx_t start;
+	float d_tmp, d_tmp1; // 4 bytes
+	int bs = config.kp * config.mp;
 
-	pre_compute2(query);
+	pre_compute2(query,context);
 	float q_sum = 0.0;
 	v_tmp1 = query;
 	for(i = 0; i < config.dim; i++) {
@@ -302,163 +181,93 @@ inline void SCQuery::search_mr_ivf3(float * query,
 		q_sum += d_tmp * d_tmp;
 	}
 
-	v_tmp1 = diff_qc;
+	v_tmp1 = context.diff_qc;
 	for(j = 0; j < kc; j++) {
 		d_tmp = q_sum + (*(v_tmp1++));
 		v_tmp[j] = d_tmp;
 		tmp[j] = j;
 	}
 
-	nth_element_id(v_tmp,v_tmp + config.kc,tmp,M);
+	// Only the ranks that the traversal can reach are sorted
+	int M = static_cast<int>(min(kc,ws.n_cache + 1));
+	if(M < config.kc)
+		nth_element_id(v_tmp,v_tmp + kc,tmp,M - 1);
 	sort_id(v_tmp,v_tmp + M,tmp);
+	for(d = 0; d < D; d++)
+		lists[d] = v_tmp;
 
 	if(verbose) {
 		cout << "Finished STEP 1" << endl;
 	}
 
 	// Step 2: Multi-sequences algorithm
-	sum = sum2 = count = count2 = 0;
-	h4 = tmp[0];
-	v_tmp1 = v_tmp + kc;
-	d_tmp = 3.0f * v_tmp[0];// + v_tmp[1] + v_tmp[2];
-
-	pq_insert6(
-			v_tmp1,
-			hid1,hid2,hid3,hid4,hid5,hid6,
-			d_tmp,
-			0,0,0,h4,h4,h4,sum2,w,verbose);
-
-	while(count < w && sum < T && count2 < size2) {
-		if(sum2 > 0) {
-			pq_pop6(
-					v_tmp1,
-					hid1,hid2,hid3,hid4,hid5,hid6,
-					h1,h2,h3,h4,h5,h6,
-					sum2,verbose);
-			bid = h4 * kc2 + h5 * kc + h6;
-			if(bid > 0) {
-				l = L[bid] - L[bid-1];
-			} else l = 0;
-			if(l > 0) {
-				prebuck[count] = bid;
-				s1[count] = h4;
-				count++;
-				sum += l;
-			}
-			i = kc2 * h1 + kc * h2 + h3;
-			traversed[i] = true;
-			cache[count2++] = i;
-		}
-
-
-		if(sum < T) {
-			m1 = i + kc2 - kc;
-			m2 = i + kc2 - 1;
-			m3 = i + kc - 1;
-			m4 = i + kc - kc2;
-			m5 = i - kc + 1;
-			m6 = i - kc2 + 1;
-			if(h1 < kc - 1
-					&& (h2 == 0 || (m1 < size2 && traversed[m1]))
-					&& (h3 == 0 || (m2 < size2 && traversed[m2]))
-			) {
-				d_tmp = v_tmp[h1+1] + v_tmp[h2] + v_tmp[h3];
-				h4 = tmp[h1+1];
-				h5 = tmp[h2];
-				h6 = tmp[h3];
-
-				pq_insert6(
-						v_tmp1,
-						hid1,hid2,hid3,hid4,hid5,hid6,
-						d_tmp,
-						h1+1,h2,h3,h4,h5,h6,sum2,w,verbose);
-			}
-			if(h2 < kc - 1
-					&& (h3 == 0 || (m3 < size2 && traversed[m3]))
-					&& (h1 == 0 || (m4 >= 0 && traversed[m4]))
-			) {
-				d_tmp = v_tmp[h1] + v_tmp[h2+1] + v_tmp[h3];
-				h4 = tmp[h1];
-				h5 = tmp[h2+1];
-				h6 = tmp[h3];
-				pq_insert6(
-						v_tmp1,
-						hid1,hid2,hid3,hid4,hid5,hid6,
-						d_tmp,
-						h1,h2+1,h3,h4,h5,h6,sum2,w,verbose);
-			}
-			if(h3 < kc - 1
-					&& (h2 == 0 || (m5 >= 0 && traversed[m5]))
-					&& (h1 == 0 || (m6 >= 0 && traversed[m6]))
-			) {
-				d_tmp = v_tmp[h1] + v_tmp[h2] + v_tmp[h3+1];
-				h4 = tmp[h1];
-				h5 = tmp[h2];
-				h6 = tmp[h3+1];
-				pq_insert6(
-						v_tmp1,
-						hid1,hid2,hid3,hid4,hid5,hid6,
-						d_tmp,
-						h1,h2,h3+1,h4,h5,h6,sum2,w,verbose);
-			}
-		}
+	// The cells with a repeated center are empty, but they are traversed
+	// to reach their successors
+	MultiSequence<D> ms(lists,config.kc,
+			ws.heap,ws.heap_cap,ws.cells,ws.n_cache);
+	MSCell<D> c;
+	sum = count = e = 0;
+	while(count < w && sum < T && ms.next(c)) {
+		bid = 0;
+		for(d = 0; d < D; d++)
+			bid = bid * kc + tmp[c.h[d]];
+		l = dir.length(bid);
+		if(l > 0) {
+			for(d = 0; d < D; d++)
+				visited[count * D + d] = tmp[c.h[d]];
+			count++;
+			sum += l;
+		} else e++;
 	}
+	ms.clear();
 
 	if(verbose) {
 		cout << "Finished STEP 2 with " << count << " cells" << endl;
 	}
 
-	int count_w = count, count2_w = count2;
-
 	// Step 3: Local search
-	// Allocate the memory to store search results
-	// Remember to free them after used
-	SimpleCluster::init_array(result,sum);
-	SimpleCluster::init_array(dist,sum);
-	count = 0;
-
-	for(i = 0; i < count_w; i++) {
-		bid = prebuck[i];
-		h3 = s1[i];
-		if(bid > 0) {
-			l = L[bid] - L[bid-1];
-			i_tmp = pid + L[bid-1];
-			c_tmp1 = codes + static_cast<size_t>(L[bid-1]) * config.mp;
-		} else {
-			l = L[bid];
-			i_tmp = pid;
-			c_tmp1 = codes;
-		}
+	TopR& top = context.top;
+	top.reset(R);
+	n = 0;
+
+	for(i = 0; i < count; i++) {
+		bid = 0;
+		for(d = 0; d < D; d++)
+			bid = bid * kc + visited[i * D + d];
+		l = dir.bucket(bid,start);
+		i_tmp = pid + start;
+		c_tmp1 = codes + start * config.mp;
 		if(verbose) {
 			cout << "This cell contains " << l << " cadidates with id=" << bid << endl;
 		}
-		d_tmp = q_sum + diff_qc[h3];
-		base1 = h3 * bs;
+		// The residuals are taken from the nearest center of the cell
+		d_tmp = q_sum + context.diff_qc[visited[i * D]];
+		if(!real_dist)
+			dot = coarse_dots(visited[i * D],context);
 		// Calculate all l distances
-		memcpy(&result[count],i_tmp,l * sizeof(int));
-		if(!real_dist) {
+		if(!real_dist && l >= (config.kp >> 3)) {
+			// Large buckets: merged table and vectorized scan
+			adc_merge_table(context.diff_qr,dot,context.adc_table,bs);
+			context.scan(c_tmp1,start,l,config.mp,config.kp,d_tmp);
+		} else if(!real_dist) {
 			for(j = 0; j < l; j++) {
 				base = 0;
 				d_tmp1 = d_tmp;
 				for(k = 0; k < config.mp; k++) {
 					base_c = base + *(c_tmp1++);
-					d_tmp1 += (diff_qr[base_c] + dot_cr[base1 + base_c]);
+					d_tmp1 += (context.diff_qr[base_c] + dot[base_c]);
 					base += config.kp;
 				}
-				dist[count++] = d_tmp1;
-				//				c_tmp1 += config.mp;
+				top.push(d_tmp1,start + j);
 			}
 		} else {
 			for(j = 0; j < l; j++) {
-				dist[count++] = SimpleCluster::distance_l2_square(
-						query,raw_data + i_tmp[j] * config.dim, config.dim);
+				top.push(raw.distance(query,i_tmp[j]),
+						start + j);
 			}
 		}
-		if(count >= T) break;
-	}
-
-	for(i = 0; i < count2_w; i++) {
-		traversed[cache[i]] = 0;
+		n += l;
+		if(n >= T) break;
 	}
 
 	if(verbose) {
@@ -466,12 +275,71 @@ inline void SCQuery::search_mr_ivf3(float * query,
 	}
 
 	// Step 4: Extract the top R
-	if(sum >= R) {
-		nth_element_id(dist,dist+sum,result,R-1);
-	}
+	k = top.finish(result,dist);
+	if(!positions)
+		for(i = 0; i < k; i++)
+			result[i] = pid[result[i]];
+	ws.sum = sum;
+	ws.empty = e;
 	if(verbose) {
 		cout << "Finished STEP 4" << endl;
 	}
 }
+
+/**
+ * Search a set of queries on all threads (nc = 2, 3 or 4).
+ * The index is shared, each thread owns a workspace and a range of queries.
+ * @param queries the query matrix (nq x dim, row major)
+ * @param nq the number of queries
+ * @param result the top R identifiers of each query (nq x R)
+ * @param dist the top R distances of each query (nq x R)
+ * @param R the number of top retrieved results
+ * @param w the maximum number of cells to be traversed
+ * @param T the maximum number of candidates
+ * @param n_threads the number of threads (0 to use all cores)
+ * @param verbose to enable verbose mode
+ */
+inline void SCQuery::search_mr_ivf_parallel(
+		float * queries, int nq,
+		idx_t * result, float * dist,
+		int R, int w, int T, int n_threads, bool verbose) const {
+	if(config.mc != 1 || nc < 2 || nc > 4) {
+		cerr << "This search method is for MultiRank IVFADC only" << endl;
+		return;
+	}
+	if(nq <= 0 || R <= 0) return;
+
+	int max_threads = 1;
+#ifdef _OPENMP
+	max_threads = n_threads > 0 ? n_threads : omp_get_max_threads();
+#endif
+	if(max_threads > nq) max_threads = nq;
+	size_t p = static_cast<size_t>(nq) / max_threads;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(max_threads)
+	{
+#pragma omp for
+#endif
+		for(int i0 = 0; i0 < max_threads; i0++) {
+			SearchWorkspace ws;
+			init_workspace(ws,w,R);
+
+			// Range definition
+			size_t start = p * static_cast<size_t>(i0);
+			size_t end = start + p;
+			if(end > nq || i0 == max_threads - 1)
+				end = nq;
+
+			for(size_t i = start; i < end; i++) {
+				search_mr_ivf(queries + i * config.dim,ws,
+						result + i * R,dist + i * R,
+						R,w,T,false,verbose);
+			}
+		}
+#ifdef _OPENMP
+	}
+#endif
+}
 } /* namespace PQLearn */
 #endif /* PQ_MR_QUERY_H_ */
@@ -0,0 +1,725 @@
+/*
+ * sc_rerank.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_RERANK_H_
+#define SC_RERANK_H_
+
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "sc_utilities.h"
+#include "sc_top.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SC_RERANK_X86
+#include <immintrin.h>
+#endif
+
+// The number of candidates whose raw vectors are requested ahead of the
+// one being re-ranked
+#ifndef SC_RERANK_PREFETCH
+#define SC_RERANK_PREFETCH 8
+#endif
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * The storage types of the raw vectors (see BaseVectors)
+ */
+enum {
+	SC_RAW_FLOAT = 0, // float32
+	SC_RAW_FP16, // IEEE half precision
+	SC_RAW_BF16, // bfloat16: the high half of a float32
+	SC_RAW_UINT8 // unsigned bytes, the type of the SIFT1B (.bvecs) vectors
+};
+
+/**
+ * The size in bytes of a component of a storage type
+ */
+inline size_t raw_type_size(int type) {
+	switch(type) {
+	case SC_RAW_FP16:
+	case SC_RAW_BF16:
+		return sizeof(uint16_t);
+	case SC_RAW_UINT8:
+		return sizeof(unsigned char);
+	default:
+		return sizeof(float);
+	}
+}
+
+/**
+ * Convert a float into half precision, rounded to the nearest even
+ */
+inline uint16_t float_to_half(float f) {
+	uint32_t x, a, r, rem;
+	memcpy(&x,&f,sizeof(float));
+	uint16_t s = static_cast<uint16_t>((x >> 16) & 0x8000);
+	a = x & 0x7FFFFFFF;
+	if(a > 0x7F800000) return s | 0x7E00; // NaN
+	if(a >= 0x477FF000) return s | 0x7C00; // rounds to infinity
+	if(a < 0x38800000) {
+		// A subnormal half: the mantissa with its implicit bit, shifted
+		if(a < 0x33000000) return s;
+		uint32_t e = a >> 23, m = (a & 0x7FFFFF) | 0x800000, shift = 126 - e;
+		r = m >> shift;
+		rem = m & ((1u << shift) - 1);
+		if(rem > (1u << (shift - 1)) || (rem == (1u << (shift - 1)) && (r & 1))) r++;
+		return s | static_cast<uint16_t>(r);
+	}
+	// Re-bias the exponent from 127 to 15
+	a -= 0x38000000;
+	r = a >> 13;
+	rem = a & 0x1FFF;
+	if(rem > 0x1000 || (rem == 0x1000 && (r & 1))) r++;
+	return s | static_cast<uint16_t>(r);
+}
+
+/**
+ * Convert a half precision number into a float
+ */
+inline float half_to_float(uint16_t h) {
+	uint32_t s = static_cast<uint32_t>(h & 0x8000) << 16,
+			e = (h >> 10) & 0x1F, m = h & 0x3FF, x;
+	if(e == 0) {
+		if(m == 0) x = s;
+		else {
+			// A subnormal half is a normal float
+			e = 113;
+			while((m & 0x400) == 0) {
+				m <<= 1;
+				e--;
+			}
+			x = s | (e << 23) | ((m & 0x3FF) << 13);
+		}
+	} else if(e == 31) {
+		x = s | 0x7F800000 | (m << 13);
+	} else {
+		x = s | ((e + 112) << 23) | (m << 13);
+	}
+	float f;
+	memcpy(&f,&x,sizeof(float));
+	return f;
+}
+
+/**
+ * Convert a float into bfloat16, rounded to the nearest even
+ */
+inline uint16_t float_to_bf16(float f) {
+	uint32_t x;
+	memcpy(&x,&f,sizeof(float));
+	if((x & 0x7FFFFFFF) > 0x7F800000)
+		return static_cast<uint16_t>((x >> 16) | 0x40); // a quiet NaN
+	x += 0x7FFF + ((x >> 16) & 1);
+	return static_cast<uint16_t>(x >> 16);
+}
+
+/**
+ * Convert a bfloat16 number into a float
+ */
+inline float bf16_to_float(uint16_t h) {
+	uint32_t x = static_cast<uint32_t>(h) << 16;
+	float f;
+	memcpy(&f,&x,sizeof(float));
+	return f;
+}
+
+/**
+ * Convert a float into an unsigned byte, rounded and clamped to [0, 255]
+ */
+inline unsigned char float_to_uint8(float f) {
+	if(!(f > 0.0f)) return 0;
+	if(f >= 255.0f) return 255;
+	return static_cast<unsigned char>(f + 0.5f);
+}
+
+/**
+ * Convert a vector into a storage type
+ * @param v the vector
+ * @param dst the stored vector, d * raw_type_size(type) bytes
+ * @param d the dimension
+ * @param type the storage type
+ */
+inline void raw_encode(const float * v, unsigned char * dst, int d, int type) {
+	int i;
+	uint16_t h;
+	switch(type) {
+	case SC_RAW_FP16:
+		for(i = 0; i < d; i++) {
+			h = float_to_half(v[i]);
+			memcpy(dst + i * sizeof(uint16_t),&h,sizeof(uint16_t));
+		}
+		break;
+	case SC_RAW_BF16:
+		for(i = 0; i < d; i++) {
+			h = float_to_bf16(v[i]);
+			memcpy(dst + i * sizeof(uint16_t),&h,sizeof(uint16_t));
+		}
+		break;
+	case SC_RAW_UINT8:
+		for(i = 0; i < d; i++)
+			dst[i] = float_to_uint8(v[i]);
+		break;
+	default:
+		memcpy(dst,v,d * sizeof(float));
+	}
+}
+
+/**
+ * The signature of an exact distance kernel
+ * @param a the first vector
+ * @param b the second vector
+ * @param d the dimension
+ * @return the squared L2 distance
+ */
+typedef float (*l2_square_t)(const float *, const float *, int);
+
+/**
+ * Scalar squared L2 distance
+ */
+inline float l2_square_scalar(const float * a, const float * b, int d) {
+	float s = 0.0f, t;
+	for(int i = 0; i < d; i++) {
+		t = a[i] - b[i];
+		s += t * t;
+	}
+	return s;
+}
+
+/**
+ * Scalar squared L2 distance to a half precision vector
+ */
+inline float l2_square_fp16_scalar(const float * a, const uint16_t * b, int d) {
+	float s = 0.0f, t;
+	for(int i = 0; i < d; i++) {
+		t = a[i] - half_to_float(b[i]);
+		s += t * t;
+	}
+	return s;
+}
+
+/**
+ * Scalar squared L2 distance to a bfloat16 vector
+ */
+inline float l2_square_bf16_scalar(const float * a, const uint16_t * b, int d) {
+	float s = 0.0f, t;
+	for(int i = 0; i < d; i++) {
+		t = a[i] - bf16_to_float(b[i]);
+		s += t * t;
+	}
+	return s;
+}
+
+/**
+ * Scalar squared L2 distance to a vector of unsigned bytes
+ */
+inline float l2_square_uint8_scalar(const float * a, const unsigned char * b, int d) {
+	float s = 0.0f, t;
+	for(int i = 0; i < d; i++) {
+		t = a[i] - static_cast<float>(b[i]);
+		s += t * t;
+	}
+	return s;
+}
+
+#ifdef SC_RERANK_X86
+/**
+ * The sum of the 8 components of an AVX register
+ */
+__attribute__((target("avx")))
+inline float l2_hsum_avx(__m256 v) {
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1));
+	s = _mm_add_ps(s,_mm_movehl_ps(s,s));
+	s = _mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+	return _mm_cvtss_f32(s);
+}
+
+/**
+ * SSE squared L2 distance: 8 components per iteration
+ */
+__attribute__((target("sse2")))
+inline float l2_square_sse(const float * a, const float * b, int d) {
+	int i = 0;
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), t0, t1;
+	for(; i + 8 <= d; i += 8) {
+		t0 = _mm_sub_ps(_mm_loadu_ps(a + i),_mm_loadu_ps(b + i));
+		t1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4),_mm_loadu_ps(b + i + 4));
+		acc0 = _mm_add_ps(acc0,_mm_mul_ps(t0,t0));
+		acc1 = _mm_add_ps(acc1,_mm_mul_ps(t1,t1));
+	}
+	acc0 = _mm_add_ps(acc0,acc1);
+	acc0 = _mm_add_ps(acc0,_mm_movehl_ps(acc0,acc0));
+	acc0 = _mm_add_ss(acc0,_mm_shuffle_ps(acc0,acc0,1));
+	return _mm_cvtss_f32(acc0) + l2_square_scalar(a + i,b + i,d - i);
+}
+
+/**
+ * AVX2 squared L2 distance: 16 components per iteration with fused
+ * multiply-adds on two accumulators
+ */
+__attribute__((target("avx2,fma")))
+inline float l2_square_avx2(const float * a, const float * b, int d) {
+	int i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), t0, t1;
+	for(; i + 16 <= d; i += 16) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_loadu_ps(b + i));
+		t1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),_mm256_loadu_ps(b + i + 8));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		acc1 = _mm256_fmadd_ps(t1,t1,acc1);
+	}
+	if(i + 8 <= d) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_loadu_ps(b + i));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		i += 8;
+	}
+	return l2_hsum_avx(_mm256_add_ps(acc0,acc1)) + l2_square_scalar(a + i,b + i,d - i);
+}
+
+/**
+ * AVX2 squared L2 distance to a half precision vector: the components are
+ * widened 8 at a time by the F16C conversion, so a stored vector is read
+ * at half the bandwidth of a float one
+ */
+__attribute__((target("avx2,fma,f16c")))
+inline float l2_square_fp16_avx2(const float * a, const uint16_t * b, int d) {
+	int i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), t0, t1;
+	for(; i + 16 <= d; i += 16) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),
+				_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))));
+		t1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),
+				_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + 8))));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		acc1 = _mm256_fmadd_ps(t1,t1,acc1);
+	}
+	if(i + 8 <= d) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),
+				_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		i += 8;
+	}
+	return l2_hsum_avx(_mm256_add_ps(acc0,acc1)) + l2_square_fp16_scalar(a + i,b + i,d - i);
+}
+
+/**
+ * AVX2 squared L2 distance to a bfloat16 vector: a bfloat16 is widened
+ * by a 16-bit shift
+ */
+__attribute__((target("avx2,fma")))
+inline float l2_square_bf16_avx2(const float * a, const uint16_t * b, int d) {
+	int i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), t0, t1;
+	for(; i + 16 <= d; i += 16) {
+		__m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_cvtepu16_epi32(_mm256_castsi256_si128(w)),16)));
+		t1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),_mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_cvtepu16_epi32(_mm256_extracti128_si256(w,1)),16)));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		acc1 = _mm256_fmadd_ps(t1,t1,acc1);
+	}
+	if(i + 8 <= d) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))),16)));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		i += 8;
+	}
+	return l2_hsum_avx(_mm256_add_ps(acc0,acc1)) + l2_square_bf16_scalar(a + i,b + i,d - i);
+}
+
+/**
+ * AVX2 squared L2 distance to a vector of unsigned bytes: 16 bytes are
+ * read at once and widened to two registers of floats
+ */
+__attribute__((target("avx2,fma")))
+inline float l2_square_uint8_avx2(const float * a, const unsigned char * b, int d) {
+	int i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), t0, t1;
+	for(; i + 16 <= d; i += 16) {
+		__m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),
+				_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(w)));
+		t1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),
+				_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(w,8))));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		acc1 = _mm256_fmadd_ps(t1,t1,acc1);
+	}
+	if(i + 8 <= d) {
+		t0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+				_mm_loadl_epi64(reinterpret_cast<const __m128i *>(b + i)))));
+		acc0 = _mm256_fmadd_ps(t0,t0,acc0);
+		i += 8;
+	}
+	return l2_hsum_avx(_mm256_add_ps(acc0,acc1)) + l2_square_uint8_scalar(a + i,b + i,d - i);
+}
+#endif
+
+/**
+ * Select the best kernel supported by the CPU
+ */
+inline l2_square_t l2_select() {
+#ifdef SC_RERANK_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return l2_square_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return l2_square_sse;
+#endif
+	return l2_square_scalar;
+}
+
+/**
+ * Compute the squared L2 distance between two vectors.
+ * The kernel is selected once, on the first call.
+ * @param a the first vector
+ * @param b the second vector
+ * @param d the dimension
+ */
+inline float l2_square(const float * a, const float * b, int d) {
+	static const l2_square_t kernel = l2_select();
+	return kernel(a,b,d);
+}
+
+/**
+ * The signatures of the exact distance kernels on the compact storage types
+ */
+typedef float (*l2_square_half_t)(const float *, const uint16_t *, int);
+typedef float (*l2_square_uint8_t)(const float *, const unsigned char *, int);
+
+/**
+ * Select the best kernel of a compact storage type supported by the CPU
+ * @param type SC_RAW_FP16 or SC_RAW_BF16
+ */
+inline l2_square_half_t l2_select_half(int type) {
+#ifdef SC_RERANK_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		if(type == SC_RAW_BF16)
+			return l2_square_bf16_avx2;
+		// The fp16 kernel also converts with F16C
+		if(__builtin_cpu_supports("f16c"))
+			return l2_square_fp16_avx2;
+	}
+#endif
+	return type == SC_RAW_BF16 ? l2_square_bf16_scalar : l2_square_fp16_scalar;
+}
+
+inline l2_square_uint8_t l2_select_uint8() {
+#ifdef SC_RERANK_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return l2_square_uint8_avx2;
+#endif
+	return l2_square_uint8_scalar;
+}
+
+/**
+ * Compute the squared L2 distance between a vector and a half precision one
+ */
+inline float l2_square_fp16(const float * a, const uint16_t * b, int d) {
+	static const l2_square_half_t kernel = l2_select_half(SC_RAW_FP16);
+	return kernel(a,b,d);
+}
+
+/**
+ * Compute the squared L2 distance between a vector and a bfloat16 one
+ */
+inline float l2_square_bf16(const float * a, const uint16_t * b, int d) {
+	static const l2_square_half_t kernel = l2_select_half(SC_RAW_BF16);
+	return kernel(a,b,d);
+}
+
+/**
+ * Compute the squared L2 distance between a vector and a vector of bytes
+ */
+inline float l2_square_uint8(const float * a, const unsigned char * b, int d) {
+	static const l2_square_uint8_t kernel = l2_select_uint8();
+	return kernel(a,b,d);
+}
+
+/**
+ * The raw vectors of the database, for the exact distances.
+ * They are either converted into memory (any .fvecs/.bvecs/.ivecs-like
+ * file, see load) or mapped from a .fvecs or a .bvecs file (see map), in
+ * which case only the pages of the re-ranked vectors are ever read.
+ * A vector is stored as float32, fp16, bf16 or uint8 (see SC_RAW_FLOAT):
+ * the distances are computed on the stored type, never widened in memory.
+ * A SIFT1B base takes 128 GB as uint8 or 256 GB as fp16 instead of 512 GB.
+ * A vector is found at data + id * stride bytes, with the 64-bit product.
+ */
+class BaseVectors {
+public:
+	BaseVectors() {
+		own = nullptr;
+		data = nullptr;
+		mapped = nullptr;
+		mapped_size = 0;
+		stride = 0;
+		type = SC_RAW_FLOAT;
+		dim = 0;
+		n = 0;
+	}
+	virtual ~BaseVectors() {
+		release();
+	}
+
+	/**
+	 * Convert a file of vectors into memory, directly into the storage type
+	 * @param filename the file
+	 * @param offset the size of the header of each vector in bytes
+	 * @param d the dimension
+	 * @param verbose enable verbose mode
+	 * @param type the storage type (see SC_RAW_FLOAT)
+	 * @return the number of vectors
+	 */
+	template<typename DataType>
+	inline idx_t load(const char * filename, int offset, int d, bool verbose,
+			int type = SC_RAW_FLOAT) {
+#ifdef _WIN32
+		return 0;
+#else
+		release();
+		if(d <= 0 || filename == nullptr || type < SC_RAW_FLOAT || type > SC_RAW_UINT8) {
+			cerr << "Defective data!" << endl;
+			exit(EXIT_FAILURE);
+		}
+		int fd = open(filename, O_RDONLY);
+		if(fd < 0) {
+			cerr << "Cannot open the file " << filename << endl;
+			exit(EXIT_FAILURE);
+		}
+		size_t f_size = get_file_size(filename);
+		unsigned char * m = (unsigned char *)mmap(0, f_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(m == MAP_FAILED) {
+			cerr << "Cannot map the file " << filename << endl;
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		madvise(m,f_size,MADV_SEQUENTIAL);
+		size_t row = static_cast<size_t>(d) * sizeof(DataType) + offset,
+				total_row = f_size / row;
+		this->type = type;
+		dim = d;
+		stride = static_cast<size_t>(d) * raw_type_size(type);
+		SimpleCluster::init_array(own,total_row * stride);
+		long long i;
+		// Each row is converted on its own: no float32 copy of the base
+#pragma omp parallel
+		{
+			float * v;
+			DataType f;
+			SimpleCluster::init_array(v,d);
+			int j;
+#pragma omp for
+			for(i = 0; i < static_cast<long long>(total_row); i++) {
+				const unsigned char * src = m + i * row + offset;
+				for(j = 0; j < d; j++) {
+					memcpy(&f,src + j * sizeof(DataType),sizeof(DataType));
+					v[j] = static_cast<float>(f);
+				}
+				raw_encode(v,own + i * stride,d,type);
+			}
+			::delete v;
+		}
+		if(munmap(m,f_size) != 0) {
+			cerr << "Cannot munmap file" << endl;
+			exit(EXIT_FAILURE);
+		}
+		data = own;
+		n = static_cast<idx_t>(total_row);
+		if(verbose)
+			cout << "Loaded " << n << " raw vectors from " << filename
+					<< " (" << memory() << " bytes)" << endl;
+		return n;
+#endif
+	}
+
+	/**
+	 * Map a .fvecs file (every vector is its dimension then d floats) or a
+	 * .bvecs file (its dimension then d bytes, kept as SC_RAW_UINT8)
+	 * @param filename the file
+	 * @param d the dimension
+	 * @param verbose enable verbose mode
+	 * @param type SC_RAW_FLOAT for a .fvecs file, SC_RAW_UINT8 for a .bvecs one
+	 * @return the number of vectors
+	 */
+	inline idx_t map(const char * filename, int d, bool verbose, int type = SC_RAW_FLOAT) {
+#ifdef _WIN32
+		return 0;
+#else
+		release();
+		if(type != SC_RAW_FLOAT && type != SC_RAW_UINT8) {
+			cerr << "Only .fvecs and .bvecs files can be mapped" << endl;
+			exit(EXIT_FAILURE);
+		}
+		int fd = open(filename, O_RDONLY);
+		if(fd < 0) {
+			cerr << "Cannot open the file " << filename << endl;
+			exit(EXIT_FAILURE);
+		}
+		struct stat s;
+		if(fstat(fd, &s) < 0) {
+			cerr << "Cannot get statistics of file " << filename << endl;
+			exit(EXIT_FAILURE);
+		}
+		size_t f_size = s.st_size,
+				row = static_cast<size_t>(d) * raw_type_size(type) + sizeof(int);
+		int header = 0;
+		if(f_size == 0 || f_size % row != 0
+				|| pread(fd,&header,sizeof(int),0) != sizeof(int) || header != d) {
+			cerr << "The file " << filename << " is not a "
+					<< (type == SC_RAW_UINT8 ? ".bvecs" : ".fvecs")
+					<< " file of dimension " << d << endl;
+			exit(EXIT_FAILURE);
+		}
+		unsigned char * m = (unsigned char *)mmap(0, f_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(m == MAP_FAILED) {
+			cerr << "Cannot map the file " << filename << endl;
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		// The re-ranked vectors are scattered: no read-ahead
+		madvise(m,f_size,MADV_RANDOM);
+		mapped = m;
+		mapped_size = f_size;
+		data = m + sizeof(int);
+		stride = row;
+		this->type = type;
+		dim = d;
+		n = static_cast<idx_t>(f_size / row);
+		if(verbose)
+			cout << "Mapped " << n << " raw vectors from " << filename << endl;
+		return n;
+#endif
+	}
+
+	/**
+	 * The squared L2 distance between a vector and a raw vector
+	 * @param query the vector, dimension() floats
+	 * @param id the identifier of the raw vector
+	 */
+	inline float distance(const float * query, idx_t id) const {
+		const unsigned char * v = data + static_cast<size_t>(id) * stride;
+		switch(type) {
+		case SC_RAW_FP16:
+			return l2_square_fp16(query,reinterpret_cast<const uint16_t *>(v),dim);
+		case SC_RAW_BF16:
+			return l2_square_bf16(query,reinterpret_cast<const uint16_t *>(v),dim);
+		case SC_RAW_UINT8:
+			return l2_square_uint8(query,v,dim);
+		default:
+			return l2_square(query,reinterpret_cast<const float *>(v),dim);
+		}
+	}
+
+	/**
+	 * Request the cache lines of a raw vector before it is read
+	 */
+	inline void prefetch(idx_t id) const {
+		const unsigned char * p = data + static_cast<size_t>(id) * stride;
+		const unsigned char * end = p + static_cast<size_t>(dim) * raw_type_size(type);
+		for(; p < end; p += 64)
+			__builtin_prefetch(p,0,0);
+		__builtin_prefetch(end - 1,0,0);
+	}
+
+	inline bool loaded() const {
+		return data != nullptr;
+	}
+
+	/**
+	 * The number of vectors
+	 */
+	inline idx_t size() const {
+		return n;
+	}
+
+	inline int dimension() const {
+		return dim;
+	}
+
+	/**
+	 * The storage type (see SC_RAW_FLOAT)
+	 */
+	inline int storage() const {
+		return type;
+	}
+
+	/**
+	 * The memory of the vectors in bytes (the size of the file if it is mapped)
+	 */
+	inline size_t memory() const {
+		return mapped != nullptr ? mapped_size : static_cast<size_t>(n) * stride;
+	}
+
+private:
+	unsigned char * own; // the converted vectors, if they are not mapped
+	const unsigned char * data; // the first vector
+	unsigned char * mapped; // the mapped file, if any
+	size_t mapped_size;
+	size_t stride; // the distance between two vectors in bytes
+	int type; // the storage type
+	int dim;
+	idx_t n;
+
+	BaseVectors(const BaseVectors&);
+	BaseVectors& operator=(const BaseVectors&);
+
+	inline void release() {
+#ifndef _WIN32
+		if(mapped != nullptr)
+			munmap(mapped,mapped_size);
+#endif
+		::delete own;
+		own = nullptr;
+		data = nullptr;
+		mapped = nullptr;
+		mapped_size = 0;
+		stride = 0;
+		type = SC_RAW_FLOAT;
+		dim = 0;
+		n = 0;
+	}
+};
+
+/**
+ * Score a short list with the exact distances.
+ * The raw vectors are scattered over the database, so the vector of
+ * the candidate i + SC_RERANK_PREFETCH is requested while the candidate i
+ * is scored: the cache misses of the gather overlap with the arithmetic.
+ * @param query the query vector
+ * @param base the raw vectors
+ * @param ids the identifiers of the candidates
+ * @param k the number of candidates
+ * @param top receives the candidates with their exact distances
+ */
+inline void exact_rerank(const float * query, const BaseVectors& base,
+		const idx_t * ids, int k, TopR& top) {
+	const int p = SC_RERANK_PREFETCH;
+	int i;
+	for(i = 0; i < k && i < p; i++)
+		base.prefetch(ids[i]);
+	for(i = 0; i < k; i++) {
+		if(i + p < k)
+			base.prefetch(ids[i + p]);
+		top.push(base.distance(query,ids[i]),ids[i]);
+	}
+}
+
+} /* namespace SC */
+
+#endif /* SC_RERANK_H_ */
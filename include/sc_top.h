@@ -0,0 +1,190 @@
+/*
+ * sc_top.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SC_TOP_H_
+#define SC_TOP_H_
+
+#include <iostream>
+#include <cfloat>
+#include "sc_utilities.h"
+
+using namespace std;
+
+namespace SC {
+
+/**
+ * A bounded collector of the R nearest candidates of a query.
+ * The candidates are kept in a max-heap of capacity R, so the scan kernels
+ * feed their distances straight into it: a candidate that is not closer than
+ * the current R-th one is rejected by a single comparison, and nothing is
+ * allocated once the capacity has been reached.
+ */
+class TopR {
+public:
+	TopR() {
+		hd = nullptr;
+		hid = nullptr;
+		n = R = capacity = 0;
+	}
+	virtual ~TopR() {
+		::delete hd;
+		::delete hid;
+		hd = nullptr;
+		hid = nullptr;
+	}
+
+	/**
+	 * Start a new query
+	 * @param r the number of candidates to be kept
+	 */
+	inline void reset(int r) {
+		if(r > capacity) {
+			::delete hd;
+			::delete hid;
+			SimpleCluster::init_array(hd,r);
+			SimpleCluster::init_array(hid,r);
+			capacity = r;
+		}
+		R = r > 0 ? r : 0;
+		n = 0;
+	}
+
+	/**
+	 * The distance that a candidate must beat to be kept
+	 */
+	inline float threshold() const {
+		return n < R ? FLT_MAX : hd[0];
+	}
+
+	/**
+	 * The number of candidates kept so far
+	 */
+	inline int size() const {
+		return n;
+	}
+
+	/**
+	 * Offer a candidate
+	 * @param d the distance
+	 * @param id the identifier
+	 */
+	inline void push(float d, idx_t id) {
+		if(n < R) {
+			// Sift up
+			int i = n++, p;
+			while(i > 0) {
+				p = (i - 1) >> 1;
+				if(hd[p] >= d) break;
+				hd[i] = hd[p];
+				hid[i] = hid[p];
+				i = p;
+			}
+			hd[i] = d;
+			hid[i] = id;
+		} else if(R > 0 && d < hd[0]) {
+			sift_down(d,id);
+		}
+	}
+
+	/**
+	 * Offer the candidates of a scanned bucket
+	 * @param d the distances
+	 * @param ids the identifiers
+	 * @param m the number of candidates
+	 */
+	inline void push(const float * d, const idx_t * ids, size_t m) {
+		size_t j = 0;
+		for(; j < m && n < R; j++)
+			push(d[j],ids[j]);
+		if(R == 0) return;
+		// The heap is full: most of the candidates fail the threshold
+		float t = hd[0];
+		for(; j < m; j++) {
+			if(d[j] < t) {
+				sift_down(d[j],ids[j]);
+				t = hd[0];
+			}
+		}
+	}
+
+	/**
+	 * Offer the candidates of a scanned bucket, identified by their positions
+	 * @param d the distances
+	 * @param first the position of the first candidate
+	 * @param m the number of candidates
+	 */
+	inline void push(const float * d, idx_t first, size_t m) {
+		size_t j = 0;
+		for(; j < m && n < R; j++)
+			push(d[j],first + static_cast<idx_t>(j));
+		if(R == 0) return;
+		float t = hd[0];
+		for(; j < m; j++) {
+			if(d[j] < t) {
+				sift_down(d[j],first + static_cast<idx_t>(j));
+				t = hd[0];
+			}
+		}
+	}
+
+	/**
+	 * Write out the candidates sorted by distance. The heap is consumed.
+	 * @param result the R identifiers, -1 if there are less than R candidates
+	 * @param dist the R distances, FLT_MAX if there are less than R candidates
+	 * @return the number of candidates
+	 */
+	inline int finish(idx_t * result, float * dist) {
+		int i, m = n;
+		// Heap sort: the largest distance goes to the end
+		for(i = m - 1; i > 0; i--) {
+			float d = hd[i];
+			idx_t id = hid[i];
+			hd[i] = hd[0];
+			hid[i] = hid[0];
+			n = i;
+			sift_down(d,id);
+		}
+		for(i = 0; i < m; i++) {
+			result[i] = hid[i];
+			dist[i] = hd[i];
+		}
+		for(i = m; i < R; i++) {
+			result[i] = -1;
+			dist[i] = FLT_MAX;
+		}
+		n = 0;
+		return m;
+	}
+
+private:
+	float * hd; // the distances of the heap
+	idx_t * hid; // the identifiers of the heap
+	int n, R, capacity;
+
+	TopR(const TopR&);
+	TopR& operator=(const TopR&);
+
+	/**
+	 * Put a candidate at the root, in place of the farthest one,
+	 * and restore the heap of the n first elements
+	 */
+	inline void sift_down(float d, idx_t id) {
+		int i = 0, c;
+		while((c = (i << 1) + 1) < n) {
+			if(c + 1 < n && hd[c + 1] > hd[c]) c++;
+			if(hd[c] <= d) break;
+			hd[i] = hd[c];
+			hid[i] = hid[c];
+			i = c;
+		}
+		hd[i] = d;
+		hid[i] = id;
+	}
+};
+
+} /* namespace SC */
+
+#endif /* SC_TOP_H_ */
@@ -22,6 +22,8 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
+#include <cerrno>
 #include <climits>
 #include <cfloat>
 #ifdef _WIN32
@@ -38,11 +40,14 @@
 #include <omp.h>
 #endif
 #include <utilities.h>
+#include "sc_heap.h"
 
 using namespace std;
 
 namespace SC {
 typedef unsigned short ushort;
+// The coarse center ids of the encoders: kc may exceed 2^16 (see HierarchicalCQ)
+typedef uint32_t cid_t;
 
 /**
  * A projective function
@@ -114,6 +119,50 @@ inline size_t get_file_size(const char * filename) {
 	return size;
 }
 
+#ifndef _WIN32
+/**
+ * Read n bytes at a given position of a file, retrying on partial reads
+ * @param fd the file descriptor
+ * @param buf the output buffer
+ * @param n the number of bytes
+ * @param pos the position in the file
+ */
+inline void read_all(int fd, unsigned char * buf, size_t n, size_t pos) {
+	ssize_t r;
+	while(n > 0) {
+		r = pread(fd, buf, n, pos);
+		if(r <= 0) {
+			if(r < 0 && errno == EINTR) continue;
+			cerr << "Cannot read from file" << endl;
+			exit(EXIT_FAILURE);
+		}
+		buf += r;
+		pos += r;
+		n -= r;
+	}
+}
+
+/**
+ * Append n bytes to a file, retrying on partial writes
+ * @param fd the file descriptor
+ * @param buf the data
+ * @param n the number of bytes
+ */
+inline void write_all(int fd, const unsigned char * buf, size_t n) {
+	ssize_t r;
+	while(n > 0) {
+		r = write(fd, buf, n);
+		if(r <= 0) {
+			if(r < 0 && errno == EINTR) continue;
+			cerr << "Cannot write to file" << endl;
+			exit(EXIT_FAILURE);
+		}
+		buf += r;
+		n -= r;
+	}
+}
+#endif
+
 /**
  * An utility to find the extension of file
  * @param filename the path to file
@@ -151,13 +200,13 @@ inline int vector_hash(
  * @param code the vector
  * @param size the dimensionality of the vector
  * @param base the base value
- * @return the conversion result as an integer
+ * @return the conversion result as a long integer
  */
-inline int vector_base(
-		ushort * code,
+inline size_t vector_base(
+		const cid_t * code,
 		int size,
-		int base) {
-	int seed = 0;
+		size_t base) {
+	size_t seed = 0;
 	for(int i = 0; i < size; i++) {
 		seed *= base;
 		seed += code[i];
@@ -173,10 +222,10 @@ inline int vector_base(
  * @return the conversion result as a long integer
  */
 inline size_t vector_base(
-		int * code,
+		const size_t * code,
 		int size,
-		int base) {
-	int seed = 0;
+		size_t base) {
+	size_t seed = 0;
 	for(int i = 0; i < size; i++) {
 		seed *= base;
 		seed += code[i];
@@ -184,6 +233,23 @@ inline size_t vector_base(
 	return seed;
 }
 
+/**
+ * The number of buckets of an inverted file: base^size
+ * @param base the number of values of a coarse code
+ * @param size the number of coarse codes of a bucket
+ * @return base^size, or 0 if it does not fit in a size_t
+ */
+inline size_t bucket_count(
+		size_t base,
+		int size) {
+	size_t n = 1;
+	for(int i = 0; i < size; i++) {
+		if(base != 0 && n > SIZE_MAX / base) return 0;
+		n *= base;
+	}
+	return n;
+}
+
 /**
  * Convert a number into a vector of defined base
  * @param v the input number
@@ -205,475 +271,6 @@ inline void vector_convert(
 	}
 }
 
-/**
- * Swap two integer by xor operations
- * @param a,b input number
- */
-inline void swap_xor(int& a, int& b) {
-	a ^= b;
-	b ^= a;
-	a ^= b;
-}
-
-/**
- * An utility to insert elements into a priority queue.
- * The priority queue is implemented by an array of float values.
- * @param heap the priority queue
- * @param hid the corresponding identifiers
- * @param data the value to be inserted
- * @param id the identifier of the data
- * @param pos the position of the data that is inserted
- * @param max_size the capacity of the heap
- * @verbose to see some log messages
- */
-inline void pq_insert(
-		float * heap,
-		int * hid,
-		float data,
-		int id,
-		int& pos,
-		int max_size,
-		bool verbose) {
-	if(pos >= max_size || pos < 0) {
-		if(verbose)
-			cerr << "Heap's full or pos is negative" << endl;
-		return;
-	}
-
-	heap[pos] = data;
-	hid[pos] = id;
-	pos++;
-	int i = pos - 1, j = i >> 1;
-	while(i > 0) {
-		if(heap[i] < heap[j]) {
-			// swapping data
-			data = heap[j];
-			heap[j] = heap[i];
-			heap[i] = data;
-			// swapping id
-			swap_xor(hid[i],hid[j]);
-		} else break;
-		i = j;
-		j = i >> 1;
-	}
-}
-
-/**
- * Pop a value and its identifier from the priority queue
- * @param heap the priority queue
- * @param hid the identifiers
- * @param curpos the current capacity of the heap
- * @param verbose to enable verbose mode
- * @return the identifier of popped data
- */
-inline int pq_pop(
-		float * heap,
-		int * hid,
-		int& curpos,
-		bool verbose) {
-	if(curpos <= 0)
-		exit(EXIT_FAILURE);
-	int tmp = hid[0];
-	float tmp2;
-	heap[0] = heap[curpos - 1];
-	hid[0] = hid[--curpos];
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			swap_xor(hid[i],hid[max]);
-			// swapping data
-			tmp2 = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp2;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-	return tmp;
-}
-
-/**
- * An utility to insert elements into a priority queue.
- * The priority queue is implemented by an array of float values.
- * Each data in the priority queue has many identifiers.
- * @param heap the priority queue
- * @param hid the corresponding identifiers
- * @param hs the number of identifiers that assigned into each data
- * @param data the value to be inserted
- * @param id the identifier of the data
- * @param pos the position of the data that is inserted
- * @param max_size the capacity of the heap
- * @verbose to see some log messages
- */
-inline void pq_insert_m(
-		float * heap,
-		int ** hid,
-		int * id,
-		int hs,
-		float data,
-		int &pos,
-		int max_size,
-		bool verbose) {
-	if(pos >= max_size || pos < 0 || hs < 0) {
-		cerr << "Heap's full or pos is negative:pos=" << pos << endl;
-		return;
-	}
-
-	heap[pos] = data;
-	for(int l = 0; l < hs; l++) {
-		hid[l][pos] = id[l];
-	}
-	pos++;
-	int i = pos - 1, j = i >> 1;
-	while(i > 0) {
-		if(heap[i] < heap[j]) {
-			// swapping data
-			data = heap[j];
-			heap[j] = heap[i];
-			heap[i] = data;
-			// swapping id
-			for(int l = 0; l < hs; l++) {
-				swap_xor(hid[l][i],hid[l][j]);
-			}
-		} else break;
-		i = j;
-		j = i >> 1;
-	}
-}
-
-/**
- * Pop a value and its identifier from the priority queue
- * @param heap the priority queue
- * @param hid the identifiers
- * @param hs the number of identifiers that are assigned into each data
- * @param curpos the current capacity of the heap
- * @param id the identifiers that are popped
- * @param v output value
- * @param verbose to enable verbose mode
- * @return the identifier of popped data
- */
-inline void pq_pop_m(
-		float * heap,
-		int ** hid,
-		int hs,
-		int& curpos,
-		int *& id,
-		float& v,
-		bool verbose) {
-	if(curpos <= 0)
-		return;
-
-	for(int l = 0; l < hs; l++) {
-		id[l] = hid[l][0];
-	}
-	v = heap[0];
-
-	float tmp;
-	heap[0] = heap[curpos - 1];
-	for(int l = 0; l < hs; l++) {
-		hid[l][0] = hid[l][curpos - 1];
-	}
-	--curpos;
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			for(int l = 0; l < hs; l++) {
-				swap_xor(hid[l][i],hid[l][max]);
-			}
-			// swapping data
-			tmp = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-}
-
-inline void pq_insert2(float * heap, int * hid, int * hid2,
-		float data, int id, int id2,
-		int& pos, int max_size, bool verbose) {
-	if(pos >= max_size || pos < 0) {
-		if(verbose)
-			cerr << "Heap's full or pos is negative:pos=" << pos << endl;
-		return;
-	}
-
-	heap[pos] = data;
-	hid[pos] = id;
-	hid2[pos] = id2;
-	pos++;
-	int i = pos - 1, j = i >> 1;
-	while(i > 0) {
-		if(heap[i] < heap[j]) {
-			// swapping data
-			data = heap[j];
-			heap[j] = heap[i];
-			heap[i] = data;
-			// swapping id
-			swap_xor(hid[i],hid[j]);
-			// swapping id2
-			swap_xor(hid2[i],hid2[j]);
-		} else break;
-		i = j;
-		j = i >> 1;
-	}
-}
-
-inline void pq_pop2(float * heap, int * hid, int * hid2,
-		int& curpos, int& id, int& id2, bool verbose) {
-	if(curpos <= 0)
-		return;
-	id = hid[0];
-	id2 = hid2[0];
-	float tmp3;
-	heap[0] = heap[curpos - 1];
-	hid[0] = hid[curpos - 1];
-	hid2[0] = hid2[--curpos];
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			swap_xor(hid[i],hid[max]);
-			swap_xor(hid2[i],hid2[max]);
-			// swapping data
-			tmp3 = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp3;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-}
-
-inline void pq_insert4(
-		float * heap,
-		int * hid1, int * hid2, int * hid3, int * hid4,
-		float data,
-		int h1, int h2, int h3, int h4,
-		int& pos, int max_size, bool verbose) {
-	if(pos >= max_size || pos < 0) {
-		if(verbose)
-			cerr << "Heap's full or pos is negative:pos=" << pos << endl;
-		return;
-	}
-
-	heap[pos] = data;
-	hid1[pos] = h1;
-	hid2[pos] = h2;
-	hid3[pos] = h3;
-	hid4[pos] = h4;
-	pos++;
-	int i = pos - 1, j = i >> 1;
-	while(i > 0) {
-		if(heap[i] < heap[j]) {
-			// swapping data
-			data = heap[j];
-			heap[j] = heap[i];
-			heap[i] = data;
-			// swapping id
-			swap_xor(hid1[i],hid1[j]);
-			swap_xor(hid2[i],hid2[j]);
-			swap_xor(hid3[i],hid3[j]);
-			swap_xor(hid4[i],hid4[j]);
-		} else break;
-		i = j;
-		j = i >> 1;
-	}
-}
-
-inline void pq_insert6(
-		float * heap,
-		int * hid1, int * hid2, int * hid3, int * hid4,
-		int * hid5, int * hid6,
-		float data,
-		int h1, int h2, int h3, int h4, int h5, int h6,
-		int& pos, int max_size, bool verbose) {
-	if(pos >= max_size || pos < 0) {
-		if(verbose)
-			cerr << "Heap's full or pos is negative:pos=" << pos << endl;
-		return;
-	}
-
-	heap[pos] = data;
-	hid1[pos] = h1;
-	hid2[pos] = h2;
-	hid3[pos] = h3;
-	hid4[pos] = h4;
-	hid5[pos] = h5;
-	hid6[pos] = h6;
-	pos++;
-	int i = pos - 1, j = i >> 1;
-	while(i > 0) {
-		if(heap[i] < heap[j]) {
-			// swapping data
-			data = heap[j];
-			heap[j] = heap[i];
-			heap[i] = data;
-			// swapping id
-			swap_xor(hid1[i],hid1[j]);
-			swap_xor(hid2[i],hid2[j]);
-			swap_xor(hid3[i],hid3[j]);
-			swap_xor(hid4[i],hid4[j]);
-			swap_xor(hid5[i],hid5[j]);
-			swap_xor(hid6[i],hid6[j]);
-		} else break;
-		i = j;
-		j = i >> 1;
-	}
-}
-
-inline void pq_pop4(
-		float * heap,
-		int * hid1, int * hid2, int * hid3, int * hid4,
-		int& h1, int& h2, int &h3, int& h4,
-		int& curpos, bool verbose) {
-	if(curpos <= 0)
-		return;
-	h1 = hid1[0];
-	h2 = hid2[0];
-	h3 = hid3[0];
-	h4 = hid4[0];
-	float tmp;
-	heap[0] = heap[curpos - 1];
-	hid1[0] = hid1[curpos - 1];
-	hid2[0] = hid2[curpos - 1];
-	hid3[0] = hid3[curpos - 1];
-	hid4[0] = hid4[--curpos];
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			swap_xor(hid1[i],hid1[max]);
-			swap_xor(hid2[i],hid2[max]);
-			swap_xor(hid3[i],hid3[max]);
-			swap_xor(hid4[i],hid4[max]);
-			// swapping data
-			tmp = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-}
-
-inline void pq_pop4_f(
-		float * heap,
-		int * hid1, int * hid2, int * hid3, int * hid4,
-		int& h1, int& h2, int &h3, int& h4, float& v,
-		int& curpos, bool verbose) {
-	if(curpos <= 0)
-		return;
-	h1 = hid1[0];
-	h2 = hid2[0];
-	h3 = hid3[0];
-	h4 = hid4[0];
-	v = heap[0];
-	float tmp;
-	heap[0] = heap[curpos - 1];
-	hid1[0] = hid1[curpos - 1];
-	hid2[0] = hid2[curpos - 1];
-	hid3[0] = hid3[curpos - 1];
-	hid4[0] = hid4[--curpos];
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			swap_xor(hid1[i],hid1[max]);
-			swap_xor(hid2[i],hid2[max]);
-			swap_xor(hid3[i],hid3[max]);
-			swap_xor(hid4[i],hid4[max]);
-			// swapping data
-			tmp = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-}
-
-inline void pq_pop6(
-		float * heap,
-		int * hid1, int * hid2, int * hid3, int * hid4,
-		int * hid5, int * hid6,
-		int& h1, int& h2, int &h3, int& h4, int& h5, int& h6,
-		int& curpos, bool verbose) {
-	if(curpos <= 0)
-		return;
-	h1 = hid1[0];
-	h2 = hid2[0];
-	h3 = hid3[0];
-	h4 = hid4[0];
-	h5 = hid5[0];
-	h6 = hid6[0];
-	float tmp;
-	heap[0] = heap[curpos - 1];
-	hid1[0] = hid1[curpos - 1];
-	hid2[0] = hid2[curpos - 1];
-	hid3[0] = hid3[curpos - 1];
-	hid4[0] = hid4[curpos - 1];
-	hid5[0] = hid5[curpos - 1];
-	hid6[0] = hid6[--curpos];
-	int i = 0, j = i << 1, max;
-	while(j + 1 < curpos) {
-		if(heap[j] < heap[j+1]) {
-			max = j;
-		} else {
-			max = j + 1;
-		}
-
-		if(heap[max] < heap[i]) {
-			// swapping id
-			swap_xor(hid1[i],hid1[max]);
-			swap_xor(hid2[i],hid2[max]);
-			swap_xor(hid3[i],hid3[max]);
-			swap_xor(hid4[i],hid4[max]);
-			swap_xor(hid5[i],hid5[max]);
-			swap_xor(hid6[i],hid6[max]);
-			// swapping data
-			tmp = heap[i];
-			heap[i] = heap[max];
-			heap[max] = tmp;
-			i = max;
-		} else break;
-		j = i << 1;
-	}
-}
-
 /**
  * The linear search
  * @param data the input data
@@ -711,8 +308,7 @@ inline int linear_search(
  * @param data the input data
  * @param query the query data
  * @param v_tmp a temporary array
- * @param heap a priority queue
- * @param hid the identifiers of the data in the priority queue
+ * @param heap the storage of a priority queue, MinHeap4<HeapEntry>::bytes(k) bytes
  * @param ans the result
  * @param N the size of the data
  * @param d the dimensionality of the vectors
@@ -724,15 +320,14 @@ inline void linear_knn(
 		DataType * data,
 		DataType * query,
 		float * v_tmp,
-		float * heap,
-		int * hid,
+		unsigned char * heap,
 		int * ans,
 		int N,
 		int d,
 		int k,
 		bool verbose) {
 	DataType * tmp = data;
-	int i, pos = 0;
+	int i;
 	for(i = 0; i < N; i++) {
 		v_tmp[i] = v_tmp[i+N] =
 				SimpleCluster::distance_l2_square<DataType>(query,tmp,d);
@@ -740,15 +335,18 @@ inline void linear_knn(
 	}
 	nth_element(v_tmp+N,v_tmp+N+k-1,v_tmp+(N<<1));
 	float d_tmp = v_tmp[N+k-1];
+	MinHeap4<HeapEntry> pq(heap,k);
+	HeapEntry e;
 	for(i = 0; i < N; i++) {
 		if(v_tmp[i] <= d_tmp) {
-			pq_insert(heap,hid,v_tmp[i],i,pos,k,verbose);
+			e.key = v_tmp[i];
+			e.id = i;
+			if(!pq.push(e) && verbose)
+				cerr << "Heap's full" << endl;
 		}
 	}
-	pos = k;
-	for(i = 0; i < k; i++) {
-		ans[i] = pq_pop(heap,hid,pos,verbose);
-	}
+	for(i = 0; i < k; i++)
+		ans[i] = pq.pop(e) ? e.id : -1;
 }
 
 /**
@@ -787,6 +385,17 @@ inline void strip_matrix(
 	if(verbose)
 		cout << "Stripped " << base << " components" << endl;
 }
+/**
+ * The type of the vector identifiers, the offsets into the inverted file
+ * and the number of vectors.
+ * Define SC_LARGE_INDEX to index more than 2^31 vectors.
+ */
+#ifdef SC_LARGE_INDEX
+typedef int64_t idx_t;
+#else
+typedef int idx_t;
+#endif
+
 /**
  * Configuration structure
  * @param N the number of data
@@ -799,7 +408,8 @@ inline void strip_matrix(
  * @param db_prefix the prefix of DB files
  */
 typedef struct {
-	int N, kc, kp, mc, mp, w, dim, T, L;
+	idx_t N;
+	int kc, kp, mc, mp, w, dim, T, L;
 	char db_prefix[256];
 	char db_path[256];
 }PQConfig;
@@ -814,7 +424,7 @@ typedef struct {
  * @return the number of records that are loaded
  */
 template<typename DataType>
-inline int load_data(
+inline idx_t load_data(
 		const char * filename,
 		DataType *& data,
 		int header,
@@ -847,7 +457,7 @@ inline int load_data(
 
 	size_t i, base = header, count = 0;
 	DataType f[1];
-	size_t d1 = d * sizeof(DataType) + header;
+	size_t d1 = static_cast<size_t>(d) * sizeof(DataType) + header;
 	unsigned char uc, buf[sizeof(DataType)];
 	size_t total_row = size / d1;
 	data = (DataType *)::operator new(total_row * d * sizeof(DataType));
@@ -1075,7 +685,7 @@ inline size_t save_data(
  * @return the number of records that are read
  */
 template<typename DataType1, typename DataType2>
-inline int load_and_convert_data(
+inline idx_t load_and_convert_data(
 		const char * filename,
 		DataType2 *& data,
 		int header,
@@ -1111,7 +721,7 @@ inline int load_and_convert_data(
 	size_t count = 0;
 	DataType1 f[1];
 	DataType2 f2;
-	size_t d1 = d * sizeof(DataType1) + header;
+	size_t d1 = static_cast<size_t>(d) * sizeof(DataType1) + header;
 	unsigned char buf[sizeof(DataType1)];
 	size_t total_row = size / d1;
 	data = (DataType2 *)::operator new(total_row * d * sizeof(DataType2));
@@ -0,0 +1,104 @@
+/*
+ * search_context.h
+ *
+ *  Created on: 2026/10/17
+ */
+
+#ifndef SEARCH_CONTEXT_H_
+#define SEARCH_CONTEXT_H_
+
+#include <iostream>
+#include <cstdint>
+#include "sc_utilities.h"
+#include "sc_top.h"
+#include "sc_adc.h"
+#include "sc_multiseq.h"
+
+using namespace std;
+
+// The number of candidates scored per call of the ADC scan kernel
+#ifndef SC_SCAN_CHUNK
+#define SC_SCAN_CHUNK 1024
+#endif
+
+namespace SC {
+
+/**
+ * The query dependent state of a search.
+ * The index (codebooks, codes and the precomputed tables) is shared
+ * by all threads, while each thread owns one SearchContext.
+ */
+class SearchContext {
+public:
+	float * diff_qc; // query-to-coarse table; size: mc * kc
+	float * diff_qr; // query-to-product table; size: mp * kp
+	float * adc_table; // merged ADC table of a bucket; size: mp * kp
+	float * dot_table; // center-to-product table of a bucket, without dot_cr; size: mp * kp
+	unsigned char * lut; // quantized fast-scan table; size: 2 * ceil(mp/2) * 16
+	uint16_t * fs_dist; // quantized fast-scan distances
+	size_t fs_capacity; // the capacity of fs_dist
+	float * real_dist; // exact distances; size: N
+	float * refine_table; // query-to-refinement table; size: mr * kr
+	size_t refine_capacity; // the capacity of refine_table
+	float * v_tmp; // coarse distances; size: kc
+	int * buckets; // coarse identifiers; size: kc
+	float * dist; // candidate distances of a chunk of a bucket
+	idx_t * result; // candidate identifiers
+	size_t capacity; // the capacity of dist and result
+	TopR top; // the R nearest candidates of the current query
+
+	SearchContext();
+	SearchContext(const PQConfig&);
+	virtual ~SearchContext();
+	void init(const PQConfig&);
+	void reserve(size_t);
+	void reserve_fs(size_t);
+	void reserve_refine(size_t);
+	void scan(const unsigned char *, const idx_t *, size_t, int, int, float);
+	void scan(const unsigned char *, idx_t, size_t, int, int, float);
+private:
+	SearchContext(const SearchContext&);
+	SearchContext& operator=(const SearchContext&);
+	void clear();
+};
+
+/**
+ * A SearchContext that also owns the scratch arrays of the cell
+ * traversals of MultiQuery and SCQuery, so that a search only takes
+ * the query, the workspace, its parameters and the output.
+ * The fixed arrays are carved out of a single allocation, each one
+ * starting on its own cache line. The frontier and the traversed cells
+ * are sized for w cells: they only grow on the query path when a
+ * traversal crosses more empty cells than that.
+ */
+class SearchWorkspace : public SearchContext {
+public:
+	float * coarse; // sorted coarse distances; size: mc * kc
+	int * coarse_id; // sorted coarse identifiers; size: mc * kc
+	float * q; // squared norms of the sub-queries; size: mc
+	unsigned char * heap; // the frontier of the traversal; size: ms_heap_bytes(D, heap_cap)
+	int * visited; // the coarse identifiers of the visited non-empty cells; size: D * w
+	CellSet cells; // the traversed cells of the current query
+	int D; // the number of coordinates of a cell
+	size_t n_cells; // kc^D
+	size_t n_cache; // the maximum number of traversed cells of a query
+	size_t heap_cap;
+	int w, R;
+	int sum; // the candidates in the visited cells of the last search
+	int empty; // the empty cells popped by the last search
+	double t1, t2; // the clock ticks spent in the pre-computation and the coarse sorting
+
+	SearchWorkspace();
+	SearchWorkspace(const PQConfig&, int, size_t, int, int);
+	virtual ~SearchWorkspace();
+	void init(const PQConfig&, int, size_t, int, int);
+	bool fits(size_t, int, int, int) const;
+private:
+	unsigned char * arena; // the single allocation behind all the arrays
+	SearchWorkspace(const SearchWorkspace&);
+	SearchWorkspace& operator=(const SearchWorkspace&);
+};
+
+} /* namespace SC */
+
+#endif /* SEARCH_CONTEXT_H_ */
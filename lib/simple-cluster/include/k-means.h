@@ -41,6 +41,11 @@
 #include <omp.h>
 #endif
 
+// Define KMEANS_BLAS (and link a CBLAS) to assign the points with sgemm
+#ifdef KMEANS_BLAS
+#include <cblas.h>
+#endif
+
 #ifndef FLT_MAX
 #define FLT_MAX 3.40282346638528859812e+38F
 #endif
@@ -67,9 +72,19 @@ enum class KmeansAssignType {
 enum class KmeansType {
 	RANDOM_SEEDS, // randomly generated seeds
 	KMEANS_PLUS_SEEDS, // k-means++
+	KMEANS_PARALLEL_SEEDS, // k-means||: k-means++ in a few parallel rounds
 	USER_SEEDS // take the seeds from input
 };
 
+/**
+ * Types of the k-means training
+ */
+enum class KmeansTrainType {
+	FULL, // greg_kmeans over all the data
+	SAMPLED, // greg_kmeans over a random sample, then one assignment of all the data
+	MINI_BATCH // mini-batch k-means, then one assignment of all the data
+};
+
 /**
  * Empty actions: how we treat the empty clusters
  */
@@ -81,11 +96,15 @@ enum class EmptyActs {
 
 /**
  * Criteria
+ * tolerance: stop when the relative change of the distortion between two
+ * iterations is below it (0 disables this test, which needs a pass over the
+ * data per iteration in greg_kmeans)
  */
 typedef struct {
 	float alpha;
 	float accuracy;
 	int iterations;
+	float tolerance;
 } KmeansCriteria;
 
 /**
@@ -97,6 +116,8 @@ typedef struct {
  * @param k the number of clusters
  * @param n_thread the number of threads
  * @param verbose for debugging
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
  */
 template<typename DataType>
 inline void random_seeds(
@@ -106,7 +127,9 @@ inline void random_seeds(
 		int N,
 		int k,
 		int n_thread,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	int i;
 	int j;
 #ifdef _WIN32
@@ -138,9 +161,9 @@ inline void random_seeds(
 	}
 #endif
 
-	int base = 0, base1;
+	size_t base = 0, base1;
 	for(i = 0; i < k; i++) {
-		base1 = tmp[i] * d;
+		base1 = tmp[i] * ld;
 		for(j = 0; j < d; j++) {
 			seeds[base++] = static_cast<float>(data[base1++]);
 		}
@@ -157,6 +180,8 @@ inline void random_seeds(
  * @param n_thread the number of threads
  * @param d_type the type of distance. Available options are NORM_L1, NORM_L2, HAMMING
  * @param verbose for debugging
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
  */
 template<typename DataType>
 inline void kmeans_pp_seeds(
@@ -167,7 +192,9 @@ inline void kmeans_pp_seeds(
 		int N,
 		int k,
 		int n_thread,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	// For generating random numbers
 	random_device rd;
 	mt19937 gen(rd());
@@ -175,7 +202,7 @@ inline void kmeans_pp_seeds(
 	uniform_int_distribution<int> int_dis(0, N - 1);
 	int tmp = int_dis(gen);
 
-	size_t base = static_cast<size_t>(tmp) * static_cast<size_t>(d);
+	size_t base = static_cast<size_t>(tmp) * ld;
 	int i, i0, start, end, p = N / n_thread;
 	for(i = 0; i < d; i++) {
 		seeds[i] = static_cast<float>(data[base++]);
@@ -195,7 +222,7 @@ inline void kmeans_pp_seeds(
 			start = p * i0;
 			end = start + p;
 			if(end >= N || i0 == n_thread - 1) end = N;
-			DataType * d_tmp2 = data + static_cast<size_t>(start) * static_cast<size_t>(d);
+			DataType * d_tmp2 = data + static_cast<size_t>(start) * ld;
 			float * d_tmp = seeds;
 			for(i = start; i < end; i++) {
 				if(d_type == DistanceType::NORM_L2)
@@ -203,7 +230,7 @@ inline void kmeans_pp_seeds(
 				else if(d_type == DistanceType::NORM_L1)
 					distances[i] = distance_l1<DataType,float>(d_tmp2, d_tmp, d);
 				sum_distances[i] = 0.0;
-				d_tmp2 += d;
+				d_tmp2 += ld;
 			}
 		}
 #ifdef _OPENMP
@@ -229,7 +256,7 @@ inline void kmeans_pp_seeds(
 		}
 		j = (i + 1) % N;
 		base1 = count * d;
-		base2 = static_cast<size_t>(j) * d;
+		base2 = static_cast<size_t>(j) * ld;
 		for(t = 0; t < d; t++) {
 			seeds[base1++] = static_cast<float>(data[base2++]);
 		}
@@ -246,7 +273,7 @@ inline void kmeans_pp_seeds(
 					start = p * i0;
 					end = start + p;
 					if(end >= N || i0 == n_thread - 1) end = N;
-					DataType * d_tmp2 = data + static_cast<size_t>(start) * static_cast<size_t>(d);
+					DataType * d_tmp2 = data + static_cast<size_t>(start) * ld;
 					float * d_tmp = seeds + (count - 1) * d; // We only need to compare the old closest distances with the new one
 					for(i = start; i < end; i++) {
 						if(d_type == DistanceType::NORM_L2)
@@ -254,7 +281,7 @@ inline void kmeans_pp_seeds(
 						else if(d_type == DistanceType::NORM_L1)
 							tmp2 = distance_l1<float,DataType>(d_tmp,d_tmp2,d);
 						if(distances[i] > tmp2) distances[i] = tmp2;
-						d_tmp2 += d;
+						d_tmp2 += ld;
 					}
 				}
 #ifdef _OPENMP
@@ -266,6 +293,358 @@ inline void kmeans_pp_seeds(
 	}
 }
 
+/**
+ * The number of rounds and the oversampling factor of k-means||:
+ * every round draws about KMEANS_PAR_FACTOR * k candidates
+ */
+#ifndef KMEANS_PAR_ROUNDS
+#define KMEANS_PAR_ROUNDS 5
+#endif
+#ifndef KMEANS_PAR_FACTOR
+#define KMEANS_PAR_FACTOR 2
+#endif
+
+/**
+ * The squared L2 distance between two points, abandoned as soon as it
+ * exceeds a bound: most candidates are far from a point, and only the
+ * distances below the bound matter
+ * @param x, y the points
+ * @param d the dimensions of the data
+ * @param bound the bound
+ * @return the distance, or a partial sum not less than the bound
+ */
+template<typename DataType>
+inline float distance_l2_square_bounded(
+		const DataType * x,
+		const DataType * y,
+		int d,
+		float bound) {
+	float s = 0.0f;
+	int j, e;
+	for(j = 0; j < d; j = e) {
+		e = std::min(d, j + 16);
+#pragma omp simd reduction(+:s)
+		for(int i = j; i < e; i++) {
+			float t = static_cast<float>(x[i]) - static_cast<float>(y[i]);
+			s += t * t;
+		}
+		if(s >= bound) break;
+	}
+	return s;
+}
+
+/**
+ * Create seeds for k-means|| (Bahmani et al., Scalable k-means++, 2012).
+ * k-means++ draws the k seeds one after the other, with a pass over the
+ * data for each of them. k-means|| draws about 2k candidates per round, each
+ * point independently with a probability proportional to its distance to
+ * the candidates, in KMEANS_PAR_ROUNDS parallel rounds. Each candidate is
+ * weighted by the number of points it is the closest candidate of, and
+ * the k seeds are drawn from the candidates by a weighted k-means++.
+ * @param data input data
+ * @param seeds the seeds
+ * @param d_type the type of distance. Available options are NORM_L1, NORM_L2
+ * @param d the dimensions of the data
+ * @param N the number of the data
+ * @param k the number of clusters
+ * @param n_thread the number of threads
+ * @param verbose for debugging
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
+ */
+template<typename DataType>
+inline void kmeans_par_seeds(
+		DataType * data,
+		float *& seeds,
+		DistanceType d_type,
+		int d,
+		int N,
+		int k,
+		int n_thread,
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<int> int_dis(0, N - 1);
+
+	float * dist; // the distance of each point to its closest candidate
+	int * nearest; // the closest candidate of each point
+	init_array<float>(dist,N);
+	init_array<int>(nearest,N);
+	vector<int> cand; // the candidates, as indices of points
+	cand.push_back(int_dis(gen));
+	fill(dist,dist + N,FLT_MAX);
+
+	long long i;
+	size_t c, first = 0;
+	int r, t;
+	double phi = 0.0, l = static_cast<double>(KMEANS_PAR_FACTOR) * k;
+	unsigned int base_seed = rd();
+	for(r = 0; r <= KMEANS_PAR_ROUNDS; r++) {
+		// Update the distances with the candidates of the last round
+		phi = 0.0;
+#ifdef _OPENMP
+		omp_set_num_threads(n_thread);
+#pragma omp parallel for reduction(+:phi) private(c) schedule(static)
+#endif
+		for(i = 0; i < N; i++) {
+			DataType * x = data + static_cast<size_t>(i) * ld;
+			float d_tmp = 0.0f;
+			for(c = first; c < cand.size(); c++) {
+				DataType * y = data + static_cast<size_t>(cand[c]) * ld;
+				if(d_type == DistanceType::NORM_L2)
+					d_tmp = distance_l2_square_bounded<DataType>(x,y,d,dist[i]);
+				else if(d_type == DistanceType::NORM_L1)
+					d_tmp = distance_l1<DataType>(x,y,d);
+				if(dist[i] > d_tmp) {
+					dist[i] = d_tmp;
+					nearest[i] = static_cast<int>(c);
+				}
+			}
+			phi += dist[i];
+		}
+		if(r == KMEANS_PAR_ROUNDS || phi <= 0.0) break;
+
+		// Oversample: every point is drawn independently
+		first = cand.size();
+		vector<vector<int> > drawn(n_thread);
+#ifdef _OPENMP
+#pragma omp parallel private(t)
+		{
+			t = omp_get_thread_num();
+#else
+		{
+			t = 0;
+#endif
+			mt19937 g(base_seed + 7919u * (r * n_thread + t + 1));
+			uniform_real_distribution<double> real_dis(0.0, 1.0);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+			for(i = 0; i < N; i++)
+				if(real_dis(g) * phi < l * dist[i])
+					drawn[t].push_back(static_cast<int>(i));
+		}
+		for(t = 0; t < n_thread; t++)
+			cand.insert(cand.end(),drawn[t].begin(),drawn[t].end());
+		if(verbose)
+			cout << "Round " << r << ": " << cand.size() << " candidates" << endl;
+	}
+
+	// The weight of a candidate is the number of points closest to it
+	size_t n_cand = cand.size();
+	vector<float> weight(n_cand,0.0f);
+	for(i = 0; i < N; i++)
+		weight[nearest[i]] += 1.0f;
+	::delete dist;
+	::delete nearest;
+
+	int m = 0, j;
+	if(static_cast<int>(n_cand) <= k) {
+		// Too few candidates: take them all, then random points
+		for(c = 0; c < n_cand; c++, m++)
+			for(j = 0; j < d; j++)
+				seeds[static_cast<size_t>(m) * d + j]
+					  = static_cast<float>(data[static_cast<size_t>(cand[c]) * ld + j]);
+		for(; m < k; m++) {
+			size_t p = static_cast<size_t>(int_dis(gen)) * ld;
+			for(j = 0; j < d; j++)
+				seeds[static_cast<size_t>(m) * d + j] = static_cast<float>(data[p + j]);
+		}
+		return;
+	}
+
+	// Weighted k-means++ over the candidates
+	vector<float> c_dist(n_cand,FLT_MAX);
+	vector<double> c_sum(n_cand);
+	double sum, pivot;
+	long long pick = 0;
+	discrete_distribution<long long> w_dis(weight.begin(),weight.end());
+	pick = w_dis(gen);
+	for(m = 0; m < k; m++) {
+		DataType * y = data + static_cast<size_t>(cand[pick]) * ld;
+		for(j = 0; j < d; j++)
+			seeds[static_cast<size_t>(m) * d + j] = static_cast<float>(y[j]);
+		if(m == k - 1) break;
+#ifdef _OPENMP
+		omp_set_num_threads(n_thread);
+#pragma omp parallel for schedule(static)
+#endif
+		for(i = 0; i < static_cast<long long>(n_cand); i++) {
+			DataType * x = data + static_cast<size_t>(cand[i]) * ld;
+			float d_tmp = 0.0f;
+			if(d_type == DistanceType::NORM_L2)
+				d_tmp = distance_l2_square_bounded<DataType>(x,y,d,c_dist[i]);
+			else if(d_type == DistanceType::NORM_L1)
+				d_tmp = distance_l1<DataType>(x,y,d);
+			if(c_dist[i] > d_tmp) c_dist[i] = d_tmp;
+		}
+		sum = 0.0;
+		for(c = 0; c < n_cand; c++) {
+			sum += weight[c] * c_dist[c];
+			c_sum[c] = sum;
+		}
+		if(sum <= 0.0) {
+			// All the candidates are seeds already: duplicate the last one
+			for(m++; m < k; m++)
+				memcpy(seeds + static_cast<size_t>(m) * d,
+						seeds + static_cast<size_t>(m - 1) * d,d * sizeof(float));
+			break;
+		}
+		uniform_real_distribution<double> real_dis(0.0, sum);
+		pivot = real_dis(gen);
+		pick = upper_bound(c_sum.begin(),c_sum.end(),pivot) - c_sum.begin();
+		if(pick >= static_cast<long long>(n_cand)) pick = n_cand - 1;
+	}
+	if(verbose)
+		cout << "Got " << k << " centers from " << n_cand << " candidates" << endl;
+}
+
+/**
+ * The tiles of the blocked assignment: at most KMEANS_GEMM_TILE points,
+ * and about KMEANS_GEMM_BUDGET distances (floats) per tile
+ */
+#ifndef KMEANS_GEMM_TILE
+#define KMEANS_GEMM_TILE 4096
+#endif
+#ifndef KMEANS_GEMM_BUDGET
+#define KMEANS_GEMM_BUDGET (1 << 24)
+#endif
+
+/**
+ * Find the nearest and the second nearest centers of a list of points.
+ * With KMEANS_BLAS and NORM_L2, the points are converted to floats by tiles
+ * and each tile is compared to all the centers with one sgemm:
+ * ||x - c||^2 = ||x||^2 + ||c||^2 - 2 <x, c>.
+ * Otherwise each point scans the centers.
+ * @param data input data
+ * @param ids the points, nullptr for the points 0 to n - 1
+ * @param n the number of points
+ * @param centers the centers
+ * @param k the number of clusters
+ * @param d the dimensions of the data
+ * @param d_type the type of distance. Available options are NORM_L1, NORM_L2
+ * @param label the nearest center of each point (n)
+ * @param min the distance to the nearest center (n)
+ * @param min2 the distance to the second nearest center (n), may be nullptr
+ * @param n_thread the number of threads
+ * @param ld the distance between two points in the data (0: d)
+ */
+template<typename DataType>
+inline void block_assign(
+		DataType * data,
+		const int * ids,
+		size_t n,
+		float * centers,
+		int k,
+		int d,
+		DistanceType d_type,
+		int * label,
+		float * min,
+		float * min2,
+		int n_thread,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	if(n_thread < 1) n_thread = 1;
+	if(n == 0) return;
+	long long r;
+#ifdef KMEANS_BLAS
+	if(d_type == DistanceType::NORM_L2) {
+		size_t tile = std::min<size_t>(KMEANS_GEMM_TILE,
+				std::max<size_t>(64,static_cast<size_t>(KMEANS_GEMM_BUDGET) / k));
+		if(tile > n) tile = n;
+		float * x, * dist, * c_norms;
+		init_array<float>(x,tile * d);
+		init_array<float>(dist,tile * k);
+		init_array<float>(c_norms,k);
+		for(int j = 0; j < k; j++) {
+			const float * c = centers + static_cast<size_t>(j) * d;
+			float s = 0.0f;
+			for(int l = 0; l < d; l++)
+				s += c[l] * c[l];
+			c_norms[j] = s;
+		}
+#ifdef _OPENMP
+		omp_set_num_threads(n_thread);
+#endif
+		for(size_t t = 0; t < n; t += tile) {
+			long long m = static_cast<long long>(std::min(tile,n - t));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+			for(r = 0; r < m; r++) {
+				size_t i = ids == nullptr ? t + r : static_cast<size_t>(ids[t + r]);
+				const DataType * src = data + i * ld;
+				float * dst = x + r * d;
+				for(int l = 0; l < d; l++)
+					dst[l] = static_cast<float>(src[l]);
+			}
+			cblas_sgemm(CblasRowMajor,CblasNoTrans,CblasTrans,m,k,d,
+					-2.0f,x,d,centers,d,0.0f,dist,k);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+			for(r = 0; r < m; r++) {
+				const float * row = dist + r * k;
+				const float * xr = x + r * d;
+				float xn = 0.0f, m1 = FLT_MAX, m2 = FLT_MAX, v;
+				int tmp = 0;
+				for(int l = 0; l < d; l++)
+					xn += xr[l] * xr[l];
+				for(int j = 0; j < k; j++) {
+					v = row[j] + c_norms[j];
+					if(v < m1) {
+						m2 = m1;
+						m1 = v;
+						tmp = j;
+					} else if(v < m2) {
+						m2 = v;
+					}
+				}
+				label[t + r] = tmp;
+				// The cancellation may leave tiny negative distances
+				min[t + r] = std::max(m1 + xn,0.0f);
+				if(min2 != nullptr)
+					min2[t + r] = m2 == FLT_MAX ? FLT_MAX : std::max(m2 + xn,0.0f);
+			}
+		}
+		::delete x;
+		::delete dist;
+		::delete c_norms;
+		return;
+	}
+#endif
+#ifdef _OPENMP
+	omp_set_num_threads(n_thread);
+#pragma omp parallel for schedule(static)
+#endif
+	for(r = 0; r < static_cast<long long>(n); r++) {
+		size_t i = ids == nullptr ? r : static_cast<size_t>(ids[r]);
+		DataType * xr = data + i * ld;
+		float * c = centers;
+		float m1 = FLT_MAX, m2 = FLT_MAX, v = 0.0f;
+		int tmp = 0;
+		for(int j = 0; j < k; j++) {
+			if(d_type == DistanceType::NORM_L2)
+				v = distance_l2_square<DataType,float>(xr,c,d);
+			else if(d_type == DistanceType::NORM_L1)
+				v = distance_l1<DataType,float>(xr,c,d);
+			if(v < m1) {
+				m2 = m1;
+				m1 = v;
+				tmp = j;
+			} else if(v < m2) {
+				m2 = v;
+			}
+			c += d;
+		}
+		label[r] = tmp;
+		min[r] = m1;
+		if(min2 != nullptr) min2[r] = m2;
+	}
+}
+
 /**
  * After having a set of centers,
  * we need to assign data into each cluster respectively.
@@ -294,46 +673,35 @@ inline void linear_assign(
 		int n_thread,
 		bool verbose) {
 	if(n_thread < 1) n_thread = 1;
-	int i, j, m, i0, start, end;
-	int tmp;
-	DataType * d_tmp;
-	float *  d_tmp1;
-
-	float min = FLT_MAX, min_tmp = 0.0;
-	d_tmp = data;
-	int base1, base2;
+	int i, m, tmp;
+	size_t base1, base2;
+	int * nearest;
+	float * dist;
+	init_array<int>(nearest,N);
+	init_array<float>(dist,N);
+	block_assign<DataType>(data,nullptr,N,centers,k,d,d_type,
+			nearest,dist,nullptr,n_thread);
 	for(i = 0; i < N; i++) {
-		// Find the minimum distances between d_tmp and a centroid
-		min = FLT_MAX;
-		d_tmp1 = centers;
-		for(j = 0; j < k; j++) {
-			if(d_type == DistanceType::NORM_L2)
-				min_tmp = distance_l2_square<DataType,float>(d_tmp,d_tmp1,d);
-			else if(d_type == DistanceType::NORM_L1)
-				min_tmp = distance_l1<DataType,float>(d_tmp,d_tmp1,d);
-			if(min > min_tmp) {
-				min = min_tmp;
-				tmp = j;
-			}
-			d_tmp1 += d;
-		}
+		tmp = nearest[i];
 		// Assign the data[i] into cluster tmp
 		if(labels[i] > -1) {
 			size[labels[i]]--;
-			base1 = labels[i] * d;
-			base2 = i * d;
+			base1 = static_cast<size_t>(labels[i]) * d;
+			base2 = static_cast<size_t>(i) * d;
 			for(m = 0; m < d; m++) {
 				sum[base1++] -= static_cast<float>(data[base2++]);
 			}
 		}
 		labels[i] = tmp;
 		size[tmp]++;
-		base1 = tmp * d;
-		base2 = i * d;
+		base1 = static_cast<size_t>(tmp) * d;
+		base2 = static_cast<size_t>(i) * d;
 		for(m = 0; m < d; m++) {
 			sum[base1++] += static_cast<float>(data[base2++]);
 		}
 	}
+	::delete nearest;
+	::delete dist;
 }
 
 /**
@@ -357,20 +725,21 @@ inline void update_center(
 		int k,
 		int d,
 		int n_thread) {
-	float * c_tmp;
+	float * c_tmp; // the previous center
 	init_array<float>(c_tmp,d);
 	int i, base = 0;
-	c_tmp = centers;
 	for(i = 0; i < k; i++) {
 		for(int j = 0; j < d; j++) {
-			centers[base] = static_cast<float>(sum[base++] / size[i]);
+			c_tmp[j] = centers[base];
+			centers[base] = static_cast<float>(sum[base] / size[i]);
+			base++;
 		}
 		if(d_type == DistanceType::NORM_L2)
 			moved[i] = distance_l2<float>(c_tmp,centers + (base - d),d);
 		else if(d_type == DistanceType::NORM_L1)
 			moved[i] = distance_l1<float>(c_tmp,centers + (base - d),d);
-		c_tmp += d;
 	}
+	::delete c_tmp;
 }
 
 /**
@@ -439,6 +808,8 @@ inline void update_bounds(
  * @param d_type the type of distance. Available options are NORM_L1, NORM_L2, HAMMING
  * @param n_thread the number of threads
  * @param verbose for debugging
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
  */
 template<typename DataType>
 inline float distortion(
@@ -449,7 +820,9 @@ inline float distortion(
 		int d,
 		int N,
 		int k,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	float e = 0.0;
 	int j;
 	DataType * tmp = data;
@@ -458,13 +831,15 @@ inline float distortion(
 			e += distance_l2_square<DataType,float>(tmp,centers + label[j] * d,d);
 		else if(d_type == DistanceType::NORM_L1)
 			e += distance_l1<DataType,float>(tmp,centers + label[j] * d,d);
-		tmp += d;
+		tmp += ld;
 	}
 	return sqrt(e);
 }
 
 /**
  * Update the farthest distances
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
  */
 template<typename DataType>
 inline void find_farthest(
@@ -478,7 +853,9 @@ inline void find_farthest(
 		int N,
 		int k,
 		int d,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	int i;
 	float d_tmp;
 	dfst = -1.0f;
@@ -494,13 +871,15 @@ inline void find_farthest(
 				fst = i;
 			}
 		}
-		tmp += d;
+		tmp += ld;
 	}
 	dfst = sqrt(dfst);
 }
 
 /**
  * Find a lonely observer
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
  */
 template<typename DataType>
 inline void find_lonely(
@@ -513,7 +892,9 @@ inline void find_lonely(
 		int N,
 		int k,
 		int d,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	int i;
 	float d_tmp;
 	dfst = -1.0f;
@@ -527,11 +908,122 @@ inline void find_lonely(
 			dfst = d_tmp;
 			fst = i;
 		}
-		tmp += d;
+		tmp += ld;
 	}
 	dfst = sqrt(dfst);
 }
 
+/**
+ * The distortion of a set of clusters: the sum of the squared distances
+ * between the data and their centers
+ * @param data input data
+ * @param centers the centers
+ * @param label the labels of data points
+ * @param d_type the type of distance. Available options are NORM_L1, NORM_L2
+ * @param d the dimensions of the data
+ * @param N the number of the data
+ * @param n_thread the number of threads
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
+ */
+template<typename DataType>
+inline double label_distortion(
+		DataType * data,
+		float * centers,
+		int * label,
+		DistanceType d_type,
+		int d,
+		int N,
+		int n_thread,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	double e = 0.0;
+	long long i;
+#ifdef _OPENMP
+	omp_set_num_threads(n_thread);
+#pragma omp parallel for reduction(+:e)
+#endif
+	for(i = 0; i < N; i++) {
+		DataType * x = data + static_cast<size_t>(i) * ld;
+		float * c = centers + static_cast<size_t>(label[i]) * d;
+		if(d_type == DistanceType::NORM_L2)
+			e += distance_l2_square<DataType,float>(x,c,d);
+		else if(d_type == DistanceType::NORM_L1)
+			e += distance_l1<DataType,float>(x,c,d);
+	}
+	return e;
+}
+
+/**
+ * Assign every point to its nearest center
+ * @param data input data
+ * @param centers the centers
+ * @param label the labels of data points
+ * @param d_type the type of distance. Available options are NORM_L1, NORM_L2
+ * @param d the dimensions of the data
+ * @param N the number of the data
+ * @param k the number of clusters
+ * @param n_thread the number of threads
+ * @param ld the distance between two points in the data (0: d), to cluster
+ * a slice of the columns of a matrix in place
+ * @return the sum of the distances to the nearest centers
+ */
+template<typename DataType>
+inline double nearest_labels(
+		DataType * data,
+		float * centers,
+		int * label,
+		DistanceType d_type,
+		int d,
+		int N,
+		int k,
+		int n_thread,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	double e = 0.0;
+	float * dist;
+	init_array<float>(dist,N);
+	block_assign<DataType>(data,nullptr,N,centers,k,d,d_type,
+			label,dist,nullptr,n_thread,ld);
+	for(int i = 0; i < N; i++)
+		e += dist[i];
+	::delete dist;
+	return e;
+}
+
+/**
+ * Draw a uniform sample of n distinct points, in the order of the data
+ * (selection sampling: one pass, no memory beyond the sample)
+ * @param data input data
+ * @param sample the sample, n * d values
+ * @param d the dimensions of the data
+ * @param N the number of the data
+ * @param n the size of the sample, at most N
+ * @param gen the random generator
+ * @param ld the distance between two points in the data (0: d)
+ */
+template<typename DataType>
+inline void sample_rows(
+		DataType * data,
+		DataType * sample,
+		int d,
+		int N,
+		int n,
+		mt19937& gen,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	uniform_real_distribution<double> real_dis(0.0, 1.0);
+	size_t row = static_cast<size_t>(d) * sizeof(DataType);
+	int i, m = 0;
+	for(i = 0; i < N && m < n; i++) {
+		if((N - i) * real_dis(gen) < n - m) {
+			memcpy(sample + static_cast<size_t>(m) * d,
+					data + static_cast<size_t>(i) * ld,row);
+			m++;
+		}
+	}
+}
+
 /**
  * The k-means method: a description of the method can be found at
  * http://home.deib.polimi.it/matteucc/Clustering/tutorial_html/kmeans.html
@@ -548,6 +1040,7 @@ inline void find_lonely(
  * @param d_type the type of distance. Available options are NORM_L1, NORM_L2, HAMMING
  * @param n_thread the number of threads
  * @param verbose for debugging
+ * @param ld the distance between two points in the data (0: d)
  */
 template<typename DataType>
 inline void greg_initialize(
@@ -564,8 +1057,10 @@ inline void greg_initialize(
 		int k,
 		int d,
 		int n_thread,
-		bool verbose) {
-	size_t base = 0, p = N / n_thread;
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	size_t base = 0;
 	// Initializing size and vector sum
 	for(int i = 0; i < k; i++) {
 		size[i] = 0;
@@ -574,60 +1069,22 @@ inline void greg_initialize(
 		}
 	}
 
-	float min, min2, d_tmp;
-	int tmp;
-#ifdef _OPENMP
-	omp_set_num_threads(n_thread);
-#pragma omp parallel
-	{
-#pragma omp for private(d_tmp,min,min2,tmp)
-#endif
-		for(int i0 = 0; i0 < n_thread; i0++) {
-			size_t start = p * i0;
-			size_t end = start + p;
-			size_t base1 = 0, base2 = 0;
-			if(end > N || i0 == n_thread - 1) end = N;
-			DataType * dt = data + start * static_cast<size_t>(d);
-			for(size_t i = start; i < end; i++) {
-				min = FLT_MAX;
-				min2 = FLT_MAX;
-				d_tmp = 0.0;
-				tmp = -1;
-				for(size_t j = 0; j < k; j++) {
-					if(d_type == DistanceType::NORM_L2) {
-						d_tmp = distance_l2_square<float,DataType>(centers + j * d,dt,d);
-					} else if(d_type == DistanceType::NORM_L1) {
-						d_tmp = distance_l1<float,DataType>(centers + j * d,dt,d);
-					}
-					if(min >= d_tmp) {
-						min2 = min;
-						min = d_tmp;
-						tmp = j;
-					} else {
-						if(min2 >= d_tmp) min2 = d_tmp;
-					}
-				}
-
-				label[i] = tmp; // Update the label
-				upper[i] = sqrt(min); // Update the upper bound on this distance
-				lower[i] = sqrt(min2); // Update the lower bound on this distance
-
-				// Update the size
-				size[tmp]++;
-
-				// Update the vector sum
-				base1 = tmp * d;
-				base2 = i * d;
-				for(size_t j = 0; j < d; j++) {
-					sum[base1++] += static_cast<float>(data[base2++]);
-				}
-				dt += d;
-			}
+	// The nearest centers, then the squared distances become the bounds
+	block_assign<DataType>(data,nullptr,N,centers,k,d,d_type,
+			label,upper,lower,n_thread,ld);
+	size_t base1, base2;
+	for(int i = 0; i < N; i++) {
+		upper[i] = sqrt(upper[i]); // Update the upper bound on this distance
+		lower[i] = sqrt(lower[i]); // Update the lower bound on this distance
+		// Update the size and the vector sum
+		size[label[i]]++;
+		base1 = static_cast<size_t>(label[i]) * d;
+		base2 = static_cast<size_t>(i) * ld;
+		for(int j = 0; j < d; j++) {
+			sum[base1++] += static_cast<float>(data[base2++]);
 		}
-#ifdef _OPENMP
 	}
-#endif
-	
+
     size_t s_max, l_tmp, base3, base4;
     int fst;
 	float dfst;
@@ -648,11 +1105,11 @@ inline void greg_initialize(
 				base = i * d;
 				if(ea == EmptyActs::SINGLETON)
 					find_lonely<DataType>(data,centers,label,d_type,
-							dfst,fst,N,k,d,verbose);
+							dfst,fst,N,k,d,verbose,ld);
 				else if(ea == EmptyActs::SINGLETON_2)
 					find_farthest<DataType>(data,centers + base,label,d_type,
-							s_max,dfst,fst,N,k,d,verbose);
-				base3 = static_cast<size_t>(fst) * d;
+							s_max,dfst,fst,N,k,d,verbose,ld);
+				base3 = static_cast<size_t>(fst) * ld;
 				base4 = label[fst] * d;
 				for(int j = 0; j < d; j++) {
 					centers[base] = static_cast<float>(data[base3++]);
@@ -681,7 +1138,9 @@ inline void greg_kmeans(
 		int k,
 		int d,
 		int n_thread,
-		bool verbose) {
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
 	// Pre-check conditions
 	if (N < k) {
 		if(verbose)
@@ -692,7 +1151,8 @@ inline void greg_kmeans(
 		for(int i = 0; i < k; i++) {
 			label[i] = i;
 			if(i < N) {
-				memcpy(centers + i * d, data + i * d, d * sizeof(float));
+				for(int j = 0; j < d; j++)
+					centers[i * d + j] = static_cast<float>(data[i * ld + j]);
 			} else {
 				memcpy(centers + i * d, inf, d * sizeof(float));
 			}
@@ -707,9 +1167,11 @@ inline void greg_kmeans(
 
 	// Seeding
 	if (type == KmeansType::RANDOM_SEEDS) {
-		random_seeds<DataType>(data,seeds,d,N,k,n_thread,verbose);
+		random_seeds<DataType>(data,seeds,d,N,k,n_thread,verbose,ld);
 	} else if(type == KmeansType::KMEANS_PLUS_SEEDS) {
-		kmeans_pp_seeds<DataType>(data,seeds,d_type,d,N,k,n_thread,verbose);
+		kmeans_pp_seeds<DataType>(data,seeds,d_type,d,N,k,n_thread,verbose,ld);
+	} else if(type == KmeansType::KMEANS_PARALLEL_SEEDS) {
+		kmeans_par_seeds<DataType>(data,seeds,d_type,d,N,k,n_thread,verbose,ld);
 	}
 
 	if(verbose)
@@ -734,113 +1196,92 @@ inline void greg_kmeans(
 	init_array<float>(lower,N);
 	init_array<int>(size,k);
 
-	int i0, i, j, s_max, l_tmp, fst, base, base0, base1, base2;
-	size_t p = N / n_thread;
-	float * fpt1, * fpt2;
-	DataType * dpt = data;
+	int i, j, s_max, l_tmp, fst;
+	size_t base, base0, base1, base2;
+	double q = 0.0, q_prev;
 	int tmp = 0;
-	float min, min2, min_tmp = 0.0,
-			d_tmp = 0.0, m, dfst;
+	float m, dfst;
 
 	// Initialize the centers
 	copy_array<float>(seeds,centers,k * d);
 	greg_initialize<DataType>(data,centers,c_sum,upper,lower,
-			label,size,d_type,ea,N,k,d,n_thread,verbose);
+			label,size,d_type,ea,N,k,d,n_thread,verbose,ld);
 	if(verbose)
 		cout << "Finished initialization" << endl;
 
-	while (1) {
-		// Update the closest distances
-		fpt1 = centers;
-		for(i = 0; i < k; i++) {
-			min2 = min = FLT_MAX;
-			fpt2 = centers;
-			for(j = 0; j < k; j++) {
-				if(j != i) {
-					if(d_type == DistanceType::NORM_L2)
-						min_tmp = distance_l2_square<float>(fpt1,fpt2,d);
-					else if(d_type == DistanceType::NORM_L1)
-						min_tmp = distance_l1<float>(fpt1,fpt2,d);
-					if(min > min_tmp) min = min_tmp;
-				}
-				fpt2 += d;
-			}
-			closest[i] = sqrt(min);
-			fpt1 += d;
-		}
+	// The points that fail the bound tests, and their new nearest centers
+	int * redo, * r_label, * c_label;
+	float * r_min, * r_min2, * c_min, * c_min2;
+	init_array<int>(redo,N);
+	init_array<int>(r_label,N);
+	init_array<float>(r_min,N);
+	init_array<float>(r_min2,N);
+	init_array<int>(c_label,k);
+	init_array<float>(c_min,k);
+	init_array<float>(c_min2,k);
+	long long r, n_redo;
 
+	while (1) {
+		// Update the closest distances: the second nearest center of
+		// a center is the nearest other one
+		block_assign<float>(centers,nullptr,k,centers,k,d,d_type,
+				c_label,c_min,c_min2,n_thread);
+		for(i = 0; i < k; i++)
+			closest[i] = k > 1 ? sqrt(c_min2[i]) : FLT_MAX;
+
+		// Bound tests
 #ifdef _OPENMP
 		omp_set_num_threads(n_thread);
-#pragma omp parallel
-		{
-#pragma omp for private(i,j,d_tmp,m,min,min2,tmp)
+#pragma omp parallel for private(m) schedule(static)
 #endif
-			for(i0 = 0; i0 < n_thread; i0++) {
-				size_t start = p * i0;
-				size_t end = start + p;
-				if(end > N || i0 == n_thread - 1) end = N;
-				int l;
-				for(i = start; i < end; i++) {
-					// Update m for bound test
-					d_tmp = closest[label[i]]/2.0;
-					m = std::max(d_tmp,lower[i]);
-					// First bound test
-					if(upper[i] > m) {
-						// We need to tighten the upper bound
-						if(d_type == DistanceType::NORM_L2)
-							upper[i] = distance_l2<DataType,float>(data + i * d,centers + label[i] * d,d);
-						else if(d_type == DistanceType::NORM_L1)
-							upper[i] = distance_l1<DataType,float>(data + i * d,centers + label[i] * d,d);
-						// Second bound test
-						if(upper[i] > m) {
-							l = label[i];
-							min2 = min = FLT_MAX;
-							tmp = -1;
-							// Assign the data to clusters
-							fpt1 = centers;
-							for(j = 0; j < k; j++) {
-								if(d_type == DistanceType::NORM_L2)
-									d_tmp = distance_l2_square<float,DataType>(fpt1,data + i * d,d);
-								else if(d_type == DistanceType::NORM_L1)
-									d_tmp = distance_l1<float,DataType>(fpt1,data + i * d,d);
-								if(min >= d_tmp) {
-									min2 = min;
-									min = d_tmp;
-									tmp = j;
-								} else {
-									if(min2 > d_tmp) min2 = d_tmp;
-								}
-								fpt1 += d;
-							}
-
-							// Assign the data[i] into cluster tmp
-							label[i] = tmp; // Update the label
-							upper[i] = sqrt(min); // Update the upper bound on this distance
-							lower[i] = sqrt(min2); // Update the lower bound on this distance
-
-							if(l != tmp) {
-								size[tmp]++;
-								size[l]--;
-								if(size[l] == 0) {
-									if(verbose)
-										cout << "An empty cluster was found!"
-										" label = " << l << endl;
-								}
-								base = i * d;
-								base0 = tmp * d;
-								base1 = l * d;
-								for(j = 0; j < d; j++) {
-									c_sum[base0++] += static_cast<float>(data[base]);
-									c_sum[base1++] -= static_cast<float>(data[base++]);
-								}
-							}
-						}
-					}
+		for(r = 0; r < static_cast<long long>(N); r++) {
+			redo[r] = 0;
+			// Update m for bound test
+			m = std::max(static_cast<float>(closest[label[r]]/2.0),lower[r]);
+			// First bound test
+			if(upper[r] > m) {
+				// We need to tighten the upper bound
+				if(d_type == DistanceType::NORM_L2)
+					upper[r] = distance_l2<DataType,float>(data + r * ld,centers + label[r] * d,d);
+				else if(d_type == DistanceType::NORM_L1)
+					upper[r] = distance_l1<DataType,float>(data + r * ld,centers + label[r] * d,d);
+				// Second bound test
+				if(upper[r] > m) redo[r] = 1;
+			}
+		}
+		n_redo = 0;
+		for(r = 0; r < static_cast<long long>(N); r++)
+			if(redo[r]) redo[n_redo++] = static_cast<int>(r);
+
+		// Assign the remaining points to clusters
+		block_assign<DataType>(data,redo,n_redo,centers,k,d,d_type,
+				r_label,r_min,r_min2,n_thread,ld);
+		for(r = 0; r < n_redo; r++) {
+			i = redo[r];
+			l_tmp = label[i];
+			tmp = r_label[r];
+			// Assign the data[i] into cluster tmp
+			label[i] = tmp; // Update the label
+			upper[i] = sqrt(r_min[r]); // Update the upper bound on this distance
+			lower[i] = sqrt(r_min2[r]); // Update the lower bound on this distance
+
+			if(l_tmp != tmp) {
+				size[tmp]++;
+				size[l_tmp]--;
+				if(size[l_tmp] == 0) {
+					if(verbose)
+						cout << "An empty cluster was found!"
+						" label = " << l_tmp << endl;
+				}
+				base = static_cast<size_t>(i) * ld;
+				base0 = static_cast<size_t>(tmp) * d;
+				base1 = static_cast<size_t>(l_tmp) * d;
+				for(j = 0; j < d; j++) {
+					c_sum[base0++] += static_cast<float>(data[base]);
+					c_sum[base1++] -= static_cast<float>(data[base++]);
 				}
 			}
-#ifdef _OPENMP
 		}
-#endif
 		// Check for empty clusters
 		if(ea != EmptyActs::NONE) {
 			for(i = 0; i < k; i++) {
@@ -858,11 +1299,11 @@ inline void greg_kmeans(
 					base = i * d;
 					if(ea == EmptyActs::SINGLETON)
 						find_lonely<DataType>(data,centers,label,d_type,
-								dfst,fst,N,k,d,verbose);
+								dfst,fst,N,k,d,verbose,ld);
 					else if(ea == EmptyActs::SINGLETON_2)
 						find_farthest<DataType>(data,centers + base,label,d_type,
-								s_max,dfst,fst,N,k,d,verbose);
-					base1 = fst * d;
+								s_max,dfst,fst,N,k,d,verbose,ld);
+					base1 = fst * ld;
 					base2 = label[fst] * d;
 					for(j = 0; j < d; j++) {
 						centers[base] = static_cast<float>(data[base1++]);
@@ -900,18 +1341,207 @@ inline void greg_kmeans(
 			cout << "Iterator " << it
 			<< "-th with error = " << e
 			<< " and distortion = "
-			<< distortion(data,centers,label,d_type,d,N,k,false)
+			<< distortion(data,centers,label,d_type,d,N,k,false,ld)
 			<< endl;
 		it++;
 		if(it >= iters || e < error || count >= 10) break;
+		// Stop when the distortion does not decrease any more
+		if(criteria.tolerance > 0.0f) {
+			q_prev = q;
+			q = label_distortion<DataType>(data,centers,label,d_type,d,N,n_thread,ld);
+			if(it > 1 && q_prev - q <= criteria.tolerance * q_prev) break;
+		}
 	}
 
+	::delete redo;
+	::delete r_label;
+	::delete r_min;
+	::delete r_min2;
+	::delete c_label;
+	::delete c_min;
+	::delete c_min2;
+
 	if(verbose)
 		cout << "Finished clustering with error is " <<
 		e << " after " << it << " iterations." << endl;
 }
 
 
+/**
+ * The k-means method over a random sample of the data: greg_kmeans clusters
+ * n_sample points, then all the data are assigned to the nearest centers.
+ * The distortion of a sample of a few hundred points per cluster is close
+ * to the one over all the data, at a fraction of the cost.
+ * @param n_sample the size of the sample, all the data if it is not smaller than N
+ * @param ld the distance between two points in the data (0: d)
+ * The other parameters are the ones of greg_kmeans.
+ */
+template<typename DataType>
+inline void sampled_kmeans(
+		DataType * data,
+		float *& centers,
+		int *& label,
+		float *& seeds,
+		KmeansType type,
+		KmeansCriteria criteria,
+		DistanceType d_type,
+		EmptyActs ea,
+		int N,
+		int k,
+		int d,
+		int n_sample,
+		int n_thread,
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	if(n_sample >= N || n_sample < k) {
+		greg_kmeans<DataType>(data,centers,label,seeds,type,criteria,
+				d_type,ea,N,k,d,n_thread,verbose,ld);
+		return;
+	}
+	random_device rd;
+	mt19937 gen(rd());
+	DataType * sample;
+	int * s_label;
+	init_array<DataType>(sample,static_cast<size_t>(n_sample) * d);
+	init_array<int>(s_label,n_sample);
+	sample_rows<DataType>(data,sample,d,N,n_sample,gen,ld);
+	if(verbose)
+		cout << "Clustering a sample of " << n_sample << " points" << endl;
+	greg_kmeans<DataType>(sample,centers,s_label,seeds,type,criteria,
+			d_type,ea,n_sample,k,d,n_thread,verbose);
+	::delete sample;
+	::delete s_label;
+	double e = nearest_labels<DataType>(data,centers,label,d_type,d,N,k,n_thread,ld);
+	if(verbose)
+		cout << "Assigned " << N << " points with distortion " << e << endl;
+}
+
+/**
+ * The mini-batch k-means method (Sculley, Web-scale k-means clustering, 2010).
+ * Each iteration assigns a random batch of points and moves each center
+ * towards its points with a learning rate of 1 / (the number of points it
+ * has received so far). The seeds are taken from a random sample.
+ * The training stops after criteria.iterations batches, or when the
+ * smoothed distortion of the batches has not decreased by more than
+ * criteria.tolerance (relative) for 10 batches. Finally all the data are
+ * assigned to the nearest centers.
+ * @param batch the number of points of a batch
+ * @param ld the distance between two points in the data (0: d)
+ * The other parameters are the ones of greg_kmeans.
+ */
+template<typename DataType>
+inline void minibatch_kmeans(
+		DataType * data,
+		float *& centers,
+		int *& label,
+		float *& seeds,
+		KmeansType type,
+		KmeansCriteria criteria,
+		DistanceType d_type,
+		EmptyActs ea,
+		int N,
+		int k,
+		int d,
+		int batch,
+		int n_thread,
+		bool verbose,
+		size_t ld = 0) {
+	if(ld == 0) ld = d;
+	if(N < k || batch >= N) {
+		greg_kmeans<DataType>(data,centers,label,seeds,type,criteria,
+				d_type,ea,N,k,d,n_thread,verbose,ld);
+		return;
+	}
+	if(batch < 1) batch = 1;
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<int> int_dis(0, N - 1);
+
+	// Seeding on a sample of a few points per cluster
+	int n_seed = std::min(N,std::max(batch,4 * k)), i, j;
+	DataType * sample;
+	init_array<DataType>(sample,static_cast<size_t>(n_seed) * d);
+	sample_rows<DataType>(data,sample,d,N,n_seed,gen,ld);
+	if(seeds == nullptr)
+		init_array<float>(seeds,static_cast<size_t>(k) * d);
+	if(type == KmeansType::RANDOM_SEEDS)
+		random_seeds<DataType>(sample,seeds,d,n_seed,k,n_thread,verbose);
+	else if(type == KmeansType::KMEANS_PLUS_SEEDS)
+		kmeans_pp_seeds<DataType>(sample,seeds,d_type,d,n_seed,k,n_thread,verbose);
+	else if(type == KmeansType::KMEANS_PARALLEL_SEEDS)
+		kmeans_par_seeds<DataType>(sample,seeds,d_type,d,n_seed,k,n_thread,verbose);
+	::delete sample;
+	copy_array<float>(seeds,centers,k * d);
+	if(verbose)
+		cout << "Finished seeding" << endl;
+
+	int * ids, * b_label, * count;
+	float * b_dist;
+	init_array<int>(ids,batch);
+	init_array<int>(b_label,batch);
+	init_array<float>(b_dist,batch);
+	init_array<int>(count,k);
+	fill(count,count + k,0);
+
+	// The smoothing weight of the distortion of a batch
+	double alpha = std::min(1.0,2.0 * batch / N), ewa = -1.0, best = DBL_MAX, e;
+	int it, no_improvement = 0;
+	for(it = 0; it < criteria.iterations; it++) {
+		for(i = 0; i < batch; i++)
+			ids[i] = int_dis(gen);
+		block_assign<DataType>(data,ids,batch,centers,k,d,d_type,
+				b_label,b_dist,nullptr,n_thread,ld);
+		// Move the centers, one point at a time
+		e = 0.0;
+		for(i = 0; i < batch; i++) {
+			DataType * x = data + static_cast<size_t>(ids[i]) * ld;
+			float * c = centers + static_cast<size_t>(b_label[i]) * d;
+			float eta = 1.0f / ++count[b_label[i]];
+			for(j = 0; j < d; j++)
+				c[j] += eta * (static_cast<float>(x[j]) - c[j]);
+			e += b_dist[i];
+		}
+		e /= batch;
+		ewa = ewa < 0.0 ? e : ewa * (1.0 - alpha) + e * alpha;
+		if(verbose)
+			cout << "Batch " << it << " with distortion " << e
+			<< " (smoothed " << ewa << ")" << endl;
+		if(ewa < best * (1.0 - criteria.tolerance)) {
+			best = ewa;
+			no_improvement = 0;
+		} else if(++no_improvement >= 10) {
+			it++;
+			break;
+		}
+	}
+
+	// The centers that never received a point are moved onto the points
+	// that are the farthest from their centers in the last batch
+	if(ea != EmptyActs::NONE) {
+		for(j = 0; j < k; j++) {
+			if(count[j] > 0) continue;
+			int fst = 0;
+			for(i = 1; i < batch; i++)
+				if(b_dist[i] > b_dist[fst]) fst = i;
+			if(b_dist[fst] <= 0.0f) break;
+			DataType * x = data + static_cast<size_t>(ids[fst]) * ld;
+			for(i = 0; i < d; i++)
+				centers[static_cast<size_t>(j) * d + i] = static_cast<float>(x[i]);
+			b_dist[fst] = 0.0f;
+		}
+	}
+	::delete ids;
+	::delete b_label;
+	::delete b_dist;
+	::delete count;
+
+	e = nearest_labels<DataType>(data,centers,label,d_type,d,N,k,n_thread,ld);
+	if(verbose)
+		cout << "Finished clustering after " << it << " batches"
+		<< " with distortion " << e << endl;
+}
+
 /**
  * The k-means method: a description of the method can be found at
  * http://home.deib.polimi.it/matteucc/Clustering/tutorial_html/kmeans.html
@@ -973,6 +1603,8 @@ inline void simple_kmeans(
 		random_seeds<DataType>(data,seeds,d,N,k,n_thread,verbose);
 	} else if(type == KmeansType::KMEANS_PLUS_SEEDS) {
 		kmeans_pp_seeds<DataType>(data,seeds,d_type,d,N,k,n_thread,verbose);
+	} else if(type == KmeansType::KMEANS_PARALLEL_SEEDS) {
+		kmeans_par_seeds<DataType>(data,seeds,d_type,d,N,k,n_thread,verbose);
 	}
 
 	if(verbose)
@@ -135,7 +135,7 @@ TEST_F(KmeansTest, test2) {
 }
 
 TEST_F(KmeansTest, test3) {
-	KmeansCriteria criteria = {2.0,1.0,100};
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
 	simple_kmeans<float>(
 			data,centers,label,seeds,
 			KmeansType::KMEANS_PLUS_SEEDS,
@@ -149,7 +149,7 @@ TEST_F(KmeansTest, test3) {
 }
 
 TEST_F(KmeansTest, test4) {
-	KmeansCriteria criteria = {2.0,1.0,100};
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
 	simple_kmeans<float>(
 			data,centers,label,seeds,
 			KmeansType::RANDOM_SEEDS,
@@ -163,7 +163,7 @@ TEST_F(KmeansTest, test4) {
 }
 
 TEST_F(KmeansTest, test5) {
-	KmeansCriteria criteria = {2.0,1.0,100};
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
 	greg_kmeans<float>(
 			data,centers,label,seeds,
 			KmeansType::RANDOM_SEEDS,
@@ -176,7 +176,7 @@ TEST_F(KmeansTest, test5) {
 }
 
 TEST_F(KmeansTest, test6) {
-	KmeansCriteria criteria = {2.0,1.0,100};
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
 	greg_kmeans<float>(
 			data,centers,label,seeds,
 			KmeansType::KMEANS_PLUS_SEEDS,
@@ -189,7 +189,7 @@ TEST_F(KmeansTest, test6) {
 }
 
 TEST_F(KmeansTest, test7) {
-	KmeansCriteria criteria = {2.0,1.0,100};
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
 	float * _data, * _centers, * _seeds;
 	int * _labels;
 	init_array(_data,6);
@@ -216,6 +216,144 @@ TEST_F(KmeansTest, test7) {
 	cout << endl;
 }
 
+TEST_F(KmeansTest, test8) {
+	// The sampled k-means labels all the data and improves on its seeds
+	KmeansCriteria criteria = {2.0,1.0,100,1e-3f};
+	random_seeds<float>(data,seeds,d,N,k,4,false);
+	double e0 = nearest_labels<float>(data,seeds,label,DistanceType::NORM_L2,d,N,k,4);
+	sampled_kmeans<float>(
+			data,centers,label,seeds,
+			KmeansType::KMEANS_PLUS_SEEDS,
+			criteria,
+			DistanceType::NORM_L2,
+			EmptyActs::SINGLETON,
+			N,k,d,N / 4,4,
+			false);
+	double e = label_distortion<float>(data,centers,label,DistanceType::NORM_L2,d,N,4);
+	for(int i = 0; i < N; i++)
+		ASSERT_TRUE(label[i] >= 0 && label[i] < k);
+	EXPECT_LT(e,e0);
+	cout << "SAMPLED: Distortion is " << sqrt(e) << endl;
+}
+
+TEST_F(KmeansTest, test9) {
+	// The mini-batch k-means stops early and improves on its seeds
+	KmeansCriteria criteria = {2.0,1.0,500,1e-3f};
+	random_seeds<float>(data,seeds,d,N,k,4,false);
+	double e0 = nearest_labels<float>(data,seeds,label,DistanceType::NORM_L2,d,N,k,4);
+	minibatch_kmeans<float>(
+			data,centers,label,seeds,
+			KmeansType::KMEANS_PLUS_SEEDS,
+			criteria,
+			DistanceType::NORM_L2,
+			EmptyActs::SINGLETON,
+			N,k,d,1024,4,
+			false);
+	double e = label_distortion<float>(data,centers,label,DistanceType::NORM_L2,d,N,4);
+	for(int i = 0; i < N; i++)
+		ASSERT_TRUE(label[i] >= 0 && label[i] < k);
+	EXPECT_LT(e,e0);
+	cout << "MINI_BATCH: Distortion is " << sqrt(e) << endl;
+}
+
+TEST_F(KmeansTest, test10) {
+	// The k-means|| seeds are distinct points of the data
+	kmeans_par_seeds<float>(data,seeds,DistanceType::NORM_L2,d,N,k,4,false);
+	int i, j, found;
+	for(i = 0; i < k; i++) {
+		found = 0;
+		for(j = 0; j < N && !found; j++)
+			found = memcmp(seeds + i * d,data + j * d,d * sizeof(float)) == 0;
+		ASSERT_TRUE(found);
+		for(j = 0; j < i; j++)
+			ASSERT_NE(0,memcmp(seeds + i * d,seeds + j * d,d * sizeof(float)));
+	}
+}
+
+TEST_F(KmeansTest, test11) {
+	KmeansCriteria criteria = {2.0,1.0,100,0.0f};
+	greg_kmeans<float>(
+			data,centers,label,seeds,
+			KmeansType::KMEANS_PARALLEL_SEEDS,
+			criteria,
+			DistanceType::NORM_L2,
+			EmptyActs::SINGLETON,
+			N,k,d,4,
+			false);
+	cout << "LINEAR: Distortion is " << distortion<float>(data,centers,label,DistanceType::NORM_L2,d,N,k,false) << endl;
+}
+
+TEST_F(KmeansTest, test12) {
+	// A strided view of the last columns is clustered like a copy of them
+	int h = d / 2, i, j;
+	float * slice;
+	int * label2;
+	init_array(slice,N * h);
+	init_array(label2,N);
+	for(i = 0; i < N; i++)
+		for(j = 0; j < h; j++)
+			slice[i * h + j] = data[i * d + h + j];
+	KmeansCriteria criteria = {2.0,1.0,20,0.0f};
+	greg_kmeans<float>(
+			data + h,centers,label,seeds,
+			KmeansType::KMEANS_PLUS_SEEDS,
+			criteria,
+			DistanceType::NORM_L2,
+			EmptyActs::SINGLETON,
+			N,k,h,4,
+			false,d);
+	double e = nearest_labels<float>(data + h,centers,label,DistanceType::NORM_L2,h,N,k,4,d);
+	double e2 = nearest_labels<float>(slice,centers,label2,DistanceType::NORM_L2,h,N,k,4);
+	EXPECT_DOUBLE_EQ(e,e2);
+	for(i = 0; i < N; i++)
+		ASSERT_EQ(label[i],label2[i]);
+	EXPECT_NEAR(e,label_distortion<float>(slice,centers,label2,DistanceType::NORM_L2,h,N,4),1e-6 * e);
+	::delete slice;
+	::delete label2;
+}
+
+TEST_F(KmeansTest, test13) {
+	// The blocked assignment of a list of points finds the nearest and
+	// the second nearest centers of a scan
+	random_seeds<float>(data,centers,d,N,k,4,false);
+	int n = N / 3, i, j, l;
+	int * ids, * near;
+	float * min, * min2;
+	init_array(ids,n);
+	init_array(near,n);
+	init_array(min,n);
+	init_array(min2,n);
+	for(i = 0; i < n; i++)
+		ids[i] = 3 * i + 1;
+	block_assign<float>(data,ids,n,centers,k,d,DistanceType::NORM_L2,
+			near,min,min2,4);
+	for(i = 0; i < n; i++) {
+		float m1 = FLT_MAX, m2 = FLT_MAX, v, eps = 0.0f;
+		// The expansion of the norms cancels a few bits of ||x||^2
+		for(j = 0; j < d; j++)
+			eps += data[ids[i] * d + j] * data[ids[i] * d + j];
+		eps *= 1e-6f;
+		for(j = 0; j < k; j++) {
+			v = distance_l2_square<float,float>(data + ids[i] * d,centers + j * d,d);
+			if(v < m1) {
+				m2 = m1;
+				m1 = v;
+			} else if(v < m2) {
+				m2 = v;
+			}
+		}
+		l = near[i];
+		v = distance_l2_square<float,float>(data + ids[i] * d,centers + l * d,d);
+		EXPECT_NEAR(m1,v,1e-4 * m1 + eps);
+		EXPECT_NEAR(m1,min[i],1e-4 * m1 + eps);
+		EXPECT_NEAR(m2,min2[i],1e-4 * m2 + eps);
+	}
+	::delete ids;
+	::delete near;
+	::delete min;
+	::delete min2;
+}
+
 /*TEST_F(KmeansTest, test6) {
 	Mat _data;
 	convert_array_to_mat(data,_data,N,d);
@@ -18,27 +18,323 @@ namespace SC {
 Encoder::Encoder() {
 	cq = nullptr;
 	pq = nullptr;
+	rq = nullptr;
+	refine = nullptr;
 	cid =  nullptr;
 	codes = nullptr;
 	old_mp = 0;
 	L = nullptr;
 	pid = nullptr;
-	L = nullptr;
-	pid = nullptr;
+	tile = 0;
+	tile_x = nullptr;
+	tile_res = nullptr;
+	tile_dist = nullptr;
+	norm_c = nullptr;
+	norm_r = nullptr;
+	norm_q = nullptr;
+	ivf_size = 0;
+	ivf_off = nullptr;
+	ivf_pid = nullptr;
+	ivf_codes = nullptr;
+	ivf_refine = nullptr;
 }
 
 Encoder::~Encoder() {
 	::delete cq;
 	::delete pq;
+	::delete rq;
 	::delete cid;
 	::delete codes;
+	::delete refine;
 	::delete L;
 	::delete pid;
 	cq = nullptr;
 	pq = nullptr;
+	rq = nullptr;
 	cid =  nullptr;
 	codes = nullptr;
-	ivf.clear();
+	refine = nullptr;
+	assign_release();
+	release_ivf();
+}
+
+/**
+ * Release the inverted file
+ */
+void Encoder::release_ivf() {
+	::delete ivf_off;
+	::delete ivf_pid;
+	::delete ivf_codes;
+	::delete ivf_refine;
+	ivf_off = nullptr;
+	ivf_pid = nullptr;
+	ivf_codes = nullptr;
+	ivf_refine = nullptr;
+	ivf_size = 0;
+}
+
+/**
+ * A view of a bucket of the inverted file
+ * @param i the bucket
+ */
+Bucket Encoder::bucket(size_t i) {
+	Bucket b;
+	if(ivf_off == nullptr || i >= ivf_size) return b;
+	b.L = ivf_off[i+1] - ivf_off[i];
+	b.pid = ivf_pid + ivf_off[i];
+	b.codes = ivf_codes + static_cast<size_t>(ivf_off[i]) * config.mp;
+	if(ivf_refine != nullptr)
+		b.refine = ivf_refine + static_cast<size_t>(ivf_off[i]) * index_refine_size(mr);
+	return b;
+}
+
+/**
+ * Prepare the blocked assignment: compute the squared norms of the centers
+ * and allocate the buffers of a tile. The tile is sized so that its distance
+ * matrix stays around SC_ASSIGN_BUDGET floats.
+ * @return the number of vectors of a tile
+ */
+size_t Encoder::assign_prepare() {
+	assign_release();
+	int bsc = config.dim/config.mc,
+			bsp = config.dim/config.mp;
+	// The two-level search compares a tile to the top-level centers only
+	size_t k = max(max(hcq.loaded() ? hcq.top_size() : config.kc,config.kp),kr);
+	tile = min<size_t>(SC_ASSIGN_TILE,max<size_t>(64,SC_ASSIGN_BUDGET / k));
+	SimpleCluster::init_array(norm_c,config.mc * config.kc);
+	SimpleCluster::init_array(norm_r,config.mp * config.kp);
+	SimpleCluster::init_array(tile_x,tile * config.dim);
+	SimpleCluster::init_array(tile_res,tile * config.dim);
+	SimpleCluster::init_array(tile_dist,tile * k);
+	l2_sqr_norms(cq,config.mc * config.kc,bsc,bsc,norm_c);
+	l2_sqr_norms(pq,config.mp * config.kp,bsp,bsp,norm_r);
+	if(mr > 0) {
+		int bsr = config.dim/mr;
+		SimpleCluster::init_array(norm_q,mr * kr);
+		l2_sqr_norms(rq,mr * kr,bsr,bsr,norm_q);
+	}
+	return tile;
+}
+
+/**
+ * Release the buffers of the blocked assignment
+ */
+void Encoder::assign_release() {
+	::delete norm_c;
+	::delete norm_r;
+	::delete norm_q;
+	::delete tile_x;
+	::delete tile_res;
+	::delete tile_dist;
+	norm_c = nullptr;
+	norm_r = nullptr;
+	norm_q = nullptr;
+	tile_x = nullptr;
+	tile_res = nullptr;
+	tile_dist = nullptr;
+}
+
+/**
+ * Find the nn nearest coarse centers of a tile of vectors in each sub-space
+ * and store the residuals to the nearest one in tile_res.
+ * The distances of a sub-space are computed with one sgemm, or with the
+ * two-level search if a coarse tree is loaded (see load_coarse_tree).
+ * @param x the vectors (m x dim, row major)
+ * @param m the number of vectors (m <= tile)
+ * @param nn the number of nearest centers
+ * @param u the output center ids (m x mc x nn), the nearest first
+ */
+void Encoder::assign_coarse(
+		const float * x,
+		size_t m,
+		int nn,
+		cid_t * u) {
+	int bsc = config.dim/config.mc;
+	int dim = config.dim, kc = config.kc, mc = config.mc;
+	if(hcq.loaded()) {
+		// mc = 1
+		vector<int> id(m * nn);
+		hcq.assign(x,m,dim,nn,&id[0],tile_dist);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for(size_t i = 0; i < m; i++) {
+			for(int k = 0; k < nn; k++)
+				u[i * nn + k] = id[i * nn + k];
+			const float * v = x + i * dim;
+			const float * c = cq + static_cast<size_t>(id[i * nn]) * dim;
+			float * r = tile_res + i * dim;
+			for(int k = 0; k < dim; k++)
+				r[k] = v[k] - c[k];
+		}
+		return;
+	}
+	for(int j = 0; j < mc; j++) {
+		l2_sqr_gemm(x + j * bsc,m,dim,nullptr,
+				cq + static_cast<size_t>(j) * kc * bsc,norm_c + j * kc,kc,bsc,
+				tile_dist);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+		{
+			// The nn nearest centers of a vector
+			vector<int> id(nn);
+			vector<float> dt(nn);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+			for(size_t i = 0; i < m; i++) {
+				nearest_row(tile_dist + i * kc,kc,nn,&id[0],&dt[0]);
+				cid_t * u_tmp = u + (i * mc + j) * nn;
+				for(int k = 0; k < nn; k++)
+					u_tmp[k] = id[k];
+				// Residual vector
+				const float * v = x + i * dim + j * bsc;
+				const float * c = cq + (static_cast<size_t>(j) * kc + id[0]) * bsc;
+				float * r = tile_res + i * dim + j * bsc;
+				for(int k = 0; k < bsc; k++)
+					r[k] = v[k] - c[k];
+			}
+		}
+	}
+}
+
+/**
+ * Compute the residuals of the vectors of tile_x to given coarse centers
+ * @param m the number of vectors
+ * @param u the center ids (m x mc)
+ */
+void Encoder::assign_residual(
+		size_t m,
+		const cid_t * u) {
+	int bsc = config.dim/config.mc;
+	int dim = config.dim, kc = config.kc, mc = config.mc;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(size_t i = 0; i < m; i++) {
+		for(int j = 0; j < mc; j++) {
+			const float * v = tile_x + i * dim + j * bsc;
+			const float * c = cq + (static_cast<size_t>(j) * kc + u[i * mc + j]) * bsc;
+			float * r = tile_res + i * dim + j * bsc;
+			for(int k = 0; k < bsc; k++)
+				r[k] = v[k] - c[k];
+		}
+	}
+}
+
+/**
+ * Encode the vectors of tile_res with a product quantizer.
+ * The distances of a sub-space are computed with one sgemm.
+ * @param books the codebooks (m_sub x k x dim/m_sub)
+ * @param norms the squared norms of the centers (m_sub x k)
+ * @param k the number of centers of a sub-space
+ * @param m_sub the number of sub-spaces
+ * @param m the number of vectors
+ * @param c the output codes (m x m_sub)
+ */
+void Encoder::assign_sub(
+		const float * books,
+		const float * norms,
+		int k,
+		int m_sub,
+		size_t m,
+		unsigned char * c) {
+	int bs = config.dim/m_sub, dim = config.dim;
+	for(int j = 0; j < m_sub; j++) {
+		l2_sqr_gemm(tile_res + j * bs,m,dim,nullptr,
+				books + static_cast<size_t>(j) * k * bs,norms + j * k,k,bs,
+				tile_dist);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for(size_t i = 0; i < m; i++)
+			c[i * m_sub + j] = argmin_row(tile_dist + i * k,k);
+	}
+}
+
+/**
+ * Encode the residuals of tile_res with the product quantizer
+ * @param m the number of vectors
+ * @param c the output codes (m x mp)
+ */
+void Encoder::assign_codes(
+		size_t m,
+		unsigned char * c) {
+	assign_sub(pq,norm_r,config.kp,config.mp,m,c);
+}
+
+/**
+ * Compute the refinement records of a tile whose residuals are in tile_res.
+ * The residuals of the residuals r2 = r - pq(r) are encoded with the
+ * refinement quantizer. The record also keeps the norm correction
+ * e = ||x1 + q(r2)||^2 - ||x1||^2 = 2<x1, q(r2)> + ||q(r2)||^2, where x1 = x - r2
+ * is the vector reconstructed by the coarse and the product quantizers:
+ * the distance to the refined vector is then
+ * d(y, x1) + e - 2 sum_j <y_j, q_j(r2)>, a second table lookup per sub-space.
+ * tile_res is overwritten.
+ * @param x the vectors (m x dim)
+ * @param m the number of vectors
+ * @param c the PQ codes of the vectors (m x mp)
+ * @param r the output records (m x index_refine_size(mr))
+ */
+void Encoder::assign_refine(
+		const float * x,
+		size_t m,
+		const unsigned char * c,
+		unsigned char * r) {
+	int dim = config.dim, kp = config.kp, mp = config.mp,
+			bsp = dim/mp, bsr = dim/mr;
+	size_t rs = index_refine_size(mr);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(size_t i = 0; i < m; i++) {
+		float * res = tile_res + i * dim;
+		for(int j = 0; j < mp; j++) {
+			const float * p = pq + (static_cast<size_t>(j) * kp + c[i * mp + j]) * bsp;
+			for(int k = 0; k < bsp; k++)
+				res[j * bsp + k] -= p[k];
+		}
+	}
+	vector<unsigned char> rc(m * mr);
+	assign_sub(rq,norm_q,kr,mr,m,&rc[0]);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(size_t i = 0; i < m; i++) {
+		const float * v = x + i * dim, * res = tile_res + i * dim;
+		float e = 0.0f;
+		for(int j = 0; j < mr; j++) {
+			const float * q = rq + (static_cast<size_t>(j) * kr + rc[i * mr + j]) * bsr;
+			for(int k = 0; k < bsr; k++)
+				e += (2.0f * (v[j * bsr + k] - res[j * bsr + k]) + q[k]) * q[k];
+		}
+		memcpy(r + i * rs,&e,sizeof(float));
+		memcpy(r + i * rs + sizeof(float),&rc[i * mr],mr);
+	}
+}
+
+/**
+ * Search the coarse centers with a two-level quantizer (IVFADC only):
+ * the coarse codebook holds the centers of its cells (see HierarchicalCQ).
+ * The codes and the inverted file are the same as with the linear search,
+ * up to the vectors that lie close to several cells.
+ * @param top_path the top-level codebook (filename.top_ of HierarchicalCQ::output)
+ * @param verbose enable verbose mode
+ */
+void Encoder::load_coarse_tree(
+		const char * top_path,
+		bool verbose) {
+	if(cq == nullptr || config.mc != 1) {
+		cerr << "The coarse tree needs the coarse codebook of an IVFADC" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(!hcq.load(top_path,cq,config.kc,config.dim,verbose))
+		exit(EXIT_FAILURE);
+	if(verbose)
+		cout << "Coarse tree: " << hcq.top_size() << "x" << hcq.cell_size()
+		<< " centers" << endl;
 }
 
 void Encoder::load_codebooks(
@@ -47,13 +343,40 @@ void Encoder::load_codebooks(
 		bool verbose) {
 	load_codebook<float>(cq_path,config,cq,0,verbose);
 	load_codebook<float>(pq_path,config,pq,1,verbose);
-	size = static_cast<int>(pow(config.kc,config.mc));
+	size = bucket_count(config.kc,config.mc);
+	if(size == 0) {
+		cerr << "The size of this inverted index is too LARGE!" << endl;
+		exit(EXIT_FAILURE);
+	}
 	if(verbose)
 		cout << "The size of ivf:" << size << endl;
 	cout << "--> Settings: (kc,mc,kp,mp)=" << config.kc << " "
 			<< config.mc << " " << config.kp << " " << config.mp << endl;
 }
 
+/**
+ * Load the refinement codebooks, a product quantizer of the residuals
+ * of the residuals (see assign_refine). The next encodings store
+ * a refinement record per vector.
+ * @param rq_path the refinement codebooks
+ * @param verbose enable verbose mode
+ */
+void Encoder::load_refinement(
+		const char * rq_path,
+		bool verbose) {
+	PQConfig rc = config;
+	::delete rq;
+	rq = nullptr;
+	load_codebook<float>(rq_path,rc,rq,1,verbose);
+	if(rc.dim != config.dim || rc.kp > 256 || rc.mp <= 0 || config.dim % rc.mp != 0) {
+		cerr << "The refinement codebooks " << rq_path << " do not match the codebooks" << endl;
+		exit(EXIT_FAILURE);
+	}
+	kr = rc.kp;
+	mr = rc.mp;
+	cout << "--> Refinement: (kr,mr)=" << kr << " " << mr << endl;
+}
+
 void Encoder::load_encoded_data(
 		const char * filename,
 		bool verbose) {
@@ -85,16 +408,25 @@ void Encoder::load_encoded_data(
 		exit(1);
 	}
 
-	int i, j, k;
+	if(index_is_container(mapped,f_size)) {
+		load_index(mapped,f_size,filename,verbose);
+		munmap(mapped,f_size);
+		close(fd);
+		return;
+	}
+
+	size_t i, p1;
+	int j, k;
 	size_t base_pid = 0, base_c = 0;
 	temp = mapped;
-	int not_empty, p, p1, l;
+	int l, n;
 
 	// Read the number of buckets and the size of database
 	memcpy(&non_empty_bucket,temp,sizeof(int));
 	cout << "The number of non empty buckets: " << non_empty_bucket << endl;
 	temp += sizeof(int);
-	memcpy(&(config.N),temp,sizeof(int));
+	memcpy(&n,temp,sizeof(int));
+	config.N = n;
 	temp += sizeof(int);
 
 	// Memory allocation
@@ -104,7 +436,7 @@ void Encoder::load_encoded_data(
 	SimpleCluster::init_array(L,size);
 	SimpleCluster::init_array(pid,static_cast<size_t>(config.N));
 
-	ushort c[config.mc];
+	vector<cid_t> c(config.mc);
 
 	for(i = 0; i < size; i++) {
 		// Read the length of the bucket
@@ -120,7 +452,7 @@ void Encoder::load_encoded_data(
 			p1 = (p1 - c[j]) / config.kc;
 		}
 
-		memcpy(&pid[base_pid],temp,l * sizeof(int));
+		index_read_ids(temp,pid + base_pid,l);
 		base_pid += l;
 		temp += l * sizeof(int);
 
@@ -145,6 +477,61 @@ void Encoder::load_encoded_data(
 #endif
 }
 
+/**
+ * Restore the bucket lengths, the ids and the coarse codes from an index container
+ * @param data the content of the file
+ * @param f_size the size of the file
+ * @param filename the name of the file
+ * @param verbose enable verbose mode
+ */
+void Encoder::load_index(
+		const unsigned char * data,
+		size_t f_size,
+		const char * filename,
+		bool verbose) {
+	if(!index_check(data,f_size,filename,true))
+		exit(EXIT_FAILURE);
+	IndexHeader header;
+	index_read_header(data,f_size,header);
+	if(!index_match(header,config,size,filename))
+		exit(EXIT_FAILURE);
+
+	non_empty_bucket = static_cast<int>(header.non_empty);
+	config.N = static_cast<idx_t>(header.n);
+	cout << "The number of non empty buckets: " << non_empty_bucket << endl;
+	SimpleCluster::init_array(cid,static_cast<size_t>(config.N)
+			* static_cast<size_t>(config.mc));
+	SimpleCluster::init_array(L,size);
+	SimpleCluster::init_array(pid,static_cast<size_t>(config.N));
+
+	BucketDirectory dir;
+	index_directory(data,header,dir,false);
+	memcpy(pid,data + header.sections[SC_SECTION_IDS].offset,
+			header.sections[SC_SECTION_IDS].size);
+
+	vector<cid_t> c(config.mc);
+	size_t i, j, l, p1, base_c = 0;
+	int k;
+	for(i = 0; i < size; i++) {
+		l = dir.length(i);
+		L[i] = l;
+		p1 = i;
+		for(k = config.mc - 1; k >= 0; --k) {
+			c[k] = p1 % config.kc;
+			p1 = (p1 - c[k]) / config.kc;
+		}
+		for(j = 0; j < l; j++) {
+			for(k = 0; k < config.mc; k++) {
+				cid[base_c++] = c[k];
+			}
+		}
+		if(verbose)
+			cout << "Read " << l << " vector(s)" << endl;
+	}
+
+	cout << "Read " << config.N << " data  from " << filename << endl;
+}
+
 PQConfig Encoder::get_config() {
 	return config;
 }
@@ -152,14 +539,17 @@ PQConfig Encoder::get_config() {
 void Encoder::statistic(bool detail) {
 	ofstream op;
 	op.open("./ivf.txt",ios::out);
-	int i, j, base = 0;
+	size_t i;
+	int j, base = 0;
+	Bucket b;
 	for(i = 0; i < size; i++) {
-		op << "Bucket " << i << ":" << ivf[i].L << endl;
+		b = bucket(i);
+		op << "Bucket " << i << ":" << b.L << endl;
 		base = 0;
-		for(j = 0; j < ivf[i].L; j++) {
-			op << ivf[i].pid[j] << ":";
+		for(j = 0; j < b.L; j++) {
+			op << b.pid[j] << ":";
 			for(int k = 0; k < config.mp; k++) {
-				op << static_cast<int>(ivf[i].codes[base++]) << " ";
+				op << static_cast<int>(b.codes[base++]) << " ";
 			}
 			op << endl;
 		}
@@ -167,43 +557,36 @@ void Encoder::statistic(bool detail) {
 	op.close();
 }
 
+/**
+ * Build the inverted file from the coarse codes (see build_ivf)
+ * @param verbose enable verbose mode
+ */
 void Encoder::distribution(bool verbose) {
-	size_t i, j;
-	size_t base_u = 0, base_c = 0, base_p = 0;
-	non_empty_bucket = 0;
-	int hash;
-	Bucket bk_tmp;
-	ivf.clear();
-	for(i = 0; i < size; i++) {
-		ivf.push_back(bk_tmp);
-	}
-	for(i = 0; i < config.N; i++) {
-		// Check whether if the bucket was created or not?
-		hash = vector_base(&cid[base_u],config.mc,config.kc);
-		// The bucket
-		if(hash < size) {
-			// Set the bucket id
-			ivf[hash].pid.insert(ivf[hash].pid.end(),base_p++);
-			ivf[hash].codes.insert(ivf[hash].codes.end(),
-					&codes[base_c], &codes[base_c + config.mp]);
-			ivf[hash].L++;
-			if(ivf[hash].L == 1) non_empty_bucket++;
-		}
-		base_u += config.mc;
-		base_c += config.mp;
-	}
+	size_t mc = config.mc;
+	size_t kc = config.kc, n = size;
+	cid_t * u = cid;
+	build_ivf(size,[u,mc,kc,n](size_t i) -> long {
+		size_t hash = vector_base(u + i * mc,mc,kc);
+		return hash < n ? static_cast<long>(hash) : -1;
+	});
 
 	if(verbose) {
 		cout << "The number of non-empty buckets: " << non_empty_bucket <<  endl;
-		int sum = 0;
-		for(i = 0; i < size; i++) {
-			cout << "ivf[" << i << "]:" << ivf[i].L << endl;
-			sum += ivf[i].L;
+		idx_t sum = 0;
+		for(size_t i = 0; i < size; i++) {
+			cout << "ivf[" << i << "]:" << ivf_off[i+1] - ivf_off[i] << endl;
+			sum += ivf_off[i+1] - ivf_off[i];
 		}
 		cout << sum << endl;
 	}
 }
 
+/**
+ * Output the inverted file in the index container (see sc_index.h)
+ * @param db_path the output folder
+ * @param db_prefix the prefix of the output file
+ * @param verbose enable verbose mode
+ */
 void Encoder::output(
 		const char * db_path,
 		const char * db_prefix,
@@ -211,9 +594,27 @@ void Encoder::output(
 	// Now we output the ivf structure to file
 	char fname[256];
 	sprintf(fname,"%s/%s_ivf.edat_",db_path,db_prefix);
+	write_index(fname,size,0,verbose);
+}
+
+void Encoder::output2(
+		const char * db_path,
+		const char * db_prefix,
+		bool verbose) {
+	// Now we output the ivf structure to file
+	char fname[256];
+	sprintf(fname,"%s/%s_ivf.edat_",db_path,db_prefix);
 	// Output the encoded data
 #ifdef _WIN32
 #else
+	if(config.N > INT_MAX) {
+		cerr << "The legacy layout cannot hold " << config.N << " vectors" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(size > INT_MAX) {
+		cerr << "The legacy layout cannot hold " << size << " buckets" << endl;
+		exit(EXIT_FAILURE);
+	}
 	int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC,(mode_t)0600); // file description
 	if(fd < 0) {
 		if(verbose)
@@ -223,9 +624,8 @@ void Encoder::output(
 
 	// The size of codes file
 	size_t f_size = static_cast<size_t>(config.N)
-					* static_cast<size_t>(config.mp)
-					+ static_cast<size_t>(config.N + size + 2)
-					* static_cast<size_t>(sizeof(int));
+											* static_cast<size_t>(config.mp)
+											+ static_cast<size_t>(config.N + size + 2) * static_cast<size_t>(sizeof(int));
 	int result = lseek(fd, f_size, SEEK_SET);
 	if (result == -1) {
 		close(fd);
@@ -251,7 +651,7 @@ void Encoder::output(
 	// Output the encoded data
 	size_t bytes = 0;
 	// The size of codes
-	int N = config.N;
+	int N = static_cast<int>(config.N);
 	// The first 8 bytes will be
 	// the number of buckets
 	memcpy(&fd_map[bytes],&non_empty_bucket,sizeof(int));
@@ -261,37 +661,27 @@ void Encoder::output(
 	bytes += sizeof(int);
 
 	// Output the buckets data
-	int L, tmp, i, j;
-	unsigned char c;
-	vector<int> pid;
-	vector<unsigned char> code2;
+	size_t i;
+	int l;
+	idx_t * _pid = pid;
+	unsigned char * _code2 = codes;
 	for(i = 0; i < size; i++) {
-		L = ivf[i].L;
+		l = L[i];
 		// Write out the length of the bucket
-		memcpy(&fd_map[bytes],&L,sizeof(int));
+		memcpy(&fd_map[bytes],&l,sizeof(int));
 		bytes += sizeof(int);
 
 		// Write the pid
-		pid = ivf[i].pid;
-		for(j = 0; j < L; j++) {
-			tmp = pid[j];
-			memcpy(&fd_map[bytes],&tmp,sizeof(int));
-			bytes += sizeof(int);
-		}
+		index_write_ids(_pid,&fd_map[bytes],l);
+		bytes += l * sizeof(int);
+		_pid += l;
 
 		// Write the code
-		code2 = ivf[i].codes;
-		if(code2.size() != L * config.mp) {
-			cerr << "Wrong data" << endl;
-			exit(EXIT_FAILURE);
-		}
-		for(j = 0; j < code2.size(); j++) {
-			c = code2[j];
-			memcpy(&fd_map[bytes],&c,sizeof(unsigned char));
-			bytes += sizeof(unsigned char);
-		}
-		pid.clear();
-		code2.clear();
+		memcpy(&fd_map[bytes],_code2, l * config.mp * sizeof(unsigned char));
+		bytes += l * config.mp * sizeof(unsigned char);
+		_code2 += l * config.mp;
+		if(verbose)
+			cout << "Exported " << l << " vector(s)" << endl;
 	}
 
 	if (munmap(fd_map, f_size) == -1) {
@@ -304,16 +694,59 @@ void Encoder::output(
 #endif
 }
 
-void Encoder::output2(
-		const char * db_path,
-		const char * db_prefix,
+/**
+ * Fill the header of an index container and place its sections
+ * @param header the header
+ * @param n_buckets the number of buckets
+ * @param nc the number of nearest centers of the dense partitioning (0 for IVFADC)
+ * @return the size of the file
+ */
+size_t Encoder::index_layout(
+		IndexHeader& header,
+		size_t n_buckets,
+		int nc) {
+	size_t n = static_cast<size_t>(config.N);
+	memset(&header,0,sizeof(IndexHeader));
+	memcpy(header.magic,SC_INDEX_MAGIC,sizeof(SC_INDEX_MAGIC));
+	header.version = SC_INDEX_VERSION;
+	header.header_size = sizeof(IndexHeader);
+	header.kc = config.kc;
+	header.mc = config.mc;
+	header.kp = config.kp;
+	header.mp = config.mp;
+	header.dim = config.dim;
+	header.nc = nc;
+	header.index_size = sizeof(idx_t);
+	header.kr = kr;
+	header.mr = mr;
+	header.n = n;
+	header.n_buckets = n_buckets;
+	header.non_empty = non_empty_bucket;
+	header.sections[SC_SECTION_OFFSETS].size = BucketDirectory::bytes(n_buckets,non_empty_bucket);
+	header.sections[SC_SECTION_IDS].size = n * sizeof(idx_t);
+	header.sections[SC_SECTION_CODES].size = n * config.mp;
+	header.sections[SC_SECTION_CODEBOOKS].size = static_cast<size_t>(config.kc + config.kp + kr)
+			* config.dim * sizeof(float);
+	header.sections[SC_SECTION_REFINE].size = n * index_refine_size(mr);
+	size_t i, f_size = index_align(sizeof(IndexHeader));
+	for(i = 0; i < SC_SECTIONS; i++) {
+		header.sections[i].offset = f_size;
+		f_size = index_align(f_size + header.sections[i].size);
+	}
+	return f_size;
+}
+
+/**
+ * Create a file of f_size bytes and map it for writing
+ * @param fname the output file
+ * @param f_size the size of the file
+ * @param verbose enable verbose mode
+ * @return the mapping
+ */
+unsigned char * Encoder::index_create(
+		const char * fname,
+		size_t f_size,
 		bool verbose) {
-	// Now we output the ivf structure to file
-	char fname[256];
-	sprintf(fname,"%s/%s_ivf.edat_",db_path,db_prefix);
-	// Output the encoded data
-#ifdef _WIN32
-#else
 	int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC,(mode_t)0600); // file description
 	if(fd < 0) {
 		if(verbose)
@@ -321,12 +754,7 @@ void Encoder::output2(
 		exit(1);
 	}
 
-	// The size of codes file
-	size_t f_size = static_cast<size_t>(config.N)
-											* static_cast<size_t>(config.mp)
-											+ static_cast<size_t>(config.N + size + 2) * static_cast<size_t>(sizeof(int));
-	int result = lseek(fd, f_size, SEEK_SET);
-	if (result == -1) {
+	if(lseek(fd, f_size - 1, SEEK_SET) == -1) {
 		close(fd);
 		if(verbose)
 			cerr << "Error calling lseek() to 'stretch' the file" <<  endl;
@@ -347,49 +775,271 @@ void Encoder::output2(
 			cerr << "Error mmapping the file" << endl;
 		exit(1);
 	}
-	// Output the encoded data
-	size_t bytes = 0;
-	// The size of codes
-	int N = config.N;
-	// The first 8 bytes will be
-	// the number of buckets
-	memcpy(&fd_map[bytes],&non_empty_bucket,sizeof(int));
-	bytes += sizeof(int);
-	// and the size of the database
-	memcpy(&fd_map[bytes],&N,sizeof(int));
-	bytes += sizeof(int);
+	close(fd);
+	return fd_map;
+}
 
-	// Output the buckets data
-	int l, tmp, i, j;
-	unsigned char c;
-	int * _pid = pid;
-	unsigned char * _code2 = codes;
-	for(i = 0; i < size; i++) {
-		l = L[i];
-		// Write out the length of the bucket
-		memcpy(&fd_map[bytes],&l,sizeof(int));
-		bytes += sizeof(int);
+/**
+ * Write the codebooks and the checksums of a mapped container, then unmap it
+ * @param fd_map the mapping
+ * @param header the header
+ * @param f_size the size of the file
+ * @param fname the output file
+ * @param verbose enable verbose mode
+ */
+void Encoder::index_finish(
+		unsigned char * fd_map,
+		IndexHeader& header,
+		size_t f_size,
+		const char * fname,
+		bool verbose) {
+	size_t i, cq_size = static_cast<size_t>(config.kc) * config.dim * sizeof(float),
+			pq_size = static_cast<size_t>(config.kp) * config.dim * sizeof(float);
+	unsigned char * _books = fd_map + header.sections[SC_SECTION_CODEBOOKS].offset;
+	memcpy(_books,cq,cq_size);
+	memcpy(_books + cq_size,pq,pq_size);
+	if(mr > 0)
+		memcpy(_books + cq_size + pq_size,rq,static_cast<size_t>(kr) * config.dim * sizeof(float));
 
-		// Write the pid
-		memcpy(&fd_map[bytes],_pid,l * sizeof(int));
-		bytes += l * sizeof(int);
-		_pid += l;
-
-		// Write the code
-		memcpy(&fd_map[bytes],_code2, l * config.mp * sizeof(unsigned char));
-		bytes += l * config.mp * sizeof(unsigned char);
-		_code2 += l * config.mp;
-		if(verbose)
-			cout << "Exported " << l << " vector(s)" << endl;
-	}
+	for(i = 0; i < SC_SECTIONS; i++)
+		header.sections[i].checksum = index_checksum(
+				fd_map + header.sections[i].offset,header.sections[i].size);
+	header.checksum = index_header_checksum(header);
+	memcpy(fd_map,&header,sizeof(IndexHeader));
 
 	if (munmap(fd_map, f_size) == -1) {
 		if(verbose)
 			cerr << "Error un-mmapping the file" << endl;
 	}
-	close(fd);
 
-	cout << "Read " << bytes << " byte(s) and wrote out " << f_size << " byte(s)" << endl;
+	cout << "Wrote out " << f_size << " byte(s) to " << fname << endl;
+}
+
+/**
+ * Write the inverted file in the index container (see sc_index.h)
+ * @param fname the output file
+ * @param n_buckets the number of buckets
+ * @param nc the number of nearest centers of the dense partitioning (0 for IVFADC)
+ * @param verbose enable verbose mode
+ */
+void Encoder::write_index(
+		const char * fname,
+		size_t n_buckets,
+		int nc,
+		bool verbose) {
+#ifdef _WIN32
+#else
+	if(ivf_off == nullptr || ivf_size != n_buckets) {
+		cerr << "The inverted file must be built first (see distribution)" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// Only the non-empty buckets have an offset
+	BucketDirectory dir;
+	dir.build(ivf_off + 1,n_buckets);
+	non_empty_bucket = static_cast<int>(dir.non_empty());
+
+	IndexHeader header;
+	size_t f_size = index_layout(header,n_buckets,nc);
+	unsigned char * fd_map = index_create(fname,f_size,verbose);
+	idx_t * _pid = reinterpret_cast<idx_t *>(fd_map + header.sections[SC_SECTION_IDS].offset);
+	unsigned char * _codes = fd_map + header.sections[SC_SECTION_CODES].offset;
+	dir.write(fd_map + header.sections[SC_SECTION_OFFSETS].offset);
+
+	// The buckets are already contiguous
+	size_t count = static_cast<size_t>(ivf_off[n_buckets]);
+	memcpy(_pid,ivf_pid,count * sizeof(idx_t));
+	memcpy(_codes,ivf_codes,count * config.mp);
+	if(mr > 0) {
+		if(ivf_refine == nullptr) {
+			cerr << "The refinement records must be encoded first" << endl;
+			exit(EXIT_FAILURE);
+		}
+		memcpy(fd_map + header.sections[SC_SECTION_REFINE].offset,ivf_refine,
+				header.sections[SC_SECTION_REFINE].size);
+	}
+	if(count != header.n) {
+		cerr << "Wrong data" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	index_finish(fd_map,header,f_size,fname,verbose);
+#endif
+}
+
+/**
+ * The path of the index container
+ * @param fname the output path
+ * @param db_path the output folder
+ * @param db_prefix the prefix of the output file
+ */
+void Encoder::index_path(
+		char * fname,
+		const char * db_path,
+		const char * db_prefix) {
+	sprintf(fname,"%s/%s_ivf.edat_",db_path,db_prefix);
+}
+
+/**
+ * The number of buckets of the inverted file: kc^mc
+ */
+size_t Encoder::num_buckets() {
+	return size;
+}
+
+/**
+ * The number of nearest centers of the dense partitioning (0 for IVFADC)
+ */
+int Encoder::index_nc() {
+	return 0;
+}
+
+/**
+ * Encode a chunk of vectors tile by tile (see assign_prepare)
+ * @param data the vectors (n x dim, row major)
+ * @param n the number of vectors
+ * @param bucket the bucket of each vector
+ * @param chunk_codes the PQ codes of each vector (n x mp)
+ * @param chunk_refine the refinement record of each vector, if mr > 0
+ */
+void Encoder::encode_chunk(
+		float * data,
+		size_t n,
+		size_t * bucket,
+		unsigned char * chunk_codes,
+		unsigned char * chunk_refine) {
+	vector<cid_t> u(n * config.mc);
+	size_t t0, m, i, rs = index_refine_size(mr);
+	for(t0 = 0; t0 < n; t0 += tile) {
+		m = min(tile,n - t0);
+		assign_coarse(data + t0 * config.dim,m,1,&u[t0 * config.mc]);
+		assign_codes(m,chunk_codes + t0 * config.mp);
+		if(mr > 0)
+			assign_refine(data + t0 * config.dim,m,chunk_codes + t0 * config.mp,
+					chunk_refine + t0 * rs);
+	}
+	for(i = 0; i < n; i++)
+		bucket[i] = vector_base(&u[i * config.mc],config.mc,config.kc);
+}
+
+/**
+ * Sort the postings of a chunk by bucket and append them to the spill file:
+ * [size_t n][size_t bucket[n]][idx_t id[n]][unsigned char codes[n * mp]]
+ * [unsigned char refine[n * index_refine_size(mr)]]
+ * The widest fields come first, so that they stay aligned whatever n is.
+ * @param fd the spill file
+ * @param first the identifier of the first vector of the chunk
+ * @param n the number of vectors
+ * @param bucket the bucket of each vector
+ * @param chunk_codes the PQ codes of each vector
+ * @param chunk_refine the refinement record of each vector, if mr > 0
+ * @param counts the number of vectors of each bucket, updated
+ */
+void Encoder::spill_run(
+		int fd,
+		idx_t first,
+		size_t n,
+		size_t * bucket,
+		unsigned char * chunk_codes,
+		unsigned char * chunk_refine,
+		idx_t * counts) {
+	vector<idx_t> order(n);
+	size_t i;
+	for(i = 0; i < n; i++)
+		order[i] = static_cast<idx_t>(i);
+	stable_sort(order.begin(),order.end(),
+			[bucket](idx_t a, idx_t b) -> bool { return bucket[a] < bucket[b]; });
+
+	size_t rs = index_refine_size(mr);
+	size_t bytes = sizeof(size_t) + n * (sizeof(size_t) + sizeof(idx_t) + config.mp + rs);
+	vector<unsigned char> run(bytes);
+	unsigned char * r = &run[0];
+	memcpy(r,&n,sizeof(size_t));
+	size_t * _bucket = reinterpret_cast<size_t *>(r + sizeof(size_t));
+	idx_t * _pid = reinterpret_cast<idx_t *>(_bucket + n);
+	unsigned char * _codes = reinterpret_cast<unsigned char *>(_pid + n);
+	unsigned char * _refine = _codes + n * config.mp;
+	for(i = 0; i < n; i++) {
+		_bucket[i] = bucket[order[i]];
+		_pid[i] = first + order[i];
+		memcpy(_codes + i * config.mp,chunk_codes + order[i] * config.mp,config.mp);
+		if(rs > 0)
+			memcpy(_refine + i * rs,chunk_refine + order[i] * rs,rs);
+		counts[_bucket[i]]++;
+	}
+	write_all(fd,r,bytes);
+}
+
+/**
+ * Merge the runs of the spill file into the index container.
+ * The runs are read one at a time, so the memory used is one run.
+ * @param fd the spill file
+ * @param fname the output file
+ * @param counts the number of vectors of each bucket
+ * @param n_buckets the number of buckets
+ * @param verbose enable verbose mode
+ */
+void Encoder::merge_runs(
+		int fd,
+		const char * fname,
+		idx_t * counts,
+		size_t n_buckets,
+		bool verbose) {
+#ifdef _WIN32
+#else
+	size_t i, j, count = 0;
+	non_empty_bucket = 0;
+	for(i = 0; i < n_buckets; i++)
+		if(counts[i] > 0) non_empty_bucket++;
+
+	IndexHeader header;
+	size_t f_size = index_layout(header,n_buckets,index_nc());
+	unsigned char * fd_map = index_create(fname,f_size,verbose);
+	idx_t * _pid = reinterpret_cast<idx_t *>(fd_map + header.sections[SC_SECTION_IDS].offset);
+	unsigned char * _codes = fd_map + header.sections[SC_SECTION_CODES].offset;
+	unsigned char * _refine = fd_map + header.sections[SC_SECTION_REFINE].offset;
+	size_t rs = index_refine_size(mr);
+
+	// The next free position of each bucket
+	idx_t l;
+	for(i = 0; i < n_buckets; i++) {
+		l = counts[i];
+		counts[i] = static_cast<idx_t>(count);
+		count += l;
+	}
+
+	size_t pos = 0, end = lseek(fd,0,SEEK_END), m, bytes;
+	vector<unsigned char> run;
+	idx_t p;
+	while(pos < end) {
+		read_all(fd,reinterpret_cast<unsigned char *>(&m),sizeof(size_t),pos);
+		pos += sizeof(size_t);
+		bytes = m * (sizeof(size_t) + sizeof(idx_t) + config.mp + rs);
+		run.resize(bytes);
+		read_all(fd,&run[0],bytes,pos);
+		pos += bytes;
+		size_t * r_bucket = reinterpret_cast<size_t *>(&run[0]);
+		idx_t * r_pid = reinterpret_cast<idx_t *>(r_bucket + m);
+		unsigned char * r_codes = reinterpret_cast<unsigned char *>(r_pid + m);
+		unsigned char * r_refine = r_codes + m * config.mp;
+		for(j = 0; j < m; j++) {
+			p = counts[r_bucket[j]]++;
+			_pid[p] = r_pid[j];
+			memcpy(_codes + static_cast<size_t>(p) * config.mp,r_codes + j * config.mp,config.mp);
+			if(rs > 0)
+				memcpy(_refine + static_cast<size_t>(p) * rs,r_refine + j * rs,rs);
+		}
+	}
+	// The counts are now the ends of the buckets
+	BucketDirectory dir;
+	dir.build(counts,n_buckets);
+	dir.write(fd_map + header.sections[SC_SECTION_OFFSETS].offset);
+	if(count != header.n) {
+		cerr << "Wrong data" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	index_finish(fd_map,header,f_size,fname,verbose);
 #endif
 }
 
@@ -22,4 +22,15 @@ MultiQuery::~MultiQuery()
 {
 }
 
+/**
+ * Size a workspace for search_multi: the cells have mc coordinates
+ * and at most w of them are traversed
+ * @param ws the workspace
+ * @param w the maximum number of cells to be traversed
+ * @param R the number of top retrieved results
+ */
+void MultiQuery::init_workspace(SearchWorkspace& ws, int w, int R) const {
+	ws.init(config,config.mc,w,w,R);
+}
+
 } /* namespace PQLearn */
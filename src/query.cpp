@@ -19,16 +19,17 @@ namespace SC {
 PQQuery::PQQuery() {
 	cq = nullptr;
 	pq = nullptr;
-	L = nullptr;
+	rq = nullptr;
 	pid = nullptr;
 	codes =  nullptr;
+	refine = nullptr;
 	norm_c = nullptr;
 	norm_r = nullptr;
 	dot_cr = nullptr;
-	diff_qr = nullptr;
-	diff_qc = nullptr;
-	real_dist = nullptr;
-	raw_data = nullptr;
+	fs_codes = nullptr;
+	fs_off = nullptr;
+	mapped = nullptr;
+	mapped_size = 0;
 }
 
 /**
@@ -37,27 +38,31 @@ PQQuery::PQQuery() {
 PQQuery::~PQQuery() {
 	::delete cq;
 	::delete pq;
-	::delete L;
-	::delete pid;
+	::delete rq;
+	if(mapped != nullptr) {
+		// The directory, pid, codes and refine point into the mapping
+		munmap(mapped,mapped_size);
+		mapped = nullptr;
+	} else {
+		::delete pid;
+		::delete refine;
+	}
 	cq = nullptr;
 	pq = nullptr;
-	L = nullptr;
+	rq = nullptr;
 	pid = nullptr;
 	codes =  nullptr;
+	refine = nullptr;
 	::delete norm_c;
 	::delete norm_r;
 	::delete dot_cr;
-	::delete diff_qr;
-	::delete diff_qc;
-	::delete real_dist;
-	::delete raw_data;
+	::delete fs_codes;
+	::delete fs_off;
 	norm_c = nullptr;
 	norm_r = nullptr;
 	dot_cr = nullptr;
-	diff_qr = nullptr;
-	diff_qc = nullptr;
-	real_dist = nullptr;
-	raw_data = nullptr;
+	fs_codes = nullptr;
+	fs_off = nullptr;
 }
 
 /**
@@ -69,17 +74,46 @@ void PQQuery::load_codebooks(
 		bool verbose) {
 	load_codebook<float>(cq_path,config,cq,0,verbose);
 	load_codebook<float>(pq_path,config,pq,1,verbose);
-	size = static_cast<int>(pow(config.kc,config.mc));
+	size = bucket_count(config.kc,config.mc);
+	if(size == 0) {
+		cerr << "The size of this inverted index is too LARGE!" << endl;
+		exit(EXIT_FAILURE);
+	}
 	cout << "--> Settings: (kc,mc,kp,mp)=" << config.kc << " "
 			<< config.mc << " " << config.kp << " " << config.mp << endl;
 }
 
+/**
+ * Rank the coarse centers with a two-level quantizer (IVFADC only): the
+ * coarse codebook holds the centers of its cells (see HierarchicalCQ).
+ * A search visits the centers of the nearest cells only, as many cells as
+ * set_probe(p) gives (SC_HCQ_PROBE by default) and at least ceil(w / kc2).
+ * @param top_path the top-level codebook (filename.top_ of HierarchicalCQ::output)
+ * @param verbose enable verbose mode
+ */
+void PQQuery::load_coarse_tree(
+		const char * top_path,
+		bool verbose) {
+	if(cq == nullptr || config.mc != 1) {
+		cerr << "The coarse tree needs the coarse codebook of an IVFADC" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(!hcq.load(top_path,cq,config.kc,config.dim,verbose))
+		exit(EXIT_FAILURE);
+	// The dot-products of a bucket are computed when it is scanned
+	::delete dot_cr;
+	dot_cr = nullptr;
+	if(verbose)
+		cout << "Coarse tree: " << hcq.top_size() << "x" << hcq.cell_size()
+		<< " centers" << endl;
+}
+
 /**
  * Load the encoded data from binary file
  * @param filename path to the encoded data file
  * @param verbose enable verbose mode
  */
-int PQQuery::load_encoded_data(const char * filename, bool verbose) {
+idx_t PQQuery::load_encoded_data(const char * filename, bool verbose) {
 #ifdef _WIN32
 #else
 	int fd = open(filename, O_RDONLY);
@@ -108,8 +142,15 @@ int PQQuery::load_encoded_data(const char * filename, bool verbose) {
 		exit(1);
 	}
 
+	if(index_is_container(mapped,f_size)) {
+		load_index(mapped,f_size,filename,verbose);
+		munmap(mapped,f_size);
+		close(fd);
+		return config.N;
+	}
+
 	int l;
-	size_t i, j, k, count = 0, tmp;
+	size_t i;
 	size_t base_pid = 0, base_code = 0;
 	temp = mapped;
 
@@ -117,12 +158,12 @@ int PQQuery::load_encoded_data(const char * filename, bool verbose) {
 	memcpy(&not_empty,temp,sizeof(int));
 	cout << "The number of non empty buckets: " << not_empty << "/" << size << endl;
 	temp += sizeof(int);
-	memcpy(&(config.N),temp,sizeof(int));
+	memcpy(&l,temp,sizeof(int));
+	config.N = l;
 	temp += sizeof(int);
 
 	// Memory allocation
-	// SimpleCluster::init_array<int>(bits,size >> 5 + 1); // The list of non-empty buckets as a bit set
-	SimpleCluster::init_array(L,size); // Only restore the length of non-empty buckets
+	dir.reset(size,not_empty); // Only the non-empty buckets have an offset
 	SimpleCluster::init_array(pid,config.N);
 	cout << "We will load " << config.N << " elements" << endl;
 	codes = (unsigned char *)::operator new(static_cast<size_t>(config.N) *
@@ -135,12 +176,15 @@ int PQQuery::load_encoded_data(const char * filename, bool verbose) {
 		if(verbose)
 			cout << "This bucket contains " << l << " vector(s)" << endl;
 
-		if(i > 0) L[i] = l + L[i-1];
-		else L[i] = l;
-
 		if(l > 0) {
+			if(!dir.append(i,static_cast<idx_t>(base_pid))) {
+				cerr << "There are more than " << not_empty
+						<< " non empty buckets in " << filename << endl;
+				exit(EXIT_FAILURE);
+			}
+
 			// Read the pid
-			memcpy(pid + base_pid,temp,l * sizeof(int));
+			index_read_ids(temp,pid + base_pid,l);
 			temp += l * sizeof(int);
 			base_pid += l;
 
@@ -152,6 +196,11 @@ int PQQuery::load_encoded_data(const char * filename, bool verbose) {
 	}
 
 
+	if(!dir.finish(static_cast<idx_t>(base_pid))) {
+		cerr << "The number of non empty buckets of " << filename << " is wrong" << endl;
+		exit(EXIT_FAILURE);
+	}
+
 	if(munmap(mapped,f_size) != 0) {
 		cerr << "Cannot munmap file data" << endl;
 		exit(EXIT_FAILURE);
@@ -165,14 +214,214 @@ int PQQuery::load_encoded_data(const char * filename, bool verbose) {
 }
 
 
+/**
+ * Map an index container (see Encoder::output).
+ * L, pid and codes point straight into the mapping, which is kept
+ * until the object is destroyed. The pages are loaded on demand and
+ * shared by all the processes that map the same file.
+ * @param filename path to the index container
+ * @param verbose enable verbose mode
+ * @return the number of vectors
+ */
+idx_t PQQuery::map_encoded_data(const char * filename, bool verbose) {
+#ifdef _WIN32
+#else
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		if(verbose)
+			cerr << "Cannot open the file" << endl;
+		exit(1);
+	}
+
+	struct stat s;
+	int status = fstat(fd, &s);
+	if(status < 0) {
+		if(verbose)
+			cerr << "Cannot get statistics of file" << endl;
+		exit(1);
+	}
+
+	size_t f_size = s.st_size; // The size of file
+	if(f_size < sizeof(IndexHeaderV2)) {
+		cerr << "The file " << filename << " is not an index container" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	/* Mapping the file */
+	unsigned char * m = (unsigned char *)mmap(0, f_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(m == MAP_FAILED) {
+		if(verbose)
+			cerr << "Cannot map the file " << filename << endl;
+		exit(1);
+	}
+	close(fd);
+
+	size_t n_buckets = num_buckets();
+	// Only the header is verified, so that the pages are still loaded on demand
+	IndexHeader header;
+	if(!index_check(m,f_size,filename,false)
+			|| !index_read_header(m,f_size,header)
+			|| !index_match(header,config,n_buckets,filename)) {
+		munmap(m,f_size);
+		exit(EXIT_FAILURE);
+	}
+	not_empty = static_cast<int>(header.non_empty);
+	config.N = static_cast<idx_t>(header.n);
+	index_directory(m,header,dir,false);
+	pid = reinterpret_cast<idx_t *>(m + header.sections[SC_SECTION_IDS].offset);
+	codes = m + header.sections[SC_SECTION_CODES].offset;
+	load_refinement(m,header,false);
+	mapped = m;
+	mapped_size = f_size;
+
+	cout << "The number of non empty buckets: " << not_empty << "/" << n_buckets
+			<< ", directory: " << dir.memory() << " byte(s)" << endl;
+	cout << "Mapped " << config.N << " data  from " << filename << endl;
+
+	return config.N;
+#endif
+}
+
+/**
+ * Map the raw vectors of a .fvecs or a .bvecs file for the exact distances,
+ * without loading them: only the pages of the re-ranked vectors are read.
+ * The bytes of a .bvecs file are used as they are (see SC_RAW_UINT8).
+ * @param filename the .fvecs or .bvecs file of the database
+ * @param verbose enable verbose mode
+ * @return the number of vectors
+ */
+idx_t PQQuery::map_data(const char * filename, bool verbose) {
+	// No table of all the exact distances (see pre_compute3) is allocated
+	size_t l = strlen(filename);
+	bool bytes = l >= 6 && strcmp(filename + l - 6,".bvecs") == 0;
+	config.N = raw.map(filename,config.dim,verbose,bytes ? SC_RAW_UINT8 : SC_RAW_FLOAT);
+	return config.N;
+}
+
+/**
+ * Copy the inverted file out of an index container.
+ * The checksums of all the sections are verified.
+ * @param data the content of the file
+ * @param f_size the size of the file
+ * @param filename the name of the file
+ * @param verbose enable verbose mode
+ */
+void PQQuery::load_index(
+		const unsigned char * data,
+		size_t f_size,
+		const char * filename,
+		bool verbose) {
+	if(!index_check(data,f_size,filename,true))
+		exit(EXIT_FAILURE);
+	IndexHeader header;
+	index_read_header(data,f_size,header);
+	size_t n_buckets = num_buckets();
+	if(!index_match(header,config,n_buckets,filename))
+		exit(EXIT_FAILURE);
+	if(verbose)
+		cout << "Verified the container " << filename << " (version "
+				<< header.version << ", " << header.n_buckets << " buckets)" << endl;
+
+	not_empty = static_cast<int>(header.non_empty);
+	config.N = static_cast<idx_t>(header.n);
+	cout << "The number of non empty buckets: " << not_empty << "/" << n_buckets << endl;
+	index_directory(data,header,dir,true);
+	SimpleCluster::init_array(pid,config.N);
+	codes = (unsigned char *)::operator new(header.sections[SC_SECTION_CODES].size + 1);
+	memcpy(pid,data + header.sections[SC_SECTION_IDS].offset,
+			header.sections[SC_SECTION_IDS].size);
+	memcpy(codes,data + header.sections[SC_SECTION_CODES].offset,
+			header.sections[SC_SECTION_CODES].size);
+	load_refinement(data,header,true);
+
+	cout << "Read " << config.N << " data  from " << filename << endl;
+}
+
+/**
+ * Read the refinement quantizer of a checked container, if it has one:
+ * its codebooks follow the coarse and the product codebooks
+ * @param data the content of the file
+ * @param header the header of the container
+ * @param copy copy the refinement records, otherwise they are a view of the data
+ */
+void PQQuery::load_refinement(
+		const unsigned char * data,
+		const IndexHeader& header,
+		bool copy) {
+	kr = header.kr;
+	mr = header.mr;
+	if(mr <= 0) return;
+	size_t books = static_cast<size_t>(config.kc + config.kp) * config.dim * sizeof(float);
+	const IndexSection& s = header.sections[SC_SECTION_REFINE];
+	::delete rq;
+	SimpleCluster::init_array(rq,static_cast<size_t>(kr) * config.dim);
+	memcpy(rq,data + header.sections[SC_SECTION_CODEBOOKS].offset + books,
+			static_cast<size_t>(kr) * config.dim * sizeof(float));
+	if(copy) {
+		refine = (unsigned char *)::operator new(s.size + 1);
+		memcpy(refine,data + s.offset,s.size);
+	} else {
+		refine = const_cast<unsigned char *>(data + s.offset);
+	}
+	cout << "--> Refinement: (kr,mr)=" << kr << " " << mr << endl;
+}
+
+/**
+ * The number of buckets of the inverted file
+ */
+size_t PQQuery::num_buckets() {
+	return size;
+}
+
+/**
+ * Pack the loaded 8-bit codes into 4-bit fast-scan blocks (kp = 16 only).
+ * Each bucket starts on a new block. The 8-bit codes are released,
+ * so only the fast-scan search can be used afterwards.
+ * @param verbose enable verbose mode
+ * @return true if the codes were packed
+ */
+bool PQQuery::enable_fast_scan(bool verbose) {
+	if(config.kp != 16) {
+		if(verbose)
+			cerr << "Fast-scan needs kp = 16, but kp = " << config.kp << endl;
+		return false;
+	}
+	if(codes == nullptr || !dir.loaded()) {
+		cerr << "The encoded data must be loaded first" << endl;
+		return false;
+	}
+
+	size_t i, l;
+	idx_t start;
+	size_t bs = fs_block_size(config.mp);
+	SimpleCluster::init_array(fs_off,size + 1);
+	fs_off[0] = 0;
+	for(i = 0; i < size; i++) {
+		l = dir.length(i);
+		fs_off[i+1] = fs_off[i] + fs_blocks(l);
+	}
+	SimpleCluster::init_array(fs_codes,fs_off[size] * bs + 1);
+	for(i = 0; i < size; i++) {
+		l = dir.bucket(i,start);
+		if(l > 0)
+			fs_pack(codes + start * config.mp,l,config.mp,
+					fs_codes + fs_off[i] * bs);
+	}
+	if(mapped == nullptr)
+		::delete codes;
+	codes = nullptr;
+
+	if(verbose)
+		cout << "Packed " << config.N << " codes into "
+		<< fs_off[size] * bs << " bytes" << endl;
+	return true;
+}
+
 double PQQuery::entropy(size_t size) {
 	double e = 0.0;
-	double N = config.N, l = L[0], x;
-	x = N/l;
-	if(L[0] > 0)
-		e = log2(x) / x;
-	for(int i = 1; i < size; i++) {
-		l = L[i] - L[i-1];
+	double N = config.N, l, x;
+	for(size_t i = 0; i < size; i++) {
+		l = dir.length(i);
 		if(l > 0.0) {
 			x = N / l;
 			e += log2(x) / x;
@@ -188,4 +437,12 @@ int PQQuery::get_size() {
 int PQQuery::get_full_size() {
 	return size;
 }
+
+PQConfig PQQuery::get_config() {
+	return config;
+}
+
+const BaseVectors& PQQuery::get_raw_data() const {
+	return raw;
+}
 } /* namespace PQLearn */
@@ -14,60 +14,31 @@
 using namespace std;
 
 namespace SC {
+/**
+ * Build the inverted file from the nc nearest coarse centers (see build_ivf)
+ * @param verbose enable verbose mode
+ */
 void SCEncoder::distribution(bool verbose) {
-	size_t i, j;
-	size_t base_u = 0, base_c = 0, base_p = 0;
-	non_empty_bucket = 0;
-	int hash, hash2;
-	Bucket bk_tmp;
-	size_t size1 = static_cast<size_t>(size);
-	size_t size2 = (size1 * (size1 - 1)) >> 1;
+	size_t i;
 	size_t kc = static_cast<size_t>(config.kc);
-	int size3 = pow(kc,nc);
-	size_t size4 = pow(kc,config.mc * nc);
-	if(size4 >= INT_MAX) {
-		cerr << "The size of this inverted index is too LARGE!" << endl;
-		cerr << "kc=" << kc << ";mc=" << config.mc << ";nc=" << nc
-				<< ";size4=" << size4 << endl;
-		exit(EXIT_FAILURE);
-	}
-	size_t id;
-	for(i = 0; i < size4; i++) {
-		ivf.push_back(bk_tmp);
-	}
+	size_t size4 = num_buckets();
 
-	int uid[config.mc];
-	for(i = 0; i < config.N; i++) {
-		for(j = 0; j < config.mc; j++, base_u++) {
-			uid[j] = 0;//config.kc * cid[base_u] + cid[base_u + config.mc];
-			for(int k = 0; k < nc; k++) {
-				uid[j] *= kc;
-				uid[j] += cid[base_u + k * config.mc];
-			}
-		}
-
-		// Set the bucket id
-		id = vector_base(&uid[0],config.mc,size3);
-		if(id != -1) {
-			ivf[id].pid.insert(ivf[id].pid.end(),base_p++);
-			ivf[id].codes.insert(ivf[id].codes.end(),
-					&codes[base_c], &codes[base_c + config.mp]);
-			ivf[id].L++;
-			if(ivf[id].L == 1) non_empty_bucket++;
-		}
-		base_u += (config.mc);
-		base_c += (config.mp);
-	}
+	// cid holds the nc nearest centers of each sub-space: [i][j][k],
+	// the digits of the bucket in base kc
+	int n = config.mc * nc;
+	cid_t * u = cid;
+	build_ivf(size4,[u,n,kc](size_t i) -> long {
+		return static_cast<long>(vector_base(u + i * n,n,kc));
+	});
 
 	if(verbose) {
-		int sum = 0;
-		int tmp = 0;
+		idx_t sum = 0;
+		idx_t tmp = 0;
 		double e = 0.0;
 		double x;
-		for(size_t i = 0; i < size4; i++) {
-			tmp = ivf[i].L;
+		for(i = 0; i < size4; i++) {
+			tmp = ivf_off[i+1] - ivf_off[i];
 			if(tmp > 0) {
-				//				cout << "ivf[" << i << "]:" << tmp << endl;
 				x = 1.0 * config.N / tmp;
 				e += log2(x) / x;
 				sum += tmp;
@@ -80,104 +51,83 @@ void SCEncoder::distribution(bool verbose) {
 	}
 }
 
+/**
+ * Output the inverted file in the index container (see sc_index.h)
+ * @param db_path the output folder
+ * @param db_prefix the prefix of the output file
+ * @param verbose enable verbose mode
+ */
 void SCEncoder::output(
 		const char * db_path,
 		const char * db_prefix,
 		bool verbose) {
 	// Now we output the ivf structure to file
 	char fname[256];
+	index_path(fname,db_path,db_prefix);
+	write_index(fname,num_buckets(),nc,verbose);
+}
+
+/**
+ * The path of the index container
+ * @param fname the output path
+ * @param db_path the output folder
+ * @param db_prefix the prefix of the output file
+ */
+void SCEncoder::index_path(
+		char * fname,
+		const char * db_path,
+		const char * db_prefix) {
 	sprintf(fname,"%s/%s_mr%d_ivf.edat_",db_path,db_prefix,nc);
-	size_t size1 = static_cast<size_t>(size);
-	size_t size2 = ((size1 * (size1 - 1)) >> 1);
-	size_t kc = static_cast<size_t>(config.kc);
-	int size3 = pow(kc,nc);
-	size_t size4 = pow(size3,config.mc);
-	if(size4 >= INT_MAX) {
+}
+
+/**
+ * The number of buckets of the inverted file: (kc^nc)^mc
+ */
+size_t SCEncoder::num_buckets() {
+	size_t size4 = bucket_count(config.kc,config.mc * nc);
+	if(size4 == 0) {
 		cerr << "The size of this inverted index is too LARGE!" << endl;
-		cerr << "kc=" << kc << ";mc=" << config.mc << ";nc=" << nc
-				<< ";size4=" << size4 << endl;
+		cerr << "kc=" << config.kc << ";mc=" << config.mc << ";nc=" << nc << endl;
 		exit(EXIT_FAILURE);
 	}
-	// Output the encoded data
-#ifdef _WIN32
-#else
-	int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC,(mode_t)0600); // file description
-	if(fd < 0) {
-		if(verbose)
-			cerr << "Cannot open the file " << fname << endl;
-		exit(1);
-	}
-
-	// The size of codes file
-	size_t f_size = static_cast<size_t>(config.N)* static_cast<size_t>(config.mp)
-															+ static_cast<size_t>(config.N + size4 + 2)
-															* static_cast<size_t>(sizeof(int));
-	int result = lseek(fd, f_size, SEEK_SET);
-	if (result == -1) {
-		close(fd);
-		if(verbose)
-			cerr << "Error calling lseek() to 'stretch' the file" <<  endl;
-		exit(1);
-	}
-
-	int status = write(fd, "", 1);
-	if(status != 1) {
-		if(verbose)
-			cerr << "Cannot write to file" << endl;
-		exit(1);
-	}
-
-	unsigned char * fd_map = (unsigned char *)mmap(0, f_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (fd_map == MAP_FAILED) {
-		close(fd);
-		if(verbose)
-			cerr << "Error mmapping the file" << endl;
-		exit(1);
-	}
-	// Output the encoded data
-	size_t bytes = 0;
-	// The size of codes
-	int N = config.N;
-	// The first 8 bytes will be
-	// the number of buckets
-	memcpy(&fd_map[bytes],&non_empty_bucket,sizeof(int));
-	bytes += sizeof(int);
-	// and the size of the database
-	memcpy(&fd_map[bytes],&N,sizeof(int));
-	bytes += sizeof(int);
-
-	// Output the buckets data
-	size_t L, tmp, i, id, j, k;
-	unsigned char c;
-	vector<int> pid;
-	vector<unsigned char> code2;
-	for(i = 0; i < size4; i++) {
-		L = ivf[i].L;
-		// Write out the length of the bucket
-		memcpy(&fd_map[bytes],&L,sizeof(int));
-		bytes += sizeof(int);
-		if(L > 0) {
-			// Write the pid
-			pid = ivf[i].pid;
-			memcpy(&fd_map[bytes],&pid[0],L * sizeof(int));
-			bytes += L *sizeof(int);
+	return size4;
+}
 
-			// Write the code
-			code2 = ivf[i].codes;
-			memcpy(&fd_map[bytes],&code2[0],code2.size() * sizeof(unsigned char));
-			bytes += code2.size() * sizeof(unsigned char);
-			pid.clear();
-			code2.clear();
-		}
-	}
+/**
+ * The number of nearest centers of the dense partitioning
+ */
+int SCEncoder::index_nc() {
+	return nc;
+}
 
-	if (munmap(fd_map, f_size) == -1) {
-		if(verbose)
-			cerr << "Error un-mmapping the file" << endl;
+/**
+ * Encode a chunk of vectors tile by tile (see assign_prepare).
+ * The bucket of a vector is given by its nc nearest centers in each subspace.
+ * @param data the vectors (n x dim, row major)
+ * @param n the number of vectors
+ * @param bucket the bucket of each vector
+ * @param chunk_codes the PQ codes of each vector (n x mp)
+ * @param chunk_refine the refinement record of each vector, if mr > 0
+ */
+void SCEncoder::encode_chunk(
+		float * data,
+		size_t n,
+		size_t * bucket,
+		unsigned char * chunk_codes,
+		unsigned char * chunk_refine) {
+	vector<cid_t> u(n * config.mc * nc);
+	size_t kc = static_cast<size_t>(config.kc);
+	size_t t0, m, i, rs = index_refine_size(mr);
+	for(t0 = 0; t0 < n; t0 += tile) {
+		m = min(tile,n - t0);
+		assign_coarse(data + t0 * config.dim,m,nc,&u[t0 * config.mc * nc]);
+		assign_codes(m,chunk_codes + t0 * config.mp);
+		if(mr > 0)
+			assign_refine(data + t0 * config.dim,m,chunk_codes + t0 * config.mp,
+					chunk_refine + t0 * rs);
 	}
-	close(fd);
-
-	cout << "Read " << bytes << " byte(s) and wrote out " << f_size << " byte(s)" << endl;
-#endif
+	// The nc codes of the mc sub-spaces are the digits of the bucket
+	for(i = 0; i < n; i++)
+		bucket[i] = vector_base(&u[i * config.mc * nc],config.mc * nc,kc);
 }
 } /* namespace PQLearn */
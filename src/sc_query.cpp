@@ -28,12 +28,37 @@ SCQuery::~SCQuery()
 {
 }
 
+/**
+ * Size a workspace for search_mr_ivf: the cells have nc coordinates.
+ * The empty cells with a repeated center are traversed too, so that
+ * the traversal is not bounded by w; the workspace is sized for w cells
+ * and grows with the longest traversal.
+ * @param ws the workspace
+ * @param w the maximum number of cells to be visited
+ * @param R the number of top retrieved results
+ */
+void SCQuery::init_workspace(SearchWorkspace& ws, int w, int R) const {
+	ws.init(config,nc,bucket_count(config.kc,nc),w,R);
+}
+
+/**
+ * The number of cells of the inverted file: kc^nc
+ */
+size_t SCQuery::num_buckets() {
+	size_t n = bucket_count(size,nc);
+	if(n == 0) {
+		cerr << "The size of this inverted index is too LARGE!" << endl;
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
 /**
  * Load the encoded data from binary file
  * @param filename path to the encoded data file
  * @param verbose enable verbose mode
  */
-int SCQuery::load_encoded_data(const char * filename, bool verbose) {
+idx_t SCQuery::load_encoded_data(const char * filename, bool verbose) {
 #ifdef _WIN32
 #else
 	int fd = open(filename, O_RDONLY);
@@ -62,22 +87,28 @@ int SCQuery::load_encoded_data(const char * filename, bool verbose) {
 		exit(1);
 	}
 
-	size_t l, i, j, k, count = 0, tmp;
+	if(index_is_container(mapped,f_size)) {
+		load_index(mapped,f_size,filename,verbose);
+		munmap(mapped,f_size);
+		close(fd);
+		return config.N;
+	}
+
+	size_t l = 0, i;
 	size_t base_pid = 0, base_code = 0;
-	size_t size1 =  static_cast<size_t>(size);
-	size_t size2 = pow(size1,nc);
+	size_t size2 = num_buckets();
 	temp = mapped;
 
 	// Read the number of buckets and the size of database
 	memcpy(&not_empty,temp,sizeof(int));
 	cout << "The number of non empty buckets: " << not_empty << endl;
 	temp += sizeof(int);
-	memcpy(&(config.N),temp,sizeof(int));
+	memcpy(&l,temp,sizeof(int));
+	config.N = l;
 	temp += sizeof(int);
 
 	// Memory allocation
-	// SimpleCluster::init_array<int>(bits,size >> 5 + 1); // The list of non-empty buckets as a bit set
-	SimpleCluster::init_array(L,size2); // Only restore the length of non-empty buckets
+	dir.reset(size2,not_empty); // Only the non-empty buckets have an offset
 	SimpleCluster::init_array(pid,config.N);
 	codes = (unsigned char *)::operator new(static_cast<size_t>(config.N) *
 			static_cast<size_t>(config.mp) * sizeof(unsigned char));
@@ -86,19 +117,18 @@ int SCQuery::load_encoded_data(const char * filename, bool verbose) {
 		// Read the length of the bucket
 		memcpy(&l,temp,sizeof(int));
 		temp += sizeof(int);
-		//		if(l > 0) {
-		//			tmp = i & 32;
-		//			bits[i>>5] |= (1 << (31 - tmp));
-		//			L[count++] = l;
-		//		}
-		if(i > 0) L[i] = l + L[i-1];
-		else L[i] = l;
 		if(verbose)
 			cout << "This bucket contains " << l << " vector(s)" << endl;
 
 		if(l > 0) {
+			if(!dir.append(i,static_cast<idx_t>(base_pid))) {
+				cerr << "There are more than " << not_empty
+						<< " non empty buckets in " << filename << endl;
+				exit(EXIT_FAILURE);
+			}
+
 			// Read the pid
-			memcpy(pid + base_pid,temp,l * sizeof(int));
+			index_read_ids(temp,pid + base_pid,l);
 			temp += l * sizeof(int);
 			base_pid += l;
 
@@ -108,7 +138,10 @@ int SCQuery::load_encoded_data(const char * filename, bool verbose) {
 			base_code += l * config.mp;
 		}
 	}
-
+	if(!dir.finish(static_cast<idx_t>(base_pid))) {
+		cerr << "The number of non empty buckets of " << filename << " is wrong" << endl;
+		exit(EXIT_FAILURE);
+	}
 
 	if(munmap(mapped,f_size) != 0) {
 		cerr << "Cannot munmap file data" << endl;
@@ -0,0 +1,257 @@
+/*
+ * search_context.cpp
+ *
+ *  Created on: 2026/10/17
+ */
+
+#include <iostream>
+#include "search_context.h"
+
+using namespace std;
+
+namespace SC {
+
+SearchContext::SearchContext() {
+	diff_qc = nullptr;
+	diff_qr = nullptr;
+	adc_table = nullptr;
+	dot_table = nullptr;
+	lut = nullptr;
+	fs_dist = nullptr;
+	fs_capacity = 0;
+	real_dist = nullptr;
+	refine_table = nullptr;
+	refine_capacity = 0;
+	v_tmp = nullptr;
+	buckets = nullptr;
+	dist = nullptr;
+	result = nullptr;
+	capacity = 0;
+}
+
+SearchContext::SearchContext(const PQConfig& config) : SearchContext::SearchContext() {
+	init(config);
+}
+
+SearchContext::~SearchContext() {
+	clear();
+	::delete real_dist;
+	real_dist = nullptr;
+}
+
+/**
+ * Allocate the query dependent tables
+ * @param config the configuration of the index
+ */
+void SearchContext::init(const PQConfig& config) {
+	clear();
+	SimpleCluster::init_array(diff_qc, config.mc * config.kc);
+	SimpleCluster::init_array(diff_qr, config.mp * config.kp);
+	SimpleCluster::init_array(adc_table, config.mp * config.kp);
+	SimpleCluster::init_array(dot_table, config.mp * config.kp);
+	SimpleCluster::init_array(lut, ((config.mp + 1) >> 1) * 32);
+	SimpleCluster::init_array(v_tmp, config.kc);
+	SimpleCluster::init_array(buckets, config.kc);
+	reserve(SC_SCAN_CHUNK);
+}
+
+/**
+ * Make sure that the candidate buffers can hold n elements
+ * @param n the number of candidates
+ */
+void SearchContext::reserve(size_t n) {
+	if(n <= capacity) return;
+	::delete dist;
+	::delete result;
+	SimpleCluster::init_array(dist, n);
+	SimpleCluster::init_array(result, n);
+	capacity = n;
+}
+
+/**
+ * Make sure that the fast-scan buffer can hold n distances
+ * @param n the number of distances
+ */
+void SearchContext::reserve_fs(size_t n) {
+	if(n <= fs_capacity) return;
+	::delete fs_dist;
+	SimpleCluster::init_array(fs_dist, n);
+	fs_capacity = n;
+}
+
+/**
+ * Make sure that the refinement table can hold n entries
+ * @param n the number of entries (mr * kr)
+ */
+void SearchContext::reserve_refine(size_t n) {
+	if(n <= refine_capacity) return;
+	::delete refine_table;
+	SimpleCluster::init_array(refine_table, n);
+	refine_capacity = n;
+}
+
+/**
+ * Score the candidates of a bucket with the merged table adc_table
+ * and offer them to top, SC_SCAN_CHUNK candidates at a time
+ * @param codes the codes of the candidates (n x mp)
+ * @param ids the identifiers of the candidates
+ * @param n the number of candidates
+ * @param mp the number of sub-quantizers
+ * @param kp the number of centers of each sub-quantizer
+ * @param bias the value added to every distance
+ */
+void SearchContext::scan(const unsigned char * codes, const idx_t * ids,
+		size_t n, int mp, int kp, float bias) {
+	if(capacity == 0) reserve(SC_SCAN_CHUNK);
+	size_t i, m;
+	for(i = 0; i < n; i += m) {
+		m = min(n - i, capacity);
+		adc_scan(codes + i * mp,m,mp,kp,adc_table,bias,dist);
+		top.push(dist,ids + i,m);
+	}
+}
+
+/**
+ * Score the candidates of a bucket like scan above, but offer them to top
+ * with their positions in the inverted file instead of their identifiers
+ * @param codes the codes of the candidates (n x mp)
+ * @param first the position of the first candidate
+ * @param n the number of candidates
+ * @param mp the number of sub-quantizers
+ * @param kp the number of centers of each sub-quantizer
+ * @param bias the value added to every distance
+ */
+void SearchContext::scan(const unsigned char * codes, idx_t first,
+		size_t n, int mp, int kp, float bias) {
+	if(capacity == 0) reserve(SC_SCAN_CHUNK);
+	size_t i, m;
+	for(i = 0; i < n; i += m) {
+		m = min(n - i, capacity);
+		adc_scan(codes + i * mp,m,mp,kp,adc_table,bias,dist);
+		top.push(dist,first + static_cast<idx_t>(i),m);
+	}
+}
+
+void SearchContext::clear() {
+	::delete diff_qc;
+	::delete diff_qr;
+	::delete adc_table;
+	::delete dot_table;
+	::delete lut;
+	::delete fs_dist;
+	::delete refine_table;
+	::delete v_tmp;
+	::delete buckets;
+	::delete dist;
+	::delete result;
+	diff_qc = nullptr;
+	diff_qr = nullptr;
+	adc_table = nullptr;
+	dot_table = nullptr;
+	lut = nullptr;
+	fs_dist = nullptr;
+	fs_capacity = 0;
+	refine_table = nullptr;
+	refine_capacity = 0;
+	v_tmp = nullptr;
+	buckets = nullptr;
+	dist = nullptr;
+	result = nullptr;
+	capacity = 0;
+}
+
+SearchWorkspace::SearchWorkspace() : SearchContext::SearchContext() {
+	coarse = nullptr;
+	coarse_id = nullptr;
+	q = nullptr;
+	heap = nullptr;
+	visited = nullptr;
+	D = 0;
+	n_cells = n_cache = heap_cap = 0;
+	w = R = 0;
+	sum = empty = 0;
+	t1 = t2 = 0.0;
+	arena = nullptr;
+}
+
+SearchWorkspace::SearchWorkspace(const PQConfig& config,
+		int D, size_t n_cache, int w, int R) : SearchWorkspace::SearchWorkspace() {
+	init(config,D,n_cache,w,R);
+}
+
+SearchWorkspace::~SearchWorkspace() {
+	::delete arena;
+	::delete heap;
+	arena = nullptr;
+	heap = nullptr;
+}
+
+/**
+ * Allocate all the scratch arrays of a search
+ * @param config the configuration of the index
+ * @param D the number of coordinates of a cell (2 to 4)
+ * @param n_cache the maximum number of traversed cells of a query
+ * @param w the maximum number of non-empty cells to be visited
+ * @param R the number of top retrieved results
+ */
+void SearchWorkspace::init(const PQConfig& config,
+		int D, size_t n_cache, int w, int R) {
+	SearchContext::init(config);
+	top.reset(R);
+	::delete arena;
+
+	const size_t line = 64;
+	size_t kc = static_cast<size_t>(config.mc) * config.kc;
+	size_t ww = static_cast<size_t>(w);
+	size_t i, m = min(n_cache,ww);
+	n_cells = 1;
+	for(i = 1; i < D; i++)
+		n_cells *= config.kc;
+	// Each visited cell adds at most D - 1 cells to the frontier, and no two
+	// cells of the frontier share their first D - 1 coordinates.
+	// The frontier and the traversed cells are sized for w cells
+	// and grow if a traversal goes further.
+	heap_cap = min(n_cells,(D - 1) * m + 1);
+	n_cells *= config.kc;
+	::delete heap;
+	SimpleCluster::init_array(heap,ms_heap_bytes(D,heap_cap));
+	cells.reserve(m);
+	size_t sizes[] = {
+			kc * sizeof(float), // coarse
+			kc * sizeof(int), // coarse_id
+			config.mc * sizeof(float), // q
+			D * ww * sizeof(int) // visited
+	};
+	const int n_arrays = sizeof(sizes) / sizeof(size_t);
+	size_t offsets[n_arrays], total = 0;
+	for(i = 0; i < n_arrays; i++) {
+		offsets[i] = total;
+		total += (sizes[i] + line - 1) / line * line;
+	}
+	SimpleCluster::init_array(arena,total + line);
+	unsigned char * base = arena + (line - reinterpret_cast<uintptr_t>(arena) % line) % line;
+
+	coarse = reinterpret_cast<float *>(base + offsets[0]);
+	coarse_id = reinterpret_cast<int *>(base + offsets[1]);
+	q = reinterpret_cast<float *>(base + offsets[2]);
+	visited = reinterpret_cast<int *>(base + offsets[3]);
+
+	this->D = D;
+	this->n_cache = n_cache;
+	this->w = w;
+	this->R = R;
+}
+
+/**
+ * Check that the workspace is large enough for a search
+ * @param n_cells the number of cells of the traversal
+ * @param D the number of coordinates of a cell
+ * @param w the maximum number of non-empty cells to be visited
+ * @param R the number of top retrieved results
+ */
+bool SearchWorkspace::fits(size_t n_cells, int D, int w, int R) const {
+	return arena != nullptr && this->D == D && this->n_cells == n_cells
+			&& w <= this->w && R <= this->R;
+}
+
+} /* namespace SC */
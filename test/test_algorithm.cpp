@@ -12,6 +12,12 @@
 #include <gtest/gtest.h>
 #include <utilities.h>
 #include "sc_algorithm.h"
+#include "sc_top.h"
+#include "sc_heap.h"
+#include "sc_multiseq.h"
+#include "sc_directory.h"
+#include "sc_rerank.h"
+#include "sc_hcq.h"
 
 using namespace std;
 using namespace SC;
@@ -98,6 +104,423 @@ TEST_F(AlgorithmTest, test5) {
 	memset(td,0,1<<28);
 }
 
+TEST_F(AlgorithmTest, test6) {
+	const int n = 100, k = 300, d = 16, r = 3;
+	float x[n * d], c[k * d], x_norms[n], c_norms[k], dist[n * k];
+	mt19937 gen(2014);
+	uniform_real_distribution<float> real_dis(-1.0, 1.0);
+	for(int i = 0; i < n * d; i++) x[i] = real_dis(gen);
+	for(int i = 0; i < k * d; i++) c[i] = real_dis(gen);
+	l2_sqr_norms(x,n,d,d,x_norms);
+	l2_sqr_norms(c,k,d,d,c_norms);
+	l2_sqr_gemm(x,n,d,x_norms,c,c_norms,k,d,dist);
+
+	for(int i = 0; i < n; i++) {
+		float dt[k], best[r];
+		int ids[k], nn[r];
+		for(int j = 0; j < k; j++) {
+			dt[j] = SimpleCluster::distance_l2_square<float>(x + i * d,c + j * d,d);
+			ids[j] = j;
+			EXPECT_NEAR(dt[j],dist[i * k + j],1e-04);
+		}
+		sort_id(dt,dt + k,ids);
+		EXPECT_EQ(ids[0],argmin_row(dist + i * k,k));
+		nearest_row(dist + i * k,k,r,nn,best);
+		for(int j = 0; j < r; j++)
+			EXPECT_EQ(ids[j],nn[j]) << "the " << j << "-th neighbor of " << i << endl;
+	}
+}
+
+TEST_F(AlgorithmTest, test7) {
+	const int n = 1000, R = 10;
+	float d[n], dt[n], best[R + 5];
+	idx_t ids[n], result[R + 5];
+	int order[n];
+	mt19937 gen(2014);
+	uniform_real_distribution<float> real_dis(0.0, 1.0);
+	for(int i = 0; i < n; i++) {
+		dt[i] = d[i] = real_dis(gen);
+		ids[i] = order[i] = i;
+	}
+	sort_id(dt,dt + n,order);
+
+	// Scalar and batch pushes, the heap is reused across queries
+	TopR top;
+	top.reset(R);
+	for(int i = 0; i < n / 2; i++)
+		top.push(d[i],ids[i]);
+	top.push(d + n / 2,ids + n / 2,n - n / 2);
+	EXPECT_EQ(R,top.finish(result,best));
+	for(int j = 0; j < R; j++) {
+		EXPECT_EQ(order[j],result[j]) << "the " << j << "-th neighbor" << endl;
+		EXPECT_EQ(dt[j],best[j]);
+	}
+
+	// Less candidates than R: the tail is padded
+	top.reset(R + 5);
+	top.push(d,ids,R);
+	EXPECT_EQ(R,top.finish(result,best));
+	for(int j = 1; j < R; j++)
+		EXPECT_LE(best[j - 1],best[j]);
+	for(int j = R; j < R + 5; j++) {
+		EXPECT_EQ(-1,result[j]);
+		EXPECT_EQ(FLT_MAX,best[j]);
+	}
+}
+
+TEST_F(AlgorithmTest, test8) {
+	// Few distinct values, below the radix sort threshold
+	const int n = 5000, r = 100;
+	float d0[n], d[n], d2[n], d3[n];
+	idx_t ids[n];
+	int ids2[n];
+	mt19937 gen(2014);
+	uniform_int_distribution<int> int_dis(-50, 50);
+	for(int i = 0; i < n; i++) {
+		d0[i] = d3[i] = d2[i] = d[i] = int_dis(gen) * 0.5f;
+		ids2[i] = ids[i] = i;
+	}
+	sort_id(d,d + n,ids);
+	sort(d3,d3 + n);
+	for(int i = 0; i < n; i++) {
+		EXPECT_EQ(d3[i],d[i]) << "data differ at " << i << endl;
+		EXPECT_EQ(d0[ids[i]],d[i]) << "indices differ at " << i << endl;
+	}
+
+	nth_element_id(d2,d2 + n,ids2,r);
+	EXPECT_EQ(d3[r],d2[r]);
+	for(int i = 0; i < n; i++) {
+		EXPECT_EQ(d0[ids2[i]],d2[i]) << "indices differ at " << i << endl;
+		if(i < r) {
+			EXPECT_LE(d2[i],d2[r]);
+		}
+		if(i > r) {
+			EXPECT_GE(d2[i],d2[r]);
+		}
+	}
+}
+
+TEST_F(AlgorithmTest, test9) {
+	// D = 3 sorted lists: the cells come out in ascending order of their sums
+	const int n = 12, D = 3, n_cells = n * n * n, w = 50;
+	float l[D][n], sums[n_cells], prev = -FLT_MAX;
+	const float * lists[D] = {l[0],l[1],l[2]};
+	mt19937 gen(2014);
+	uniform_real_distribution<float> real_dis(0.0, 1.0);
+	for(int d = 0; d < D; d++) {
+		for(int i = 0; i < n; i++)
+			l[d][i] = real_dis(gen);
+		sort(l[d],l[d] + n);
+	}
+	int m = 0;
+	for(int i = 0; i < n; i++)
+		for(int j = 0; j < n; j++)
+			for(int k = 0; k < n; k++)
+				sums[m++] = l[0][i] + l[1][j] + l[2][k];
+	sort(sums,sums + n_cells);
+
+	// The frontier and the set start small and grow with the traversal
+	unsigned char * heap;
+	size_t heap_cap = 4;
+	SimpleCluster::init_array(heap,ms_heap_bytes(D,heap_cap));
+	CellSet cells;
+	cells.reserve(8);
+	vector<bool> seen(n_cells,false);
+	MultiSequence<D> ms(lists,n,heap,heap_cap,cells,n_cells);
+	MSCell<D> c;
+	m = 0;
+	while(ms.next(c)) {
+		size_t i = (c.h[0] * n + c.h[1]) * n + c.h[2];
+		EXPECT_FALSE(seen[i]) << "the cell " << i << " is visited twice" << endl;
+		seen[i] = true;
+		EXPECT_LE(prev,c.key);
+		EXPECT_FLOAT_EQ(sums[m++],c.key);
+		prev = c.key;
+	}
+	EXPECT_EQ(n_cells,m);
+	EXPECT_LT(4u,heap_cap);
+	EXPECT_EQ(static_cast<size_t>(n_cells),cells.size());
+	ms.clear();
+	EXPECT_EQ(0u,cells.size());
+
+	// A bounded traversal visits the w closest cells
+	MultiSequence<D> ms2(lists,n,heap,heap_cap,cells,w);
+	m = 0;
+	while(ms2.next(c))
+		EXPECT_FLOAT_EQ(sums[m++],c.key);
+	EXPECT_EQ(w,m);
+	ms2.clear();
+	::delete heap;
+}
+
+TEST_F(AlgorithmTest, test10) {
+	// The 4-ary heap pops its keys in ascending order, duplicates included
+	const int n = 1000, cap = 900;
+	float d[n];
+	vector<unsigned char> storage(MinHeap4<HeapEntry>::bytes(cap) + 5);
+	MinHeap4<HeapEntry> pq(storage.data() + 5,cap);
+	mt19937 gen(2014);
+	uniform_int_distribution<int> int_dis(0, 300);
+	HeapEntry e;
+	for(int i = 0; i < n; i++) {
+		e.key = d[i] = int_dis(gen) * 0.25f;
+		e.id = i;
+		EXPECT_EQ(i < cap,pq.push(e));
+	}
+	EXPECT_EQ(static_cast<size_t>(cap),pq.size());
+	// The children of a cell share a half cache line
+	EXPECT_EQ(3 * sizeof(HeapEntry),reinterpret_cast<uintptr_t>(&pq.top()) % 64);
+
+	sort(d,d + cap);
+	for(int i = 0; i < cap; i++) {
+		ASSERT_TRUE(pq.pop(e));
+		EXPECT_EQ(d[i],e.key) << "keys differ at " << i << endl;
+		if(i > 0 && i % 100 == 0) {
+			// Interleave the insertions and the removals
+			EXPECT_TRUE(pq.push(e));
+			ASSERT_TRUE(pq.pop(e));
+			EXPECT_EQ(d[i],e.key);
+		}
+	}
+	EXPECT_TRUE(pq.empty());
+	EXPECT_FALSE(pq.pop(e));
+}
+
+TEST_F(AlgorithmTest, test11) {
+	// The set of traversed cells holds indices beyond 32 bits
+	const size_t n = 10000, big = static_cast<size_t>(1) << 40;
+	CellSet cells;
+	cells.reserve(100);
+	mt19937_64 gen(2014);
+	vector<size_t> in(n);
+	for(size_t i = 0; i < n; i++) {
+		in[i] = (gen() % big) | 1; // odd indices
+		if(!cells.contains(in[i]))
+			cells.insert(in[i]);
+	}
+	for(size_t i = 0; i < n; i++) {
+		EXPECT_TRUE(cells.contains(in[i]));
+		EXPECT_FALSE(cells.contains(in[i] - 1));
+	}
+	size_t bytes = cells.bytes();
+	cells.clear();
+	EXPECT_EQ(0u,cells.size());
+	EXPECT_EQ(bytes,cells.bytes());
+	for(size_t i = 0; i < n; i++)
+		EXPECT_FALSE(cells.contains(in[i]));
+}
+
+TEST_F(AlgorithmTest, test12) {
+	// The directory gives the buckets of the dense prefix sums, and finds
+	// the bucket of every position
+	const size_t n = 5000;
+	vector<idx_t> ends(n);
+	mt19937 gen(2014);
+	uniform_int_distribution<int> int_dis(0, 99);
+	idx_t end = 0;
+	for(size_t b = 0; b < n; b++) {
+		// Mostly empty buckets, with long runs in the first words
+		if(b >= 700 && int_dis(gen) < 97) end += int_dis(gen) % 5 + 1;
+		ends[b] = end;
+	}
+	BucketDirectory dir;
+	dir.build(ends.data(),n);
+	EXPECT_EQ(n,dir.size());
+	EXPECT_EQ(end,dir.end());
+
+	vector<unsigned char> buf(BucketDirectory::bytes(n,dir.non_empty()));
+	EXPECT_EQ(buf.size(),dir.memory());
+	dir.write(buf.data());
+	BucketDirectory view;
+	view.view(buf.data(),n,dir.non_empty());
+
+	idx_t start, l, prev = 0;
+	size_t ne = 0;
+	for(size_t b = 0; b < n; b++) {
+		EXPECT_EQ(ne,dir.rank(b));
+		l = view.bucket(b,start);
+		EXPECT_EQ(ends[b] - prev,l) << "lengths differ at " << b << endl;
+		if(l > 0) {
+			EXPECT_EQ(prev,start);
+			for(idx_t p = start; p < start + l; p++)
+				ASSERT_EQ(b,dir.find(p));
+			ne++;
+		}
+		prev = ends[b];
+	}
+	EXPECT_EQ(ne,dir.non_empty());
+}
+
+TEST_F(AlgorithmTest, test13) {
+	// The exact distance kernels agree on every dimension, tails included
+	mt19937 gen(2014);
+	uniform_real_distribution<float> real_dis(-1.0, 1.0);
+	vector<float> a(131), b(131);
+	for(int i = 0; i < 131; i++) {
+		a[i] = real_dis(gen);
+		b[i] = real_dis(gen);
+	}
+	float d;
+	for(int n = 0; n <= 131; n++) {
+		d = l2_square_scalar(a.data(),b.data(),n);
+		EXPECT_NEAR(d,l2_square(a.data(),b.data(),n),1e-4f * (d + 1.0f));
+#ifdef SC_RERANK_X86
+		EXPECT_NEAR(d,l2_square_sse(a.data(),b.data(),n),1e-4f * (d + 1.0f));
+		if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+			EXPECT_NEAR(d,l2_square_avx2(a.data(),b.data(),n),1e-4f * (d + 1.0f));
+		}
+#endif
+	}
+}
+
+TEST_F(AlgorithmTest, test14) {
+	// The conversions round to the nearest and the compact kernels agree
+	// with the distances to the decoded vectors
+	EXPECT_EQ(1.0f,half_to_float(float_to_half(1.0f)));
+	EXPECT_EQ(-2.5f,half_to_float(float_to_half(-2.5f)));
+	EXPECT_EQ(65504.0f,half_to_float(float_to_half(65504.0f)));
+	EXPECT_TRUE(isinf(half_to_float(float_to_half(70000.0f))));
+	EXPECT_TRUE(isnan(half_to_float(float_to_half(NAN))));
+	EXPECT_EQ(ldexp(1.0f,-24),half_to_float(float_to_half(ldexp(1.0f,-24))));
+	EXPECT_EQ(0x3C00,float_to_half(1.0f + ldexp(1.0f,-11))); // a tie, to even
+	EXPECT_EQ(0x3C01,float_to_half(1.0f + ldexp(1.0f,-11) + ldexp(1.0f,-20)));
+	EXPECT_EQ(1.0f,bf16_to_float(float_to_bf16(1.0f)));
+	EXPECT_EQ(0x3F80,float_to_bf16(1.0f + ldexp(1.0f,-8))); // a tie, to even
+	EXPECT_TRUE(isnan(bf16_to_float(float_to_bf16(NAN))));
+	EXPECT_EQ(0,float_to_uint8(-3.0f));
+	EXPECT_EQ(255,float_to_uint8(300.0f));
+	EXPECT_EQ(13,float_to_uint8(12.6f));
+
+	mt19937 gen(2014);
+	uniform_real_distribution<float> real_dis(-1.0, 1.0);
+	vector<float> a(131), b(131), h(131), f(131), u(131);
+	vector<uint16_t> bh(131), bf(131);
+	vector<unsigned char> bu(131);
+	int i, n;
+	for(i = 0; i < 131; i++) {
+		a[i] = real_dis(gen) * 128.0f + 128.0f;
+		b[i] = real_dis(gen) * 128.0f + 128.0f;
+		bh[i] = float_to_half(b[i]);
+		bf[i] = float_to_bf16(b[i]);
+		bu[i] = float_to_uint8(b[i]);
+		h[i] = half_to_float(bh[i]);
+		f[i] = bf16_to_float(bf[i]);
+		u[i] = bu[i];
+		EXPECT_LE(fabs(h[i] - b[i]),ldexp(fabs(b[i]),-11));
+		EXPECT_LE(fabs(f[i] - b[i]),ldexp(fabs(b[i]),-8));
+	}
+	float d;
+	for(n = 0; n <= 131; n++) {
+		d = l2_square_scalar(a.data(),h.data(),n);
+		EXPECT_NEAR(d,l2_square_fp16_scalar(a.data(),bh.data(),n),1e-4f * (d + 1.0f));
+		EXPECT_NEAR(d,l2_square_fp16(a.data(),bh.data(),n),1e-4f * (d + 1.0f));
+		d = l2_square_scalar(a.data(),f.data(),n);
+		EXPECT_NEAR(d,l2_square_bf16_scalar(a.data(),bf.data(),n),1e-4f * (d + 1.0f));
+		EXPECT_NEAR(d,l2_square_bf16(a.data(),bf.data(),n),1e-4f * (d + 1.0f));
+		d = l2_square_scalar(a.data(),u.data(),n);
+		EXPECT_NEAR(d,l2_square_uint8_scalar(a.data(),bu.data(),n),1e-4f * (d + 1.0f));
+		EXPECT_NEAR(d,l2_square_uint8(a.data(),bu.data(),n),1e-4f * (d + 1.0f));
+#ifdef SC_RERANK_X86
+		if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+			if(__builtin_cpu_supports("f16c")) {
+				d = l2_square_scalar(a.data(),h.data(),n);
+				EXPECT_NEAR(d,l2_square_fp16_avx2(a.data(),bh.data(),n),1e-4f * (d + 1.0f));
+			}
+			d = l2_square_scalar(a.data(),f.data(),n);
+			EXPECT_NEAR(d,l2_square_bf16_avx2(a.data(),bf.data(),n),1e-4f * (d + 1.0f));
+			d = l2_square_scalar(a.data(),u.data(),n);
+			EXPECT_NEAR(d,l2_square_uint8_avx2(a.data(),bu.data(),n),1e-4f * (d + 1.0f));
+		}
+#endif
+	}
+}
+
+TEST_F(AlgorithmTest, test15) {
+	// The two-level coarse quantizer: with all the cells probed, the assignment
+	// and the ranking are those of a linear scan of the kc1 x kc2 centers
+	const int N = 3000, d = 16, kc1 = 6, kc2 = 8, kc = kc1 * kc2, nq = 20;
+	mt19937 gen(2014);
+	normal_distribution<float> dis(0.0, 1.0);
+	vector<float> data(N * d), query(nq * d);
+	int i, j, k;
+	for(i = 0; i < N * d; i++) data[i] = dis(gen) + (i / d % 4) * 3.0f;
+	for(i = 0; i < nq * d; i++) query[i] = dis(gen) * 2.0f;
+
+	for(float balance : {0.0f, 1.2f}) {
+		HierarchicalCQ hcq;
+		hcq.train(data.data(),N,d,kc1,kc2,balance,false);
+		ASSERT_TRUE(hcq.loaded());
+		ASSERT_EQ(kc1,hcq.top_size());
+		ASSERT_EQ(kc2,hcq.cell_size());
+		ASSERT_EQ(kc,hcq.size());
+		const float * c = hcq.centers();
+		for(i = 0; i < kc * d; i++) ASSERT_FALSE(isnan(c[i]));
+		hcq.set_probe(kc1);
+
+		// Assignment
+		vector<int> ids(nq * 2);
+		vector<float> work(nq * kc1), ref(kc);
+		hcq.assign(query.data(),nq,d,2,ids.data(),work.data());
+		for(i = 0; i < nq; i++) {
+			for(j = 0; j < kc; j++) {
+				ref[j] = 0;
+				for(k = 0; k < d; k++)
+					ref[j] += (query[i * d + k] - c[j * d + k]) * (query[i * d + k] - c[j * d + k]);
+			}
+			float best = *min_element(ref.begin(),ref.end());
+			EXPECT_NEAR(best,ref[ids[i * 2]],1e-3f * (best + 1.0f));
+			EXPECT_LE(ref[ids[i * 2]],ref[ids[i * 2 + 1]] + 1e-3f * (best + 1.0f));
+		}
+
+		// Ranking
+		vector<float> q_qc(kc), v_tmp(kc);
+		vector<int> buckets(kc);
+		const float * q = query.data();
+		int w = hcq.rank(q,10,q_qc.data(),buckets.data(),v_tmp.data());
+		ASSERT_EQ(10,w);
+		for(j = 0; j < kc; j++) {
+			float s = 0, n = 0;
+			for(k = 0; k < d; k++) {
+				s += q[k] * c[j * d + k];
+				n += c[j * d + k] * c[j * d + k];
+			}
+			EXPECT_NEAR(n - 2.0f * s,q_qc[j],1e-3f * (n + 1.0f));
+			ref[j] = n - 2.0f * s;
+		}
+		vector<float> sorted(ref);
+		sort(sorted.begin(),sorted.end());
+		for(i = 0; i < w; i++) {
+			EXPECT_FLOAT_EQ(q_qc[buckets[i]],v_tmp[i]);
+			EXPECT_NEAR(sorted[i],v_tmp[i],1e-3f * (fabs(sorted[i]) + 1.0f));
+			if(i > 0) {
+				EXPECT_LE(v_tmp[i - 1],v_tmp[i]);
+			}
+		}
+
+		// With fewer cells probed, only their centers are ranked
+		hcq.set_probe(1);
+		w = hcq.rank(q,kc,q_qc.data(),buckets.data(),v_tmp.data());
+		EXPECT_EQ(kc,w);
+		w = hcq.rank(q,4,q_qc.data(),buckets.data(),v_tmp.data());
+		EXPECT_EQ(4,w);
+		for(i = 1; i < w; i++)
+			EXPECT_EQ(buckets[0] / kc2,buckets[i] / kc2);
+	}
+}
+
+TEST_F(AlgorithmTest, test16) {
+	// The bucket counts and the bucket ids of the inverted files beyond 2^31
+	EXPECT_EQ(static_cast<size_t>(1) << 32,bucket_count(256,4));
+	EXPECT_EQ(static_cast<size_t>(1) << 40,bucket_count(1024,4));
+	EXPECT_EQ(0u,bucket_count(static_cast<size_t>(1) << 32,3));
+	EXPECT_EQ(1u,bucket_count(256,0));
+	cid_t u[4] = {255,255,255,255}, v[4] = {1,0,0,3};
+	EXPECT_EQ((static_cast<size_t>(1) << 32) - 1,vector_base(u,4,256));
+	EXPECT_EQ((static_cast<size_t>(1) << 24) + 3,vector_base(v,4,256));
+	size_t w[2] = {65535,65535};
+	EXPECT_EQ((static_cast<size_t>(1) << 32) - 1,vector_base(w,2,65536));
+}
+
 int main(int argc, char * argv[]) {
 	/*
 	 * The method is initializes the Google framework and must be called before RUN_ALL_TESTS
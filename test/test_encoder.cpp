@@ -8,6 +8,7 @@
 #include "encoder.h"
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <random>
 #include <cstring>
 #include <cstdio>
@@ -104,6 +105,75 @@ TEST_F(EncoderTest, DISABLED_test7) {
 	e.output2("./data/codebooks",name,true);
 }
 
+TEST_F(EncoderTest, test9) {
+	char filename[256];
+	sprintf(filename, "./data/codebooks/code_%d_ivf.edat_",param_k);
+	ifstream input(filename, ios::in | ios::binary | ios::ate);
+	size_t f_size = input.tellg();
+	vector<unsigned char> data(f_size);
+	input.seekg(0);
+	input.read(reinterpret_cast<char *>(&data[0]), f_size);
+	input.close();
+
+	ASSERT_TRUE(index_check(&data[0],f_size,filename,true));
+	IndexHeader header;
+	ASSERT_TRUE(index_read_header(&data[0],f_size,header));
+	PQConfig config = e.get_config();
+	EXPECT_EQ(config.N,header.n);
+	EXPECT_EQ(param_k,header.n_buckets);
+	EXPECT_EQ(config.mp,header.mp);
+	EXPECT_EQ(0,header.nc);
+}
+
+TEST_F(EncoderTest, test10) {
+	char name[256], filename1[256], filename2[256];
+	sprintf(name, "code_%d_s",param_k);
+	Encoder s;
+	sprintf(filename1,"./data/codebooks/cq_%d.ctr_",param_k);
+	sprintf(filename2,"./data/codebooks/pq_%d.ctr_",param_k);
+	s.load_codebooks(filename1,filename2,false);
+	// A chunk size that does not divide N
+	s.encode_stream<float>("./data/sift/sift_base.fvecs",4,"./data/codebooks",name,99991,true);
+	EXPECT_EQ(1000000,s.get_config().N);
+
+	// The same container as the one written by Encoder::output
+	sprintf(filename1, "./data/codebooks/code_%d_ivf.edat_",param_k);
+	sprintf(filename2, "./data/codebooks/code_%d_s_ivf.edat_",param_k);
+	ifstream input1(filename1, ios::in | ios::binary);
+	ifstream input2(filename2, ios::in | ios::binary);
+	vector<char> data1((istreambuf_iterator<char>(input1)),istreambuf_iterator<char>());
+	vector<char> data2((istreambuf_iterator<char>(input2)),istreambuf_iterator<char>());
+	ASSERT_EQ(data1.size(),data2.size());
+	EXPECT_TRUE(data1 == data2);
+}
+
+TEST_F(EncoderTest, test11) {
+	// rq is trained on the residuals of the coarse and the product
+	// quantizers (see PQQuantizer::calc_residual_vector)
+	char name[256], filename1[256], filename2[256];
+	sprintf(name, "code_%d_r",param_k);
+	Encoder r;
+	sprintf(filename1,"./data/codebooks/cq_%d.ctr_",param_k);
+	sprintf(filename2,"./data/codebooks/pq_%d.ctr_",param_k);
+	r.load_codebooks(filename1,filename2,false);
+	sprintf(filename1,"./data/codebooks/rq_%d.ctr_",param_k);
+	r.load_refinement(filename1,true);
+	r.encode<float>("./data/sift/sift_base.fvecs",4,false);
+	r.distribution(false);
+	r.output("./data/codebooks",name,true);
+
+	sprintf(filename1, "./data/codebooks/code_%d_r_ivf.edat_",param_k);
+	ifstream input(filename1, ios::in | ios::binary);
+	vector<unsigned char> data((istreambuf_iterator<char>(input)),istreambuf_iterator<char>());
+	ASSERT_TRUE(index_check(&data[0],data.size(),filename1,true));
+	IndexHeader header;
+	ASSERT_TRUE(index_read_header(&data[0],data.size(),header));
+	EXPECT_EQ(SC_INDEX_VERSION,header.version);
+	EXPECT_GT(header.mr,0);
+	EXPECT_EQ(header.n * index_refine_size(header.mr),
+			header.sections[SC_SECTION_REFINE].size);
+}
+
 int main(int argc, char * argv[]) {
 	/*
 	 * The method is initializes the Google framework and must be called before RUN_ALL_TESTS
@@ -90,7 +90,7 @@ public:
 	static int N;
 	static int M;
 	static Evaluation e;
-	static int * gt;
+	static idx_t * gt;
 };
 
 // Global variables
@@ -99,7 +99,7 @@ char RecallTest::setting_path[256];
 char RecallTest::base_dir[256];
 int RecallTest::d;
 Evaluation RecallTest::e;
-int * RecallTest::gt;
+idx_t * RecallTest::gt;
 int RecallTest::N;
 int RecallTest::M;
 
@@ -134,7 +134,7 @@ TEST_F(RecallTest, test2) {
 		cout << "Experiment was hold at " << *it << endl;
 		for(int i = 0; i < 5; i++) {
 			R = r[i];
-			int * result;
+			idx_t * result;
 			SimpleCluster::init_array(result,N*R);
 			char result_path[256];
 			sprintf(result_path, "%s/%s/search_result_%d.txt",path,it->c_str(),R);
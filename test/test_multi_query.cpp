@@ -151,44 +151,28 @@ TEST_F(QueryTest, test4) {
 	int R, r[] = {1,10,100,1000,10000,100000};
 	ofstream output;
 	char filename[256];
-	int * result, * it, * hid1, * hid2, * hid3, * hid4, * s1, * s2, * prebuck, * cache;
-	float * v_tmp, * dist, * q, * tmp;
-	bool * traversed;
-	SimpleCluster::init_array(v_tmp,(kc << 1) + w);
-	SimpleCluster::init_array(q, 2);
-	SimpleCluster::init_array(it,kc<<1);
-	SimpleCluster::init_array(hid1,w);
-	SimpleCluster::init_array(hid2,w);
-	SimpleCluster::init_array(hid3,w);
-	SimpleCluster::init_array(hid4,w);
-	SimpleCluster::init_array(s1,w);
-	SimpleCluster::init_array(s2,w);
-	SimpleCluster::init_array(prebuck,w);
-	SimpleCluster::init_array(cache,w);
-	SimpleCluster::init_array(traversed,kc * kc);
-	double t1, t2;
+	idx_t * result;
+	float * dist, * tmp;
+	SearchWorkspace ws;
+	worker->init_workspace(ws,w,r[2]);
+	SimpleCluster::init_array(result,r[2]);
+	SimpleCluster::init_array(dist,r[2]);
 
-	int sum = 0, e = 0;
+	int sum = 0;
 	for(int i = 0; i < 3; i++) {
 		t = 0.0;
-		t1 = t2 = 0.0;
+		ws.t1 = ws.t2 = 0.0;
 		R = r[i];
 		tmp = data;
 		sprintf(filename,"%s/%d/search_result_%d.txt",log_path,static_cast<int>(timer),R);
 		output.open(filename,ios::out);
 		for(int j = 0; j < M; j++) {
 			st = clock();
-			worker->search_multi2(
-					tmp,
-					v_tmp,dist,q,
-					it,result,
-					hid1,hid2,hid3,hid4,
-					s1,s2,
-					prebuck,cache,traversed,
-					sum,R,w,T,kc,e,t1,t2,false,false);
+			worker->search_multi(tmp,ws,result,dist,R,w,T,false,false);
 			ed = clock();
 			t += static_cast<double>(ed - st);
-			EXPECT_FALSE(traversed[0]);
+			sum = ws.sum;
+			EXPECT_EQ(0u,ws.cells.size());
 			for(int i = 0; i < (R>sum?sum:R); i++)
 				output << result[i] << " ";
 			if(sum < R)
@@ -196,20 +180,18 @@ TEST_F(QueryTest, test4) {
 					output << "-1 ";
 			output << endl;
 			tmp += d;
-			::delete result;
-			result = nullptr;
-			::delete dist;
-			dist =  nullptr;
 		}
 
 		output.close();
 		cout << "Finished search@" << R << " in " <<
 				1000.0f * t / CLOCKS_PER_SEC << "[ms]" << endl;
 		cout << "Precomputed in " <<
-				1000.0f * t1 / CLOCKS_PER_SEC << "[ms]" << endl;
+				1000.0f * ws.t1 / CLOCKS_PER_SEC << "[ms]" << endl;
 		cout << "Sorted data in " <<
-				1000.0f * t2 / CLOCKS_PER_SEC << "[ms]" << endl;
+				1000.0f * ws.t2 / CLOCKS_PER_SEC << "[ms]" << endl;
 	}
+	::delete result;
+	::delete dist;
 }
 
 TEST_F(QueryTest, DISABLED_test5) {
@@ -220,44 +202,28 @@ TEST_F(QueryTest, DISABLED_test5) {
 	int R, r[] = {1,10,100,1000,10000,100000};
 	ofstream output;
 	char filename[256];
-	int * result, * it, * hid1, * hid2, * hid3, * hid4, * s1, * s2, * prebuck, * cache;
-	float * v_tmp, * dist, * q, * tmp;
-	bool * traversed;
-	SimpleCluster::init_array(v_tmp,(kc << 1) + w);
-	SimpleCluster::init_array(q, 2);
-	SimpleCluster::init_array(it,kc<<1);
-	SimpleCluster::init_array(hid1,w);
-	SimpleCluster::init_array(hid2,w);
-	SimpleCluster::init_array(hid3,w);
-	SimpleCluster::init_array(hid4,w);
-	SimpleCluster::init_array(s1,w);
-	SimpleCluster::init_array(s2,w);
-	SimpleCluster::init_array(prebuck,w);
-	SimpleCluster::init_array(cache,w);
-	SimpleCluster::init_array(traversed,kc * kc);
-	double t1, t2;
+	idx_t * result;
+	float * dist, * tmp;
+	SearchWorkspace ws;
+	worker->init_workspace(ws,w,r[2]);
+	SimpleCluster::init_array(result,r[2]);
+	SimpleCluster::init_array(dist,r[2]);
 
-	int sum = 0, e = 0;
+	int sum = 0;
 	for(int i = 0; i < 3; i++) {
 		t = 0.0;
-		t1 = t2 = 0.0;
+		ws.t1 = ws.t2 = 0.0;
 		R = r[i];
 		tmp = data;
 		sprintf(filename,"%s/%d/search_result_%d.txt",log_path,static_cast<int>(timer),R);
 		output.open(filename,ios::out);
 		for(int j = 0; j < N; j++) {
 			st = clock();
-			worker->search_multi2(
-					tmp,
-					v_tmp,dist,q,
-					it,result,
-					hid1,hid2,hid3,hid4,
-					s1,s2,
-					prebuck,cache,traversed,
-					sum,R,w,T,kc,e,t1,t2,true,false);
+			worker->search_multi(tmp,ws,result,dist,R,w,T,true,false);
 			ed = clock();
 			t += static_cast<double>(ed - st);
-			EXPECT_FALSE(traversed[0]);
+			sum = ws.sum;
+			EXPECT_EQ(0u,ws.cells.size());
 			for(int i = 0; i < (R>sum?sum:R); i++)
 				output << result[i] << " ";
 			if(sum < R)
@@ -265,20 +231,46 @@ TEST_F(QueryTest, DISABLED_test5) {
 					output << "-1 ";
 			output << endl;
 			tmp += d;
-			::delete result;
-			result = nullptr;
-			::delete dist;
-			dist =  nullptr;
 		}
 
 		output.close();
 		cout << "Finished search@" << R << " in " <<
 				1000.0f * t / CLOCKS_PER_SEC << "[ms]" << endl;
 		cout << "Precomputed in " <<
-				1000.0f * t1 / CLOCKS_PER_SEC << "[ms]" << endl;
+				1000.0f * ws.t1 / CLOCKS_PER_SEC << "[ms]" << endl;
 		cout << "Sorted data in " <<
-				1000.0f * t2 / CLOCKS_PER_SEC << "[ms]" << endl;
+				1000.0f * ws.t2 / CLOCKS_PER_SEC << "[ms]" << endl;
 	}
+	::delete result;
+	::delete dist;
+}
+
+TEST_F(QueryTest, test6) {
+	int R = 10;
+	size_t n = static_cast<size_t>(N) * R;
+	idx_t * result, * result1;
+	float * dist, * dist1;
+	SearchWorkspace ws;
+	worker->init_workspace(ws,w,R);
+	SimpleCluster::init_array(result,R);
+	SimpleCluster::init_array(dist,R);
+	SimpleCluster::init_array(result1,n);
+	SimpleCluster::init_array(dist1,n);
+
+	worker->search_multi_parallel(data,N,result1,dist1,R,w,T,0,false);
+	float * tmp = data;
+	for(int j = 0; j < N; j++) {
+		worker->search_multi(tmp,ws,result,dist,R,w,T,false,false);
+		if(ws.sum >= R) {
+			for(int i = 0; i < R; i++)
+				EXPECT_FLOAT_EQ(dist[i],dist1[j * R + i]);
+		}
+		tmp += d;
+	}
+	::delete result;
+	::delete dist;
+	::delete result1;
+	::delete dist1;
 }
 
 int main(int argc, char * argv[])
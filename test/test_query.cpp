@@ -17,6 +17,7 @@
 #include <sys/types.h>
 #endif
 #include <query.h>
+#include <evaluation.h>
 
 using namespace std;
 using namespace SC;
@@ -154,10 +155,11 @@ TEST_F(QueryTest, test4) {
 	int R, r[] = {1,10,100,1000,10000};
 	ofstream output;
 	char filename[256];
-	int * result, * buckets, * i_tmp, * bk;
-	float * v_tmp, * dist, * tmp;
-	SimpleCluster::init_array(v_tmp,kc);
-	SimpleCluster::init_array(buckets,kc);
+	idx_t * result;
+	int * bk;
+	float * dist, * tmp;
+	unsigned char * heap;
+	SimpleCluster::init_array(heap,MinHeap4<HeapEntry>::bytes(kc));
 	SimpleCluster::init_array(bk,kc);
 
 	int sum = 0;
@@ -171,8 +173,8 @@ TEST_F(QueryTest, test4) {
 			st = clock();
 			worker->search_ivfadc(
 					tmp,
-					v_tmp,dist,
-					result,buckets,bk,
+					heap,dist,
+					result,bk,
 					sum,R,w,T,false,false);
 			ed = clock();
 			t += static_cast<double>(ed - st);
@@ -203,10 +205,11 @@ TEST_F(QueryTest, DISABLED_test5) {
 	double t = 0.0;
 	ofstream output;
 	char filename[256];
-	int * result, * buckets, * i_tmp, * bk;
-	float * v_tmp, * dist, * tmp;
-	SimpleCluster::init_array(v_tmp,kc);
-	SimpleCluster::init_array(buckets,kc);
+	idx_t * result;
+	int * bk;
+	float * dist, * tmp;
+	unsigned char * heap;
+	SimpleCluster::init_array(heap,MinHeap4<HeapEntry>::bytes(kc));
 	SimpleCluster::init_array(bk,kc);
 
 	int sum = 0;
@@ -221,8 +224,8 @@ TEST_F(QueryTest, DISABLED_test5) {
 			st = clock();
 			worker->search_ivfadc(
 					tmp,
-					v_tmp,dist,
-					result,buckets,bk,
+					heap,dist,
+					result,bk,
 					sum,R,w,T,true,false);
 			ed = clock();
 			t += static_cast<double>(ed - st);
@@ -241,6 +244,320 @@ TEST_F(QueryTest, DISABLED_test5) {
 	}
 }
 
+TEST_F(QueryTest, test6) {
+	clock_t st, ed;
+	time_t timer = time(NULL);
+	struct stat sb;
+	ofstream output;
+	char filename[256];
+
+	// test4 may have created the folder in the same second
+	sprintf(filename,"%s/%d",log_path,static_cast<int>(timer));
+	if(stat(filename, &sb) != 0)
+		create_log_dir(log_path,timer);
+	int R, r[] = {1,10,100};
+	for(int i = 0; i < 3; i++) {
+		R = r[i];
+		idx_t * result;
+		float * dist;
+		SimpleCluster::init_array(result,static_cast<size_t>(N) * R);
+		SimpleCluster::init_array(dist,static_cast<size_t>(N) * R);
+		st = clock();
+		worker->search_ivfadc_batch(data,N,result,dist,R,w,T,false);
+		ed = clock();
+		sprintf(filename,"%s/%d/search_result_%d.txt",log_path,static_cast<int>(timer),R);
+		output.open(filename,ios::out);
+		for(int j = 0; j < N; j++) {
+			for(int k = 0; k < R; k++)
+				output << result[j * R + k] << " ";
+			output << endl;
+		}
+		output.close();
+		EXPECT_TRUE(result[0] >= 0);
+		EXPECT_TRUE(R == 1 || dist[0] <= dist[1]);
+		cout << "Finished batch search@" << R << " in " <<
+				1000.0f * (ed - st) / CLOCKS_PER_SEC << "[ms]" << endl;
+		::delete result;
+		::delete dist;
+	}
+}
+
+TEST_F(QueryTest, test7) {
+	clock_t st, ed;
+	int R = 10;
+	size_t n = static_cast<size_t>(N) * R;
+	idx_t * result1, * result2;
+	float * dist1, * dist2;
+	SimpleCluster::init_array(result1,n);
+	SimpleCluster::init_array(result2,n);
+	SimpleCluster::init_array(dist1,n);
+	SimpleCluster::init_array(dist2,n);
+	worker->search_ivfadc_batch(data,N,result1,dist1,R,w,T,false);
+	st = clock();
+	worker->search_ivfadc_parallel(data,N,result2,dist2,R,w,T,0,false);
+	ed = clock();
+	for(size_t i = 0; i < n; i++) {
+		EXPECT_EQ(result1[i],result2[i]);
+	}
+	cout << "Finished parallel search@" << R << " in " <<
+			1000.0f * (ed - st) / CLOCKS_PER_SEC << "[ms] (CPU time)" << endl;
+	::delete result1;
+	::delete result2;
+	::delete dist1;
+	::delete dist2;
+}
+
+/**
+ * The vectorized ADC scan must give the same distances as the scalar one
+ */
+TEST(ADCTest, test0) {
+	int mp = 8, kp = 256, n = 1003;
+	unsigned char * c;
+	float * table, * dist1, * dist2;
+	SimpleCluster::init_array(c,n * mp);
+	SimpleCluster::init_array(table,mp * kp);
+	SimpleCluster::init_array(dist1,n);
+	SimpleCluster::init_array(dist2,n);
+	srand(0);
+	for(int i = 0; i < n * mp; i++)
+		c[i] = static_cast<unsigned char>(rand() % kp);
+	for(int i = 0; i < mp * kp; i++)
+		table[i] = static_cast<float>(rand()) / RAND_MAX;
+	adc_scan_scalar(c,n,mp,kp,table,1.0f,dist1);
+	for(int i = 1; i <= n; i += 7) {
+		adc_scan(c,i,mp,kp,table,1.0f,dist2);
+		for(int j = 0; j < i; j++)
+			EXPECT_FLOAT_EQ(dist1[j],dist2[j]);
+	}
+	::delete c;
+	::delete table;
+	::delete dist1;
+	::delete dist2;
+}
+
+/**
+ * The fast-scan kernels must give the same distances as the scalar sums,
+ * for an odd mp and a partial last block
+ */
+TEST(ADCTest, test1) {
+	int mps[] = {7, 8}, n = 3 * FS_BLOCK + 5;
+	srand(0);
+	for(int mp : mps) {
+		size_t nb = fs_blocks(n), bs = fs_block_size(mp);
+		int np = (mp + 1) >> 1;
+		unsigned char * c, * packed, * lut;
+		float * table, delta, offset, sum;
+		uint16_t * dist1, * dist2;
+		SimpleCluster::init_array(c,n * mp);
+		SimpleCluster::init_array(packed,nb * bs);
+		SimpleCluster::init_array(table,mp * 16);
+		SimpleCluster::init_array(lut,np * 32);
+		SimpleCluster::init_array(dist1,nb * FS_BLOCK);
+		SimpleCluster::init_array(dist2,nb * FS_BLOCK);
+		for(int i = 0; i < n * mp; i++)
+			c[i] = static_cast<unsigned char>(rand() % 16);
+		for(int i = 0; i < mp * 16; i++)
+			table[i] = static_cast<float>(rand()) / RAND_MAX;
+
+		// Packing
+		fs_pack(c,n,mp,packed);
+		for(int i = 0; i < n; i++)
+			for(int m = 0; m < mp; m++)
+				ASSERT_EQ(c[i * mp + m],fs_code(packed,i,m,mp));
+
+		// Quantization: each entry within half a step, the padding is zero
+		offset = fs_quantize_lut(table,mp,lut,delta);
+		sum = 0.0f;
+		for(int m = 0; m < mp; m++) {
+			float mn = table[m * 16];
+			for(int x = 1; x < 16; x++)
+				mn = min(mn,table[m * 16 + x]);
+			sum += mn;
+			for(int x = 0; x < 16; x++)
+				EXPECT_NEAR(table[m * 16 + x],mn + delta * lut[m * 16 + x],
+						0.5f * delta + 1e-6f);
+		}
+		EXPECT_FLOAT_EQ(sum,offset);
+		for(int x = mp * 16; x < np * 32; x++)
+			EXPECT_EQ(0,lut[x]);
+
+		// Scanning: the scalar kernel against the sums of the codes
+		fs_scan_scalar(packed,nb,mp,lut,dist1);
+		for(int i = 0; i < n; i++) {
+			int d = 0;
+			for(int m = 0; m < mp; m++)
+				d += lut[m * 16 + c[i * mp + m]];
+			EXPECT_EQ(d,dist1[i]);
+		}
+		// Then every kernel against the scalar one, padding included
+		vector<fs_scan_t> kernels(1,fs_scan);
+#ifdef SC_FS_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("ssse3"))
+			kernels.push_back(fs_scan_ssse3);
+		if(__builtin_cpu_supports("avx2"))
+			kernels.push_back(fs_scan_avx2);
+#endif
+		for(fs_scan_t kernel : kernels) {
+			memset(dist2,0xff,nb * FS_BLOCK * sizeof(uint16_t));
+			kernel(packed,nb,mp,lut,dist2);
+			for(size_t i = 0; i < nb * FS_BLOCK; i++)
+				EXPECT_EQ(dist1[i],dist2[i]);
+		}
+		::delete c;
+		::delete packed;
+		::delete table;
+		::delete lut;
+		::delete dist1;
+		::delete dist2;
+	}
+}
+
+/**
+ * The mapped index must give the same results as the loaded one
+ */
+TEST_F(QueryTest, test8) {
+	PQQuery * mapped = new PQQuery();
+	mapped->load_codebooks(cq_path,pq_path,false);
+	mapped->map_encoded_data(code_path,false);
+	mapped->pre_compute1();
+
+	int R = 10;
+	size_t n = static_cast<size_t>(N) * R;
+	idx_t * result1, * result2;
+	float * dist1, * dist2;
+	SimpleCluster::init_array(result1,n);
+	SimpleCluster::init_array(result2,n);
+	SimpleCluster::init_array(dist1,n);
+	SimpleCluster::init_array(dist2,n);
+	worker->search_ivfadc_batch(data,N,result1,dist1,R,w,T,false);
+	mapped->search_ivfadc_batch(data,N,result2,dist2,R,w,T,false);
+	for(size_t i = 0; i < n; i++) {
+		EXPECT_EQ(result1[i],result2[i]);
+		EXPECT_FLOAT_EQ(dist1[i],dist2[i]);
+	}
+	::delete result1;
+	::delete result2;
+	::delete dist1;
+	::delete dist2;
+	delete mapped;
+}
+
+/**
+ * Fast-scan search (only when the index has kp = 16).
+ * The codes are packed on a separate index because the 8-bit codes are released.
+ */
+TEST_F(QueryTest, test9) {
+	int R = 10;
+	size_t n = static_cast<size_t>(N) * R;
+	idx_t * result1, * result2;
+	float * dist1, * dist2;
+	SimpleCluster::init_array(result1,n);
+	SimpleCluster::init_array(dist1,n);
+	worker->search_ivfadc_batch(data,N,result1,dist1,R,w,T,false);
+	PQQuery * fs = new PQQuery();
+	fs->load_codebooks(cq_path,pq_path,false);
+	fs->load_encoded_data(code_path,false);
+	fs->pre_compute1();
+	if(!fs->enable_fast_scan(true)) {
+		::delete result1;
+		::delete dist1;
+		delete fs;
+		return;
+	}
+
+	clock_t st, ed;
+	SearchContext context(fs->get_config());
+	SimpleCluster::init_array(result2,n);
+	SimpleCluster::init_array(dist2,n);
+	st = clock();
+	for(int j = 0; j < N; j++)
+		fs->search_ivfadc_fs(data + static_cast<size_t>(j) * d,context,
+				result2 + j * R,dist2 + j * R,R,4 * R,w,T,false);
+	ed = clock();
+	// The re-ranked short list should recover the 8-bit results.
+	// With kp = 16 many codes are equal, so the distances are compared, not the ids.
+	int same = 0;
+	for(size_t j = 0; j < n; j++)
+		if(fabs(dist1[j] - dist2[j]) <= 1e-3f * (fabs(dist1[j]) + 1.0f)) same++;
+	EXPECT_GE(same, 0.95 * n);
+	cout << "Finished fast-scan search@" << R << " in " <<
+			1000.0f * (ed - st) / CLOCKS_PER_SEC << "[ms], overlap: " <<
+			static_cast<double>(same) / n << endl;
+	::delete result1;
+	::delete result2;
+	::delete dist1;
+	::delete dist2;
+	delete fs;
+}
+
+TEST_F(QueryTest, test10) {
+	// Two-stage search: the ADC short list is re-ranked with the raw vectors
+	int R = 10, K = 100, n_eval = min(N,100);
+	size_t n = static_cast<size_t>(N) * R;
+	idx_t * result1, * result2, nn;
+	float * dist1, * dist2, best, e;
+	SimpleCluster::init_array(result1,n);
+	SimpleCluster::init_array(dist1,n);
+	SimpleCluster::init_array(result2,n);
+	SimpleCluster::init_array(dist2,n);
+	fill(result1,result1 + n,static_cast<idx_t>(-1));
+	fill(result2,result2 + n,static_cast<idx_t>(-1));
+	worker->load_data<unsigned char>(base_path,4,false);
+
+	clock_t st, ed;
+	double t1, t2;
+	SearchContext context(worker->get_config());
+	st = clock();
+	for(int j = 0; j < N; j++)
+		worker->search_ivfadc(data + static_cast<size_t>(j) * d,context,
+				result1 + j * R,dist1 + j * R,R,w,T,false);
+	ed = clock();
+	t1 = 1000.0 * (ed - st) / CLOCKS_PER_SEC;
+	st = clock();
+	for(int j = 0; j < N; j++)
+		worker->search_ivfadc_rerank(data + static_cast<size_t>(j) * d,context,
+				result2 + j * R,dist2 + j * R,R,K,w,T,false);
+	ed = clock();
+	t2 = 1000.0 * (ed - st) / CLOCKS_PER_SEC;
+
+	// The exact nearest neighbors of the first queries
+	const BaseVectors& raw = worker->get_raw_data();
+	Evaluation eval;
+	idx_t * gt;
+	int recall1, recall2;
+	SimpleCluster::init_array(gt,n_eval);
+	for(int j = 0; j < n_eval; j++) {
+		const float * q = data + static_cast<size_t>(j) * d;
+		best = FLT_MAX;
+		nn = -1;
+		for(idx_t i = 0; i < raw.size(); i++) {
+			e = raw.distance(q,i);
+			if(e < best) {
+				best = e;
+				nn = i;
+			}
+		}
+		gt[j] = nn;
+		// The ADC top 1 is in the short list, so its exact distance is an upper bound
+		ASSERT_GE(result1[j * R],0);
+		ASSERT_LT(result1[j * R],raw.size());
+		EXPECT_LE(dist2[j * R],raw.distance(q,result1[j * R]) + 1e-3f);
+	}
+	eval.calc_recall(result1,gt,R,n_eval,recall1,false);
+	eval.calc_recall(result2,gt,R,n_eval,recall2,false);
+	EXPECT_GE(recall2,recall1);
+	cout << "ADC search@" << R << ": " << t1 << "[ms], recall " <<
+			static_cast<double>(recall1) / n_eval << endl;
+	cout << "Re-ranked search@" << R << " (K=" << K << "): " << t2 << "[ms], recall " <<
+			static_cast<double>(recall2) / n_eval << endl;
+	::delete gt;
+	::delete result1;
+	::delete result2;
+	::delete dist1;
+	::delete dist2;
+}
+
 int main(int argc, char * argv[])
 {
 	/*The method is initializes the Google framework and must be called before RUN_ALL_TESTS */
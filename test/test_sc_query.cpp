@@ -143,22 +143,12 @@ if(CreateDirectory(data_folder, nullptr) == 0) {
 	int R, r[] = {1,10,100,1000,10000,100000};
 	ofstream output;
 	char filename[256];
-	int * result, * it, * hid1, * hid2, * hid3, * hid4, * s1, * s2, * prebuck, * cache;
-	float * v_tmp, * dist, * tmp;
-	bool * traversed;
-	SimpleCluster::init_array(v_tmp,kc + w);
-	SimpleCluster::init_array(it,kc);
-	SimpleCluster::init_array(hid1,w);
-	SimpleCluster::init_array(hid2,w);
-	SimpleCluster::init_array(hid3,w);
-	SimpleCluster::init_array(hid4,w);
-	SimpleCluster::init_array(s1,w);
-	SimpleCluster::init_array(s2,w);
-	SimpleCluster::init_array(prebuck,w);
-	SimpleCluster::init_array(cache,w);
-	SimpleCluster::init_array(traversed,kc * kc);
-	memset(traversed,0,kc * kc);
-	traversed[0] = true;
+	idx_t * result;
+	float * dist, * tmp;
+	SearchWorkspace ws;
+	worker->init_workspace(ws,w,r[4]);
+	SimpleCluster::init_array(result,r[4]);
+	SimpleCluster::init_array(dist,r[4]);
 
 	int sum = 0;
 	for(int i = 0; i < 5; i++) {
@@ -169,18 +159,11 @@ if(CreateDirectory(data_folder, nullptr) == 0) {
 		output.open(filename,ios::out);
 		for(int j = 0; j < N; j++) {
 			st = clock();
-			worker->search_mr_ivf(
-					tmp,
-					v_tmp,dist,
-					it,result,
-					hid1,hid2,hid3,hid4,
-					s1,s2,
-					prebuck,cache,traversed,
-					sum,R,w,T,M,false,false);
+			worker->search_mr_ivf(tmp,ws,result,dist,R,w,T,false,false);
 			ed = clock();
 			t += static_cast<double>(ed - st);
-			EXPECT_TRUE(traversed[0]);
-			EXPECT_TRUE(!traversed[1]);
+			sum = ws.sum;
+			EXPECT_EQ(0u,ws.cells.size());
 			for(int i = 0; i < (R>sum?sum:R); i++) {
 				output << result[i] << " ";
 			}
@@ -190,16 +173,14 @@ if(CreateDirectory(data_folder, nullptr) == 0) {
 				}
 			output << endl;
 			tmp += d;
-			::delete result;
-			result = nullptr;
-			::delete dist;
-			dist =  nullptr;
 		}
 
 		output.close();
 		cout << "Finished search@" << R << " in " <<
 				1000.0f * t / CLOCKS_PER_SEC << "[ms]" << endl;
 	}
+	::delete result;
+	::delete dist;
 }
 
 TEST_F(QueryTest, DISABLED_test5) {
@@ -234,41 +215,22 @@ if(CreateDirectory(data_folder, nullptr) == 0) {
 		exit(1);
 	}
 	double t = 0.0;
-	int M = kc >> 4;
 	ofstream output;
 	char filename[256];
-	int * result, * it, * hid1, * hid2, * hid3, * hid4, * s1, * s2, * prebuck, * cache;
-	float * v_tmp, * dist, * tmp;
-	bool * traversed;
-	SimpleCluster::init_array(v_tmp,kc + w);
-	SimpleCluster::init_array(it,kc);
-	SimpleCluster::init_array(hid1,w);
-	SimpleCluster::init_array(hid2,w);
-	SimpleCluster::init_array(hid3,w);
-	SimpleCluster::init_array(hid4,w);
-	SimpleCluster::init_array(s1,w);
-	SimpleCluster::init_array(s2,w);
-	SimpleCluster::init_array(prebuck,w);
-	SimpleCluster::init_array(cache,w);
-	SimpleCluster::init_array(traversed,kc * kc);
-	memset(traversed,0,kc * kc);
-	traversed[0] = true;
+	idx_t * result;
+	float * dist, * tmp;
+	SearchWorkspace ws;
+	worker->init_workspace(ws,w,1);
+	SimpleCluster::init_array(result,1);
+	SimpleCluster::init_array(dist,1);
 
-	int sum = 0;
 	t = 0.0;
 	tmp = data;
 	sprintf(filename,"%s/search/%d/search_result_%d.txt",base_dir,static_cast<int>(timer),1);
 	output.open(filename,ios::out);
 	for(int j = 0; j < N; j++) {
 		st = clock();
-		worker->search_mr_ivf(
-				tmp,
-				v_tmp,dist,
-				it,result,
-				hid1,hid2,hid3,hid4,
-				s1,s2,
-				prebuck,cache,traversed,
-				sum,1,w,T,M,true,false);
+		worker->search_mr_ivf(tmp,ws,result,dist,1,w,T,true,false);
 		ed = clock();
 		t += static_cast<double>(ed - st);
 		for(int i = 0; i < 1; i++) {
@@ -276,13 +238,11 @@ if(CreateDirectory(data_folder, nullptr) == 0) {
 		}
 		output << endl;
 		tmp += d;
-		::delete result;
-		result = nullptr;
-		::delete dist;
-		dist =  nullptr;
 	}
 
 	output.close();
+	::delete result;
+	::delete dist;
 	cout << "Finished search@1 in " <<
 			1000.0f * t / CLOCKS_PER_SEC << "[ms]" << endl;
 }